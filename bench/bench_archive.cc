@@ -0,0 +1,117 @@
+#include <pnet.hpp>
+
+#include <cmath>
+#include <random>
+
+// Compares the size and decode speed of .pkt, .pkt.gz and .pka files.
+//
+// Usage: bench_archive [num_packets]   (default: 5M)
+//
+// Traffic is synthetic: 100k flows with skewed popularity, a few hundred
+// local hosts, mostly web ports, exponential inter-arrival times.
+
+uint64_t fileSize(const std::string &filename){
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  return in.tellg();
+}
+
+void report(const std::string &name, uint64_t num_packets, uint64_t bytes,
+            pnet::Time elapsed, uint64_t checksum){
+  double ns = 1000.0 * elapsed.microseconds() / num_packets;
+  printf("  %-24s %6.2f bytes/packet %7.2f ns/packet %8.1f Mpps  (%lu)\n",
+         name.c_str(), (double) bytes / num_packets, ns, 1000.0 / ns,
+         checksum);
+}
+
+void reportRange(const std::string &name, uint64_t num_packets,
+                 pnet::Time elapsed){
+  printf("  %-24s %8lu packets %8.3f ms\n", name.c_str(), num_packets,
+         elapsed.microseconds() / 1000.0);
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 5000000;
+  const uint64_t num_flows = 100000;
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<pnet::Packet> flows(num_flows);
+  for(uint64_t i = 0; i < num_flows; ++i){
+    pnet::Packet &flow = flows[i];
+    flow.ip_src.s_addr = htonl(0x0a000000 + random() % 500);
+    flow.ip_dst.s_addr = htonl(random() % 0xffffffff);
+    flow.port_src = htons(1024 + random() % 64000);
+    flow.port_dst = htons(random() % 4 ? 443 : 80);
+    flow.protocol = random() % 10 ? IPPROTO_TCP : IPPROTO_UDP;
+    flow.flags = flow.protocol == IPPROTO_TCP ? pnet::Packet::TCP_ACK : 0;
+  }
+  std::vector<pnet::Packet> packets(num_packets);
+  uint64_t t = 1500000000000000ull;
+  for(pnet::Packet &packet : packets){
+    packet = flows[(uint64_t) (num_flows * std::pow(uniform(random), 4))];
+    packet.size = uniform(random) < 0.5 ? 1500 : 40 + random() % 1460;
+    t += (uint64_t) (-std::log(1 - uniform(random)) * 2);
+    packet.t_arrival = pnet::Time(t);
+  }
+
+  const std::string pkt = "/tmp/bench_archive.pkt";
+  const std::string formats[] = {pkt, pkt + ".gz", "/tmp/bench_archive.pka"};
+  printf("%lu packets, writing:\n", num_packets);
+  {
+    pnet::TicTocTimer timer;
+    std::ofstream out(pkt, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(packets.data()),
+              num_packets * sizeof(pnet::Packet));
+    out.close();
+    report(".pkt", num_packets, fileSize(pkt), timer.toc(), 0);
+  }
+  for(uint64_t i = 1; i < 3; ++i){
+    pnet::TicTocTimer timer;
+    pnet::convertPacketFile(pkt, formats[i]);
+    report(formats[i].substr(formats[i].find('.')), num_packets,
+           fileSize(formats[i]), timer.toc(), 0);
+  }
+
+  printf("reading with PacketReader:\n");
+  for(const std::string &filename : formats){
+    pnet::TicTocTimer timer;
+    uint64_t checksum = 0;
+    {
+      pnet::PacketReader reader(filename);
+      for(const pnet::Packet &packet : reader.packets){
+        checksum += packet.size;
+      }
+    }
+    report(filename.substr(filename.find('.')), num_packets,
+           fileSize(filename), timer.toc(), checksum);
+  }
+
+  // 100 ms in the middle of the capture.
+  printf("reading 100 ms:\n");
+  pnet::Time t1 = packets[num_packets / 2].t_arrival;
+  pnet::Time t2 = t1 + pnet::Time(0, 100000);
+  {
+    pnet::TicTocTimer timer;
+    uint64_t checksum = 0;
+    pnet::PacketReader reader(pkt);
+    const pnet::Packet *first = std::lower_bound(reader.packets.begin(),
+                                                 reader.packets.end(), t1,
+        [](const pnet::Packet &p, pnet::Time t){ return p.t_arrival < t; });
+    for(; first != reader.packets.end() && first->t_arrival < t2; ++first){
+      ++checksum;
+    }
+    reportRange(".pkt binary search", checksum, timer.toc());
+  }
+  {
+    pnet::TicTocTimer timer;
+    pnet::PacketArchiveReader reader(formats[2]);
+    std::vector<pnet::Packet> range;
+    uint64_t checksum = reader.readRange(t1, t2, range);
+    reportRange(".pka readRange", checksum, timer.toc());
+  }
+
+  for(const std::string &filename : formats){
+    pnet::utils::rm(filename);
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include <pnet.hpp>
+#include <pnet_cardinality.hpp>
+
+#include <random>
+
+// Insert cost of a CardinalityEstimator per mode, and register merge speed.
+//
+// Usage: bench_cardinality [num_packets] [num_sources]   (default: 10M, 1M)
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 10000000;
+  uint64_t num_sources = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                                  : 1000000;
+  std::mt19937_64 random(42);
+  std::vector<pnet::Packet> packets(num_packets);
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::Packet &packet = packets[i];
+    packet.ip_src.s_addr = random() % num_sources;
+    packet.ip_dst.s_addr = random() % 100000;
+    packet.port_src = htons(1024);
+    packet.port_dst = htons(random() % 1024);
+    packet.protocol = IPPROTO_TCP;
+    packet.t_arrival = pnet::Time(1500000000000000ull + i);
+  }
+  printf("%lu packets, %lu sources:\n", num_packets, num_sources);
+  const char *names[] = {"source", "destination", "destination port"};
+  for(int mode = 0; mode < 3; ++mode){
+    pnet::CardinalityEstimator estimator(
+        (pnet::CardinalityEstimator::Mode) mode);
+    pnet::TicTocTimer timer;
+    for(const pnet::Packet &packet : packets){
+      estimator.insert(packet);
+    }
+    pnet::Time elapsed = timer.toc();
+    printf("  %-28s %8.2f ns/packet %8lu keys %8lu evictions  top %.0f\n",
+           names[mode], 1000.0 * elapsed.microseconds() / num_packets,
+           estimator.numKeys(), estimator.numEvictions(),
+           estimator.top(1)[0].estimate);
+  }
+
+  pnet::HyperLogLog a(16), b(16);
+  for(uint64_t i = 0; i < 1000000; ++i){
+    (i % 2 ? a : b).add(pnet::hash::mix64(i));
+  }
+  const uint64_t num_merges = 10000;
+  pnet::TicTocTimer timer;
+  for(uint64_t i = 0; i < num_merges; ++i){
+    a.merge(b);
+  }
+  pnet::Time elapsed = timer.toc();
+  printf("  %-28s %8.2f GB/s  (%.0f)\n", "merge 2^16 registers",
+         (double) num_merges * a.getRegisters().size()
+         / elapsed.microseconds() / 1000, a.estimate());
+  return 0;
+}
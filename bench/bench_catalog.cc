@@ -0,0 +1,49 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Locates time ranges in the catalog of a month of recordings: one file
+// per 10 seconds, a mark per second. No record files are created.
+//
+// Usage: bench_catalog [num_queries]   (default: 10000)
+
+int main(int argc, char *argv[]){
+  uint64_t num_queries = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 10000;
+  const std::string dir = "/tmp/bench_catalog";
+  const uint64_t t_start = 1500000000000000ull;
+  const uint64_t num_files = 30 * 24 * 360;
+  pnet::utils::rm("-rf " + dir);
+  pnet::utils::findOrCreate(dir);
+  {
+    pnet::CatalogWriter writer(dir, "packets");
+    for(uint64_t i = 0; i < num_files; ++i){
+      writer.open(pnet::Time(t_start + i * 10000000).toDateString() + ".pkt");
+      for(uint64_t j = 0; j < 100; ++j){
+        writer.add(pnet::Time(t_start + i * 10000000 + j * 100000), 28);
+      }
+    }
+  }
+  printf("%lu files in the catalog:\n", num_files);
+
+  pnet::TicTocTimer timer;
+  pnet::Catalog catalog(dir, "packets");
+  printf("  %-28s %8.1f us\n", "open", (double) timer.toc().microseconds());
+
+  std::mt19937_64 random(42);
+  uint64_t checksum = 0;
+  timer.tic();
+  for(uint64_t i = 0; i < num_queries; ++i){
+    pnet::Time t_begin(t_start + random() % (num_files * 10000000));
+    pnet::Time t_end = t_begin + pnet::Time(60, 0);
+    for(uint64_t file : catalog.find(t_begin, t_end)){
+      checksum += catalog.seek(file, t_begin).offset
+                  + catalog.seekEnd(file, t_end).offset;
+    }
+  }
+  printf("  %-28s %8.2f us/query  (%lu)\n", "find + seek one minute",
+         (double) timer.toc().microseconds() / num_queries, checksum);
+
+  pnet::utils::rm("-rf " + dir);
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <pnet.hpp>
+
+// Compares in-process gzip (GzipWriter/GzipReader) with the former
+// approach of writing a plain file and calling gzip/gunzip on it.
+//
+// Usage: bench_compress [num_packets]   (default: 5M)
+
+void report(const std::string &name, uint64_t bytes, pnet::Time elapsed,
+            uint64_t compressed){
+  double seconds = elapsed.microseconds() / 1e6;
+  printf("  %-28s %8.1f MB/s  ratio %5.2f\n", name.c_str(),
+         bytes / seconds / 1e6, (double) bytes / compressed);
+}
+
+uint64_t fileSize(const std::string &filename){
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  return in.tellg();
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 5000000;
+  const std::string plain = "/tmp/bench_compress.pkt";
+  const std::string gz_file = plain + ".gz";
+  std::string data;
+  data.reserve(num_packets * sizeof(pnet::Packet));
+  pnet::Packet packet;
+  packet.ip_dst.s_addr = packet.port_dst = packet.protocol = packet.flags = 0;
+  for(uint64_t i = 0; i < num_packets; ++i){
+    packet.ip_src.s_addr = (i * 2654435761u) % 10000;
+    packet.port_src = i % 64;
+    packet.size = (i * 7919) % 1500;
+    packet.t_arrival = 1500000000000000ull + i * 10;
+    data.append(reinterpret_cast<const char*>(&packet), sizeof(packet));
+  }
+  printf("%lu packets, %.1f MB:\n", num_packets, data.size() / 1e6);
+
+  pnet::TicTocTimer timer;
+  {
+    std::ofstream out(plain, std::ios::binary);
+    out << data;
+  }
+  pnet::utils::zip(plain, gz_file);
+  report("write + gzip", data.size(), timer.toc(), fileSize(gz_file));
+
+  uint32_t threads[] = {0, 1, 2, 4};
+  for(uint32_t num_threads : threads){
+    timer.tic();
+    pnet::GzipWriter writer(gz_file, num_threads);
+    writer.write(data.data(), data.size());
+    writer.close();
+    report("GzipWriter " + std::to_string(num_threads) + " threads",
+           data.size(), timer.toc(), writer.bytesOut());
+  }
+
+  std::string result(data.size(), 0);
+  timer.tic();
+  pnet::utils::unzip(gz_file, plain);
+  {
+    std::ifstream in(plain, std::ios::binary);
+    in.read(&result[0], result.size());
+  }
+  report("gunzip + read", data.size(), timer.toc(), fileSize(gz_file));
+
+  timer.tic();
+  {
+    pnet::GzipReader reader(gz_file);
+    uint64_t offset = 0, n;
+    while((n = reader.read(&result[offset], 1 << 20)) > 0){
+      offset += n;
+    }
+  }
+  report("GzipReader read()", data.size(), timer.toc(), fileSize(gz_file));
+
+  for(uint32_t num_threads : threads){
+    if(num_threads == 0){
+      continue;
+    }
+    timer.tic();
+    pnet::GzipReader reader(gz_file);
+    reader.readAll(&result[0], num_threads);
+    report("GzipReader readAll " + std::to_string(num_threads) + " threads",
+           data.size(), timer.toc(), fileSize(gz_file));
+  }
+  pnet::ASSERT_TRUE(result == data, "roundtrip failed");
+
+  pnet::utils::rm(plain);
+  pnet::utils::rm(gz_file);
+  return 0;
+}
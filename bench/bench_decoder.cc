@@ -0,0 +1,98 @@
+#include <pnet_decoder.hpp>
+
+#include <random>
+
+// Decoding rate of FrameDecoder on frames held in memory.
+//
+// Usage: bench_decoder [num_frames]   (default: 4096 frames, decoded 10000
+//                                      times)
+
+typedef std::vector<uint8_t> Bytes;
+
+void put16(Bytes &b, uint16_t x){
+  b.push_back(x >> 8);
+  b.push_back(x & 0xff);
+}
+
+// Ethernet, optional VLAN tag, IPv4 or IPv6, TCP.
+Bytes makeFrame(std::mt19937_64 &rng, bool vlan, bool ipv6){
+  Bytes b(12, 0);
+  if(vlan){
+    put16(b, 0x8100);
+    put16(b, 10);
+  }
+  put16(b, ipv6 ? 0x86dd : 0x0800);
+  if(ipv6){
+    put16(b, 0x6000);
+    put16(b, 0);
+    put16(b, 20);
+    b.push_back(IPPROTO_TCP);
+    b.push_back(64);
+    for(int i = 0; i < 32; ++i){
+      b.push_back((uint8_t) rng());
+    }
+  } else {
+    b.push_back(0x45);
+    b.push_back(0);
+    put16(b, 40 + rng() % 1460);
+    put16(b, 0);
+    put16(b, 0x4000);
+    b.push_back(64);
+    b.push_back(IPPROTO_TCP);
+    put16(b, 0);
+    for(int i = 0; i < 8; ++i){
+      b.push_back((uint8_t) rng());
+    }
+  }
+  for(int i = 0; i < 4; ++i){
+    b.push_back((uint8_t) rng());
+  }
+  b.resize(b.size() + 8, 0);
+  b.push_back(0x50);
+  b.push_back(pnet::Packet::TCP_ACK);
+  b.resize(b.size() + 6, 0);
+  b.resize(b.size() + 64, 0);   // payload
+  return b;
+}
+
+void bench(const std::string &name, const std::vector<Bytes> &frames,
+           uint64_t repeat){
+  std::vector<pnet::Frame> batch(frames.size());
+  for(uint64_t i = 0; i < frames.size(); ++i){
+    batch[i].data = frames[i].data();
+    batch[i].caplen = batch[i].wirelen = frames[i].size();
+    batch[i].linktype = pnet::LINKTYPE_ETHERNET;
+    batch[i].timestamp = pnet::Time(i);
+  }
+  const uint64_t BATCH_SIZE = 256;
+  std::vector<pnet::Packet> packets(BATCH_SIZE);
+  pnet::FrameDecoder decoder;
+  uint64_t num_packets = 0;
+  pnet::TicTocTimer timer;
+  for(uint64_t r = 0; r < repeat; ++r){
+    for(uint64_t i = 0; i < batch.size(); i += BATCH_SIZE){
+      uint64_t n = std::min(BATCH_SIZE, batch.size() - i);
+      num_packets += decoder.decode(&batch[i], n, packets.data());
+    }
+  }
+  pnet::Time elapsed = timer.toc();
+  double ns = 1000.0 * elapsed.microseconds() / num_packets;
+  printf("  %-28s %8.2f ns/packet %8.1f Mpps\n", name.c_str(), ns,
+         1000.0 / ns);
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_frames = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4096;
+  uint64_t repeat = std::max<uint64_t>(1, 40000000 / num_frames);
+  std::mt19937_64 rng(1234);
+  std::vector<Bytes> ipv4, mixed;
+  for(uint64_t i = 0; i < num_frames; ++i){
+    ipv4.push_back(makeFrame(rng, false, false));
+    uint64_t r = rng() % 10;
+    mixed.push_back(makeFrame(rng, r == 0, r == 1));
+  }
+  printf("%lu frames:\n", num_frames);
+  bench("IPv4/TCP", ipv4, repeat);
+  bench("10% VLAN, 10% IPv6", mixed, repeat);
+  return 0;
+}
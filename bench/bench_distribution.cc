@@ -0,0 +1,64 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Cost of reading the FSD: a walk over all flows versus a snapshot of the
+// distributions kept up to date by the table, and the insert overhead of
+// keeping them.
+//
+// Usage: bench_distribution [num_flows] [num_reads]   (default: 5M, 100)
+
+int main(int argc, char *argv[]){
+  uint64_t num_flows = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                : 5000000;
+  uint64_t num_reads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100;
+  std::mt19937_64 random(42);
+  pnet::FlowTable table(nullptr, 0, num_flows);
+  pnet::TicTocTimer timer;
+  uint64_t t = 1500000000000000ull, num_packets = 0;
+  for(uint64_t i = 0; i < num_flows; ++i){
+    pnet::Packet packet;
+    packet.ip_src.s_addr = htonl(0x0a000000 + i);
+    packet.ip_dst.s_addr = htonl(0xc0a80101);
+    packet.port_src = htons(1024);
+    packet.port_dst = htons(443);
+    packet.protocol = random() % 4 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.flags = 0;
+    // Mostly mice, a few elephants.
+    uint64_t size = random() % 100 ? 1 + random() % 4 : 1 + random() % 200;
+    for(uint64_t j = 0; j < size; ++j){
+      packet.size = 40 + random() % 1460;
+      packet.t_arrival = pnet::Time(t);
+      table.insert(packet);
+      ++num_packets;
+    }
+    t += 1;
+  }
+  pnet::Time elapsed = timer.toc();
+  printf("%lu flows, %lu packets:\n", table.flows.num_elements, num_packets);
+  printf("  %-28s %8.2f ns/packet\n", "insert",
+         1000.0 * elapsed.microseconds() / num_packets);
+
+  uint64_t checksum = 0;
+  timer.tic();
+  for(uint64_t r = 0; r < num_reads; ++r){
+    std::vector<uint64_t> counts(pnet::FlowTable::NUM_FSD_BINS, 0);
+    for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+      counts[std::min(pnet::FlowTable::NUM_FSD_BINS, flow->size()) - 1]++;
+    }
+    checksum += counts[0];
+  }
+  elapsed = timer.toc();
+  printf("  %-28s %12.2f us/read\n", "walk over flows",
+         (double) elapsed.microseconds() / num_reads);
+
+  timer.tic();
+  for(uint64_t r = 0; r < num_reads; ++r){
+    checksum += table.getCurrentFSD()[0];
+  }
+  elapsed = timer.toc();
+  printf("  %-28s %12.2f us/read\n", "snapshot",
+         (double) elapsed.microseconds() / num_reads);
+  printf("  (%lu)\n", checksum);
+  return 0;
+}
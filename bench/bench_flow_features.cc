@@ -0,0 +1,66 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Cost of flow features: streaming in the FlowTable (on top of a summary
+// only table), and the batch path over the packets of a file.
+//
+// Usage: bench_flow_features [num_packets] [num_flows]   (default: 10M, 10K)
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 10000000;
+  uint64_t num_flows = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                                : 10000;
+  std::mt19937_64 random(42);
+  std::vector<pnet::Packet> packets(num_packets);
+  uint64_t t = 1500000000000000ull;
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::Packet &packet = packets[i];
+    packet.ip_src.s_addr = htonl(0x0a000000 + random() % num_flows);
+    packet.ip_dst.s_addr = htonl(0xc0a80101);
+    packet.port_src = htons(1024);
+    packet.port_dst = htons(443);
+    packet.protocol = IPPROTO_TCP;
+    packet.flags = pnet::Packet::TCP_ACK;
+    packet.size = random() % 2 ? 1500 : 40 + random() % 1460;
+    if(random() % 3 == 0){
+      std::swap(packet.ip_src, packet.ip_dst);
+      std::swap(packet.port_src, packet.port_dst);
+    }
+    t += random() % 20;
+    packet.t_arrival = pnet::Time(t);
+  }
+  printf("%lu packets in %lu flows:\n", num_packets, num_flows);
+
+  for(bool features : {false, true}){
+    pnet::FlowTable table;
+    table.setHistoryPolicy(pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+    table.setFeatureExtraction(features);
+    pnet::TicTocTimer timer;
+    for(const pnet::Packet &packet : packets){
+      table.insert(packet);
+    }
+    pnet::Time elapsed = timer.toc();
+    double checksum = 0;
+    for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+      checksum += flow->getFeatures()[pnet::FlowFeatures::IAT_STD];
+    }
+    printf("  %-28s %8.2f ns/packet  (%g)\n",
+           features ? "table, features" : "table, summary only",
+           1000.0 * elapsed.microseconds() / num_packets, checksum);
+  }
+
+  std::vector<pnet::Key> keys;
+  std::vector<pnet::FlowFeatures> features;
+  pnet::TicTocTimer timer;
+  pnet::extractFlowFeatures(packets.data(), packets.size(), keys, features);
+  pnet::Time elapsed = timer.toc();
+  double checksum = 0;
+  for(const pnet::FlowFeatures &f : features){
+    checksum += f[pnet::FlowFeatures::IAT_STD];
+  }
+  printf("  %-28s %8.2f ns/packet  (%g)\n", "batch",
+         1000.0 * elapsed.microseconds() / num_packets, checksum);
+  return 0;
+}
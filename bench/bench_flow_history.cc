@@ -0,0 +1,71 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Insert cost and memory of flow histories under each HistoryPolicy.
+//
+// Usage: bench_flow_history [num_packets] [num_flows]   (default: 10M, 100)
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 10000000;
+  uint64_t num_flows = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100;
+  std::mt19937_64 random(42);
+  std::vector<pnet::Packet> packets(num_packets);
+  uint64_t t = 1500000000000000ull;
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::Packet &packet = packets[i];
+    packet.ip_src.s_addr = htonl(0x0a000000 + i % num_flows);
+    packet.ip_dst.s_addr = htonl(0xc0a80101);
+    packet.port_src = htons(1024);
+    packet.port_dst = htons(443);
+    packet.protocol = IPPROTO_TCP;
+    packet.flags = pnet::Packet::TCP_ACK;
+    packet.size = random() % 2 ? 1500 : 40 + random() % 1460;
+    if(random() % 3 == 0){
+      std::swap(packet.ip_src, packet.ip_dst);
+      std::swap(packet.port_src, packet.port_dst);
+    }
+    t += random() % 20;
+    packet.t_arrival = pnet::Time(t);
+  }
+
+  struct Case {
+    const char *name;
+    pnet::HistoryPolicy policy;
+  } cases[] = {
+    {"full", pnet::HistoryPolicy()},
+    {"first 1000", pnet::HistoryPolicy(pnet::HistoryPolicy::FIRST_N, 1000)},
+    {"reservoir 1000",
+     pnet::HistoryPolicy(pnet::HistoryPolicy::RESERVOIR, 1000)},
+    {"summary", pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY)},
+  };
+  printf("%lu packets in %lu flows:\n", num_packets, num_flows);
+  printf("  %-28s %8.2f bytes/packet (16 bytes PacketInfo)\n", "uncompressed",
+         16.0);
+  for(const Case &c : cases){
+    pnet::FlowTable table;
+    table.setHistoryPolicy(c.policy);
+    pnet::TicTocTimer timer;
+    for(const pnet::Packet &packet : packets){
+      table.insert(packet);
+    }
+    pnet::Time elapsed = timer.toc();
+    uint64_t history_bytes = table.flows.packetStats().live_blocks
+                             * table.flows.packetStats().block_size;
+    uint64_t kept = 0, checksum = 0;
+    for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+      kept += flow->packets.size();
+      if(c.policy.mode == pnet::HistoryPolicy::RESERVOIR){
+        history_bytes += flow->packets.size() * sizeof(pnet::PacketInfo);
+      } else {
+        history_bytes += flow->packets.blockBytes();
+      }
+      checksum += flow->size();
+    }
+    printf("  %-28s %8.2f bytes/packet %8.2f ns/packet %10lu kept  (%lu)\n",
+           c.name, (double) history_bytes / num_packets,
+           1000.0 * elapsed.microseconds() / num_packets, kept, checksum);
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <pnet.hpp>
+
+#include <random>
+#include <unordered_map>
+
+// Compares the flat FlowIndex against the previous
+// std::unordered_map<Key, Flow*, KeyHash> flow table index.
+//
+// Usage: bench_flow_index [num_flows ...]   (default: 1M and 10M flows)
+
+// The additive hash that FlowTable used before FlowIndex.
+class LegacyKeyHash {
+  public:
+    std::size_t operator()(const pnet::Key& key) const {
+      return (key.ip_src.s_addr + key.ip_dst.s_addr + key.port_src
+              + key.port_dst + key.protocol);
+    }
+};
+
+std::vector<pnet::Key> generateKeys(uint64_t num_flows){
+  std::mt19937_64 rng(1234);
+  std::vector<pnet::Key> keys(num_flows);
+  for(auto &key : keys){
+    uint64_t r = rng();
+    key.ip_src.s_addr = (uint32_t) r;
+    key.ip_dst.s_addr = (uint32_t) (r >> 32);
+    r = rng();
+    key.port_src = (uint16_t) r;
+    key.port_dst = (uint16_t) (r >> 16);
+    key.protocol = (r >> 32) & 1 ? 6 : 17;
+  }
+  return keys;
+}
+
+// Reverse direction of every key, i.e. the keys of the response packets.
+std::vector<pnet::Key> reverseKeys(const std::vector<pnet::Key> &keys){
+  std::vector<pnet::Key> reversed(keys);
+  for(auto &key : reversed){
+    std::swap(key.ip_src, key.ip_dst);
+    std::swap(key.port_src, key.port_dst);
+  }
+  return reversed;
+}
+
+// Keys are looked up in a random order to defeat the prefetcher.
+std::vector<uint64_t> lookupOrder(uint64_t num_flows){
+  std::vector<uint64_t> order(num_flows);
+  for(uint64_t i = 0; i < num_flows; ++i){
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  return order;
+}
+
+void report(const std::string &name, uint64_t num_ops, pnet::Time elapsed){
+  double ns = 1000.0 * elapsed.microseconds() / num_ops;
+  printf("  %-28s %8.1f ns/op %8.2f Mops/s\n",
+         name.c_str(), ns, 1000.0 / ns);
+}
+
+void bench_unordered_map(const std::vector<pnet::Key> &keys,
+                         const std::vector<pnet::Key> &reversed,
+                         const std::vector<uint64_t> &order){
+  std::unordered_map<pnet::Key, pnet::Key*, LegacyKeyHash> map;
+  map.reserve(pnet::FlowTable::HASH_SIZE_HINT);
+  std::vector<pnet::Key> values(keys);
+  uint64_t found = 0;
+
+  pnet::TicTocTimer timer;
+  for(uint64_t i = 0; i < keys.size(); ++i){
+    map.insert({keys[i], &values[i]});
+  }
+  report("unordered_map insert", keys.size(), timer.toc());
+
+  timer.tic();
+  for(uint64_t i : order){
+    found += map.find(keys[i]) != map.end();
+  }
+  report("unordered_map find", keys.size(), timer.toc());
+
+  timer.tic();
+  for(uint64_t i : order){
+    found += map.find(reversed[i]) != map.end();
+  }
+  report("unordered_map find reverse", keys.size(), timer.toc());
+
+  timer.tic();
+  for(uint64_t i = 0; i < keys.size(); ++i){
+    map.erase(keys[i]);
+  }
+  report("unordered_map erase", keys.size(), timer.toc());
+  printf("  (found %lu)\n", found);
+}
+
+void bench_flow_index(const std::vector<pnet::Key> &keys,
+                      const std::vector<pnet::Key> &reversed,
+                      const std::vector<uint64_t> &order){
+  pnet::FlowIndex<pnet::Key, pnet::Key> index(
+      pnet::FlowTable::HASH_SIZE_HINT);
+  std::vector<pnet::Key> values(keys);
+  uint64_t found = 0;
+
+  pnet::TicTocTimer timer;
+  for(uint64_t i = 0; i < keys.size(); ++i){
+    index.insert(keys[i].hash(), &values[i]);
+  }
+  report("FlowIndex insert", keys.size(), timer.toc());
+
+  timer.tic();
+  for(uint64_t i : order){
+    found += index.find(keys[i], keys[i].hash()) != nullptr;
+  }
+  report("FlowIndex find", keys.size(), timer.toc());
+
+  timer.tic();
+  for(uint64_t i : order){
+    found += index.find(reversed[i], reversed[i].hash()) != nullptr;
+  }
+  report("FlowIndex find reverse", keys.size(), timer.toc());
+  printf("  average probe length: %.3f\n", index.averageProbeLength());
+
+  timer.tic();
+  for(uint64_t i = 0; i < keys.size(); ++i){
+    index.erase(&values[i], keys[i].hash());
+  }
+  report("FlowIndex erase", keys.size(), timer.toc());
+  printf("  (found %lu)\n", found);
+}
+
+int main(int argc, char *argv[]){
+  std::vector<uint64_t> sizes = {1000000, 10000000};
+  if(argc > 1){
+    sizes.clear();
+    for(int i = 1; i < argc; ++i){
+      sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+  }
+  for(uint64_t num_flows : sizes){
+    printf("%lu flows:\n", num_flows);
+    std::vector<pnet::Key> keys = generateKeys(num_flows);
+    std::vector<pnet::Key> reversed = reverseKeys(keys);
+    std::vector<uint64_t> order = lookupOrder(num_flows);
+    bench_unordered_map(keys, reversed, order);
+    bench_flow_index(keys, reversed, order);
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Compares text and binary flow records: recording with FlowRecorder and
+// reading back.
+//
+// Usage: bench_flow_record [num_flows]   (default: 2M)
+
+const std::string output_dir = "/tmp/bench_flow_record";
+
+void report(const std::string &name, uint64_t num_flows, uint64_t bytes,
+            pnet::Time elapsed, uint64_t checksum){
+  double ns = 1000.0 * elapsed.microseconds() / num_flows;
+  printf("  %-28s %6.2f bytes/flow %8.2f ns/flow %7.2f M flows/s  (%lu)\n",
+         name.c_str(), (double) bytes / num_flows, ns, 1000.0 / ns,
+         checksum);
+}
+
+uint64_t directorySize(){
+  uint64_t size = 0;
+  for(const std::string &file : pnet::utils::ls(output_dir, true,
+                                                {".flr", ".flw", ".gz"})){
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    size += in.tellg();
+  }
+  return size;
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_flows = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                : 2000000;
+  std::mt19937_64 random(42);
+  std::vector<pnet::Flow*> flows;
+  uint64_t t = 1500000000000000ull;
+  for(uint64_t i = 0; i < num_flows; ++i){
+    pnet::Packet packet;
+    packet.ip_src.s_addr = htonl(0x0a000000 + random() % 500);
+    packet.ip_dst.s_addr = htonl(random() % 0xffffffff);
+    packet.port_src = htons(1024 + random() % 64000);
+    packet.port_dst = htons(random() % 4 ? 443 : 80);
+    packet.protocol = random() % 10 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.flags = 0;
+    packet.size = 40 + random() % 1460;
+    t += random() % 4;
+    packet.t_arrival = pnet::Time(t);
+    flows.push_back(new pnet::Flow(packet));
+  }
+
+  const pnet::FlowRecorder::Format formats[] = {
+    pnet::FlowRecorder::TEXT, pnet::FlowRecorder::TEXT_GZ,
+    pnet::FlowRecorder::FLR, pnet::FlowRecorder::FLR_GZ};
+  const char *names[] = {".flw", ".flw.gz", ".flr", ".flr.gz"};
+  for(uint64_t f = 0; f < 4; ++f){
+    pnet::utils::rm("-rf " + output_dir);
+    pnet::utils::findOrCreate(output_dir);
+    printf("%s\n", names[f]);
+    {
+      pnet::TicTocTimer timer;
+      {
+        pnet::FlowRecorder recorder(output_dir, formats[f]);
+        for(const pnet::Flow *flow : flows){
+          recorder.write(*flow);
+        }
+      }
+      report("FlowRecorder::write", num_flows, directorySize(), timer.toc(),
+             0);
+    }
+    {
+      pnet::TicTocTimer timer;
+      std::vector<pnet::FlowRecord> records;
+      pnet::readFlowRange(output_dir, pnet::Time(0), pnet::Time(~0ull >> 1),
+                          records);
+      uint64_t checksum = 0;
+      for(const pnet::FlowRecord &record : records){
+        checksum += record.bytes;
+      }
+      report("readFlowRange", num_flows, directorySize(), timer.toc(),
+             checksum);
+    }
+    if(formats[f] == pnet::FlowRecorder::FLR){
+      pnet::TicTocTimer timer;
+      uint64_t checksum = 0;
+      for(const std::string &file : pnet::utils::ls(output_dir, true,
+                                                    {".flr"})){
+        pnet::FlowRecordReader reader(file);
+        for(const pnet::FlowRecord &record : reader){
+          checksum += record.bytes;
+        }
+      }
+      report("FlowRecordReader (mapped)", num_flows, directorySize(),
+             timer.toc(), checksum);
+    }
+  }
+
+  for(pnet::Flow *flow : flows){
+    delete flow;
+  }
+  pnet::utils::rm("-rf " + output_dir);
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <pnet.hpp>
+#include <pnet_flow_shards.hpp>
+
+#include <random>
+
+// Throughput of ShardedFlowTable with increasing number of shards.
+//
+// Usage: bench_flow_shards [max_shards] [num_packets] [num_flows]
+//   (defaults: number of cores, 20M packets, 1M flows)
+// Shard counts are doubled from 1 up to max_shards.
+
+std::vector<pnet::Packet> generatePackets(uint64_t num_packets,
+                                          uint64_t num_flows){
+  std::mt19937_64 rng(1234);
+  std::vector<pnet::Key> keys(num_flows);
+  for(auto &key : keys){
+    uint64_t r = rng();
+    key.ip_src.s_addr = (uint32_t) r;
+    key.ip_dst.s_addr = (uint32_t) (r >> 32);
+    r = rng();
+    key.port_src = (uint16_t) r;
+    key.port_dst = (uint16_t) (r >> 16);
+    key.protocol = (r >> 32) & 1 ? 6 : 17;
+  }
+  std::vector<pnet::Packet> packets(num_packets);
+  uint64_t t = 1500000000ULL * 1000000;
+  for(auto &packet : packets){
+    packet = pnet::Packet(keys[rng() % num_flows]);
+    packet.size = 64 + rng() % 1400;
+    t += rng() % 4;
+    packet.t_arrival = t;
+  }
+  return packets;
+}
+
+int main(int argc, char *argv[]){
+  uint64_t max_shards = std::thread::hardware_concurrency();
+  uint64_t num_packets = 20000000;
+  uint64_t num_flows = 1000000;
+  if(argc > 1) max_shards = std::strtoull(argv[1], nullptr, 10);
+  if(argc > 2) num_packets = std::strtoull(argv[2], nullptr, 10);
+  if(argc > 3) num_flows = std::strtoull(argv[3], nullptr, 10);
+
+  std::vector<pnet::Packet> packets = generatePackets(num_packets, num_flows);
+  printf("%lu packets, %lu flows, %u hardware threads\n",
+         num_packets, num_flows, std::thread::hardware_concurrency());
+
+  double base_mpps = 0;
+  for(uint64_t num_shards = 1; num_shards <= max_shards; num_shards *= 2){
+    pnet::ShardedFlowTable table(num_shards);
+    pnet::TicTocTimer timer;
+    for(auto &packet : packets){
+      table.insert(packet);
+    }
+    table.sync();
+    double mpps = (double) num_packets / timer.toc().microseconds();
+    if(num_shards == 1){
+      base_mpps = mpps;
+    }
+    printf("  %3lu shards: %7.2f Mpps  speedup %5.2fx  (%lu flows)\n",
+           num_shards, mpps, mpps / base_mpps, table.numFlows());
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include <pnet_logger.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Latency of Logger::INFO() on the calling threads, which is what the
+// packet path pays for a message.
+//
+// Usage: bench_logger [messages_per_thread] [num_threads]
+//   (defaults: 100K messages, 4 threads)
+
+int main(int argc, char *argv[]){
+  uint64_t num_messages = 100000;
+  uint64_t num_threads = 4;
+  if(argc > 1) num_messages = std::strtoull(argv[1], nullptr, 10);
+  if(argc > 2) num_threads = std::strtoull(argv[2], nullptr, 10);
+
+  std::string log_name = "/tmp/pnet_bench_logger.log";
+  pnet::Logger::INIT(log_name, 1 << 16);
+  std::vector<std::vector<double>> latencies(num_threads);
+  std::vector<std::thread> threads;
+  pnet::TicTocTimer timer;
+  for(uint64_t t = 0; t < num_threads; ++t){
+    threads.push_back(std::thread([&, t](){
+      std::string message = "FlowRecorder > rotated file "
+                            + std::to_string(t) + "_";
+      latencies[t].reserve(num_messages);
+      for(uint64_t i = 0; i < num_messages; ++i){
+        std::string text = message + std::to_string(i);
+        auto t_start = std::chrono::steady_clock::now();
+        pnet::Logger::INFO(text);
+        latencies[t].push_back(std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - t_start).count());
+      }
+    }));
+  }
+  for(std::thread &thread : threads){
+    thread.join();
+  }
+  double produce_us = timer.toc().microseconds();
+  pnet::Logger::FLUSH();
+  double total_us = timer.toc().microseconds();
+  uint64_t dropped = pnet::Logger::numDropped();
+  pnet::Logger::CLOSE();
+
+  std::vector<double> all;
+  for(const std::vector<double> &l : latencies){
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&all](double p){
+    return all[std::min<uint64_t>(all.size() - 1, p * all.size())];
+  };
+  printf("%lu threads x %lu messages: %.2f M msg/s logged, "
+         "%.2f M msg/s written, %lu dropped\n", num_threads, num_messages,
+         all.size() / produce_us, all.size() / total_us, dropped);
+  printf("INFO() latency: p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f ns\n",
+         percentile(0.5), percentile(0.99), percentile(0.999), all.back());
+  pnet::utils::rm(log_name);
+  return 0;
+}
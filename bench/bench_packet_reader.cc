@@ -0,0 +1,80 @@
+#include <pnet.hpp>
+
+#include <sys/resource.h>
+
+// Compares PacketReader streaming and mapped reads with the former
+// istream based reader, which copied every record into a vector.
+//
+// Usage: bench_packet_reader [num_packets]   (default: 10M)
+//
+// Peak RSS only grows, so the runs go from the least to the most memory.
+
+uint64_t peakRSS(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;   // MB
+}
+
+void report(const std::string &name, uint64_t num_packets,
+            pnet::Time elapsed, uint64_t checksum){
+  double ns = 1000.0 * elapsed.microseconds() / num_packets;
+  printf("  %-20s %6.2f ns/packet %8.1f Mpps  peak RSS %5lu MB  (%lu)\n",
+         name.c_str(), ns, 1000.0 / ns, peakRSS(), checksum);
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 10000000;
+  const std::string filename = "/tmp/bench_packet_reader.pkt";
+  {
+    std::ofstream out(filename, std::ios::binary);
+    pnet::Packet packet;
+    for(uint64_t i = 0; i < num_packets; ++i){
+      packet.size = i % 1500;
+      packet.t_arrival = i;
+      out << packet;
+    }
+  }
+  printf("%lu packets, peak RSS %lu MB:\n", num_packets, peakRSS());
+
+  pnet::TicTocTimer timer;
+  uint64_t checksum = 0;
+  {
+    pnet::PacketReader reader(filename);
+    pnet::PacketSpan span;
+    while(!(span = reader.next(65536)).empty()){
+      for(const pnet::Packet &packet : span){
+        checksum += packet.size;
+      }
+    }
+  }
+  report("streaming next()", num_packets, timer.toc(), checksum);
+
+  timer.tic();
+  checksum = 0;
+  {
+    pnet::PacketReader reader(filename);
+    for(const pnet::Packet &packet : reader.packets){
+      checksum += packet.size;
+    }
+  }
+  report("mapped packets", num_packets, timer.toc(), checksum);
+
+  timer.tic();
+  checksum = 0;
+  {
+    std::ifstream fin(filename, std::ios::binary);
+    std::vector<pnet::Packet> packets;
+    pnet::Packet temp;
+    while(fin >> temp){
+      packets.push_back(temp);
+    }
+    for(const pnet::Packet &packet : packets){
+      checksum += packet.size;
+    }
+  }
+  report("istream + vector", num_packets, timer.toc(), checksum);
+
+  pnet::utils::rm(filename);
+  return 0;
+}
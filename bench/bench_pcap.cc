@@ -0,0 +1,58 @@
+#include <pnet_interface.hpp>
+
+#include <random>
+
+// Reads a capture file through PcapInterface into a FlowTable and reports
+// the ingestion rate.
+//
+// Usage: bench_pcap [file.pcap]
+//        bench_pcap -n num_packets   (writes a synthetic capture to /tmp)
+
+std::string writeCapture(uint64_t num_packets){
+  std::string filename = "/tmp/bench_pcap.pcap";
+  std::mt19937_64 rng(1234);
+  pnet::PcapWriter writer(filename);
+  pnet::Packet packet;
+  for(uint64_t i = 0; i < num_packets; ++i){
+    uint64_t r = rng();
+    packet.ip_src.s_addr = (uint32_t) (r % 100000);
+    packet.ip_dst.s_addr = (uint32_t) (r >> 40);
+    packet.port_src = (uint16_t) (r >> 17);
+    packet.port_dst = htons(443);
+    packet.protocol = (r >> 33) & 1 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.flags = pnet::Packet::TCP_ACK;
+    packet.size = 40 + (r >> 50) % 1460;
+    packet.t_arrival = pnet::Time(i * 10);
+    writer.write(packet);
+  }
+  return filename;
+}
+
+int main(int argc, char *argv[]){
+  std::string filename;
+  if(argc == 2){
+    filename = argv[1];
+  } else {
+    uint64_t num_packets = 10000000;
+    if(argc == 3 && std::string(argv[1]) == "-n"){
+      num_packets = std::strtoull(argv[2], nullptr, 10);
+    }
+    printf("writing %lu packets...\n", num_packets);
+    filename = writeCapture(num_packets);
+  }
+  pnet::Logger::INIT("/tmp/bench_pcap.log");
+  pnet::NetworkInterface *iface =
+      pnet::NetworkInterface::createInterface(filename);
+  pnet::FlowTable table;
+  iface->setFlowTable(&table);
+  if(!iface->open(filename)){
+    return 1;
+  }
+  iface->loop();
+  iface->close();
+  printf("%lu flows, %lu expired\n", table.flow_hash.size(),
+         table.num_expired_flows);
+  delete iface;
+  pnet::Logger::CLOSE();
+  return 0;
+}
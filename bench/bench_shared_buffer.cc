@@ -0,0 +1,38 @@
+#include <pnet_shared_buffer.hpp>
+
+#include <sys/wait.h>
+
+// Producer-to-consumer throughput of SharedBuffer across fork().
+//
+// Usage: bench_shared_buffer [num_packets] [capacity]
+//   (defaults: 50M packets, 65536 packets capacity)
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = 50000000;
+  uint64_t capacity = pnet::SharedBuffer::DEFAULT_CAPACITY;
+  if(argc > 1) num_packets = std::strtoull(argv[1], nullptr, 10);
+  if(argc > 2) capacity = std::strtoull(argv[2], nullptr, 10);
+
+  for(uint64_t batch_size : {1, 16, 256}){
+    pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet(capacity);
+    std::vector<pnet::Packet> batch(batch_size);
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0){
+      for(uint64_t i = 0; i < num_packets; i += batch_size){
+        buffer->produce(batch.data(), std::min(batch_size, num_packets - i));
+      }
+      _exit(0);
+    }
+    pnet::TicTocTimer timer;
+    uint64_t received = 0;
+    while(received < num_packets){
+      received += buffer->consume(batch.data(), batch_size);
+    }
+    double mpps = (double) num_packets / timer.toc().microseconds();
+    waitpid(pid, nullptr, 0);
+    printf("batch %3lu: %7.2f Mpps\n", batch_size, mpps);
+    pnet::SharedBuffer::destroy();
+  }
+  return 0;
+}
@@ -0,0 +1,345 @@
+#include <pnet.hpp>
+#include <pnet_admission.hpp>
+#include <pnet_interface.hpp>
+#include <pnet_shared_buffer.hpp>
+#include <pnet_traffic.hpp>
+
+#include <sys/wait.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+// Micro and end-to-end benchmarks of the packet path on synthetic traffic
+// (see TrafficGenerator). For each component: throughput (Mpps), mean cost
+// per packet, latency percentiles per batch of BATCH packets, and peak
+// resident memory. Each component runs in a child process of its own, so
+// that peak memory is its own.
+//
+// Usage: bench_suite [options] [component ...]
+//   -n num_packets       (default: 5M)
+//   -f concurrent_flows  (default: 100K)
+//   -z zipf_exponent     (default: 1.2)
+//   -w file.pkt          write the traffic into a .pkt(.gz) file and exit
+//   -p                   publish metrics, for pnet-top to watch
+// Components: generator flow_table flow_table_summary shared_buffer
+//             packet_recorder packet_reader replay flow_recorder
+//             end_to_end (default: all)
+
+const uint64_t BATCH = 256;
+const std::string output_dir = "/tmp/pnet_bench_suite";
+
+// Nanoseconds per packet of each batch.
+class Latencies {
+  public:
+    void add(std::chrono::steady_clock::time_point t_start, uint64_t n){
+      auto t_end = std::chrono::steady_clock::now();
+      samples.push_back(std::chrono::duration<double, std::nano>(
+          t_end - t_start).count() / n);
+    }
+
+    double percentile(double p){
+      if(samples.empty()){
+        return 0;
+      }
+      uint64_t k = std::min<uint64_t>(samples.size() - 1,
+                                      p * samples.size());
+      std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+      return samples[k];
+    }
+
+  private:
+    std::vector<double> samples;
+};
+
+// Resident memory in MB, current (VmRSS) or peak (VmHWM).
+double residentMB(const std::string &field){
+  std::ifstream in("/proc/self/status");
+  std::string line;
+  while(std::getline(in, line)){
+    if(line.compare(0, field.size(), field) == 0){
+      return std::strtod(line.c_str() + field.size() + 1, nullptr) / 1024;
+    }
+  }
+  return 0;
+}
+
+// Runs the benchmark in a child process, which prints its results.
+void run(const std::string &name,
+         std::function<uint64_t(Latencies&)> benchmark){
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid == 0){
+    double rss_start = residentMB("VmRSS:");
+    Latencies latencies;
+    pnet::TicTocTimer timer;
+    uint64_t num_packets = benchmark(latencies);
+    double elapsed = timer.toc().microseconds();
+    printf("  %-20s %8.2f Mpps %8.1f ns/pkt  p50 %7.1f  p99 %7.1f  "
+           "p99.9 %8.1f ns/pkt  peak RSS %7.1f MB (+%.1f)\n",
+           name.c_str(), num_packets / elapsed, 1000 * elapsed / num_packets,
+           latencies.percentile(0.5), latencies.percentile(0.99),
+           latencies.percentile(0.999), residentMB("VmHWM:"),
+           residentMB("VmHWM:") - rss_start);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+    printf("  %-20s failed\n", name.c_str());
+  }
+}
+
+// Inserts all packets in batches, timing each batch.
+template <typename Insert>
+uint64_t insertAll(const std::vector<pnet::Packet> &packets,
+                   Latencies &latencies, Insert insert){
+  for(uint64_t i = 0; i < packets.size(); i += BATCH){
+    uint64_t n = std::min(BATCH, packets.size() - i);
+    auto t_start = std::chrono::steady_clock::now();
+    for(uint64_t j = i; j < i + n; ++j){
+      insert(packets[j]);
+    }
+    latencies.add(t_start, n);
+  }
+  return packets.size();
+}
+
+int main(int argc, char *argv[]){
+  pnet::TrafficConfig config;
+  config.concurrent_flows = 100000;
+  uint64_t num_packets = 5000000;
+  std::string write_file;
+  bool publish = false;
+  std::vector<std::string> components;
+  for(int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if(arg == "-n" && i + 1 < argc){
+      num_packets = std::strtoull(argv[++i], nullptr, 10);
+    } else if(arg == "-f" && i + 1 < argc){
+      config.concurrent_flows = std::strtoull(argv[++i], nullptr, 10);
+    } else if(arg == "-z" && i + 1 < argc){
+      config.zipf_exponent = std::strtod(argv[++i], nullptr);
+    } else if(arg == "-w" && i + 1 < argc){
+      write_file = argv[++i];
+    } else if(arg == "-p"){
+      publish = true;
+    } else {
+      components.push_back(arg);
+    }
+  }
+  if(!write_file.empty()){
+    pnet::TrafficGenerator generator(config);
+    generator.writeFile(write_file, num_packets);
+    printf("%lu packets of %lu flows written to %s\n", num_packets,
+           generator.numFlows(), write_file.c_str());
+    return 0;
+  }
+  if(publish && !pnet::Metrics::publish()){
+    printf("cannot publish metrics\n");
+    return 1;
+  }
+  auto selected = [&components](const std::string &name){
+    return components.empty()
+           || std::find(components.begin(), components.end(), name)
+              != components.end();
+  };
+
+  pnet::TrafficGenerator generator(config);
+  std::vector<pnet::Packet> packets;
+  generator.generate(packets, num_packets);
+  printf("%lu packets, %lu flows (%lu concurrent, zipf %.2f):\n",
+         num_packets, generator.numFlows(), config.concurrent_flows,
+         config.zipf_exponent);
+
+  if(selected("generator")){
+    run("generator", [&](Latencies &latencies){
+      pnet::TrafficGenerator g(config);
+      uint64_t checksum = 0;
+      for(uint64_t i = 0; i < num_packets; i += BATCH){
+        uint64_t n = std::min(BATCH, num_packets - i);
+        auto t_start = std::chrono::steady_clock::now();
+        for(uint64_t j = 0; j < n; ++j){
+          checksum += g.next().size;
+        }
+        latencies.add(t_start, n);
+      }
+      return checksum ? num_packets : 0;
+    });
+  }
+  if(selected("flow_table")){
+    run("flow_table", [&](Latencies &latencies){
+      pnet::FlowTable table;
+      return insertAll(packets, latencies, [&table](const pnet::Packet &p){
+        table.insert(p);
+      });
+    });
+  }
+  if(selected("flow_table_summary")){
+    run("flow_table_summary", [&](Latencies &latencies){
+      pnet::FlowTable table;
+      table.setHistoryPolicy(
+          pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+      return insertAll(packets, latencies, [&table](const pnet::Packet &p){
+        table.insert(p);
+      });
+    });
+  }
+  if(selected("shared_buffer")){
+    run("shared_buffer", [&](Latencies &latencies){
+      pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet();
+      std::thread producer([&](){
+        for(uint64_t i = 0; i < packets.size(); i += BATCH){
+          buffer->produce(&packets[i], std::min(BATCH, packets.size() - i));
+        }
+        buffer->close();
+      });
+      std::vector<pnet::Packet> batch(BATCH);
+      uint64_t n = 0, consumed = 0;
+      do {
+        auto t_start = std::chrono::steady_clock::now();
+        n = buffer->consume(batch.data(), BATCH);
+        if(n){
+          latencies.add(t_start, n);
+        }
+        consumed += n;
+      } while(n > 0);
+      producer.join();
+      return consumed;
+    });
+  }
+  if(selected("packet_recorder")){
+    run("packet_recorder", [&](Latencies &latencies){
+      pnet::utils::rm("-rf " + output_dir);
+      pnet::utils::findOrCreate(output_dir);
+      uint64_t n;
+      {
+        pnet::PacketRecorder recorder(output_dir);
+        n = insertAll(packets, latencies,
+                      [&recorder](const pnet::Packet &p){
+                        recorder.write(p);
+                      });
+      }
+      pnet::utils::rm("-rf " + output_dir);
+      return n;
+    });
+  }
+  if(selected("packet_reader")){
+    std::string file = "/tmp/pnet_bench_suite.pkt";
+    pnet::TrafficGenerator(config).writeFile(file, num_packets);
+    run("packet_reader", [&](Latencies &latencies){
+      pnet::PacketReader reader(file);
+      uint64_t checksum = 0, n = 0;
+      while(true){
+        auto t_start = std::chrono::steady_clock::now();
+        pnet::PacketSpan span = reader.next(BATCH);
+        if(span.empty()){
+          break;
+        }
+        for(const pnet::Packet &p : span){
+          checksum += p.size;
+        }
+        latencies.add(t_start, span.size());
+        n += span.size();
+      }
+      return checksum ? n : 0;
+    });
+    pnet::utils::rm(file);
+  }
+  if(selected("replay")){
+    // Trace replay as fast as possible through the shared buffer.
+    std::string file = "/tmp/pnet_bench_suite.pkt";
+    pnet::TrafficGenerator(config).writeFile(file, num_packets);
+    run("replay", [&](Latencies &latencies){
+      pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet();
+      pnet::PktInterface iface(pnet::ReplayConfig(0));
+      iface.setSharedBuffer(buffer);
+      if(!iface.open(file)){
+        return (uint64_t) 0;
+      }
+      std::thread producer([&](){
+        iface.loop();
+        buffer->close();
+      });
+      std::vector<pnet::Packet> batch(BATCH);
+      uint64_t n = 0, consumed = 0;
+      do {
+        auto t_start = std::chrono::steady_clock::now();
+        n = buffer->consume(batch.data(), BATCH);
+        if(n){
+          latencies.add(t_start, n);
+        }
+        consumed += n;
+      } while(n > 0);
+      producer.join();
+      return consumed;
+    });
+    pnet::utils::rm(file);
+  }
+  if(selected("flow_recorder")){
+    run("flow_recorder", [&](Latencies &latencies){
+      pnet::utils::rm("-rf " + output_dir);
+      pnet::utils::findOrCreate(output_dir);
+      uint64_t n;
+      {
+        pnet::FlowRecorder recorder(output_dir);
+        pnet::FlowTable table(&recorder);
+        table.setHistoryPolicy(
+            pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+        n = insertAll(packets, latencies, [&table](const pnet::Packet &p){
+          table.insert(p);
+        });
+        table.Flush();
+      }
+      pnet::utils::rm("-rf " + output_dir);
+      return n;
+    });
+  }
+  if(selected("end_to_end")){
+    // Capture thread to SharedBuffer, then admission control, flow table
+    // and flow recorder in the consumer.
+    run("end_to_end", [&](Latencies &latencies){
+      pnet::utils::rm("-rf " + output_dir);
+      pnet::utils::findOrCreate(output_dir);
+      pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet();
+      std::thread producer([&](){
+        pnet::TrafficGenerator g(config);
+        std::vector<pnet::Packet> batch;
+        for(uint64_t i = 0; i < num_packets; i += BATCH){
+          g.generate(batch, std::min(BATCH, num_packets - i));
+          buffer->produce(batch.data(), batch.size());
+        }
+        buffer->close();
+      });
+      uint64_t consumed = 0;
+      {
+        pnet::FlowRecorder recorder(output_dir);
+        pnet::FlowTable table(&recorder);
+        table.setHistoryPolicy(
+            pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+        pnet::AdmissionControl admission(table, pnet::AdmissionPolicy(
+            pnet::AdmissionPolicy::ADAPTIVE), buffer);
+        std::vector<pnet::Packet> batch(BATCH);
+        uint64_t n;
+        do {
+          auto t_start = std::chrono::steady_clock::now();
+          n = buffer->consume(batch.data(), BATCH);
+          for(uint64_t i = 0; i < n; ++i){
+            admission.insert(batch[i]);
+          }
+          if(n){
+            latencies.add(t_start, n);
+          }
+          consumed += n;
+        } while(n > 0);
+        producer.join();
+      }
+      pnet::utils::rm("-rf " + output_dir);
+      return consumed;
+    });
+  }
+  pnet::Metrics::unpublish();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <pnet.hpp>
+
+#include <random>
+
+// Text packet throughput: Packet::toString()/fromString() against
+// PacketTextCodec on one and several threads.
+//
+// Usage: bench_text [num_packets] [num_threads]   (default: 2M, 4)
+
+void report(const std::string &name, uint64_t num_packets, uint64_t bytes,
+            pnet::Time elapsed){
+  double ns = 1000.0 * elapsed.microseconds() / num_packets;
+  printf("  %-28s %8.2f ns/packet %8.2f Mpps %8.1f MB/s\n", name.c_str(),
+         ns, 1000.0 / ns, bytes / (elapsed.microseconds() + 1.0));
+}
+
+int main(int argc, char *argv[]){
+  uint64_t num_packets = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                  : 2000000;
+  uint32_t num_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+  std::mt19937_64 random(42);
+  std::vector<pnet::Packet> packets(num_packets);
+  uint64_t t = 1500000000000000ull;
+  for(pnet::Packet &packet : packets){
+    packet.ip_src.s_addr = htonl(0x0a000000 + random() % 500);
+    packet.ip_dst.s_addr = htonl(random() % 0xffffffff);
+    packet.port_src = htons(1024 + random() % 64000);
+    packet.port_dst = htons(random() % 4 ? 443 : 80);
+    packet.protocol = random() % 10 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.flags = packet.protocol == IPPROTO_TCP ? pnet::Packet::TCP_ACK : 0;
+    packet.size = 40 + random() % 1460;
+    t += random() % 4;
+    packet.t_arrival = pnet::Time(t);
+  }
+
+  printf("%lu packets, formatting:\n", num_packets);
+  std::string text;
+  {
+    pnet::TicTocTimer timer;
+    for(const pnet::Packet &packet : packets){
+      text += packet.toString();
+      text += '\n';
+    }
+    report("Packet::toString", num_packets, text.size(), timer.toc());
+  }
+  for(uint32_t threads : {1u, num_threads}){
+    pnet::PacketTextCodec codec(threads);
+    std::string out;
+    out.reserve(text.size());
+    pnet::TicTocTimer timer;
+    codec.format(packets.data(), num_packets, out);
+    pnet::Time elapsed = timer.toc();
+    pnet::ASSERT_TRUE(out == text, "codec output differs");
+    report("PacketTextCodec x" + std::to_string(threads), num_packets,
+           out.size(), elapsed);
+  }
+
+  printf("parsing:\n");
+  {
+    pnet::TicTocTimer timer;
+    std::istringstream lines(text);
+    std::string line;
+    std::vector<pnet::Packet> parsed;
+    parsed.reserve(num_packets);
+    pnet::Packet packet;
+    while(std::getline(lines, line)){
+      packet.fromString(line);
+      parsed.push_back(packet);
+    }
+    report("Packet::fromString", num_packets, text.size(), timer.toc());
+  }
+  for(uint32_t threads : {1u, num_threads}){
+    pnet::PacketTextCodec codec(threads);
+    std::vector<pnet::Packet> parsed;
+    pnet::TicTocTimer timer;
+    codec.parse(text.data(), text.size(), parsed);
+    pnet::Time elapsed = timer.toc();
+    pnet::ASSERT_TRUE(parsed.size() == num_packets &&
+                      std::memcmp(parsed.data(), packets.data(),
+                                  num_packets * sizeof(pnet::Packet)) == 0,
+                      "codec round-trip differs");
+    report("PacketTextCodec x" + std::to_string(threads), num_packets,
+           text.size(), elapsed);
+  }
+  return 0;
+}
@@ -4,6 +4,21 @@
 #include "pnet_time.hpp"
 #include "pnet_utils.hpp"
 #include "pnet_logger.hpp"
+#include "pnet_metrics.hpp"
+#include "pnet_compress.hpp"
+#include "pnet_packet.hpp"
+#include "pnet_text.hpp"
+#include "pnet_archive.hpp"
+#include "pnet_file.hpp"
+#include "pnet_catalog.hpp"
+#include "pnet_distribution.hpp"
+#include "pnet_flow_features.hpp"
+#include "pnet_flow_record.hpp"
 #include "pnet_flow.hpp"
+#include "pnet_cardinality.hpp"
+#include "pnet_admission.hpp"
+#include "pnet_decoder.hpp"
+#include "pnet_pcap.hpp"
+#include "pnet_afpacket.hpp"
 
 #endif
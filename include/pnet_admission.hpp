@@ -0,0 +1,202 @@
+#ifndef PNET_ADMISSION_HPP_
+#define PNET_ADMISSION_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include <pnet_flow.hpp>
+#include <pnet_shared_buffer.hpp>
+
+namespace pnet {
+
+  // Configuration of an AdmissionControl.
+  //    - ALL: every packet goes to the table.
+  //    - FLOW_SAMPLING: 1-in-rate flows, chosen by the hash of their key,
+  //      so that both directions and all packets of a flow are kept or
+  //      shed together, on every run.
+  //    - SAMPLE_AND_HOLD: packets of new flows are kept with probability
+  //      1 / rate, then all packets of the flows held in the table. Large
+  //      flows are kept with their size, most small flows are shed.
+  //    - ADAPTIVE: flow sampling at a power of two rate, raised when the
+  //      buffer fills up or the table grows beyond max_flows and lowered
+  //      when both are back to normal. Flows already in the table keep all
+  //      their packets when the rate changes.
+  struct AdmissionPolicy {
+
+    enum Mode { ALL, FLOW_SAMPLING, SAMPLE_AND_HOLD, ADAPTIVE };
+
+    AdmissionPolicy(Mode mode_ = ALL, uint16_t rate_ = 1)
+        : mode(mode_), rate(rate_), max_rate(1024), high_occupancy(0.75),
+          low_occupancy(0.25), max_flows(0), check_interval(4096),
+          seed(0) {}
+
+    Mode mode;
+    uint16_t rate;              // 1-in-rate, initial rate if ADAPTIVE
+    uint16_t max_rate;          // ADAPTIVE
+    double high_occupancy;      // of the buffer, to raise the rate
+    double low_occupancy;       // of the buffer, to lower the rate
+    uint64_t max_flows;         // in the table, zero for no limit
+    uint64_t check_interval;    // packets between load checks
+    uint64_t seed;              // of the sampling hash
+  };
+
+
+  // Admission control in front of a FlowTable: sheds load by sampling
+  // flows, so that the consumer keeps up with the capture during bursts
+  // and the table stays within bounds. See AdmissionPolicy.
+  //
+  // Flows are tagged with the sampling they went through (see FlowRecord),
+  // so that flow counts and sizes, recorded or read from the table, can be
+  // scaled back to unbiased estimates, see estimatedFSD() and
+  // FlowRecord::weight().
+  class AdmissionControl {
+
+    public:
+      // The buffer, if given, is the one the packets are consumed from,
+      // its occupancy drives ADAPTIVE sampling.
+      AdmissionControl(FlowTable &table_,
+                       const AdmissionPolicy &policy_ = AdmissionPolicy(),
+                       const SharedBuffer *buffer_ = nullptr)
+          : table(table_), policy(policy_), buffer(buffer_),
+            num_seen(0), num_admitted(0), random(policy_.seed + 1) {
+        ASSERT_TRUE(policy.rate > 0, "AdmissionControl:: zero rate");
+        rate = policy.rate;
+        if (policy.mode == AdmissionPolicy::ADAPTIVE) {
+          ASSERT_TRUE(policy.check_interval > 0,
+                      "AdmissionControl:: zero check interval");
+          // Powers of two, so that the flows sampled at a rate are also
+          // sampled at all lower rates.
+          uint16_t power = 1;
+          while (power < rate && power < 0x8000) {
+            power <<= 1;
+          }
+          rate = power;
+        }
+        applyRate();
+      }
+
+      // Inserts the packet into the table if admitted.
+      // Returns true if it was admitted.
+      bool insert(const Packet &pkt) {
+        ++num_seen;
+        if (policy.mode == AdmissionPolicy::ADAPTIVE
+            && num_seen % policy.check_interval == 0) {
+          adapt();
+        }
+        if (!admit(pkt)) {
+          return false;
+        }
+        ++num_admitted;
+        table.insert(pkt);
+        return true;
+      }
+
+      // Current 1-in-N rate.
+      uint16_t getRate() const {
+        return rate;
+      }
+
+      uint64_t numSeen() const {
+        return num_seen;
+      }
+
+      uint64_t numAdmitted() const {
+        return num_admitted;
+      }
+
+      uint64_t numShed() const {
+        return num_seen - num_admitted;
+      }
+
+    private:
+      AdmissionControl(const AdmissionControl&);
+      AdmissionControl& operator=(const AdmissionControl&);
+
+      bool admit(const Packet &pkt) {
+        switch (policy.mode) {
+          case AdmissionPolicy::ALL:
+            return true;
+          case AdmissionPolicy::FLOW_SAMPLING:
+            return sampled(pkt);
+          case AdmissionPolicy::SAMPLE_AND_HOLD:
+            return nextRandom() % rate == 0 || table.find(pkt) != nullptr;
+          case AdmissionPolicy::ADAPTIVE:
+            return sampled(pkt) || (rate > 1 && table.find(pkt) != nullptr);
+        }
+        return true;
+      }
+
+      // Direction-symmetric and deterministic. With power of two rates,
+      // flows sampled at rate 2N are a subset of those sampled at N.
+      bool sampled(const Packet &pkt) const {
+        return rate == 1
+               || (pkt.hash(policy.seed) >> 16) % rate == 0;
+      }
+
+      void adapt() {
+        double occupancy = buffer ? (double) buffer->occupancy()
+                                    / buffer->capacity() : 0;
+        uint64_t num_flows = table.flows.num_elements;
+        bool overloaded = occupancy > policy.high_occupancy
+                          || (policy.max_flows && num_flows > policy.max_flows);
+        bool relaxed = occupancy < policy.low_occupancy
+                       && (!policy.max_flows
+                           || num_flows < policy.max_flows / 2);
+        if (overloaded && rate < policy.max_rate) {
+          rate <<= 1;
+          applyRate();
+        } else if (relaxed && rate > 1) {
+          rate >>= 1;
+          applyRate();
+        }
+      }
+
+      void applyRate() {
+        if (policy.mode == AdmissionPolicy::ALL || rate == 1) {
+          table.setSampling(sampling::NONE, 1);
+        } else if (policy.mode == AdmissionPolicy::SAMPLE_AND_HOLD) {
+          table.setSampling(sampling::HOLD, rate);
+        } else {
+          table.setSampling(sampling::FLOW, rate);
+        }
+      }
+
+      uint64_t nextRandom() {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return random;
+      }
+
+    private:
+      FlowTable &table;
+      AdmissionPolicy policy;
+      const SharedBuffer *buffer;
+      uint16_t rate;
+      uint64_t num_seen;
+      uint64_t num_admitted;
+      uint64_t random;
+  };
+
+
+  // FSD of the flows of a table, as getCurrentFSD(), scaled back to the
+  // flows before sampling: each flow counts for FlowRecord::weight() flows
+  // of FlowRecord::estimatedPackets() packets. Walks over all flows.
+  inline std::vector<double> estimatedFSD(const FlowTable &table,
+                                          uint16_t proto = 0) {
+    std::vector<double> counts(FlowTable::NUM_FSD_BINS, 0);
+    for (const Flow *flow = table.flows.head; flow; flow = flow->next) {
+      if (proto != 0 && flow->protocol != proto) {
+        continue;
+      }
+      FlowRecord record = flow->toRecord();
+      uint64_t packets = record.estimatedPackets() + 0.5;
+      counts[std::min<uint64_t>(packets, counts.size()) - 1] +=
+          record.weight();
+    }
+    return counts;
+  }
+
+} // namespace pnet
+
+#endif // PNET_ADMISSION_HPP_
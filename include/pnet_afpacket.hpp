@@ -0,0 +1,321 @@
+#ifndef PNET_AFPACKET_HPP_
+#define PNET_AFPACKET_HPP_
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <pnet_decoder.hpp>
+
+namespace pnet {
+
+  // Ring geometry and fanout settings of an AfPacketRing.
+  struct AfPacketConfig {
+    AfPacketConfig()
+        : block_size(1 << 22), num_blocks(64), block_timeout_ms(10),
+          fanout_group(-1), fanout_mode(PACKET_FANOUT_HASH),
+          promiscuous(false), ignore_outgoing(false) {}
+
+    uint32_t block_size;        // bytes, a multiple of the page size
+    uint32_t num_blocks;
+    uint32_t block_timeout_ms;  // a partly filled block is retired after this
+    int fanout_group;           // sockets of the same group share the traffic,
+                                // -1 disables fanout
+    int fanout_mode;            // PACKET_FANOUT_HASH, _LB, _CPU, ...
+    bool promiscuous;
+    bool ignore_outgoing;       // skip packets sent by this host
+  };
+
+  // Live capture from a Linux AF_PACKET socket with a TPACKET_V3 RX ring.
+  //
+  // The kernel writes packets into a ring of blocks mapped into our address
+  // space and hands over whole blocks at once. Returned frames point into
+  // the ring, nothing is copied: a block is given back to the kernel on the
+  // next call, once all of its frames have been returned. Several rings
+  // (threads or processes) in the same fanout group split the traffic of
+  // an interface between them.
+  class AfPacketRing {
+
+    public:
+      // Kernel counters, accumulated since the ring was opened.
+      struct Stats {
+        Stats() : packets(0), drops(0), freezes(0) {}
+        uint64_t packets;   // packets passed to the ring
+        uint64_t drops;     // packets dropped because the ring was full
+        uint64_t freezes;   // times the ring was full
+      };
+
+    public:
+      AfPacketRing()
+          : fd(-1), ring(nullptr), ring_size(0), linktype(LINKTYPE_ETHERNET),
+            ignore_outgoing(false), current(0), block(nullptr),
+            remaining(0), frame(nullptr) {}
+
+      ~AfPacketRing() {
+        close();
+      }
+
+      // Returns false and sets error() on failure.
+      bool open(const std::string &dev,
+                const AfPacketConfig &config = AfPacketConfig()) {
+        close();
+        config_ = config;
+        ignore_outgoing = config.ignore_outgoing;
+        int ifindex = if_nametoindex(dev.c_str());
+        if (ifindex == 0) {
+          return fail("no such interface: " + dev);
+        }
+        // Devices without an Ethernet header (tun, ppp, ...) are opened in
+        // cooked mode, which strips the link-layer header.
+        int type = SOCK_RAW;
+        linktype = LINKTYPE_ETHERNET;
+        if (!hasEthernetHeader(dev)) {
+          type = SOCK_DGRAM;
+          linktype = LINKTYPE_RAW;
+        }
+        fd = socket(AF_PACKET, type, htons(ETH_P_ALL));
+        if (fd == -1) {
+          return fail("socket");
+        }
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+                       sizeof(version)) != 0) {
+          return fail("PACKET_VERSION");
+        }
+        struct tpacket_req3 req;
+        std::memset(&req, 0, sizeof(req));
+        req.tp_block_size = config.block_size;
+        req.tp_block_nr = config.num_blocks;
+        req.tp_frame_size = FRAME_SIZE;
+        req.tp_frame_nr = (uint64_t) config.block_size * config.num_blocks
+                          / FRAME_SIZE;
+        req.tp_retire_blk_tov = config.block_timeout_ms;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req,
+                       sizeof(req)) != 0) {
+          return fail("PACKET_RX_RING");
+        }
+        ring_size = (uint64_t) config.block_size * config.num_blocks;
+        void *memory = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_LOCKED, fd, 0);
+        if (memory == MAP_FAILED) {
+          // MAP_LOCKED fails beyond RLIMIT_MEMLOCK.
+          memory = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+        }
+        if (memory == MAP_FAILED) {
+          ring = nullptr;
+          return fail("mmap");
+        }
+        ring = static_cast<uint8_t*>(memory);
+        struct sockaddr_ll address;
+        std::memset(&address, 0, sizeof(address));
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_ALL);
+        address.sll_ifindex = ifindex;
+        if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+          return fail("bind");
+        }
+#ifdef PACKET_IGNORE_OUTGOING
+        // Saves ring space, next() filters them otherwise. This has no
+        // effect on fanout sockets.
+        int ignore = 1;
+        if (config.ignore_outgoing) {
+          setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore,
+                     sizeof(ignore));
+        }
+#endif
+        if (config.promiscuous) {
+          struct packet_mreq mreq;
+          std::memset(&mreq, 0, sizeof(mreq));
+          mreq.mr_ifindex = ifindex;
+          mreq.mr_type = PACKET_MR_PROMISC;
+          if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                         sizeof(mreq)) != 0) {
+            return fail("PACKET_ADD_MEMBERSHIP");
+          }
+        }
+        if (config.fanout_group >= 0) {
+          // Fragments of a datagram must hash to the same socket.
+          int flags = config.fanout_mode == PACKET_FANOUT_HASH
+                      ? PACKET_FANOUT_FLAG_DEFRAG : 0;
+          int fanout = (config.fanout_group & 0xffff)
+                       | ((config.fanout_mode | flags) << 16);
+          if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout,
+                         sizeof(fanout)) != 0) {
+            return fail("PACKET_FANOUT");
+          }
+        }
+        return true;
+      }
+
+      void close() {
+        if (ring) {
+          munmap(ring, ring_size);
+          ring = nullptr;
+        }
+        if (fd != -1) {
+          ::close(fd);
+          fd = -1;
+        }
+        current = 0;
+        block = nullptr;
+        remaining = 0;
+      }
+
+      // Returns up to max_frames frames, waiting at most timeout_ms for
+      // the kernel to fill a block. Returns 0 on timeout. Frames stay valid
+      // until the next call.
+      uint64_t next(Frame *frames, uint64_t max_frames, int timeout_ms) {
+        if (block && remaining == 0) {
+          releaseBlock();
+        }
+        if (!block) {
+          tpacket_block_desc *desc = blockAt(current);
+          if (!ready(desc)) {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+            poll(&pfd, 1, timeout_ms);
+            if (!ready(desc)) {
+              return 0;
+            }
+          }
+          block = desc;
+          remaining = desc->hdr.bh1.num_pkts;
+          frame = reinterpret_cast<uint8_t*>(desc)
+                  + desc->hdr.bh1.offset_to_first_pkt;
+        }
+        uint64_t n = 0;
+        while (n < max_frames && remaining > 0) {
+          const tpacket3_hdr *header =
+              reinterpret_cast<const tpacket3_hdr*>(frame);
+          if (!ignore_outgoing || !outgoing(header)) {
+            Frame &f = frames[n++];
+            f.data = frame + header->tp_mac;
+            f.caplen = header->tp_snaplen;
+            f.wirelen = header->tp_len;
+            f.linktype = linktype;
+            f.timestamp = Time(header->tp_sec, header->tp_nsec / 1000);
+          }
+          frame += header->tp_next_offset;
+          --remaining;
+        }
+        return n;
+      }
+
+      // Reads the kernel counters (which the kernel resets on every read).
+      const Stats& stats() {
+        if (fd != -1) {
+          struct tpacket_stats_v3 kstats;
+          socklen_t length = sizeof(kstats);
+          if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &kstats,
+                         &length) == 0) {
+            stats_.packets += kstats.tp_packets;
+            stats_.drops += kstats.tp_drops;
+            stats_.freezes += kstats.tp_freeze_q_cnt;
+          }
+        }
+        return stats_;
+      }
+
+      const AfPacketConfig& config() const {
+        return config_;
+      }
+
+      const std::string& error() const {
+        return error_;
+      }
+
+      bool isOpen() const {
+        return ring != nullptr;
+      }
+
+    private:
+      // Only used to size tp_frame_nr, packets are packed in the blocks.
+      static const uint32_t FRAME_SIZE = 2048;
+
+      AfPacketRing(const AfPacketRing&);
+      AfPacketRing& operator=(const AfPacketRing&);
+
+      bool fail(const std::string &what) {
+        error_ = "AfPacketRing:: " + what;
+        if (errno) {
+          error_ += ": " + std::string(std::strerror(errno));
+        }
+        close();
+        return false;
+      }
+
+      static bool hasEthernetHeader(const std::string &dev) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock == -1) {
+          return true;
+        }
+        struct ifreq ifr;
+        std::memset(&ifr, 0, sizeof(ifr));
+        std::strncpy(ifr.ifr_name, dev.c_str(), IFNAMSIZ - 1);
+        int result = ioctl(sock, SIOCGIFHWADDR, &ifr);
+        ::close(sock);
+        if (result != 0) {
+          return true;
+        }
+        return ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER
+               || ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+      }
+
+      // The sockaddr_ll follows the aligned tpacket3_hdr.
+      static bool outgoing(const tpacket3_hdr *header) {
+        const sockaddr_ll *address = reinterpret_cast<const sockaddr_ll*>(
+            reinterpret_cast<const uint8_t*>(header)
+            + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+        return address->sll_pkttype == PACKET_OUTGOING;
+      }
+
+      tpacket_block_desc* blockAt(uint32_t i) const {
+        return reinterpret_cast<tpacket_block_desc*>(
+            ring + (uint64_t) i * config_.block_size);
+      }
+
+      static bool ready(tpacket_block_desc *desc) {
+        return __atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+               & TP_STATUS_USER;
+      }
+
+      void releaseBlock() {
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        block = nullptr;
+        current = (current + 1) % config_.num_blocks;
+      }
+
+    private:
+      int fd;
+      uint8_t *ring;
+      uint64_t ring_size;
+      uint32_t linktype;
+      bool ignore_outgoing;
+      AfPacketConfig config_;
+      Stats stats_;
+      std::string error_;
+
+      uint32_t current;             // index of the next block
+      tpacket_block_desc *block;    // block being read, owned by us
+      uint32_t remaining;           // frames left in the block
+      const uint8_t *frame;         // next frame in the block
+  };
+
+} // namespace pnet
+
+#endif // PNET_AFPACKET_HPP_
@@ -0,0 +1,331 @@
+#ifndef PNET_ALLOCATOR_HPP_
+#define PNET_ALLOCATOR_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Usage statistics of a SlabAllocator.
+  struct AllocatorStats {
+    AllocatorStats() : block_size(0), blocks_per_slab(0), live_blocks(0),
+                       high_water_mark(0), num_slabs(0),
+                       total_allocations(0) {}
+
+    uint64_t reservedBytes() const {
+      return num_slabs * blocks_per_slab * block_size;
+    }
+
+    std::string toString() const {
+      return "live blocks = " + std::to_string(live_blocks)
+             + ", high water mark = " + std::to_string(high_water_mark)
+             + ", slabs = " + std::to_string(num_slabs)
+             + ", reserved bytes = " + std::to_string(reservedBytes())
+             + ", allocations = " + std::to_string(total_allocations);
+    }
+
+    uint64_t block_size;
+    uint64_t blocks_per_slab;
+    uint64_t live_blocks;       // blocks currently in use
+    uint64_t high_water_mark;   // maximum of live_blocks so far
+    uint64_t num_slabs;         // slabs reserved from the system
+    uint64_t total_allocations;
+  };
+
+
+  // Fixed-size block allocator.
+  //
+  // Memory is reserved from the system in large slabs and handed out in
+  // blocks of equal size. Released blocks go to an intrusive free list
+  // (the first word of a free block points to the next free block), hence
+  // both allocate() and release() are O(1) and memory never fragments.
+  // Slabs are kept until the allocator is destroyed and are reused for new
+  // blocks, so steady-state churn does not reach malloc at all.
+  class SlabAllocator {
+
+    public:
+      SlabAllocator(uint64_t block_size_, uint64_t blocks_per_slab_)
+          : free_list(nullptr), next_block(nullptr), slab_end(nullptr) {
+        // Blocks must be able to hold the free list pointer and stay aligned.
+        uint64_t align = sizeof(void*);
+        block_size_ = std::max<uint64_t>(block_size_, sizeof(void*));
+        stats.block_size = (block_size_ + align - 1) / align * align;
+        stats.blocks_per_slab = blocks_per_slab_;
+      }
+
+      ~SlabAllocator(){
+        for(char *slab : slabs){
+          std::free(slab);
+        }
+      }
+
+      void* allocate() {
+        void *block;
+        if (free_list) {
+          block = free_list;
+          free_list = *reinterpret_cast<void**>(free_list);
+        } else {
+          if (next_block == slab_end) {
+            addSlab();
+          }
+          block = next_block;
+          next_block += stats.block_size;
+        }
+        ++stats.total_allocations;
+        if (++stats.live_blocks > stats.high_water_mark) {
+          stats.high_water_mark = stats.live_blocks;
+        }
+        return block;
+      }
+
+      void release(void *block) {
+        *reinterpret_cast<void**>(block) = free_list;
+        free_list = block;
+        --stats.live_blocks;
+      }
+
+      // Releases 'count' blocks in O(1). The blocks must already be linked
+      // through their first words from 'first' to 'last'.
+      void releaseChain(void *first, void *last, uint64_t count) {
+        *reinterpret_cast<void**>(last) = free_list;
+        free_list = first;
+        stats.live_blocks -= count;
+      }
+
+      const AllocatorStats& getStats() const {
+        return stats;
+      }
+
+    private:
+      SlabAllocator(const SlabAllocator&);
+      SlabAllocator& operator=(const SlabAllocator&);
+
+      void addSlab() {
+        uint64_t slab_size = stats.block_size * stats.blocks_per_slab;
+        char *slab = (char*) std::malloc(slab_size);
+        ASSERT_TRUE(slab, "SlabAllocator:: Unable to allocate memory");
+        slabs.push_back(slab);
+        next_block = slab;
+        slab_end = slab + slab_size;
+        ++stats.num_slabs;
+      }
+
+    private:
+      void *free_list;
+      char *next_block;   // first never used block of the current slab
+      char *slab_end;
+      std::vector<char*> slabs;
+      AllocatorStats stats;
+  };
+
+
+  // Pool of objects of type T drawn from a SlabAllocator.
+  template <typename T>
+  class ObjectPool {
+
+    public:
+      explicit ObjectPool(uint64_t objects_per_slab = 4096)
+          : allocator(sizeof(T), objects_per_slab) {}
+
+      template <typename... Args>
+      T* create(Args&&... args) {
+        return new (allocator.allocate()) T(std::forward<Args>(args)...);
+      }
+
+      void destroy(T *object) {
+        object->~T();
+        allocator.release(object);
+      }
+
+      const AllocatorStats& getStats() const {
+        return allocator.getStats();
+      }
+
+    private:
+      SlabAllocator allocator;
+  };
+
+
+  // A singly linked chunk of N elements. The link is the first member,
+  // so a chain of chunks doubles as a SlabAllocator free list.
+  template <typename T, uint64_t N>
+  struct Chunk {
+    Chunk *next;
+    T items[N];
+  };
+
+
+  // Shared arena of chunks used by ChunkedList.
+  template <typename T, uint64_t N>
+  class ChunkArena {
+
+    public:
+      typedef Chunk<T, N> ChunkType;
+
+    public:
+      explicit ChunkArena(uint64_t chunks_per_slab = 4096)
+          : allocator(sizeof(ChunkType), chunks_per_slab) {}
+
+      ChunkType* allocate() {
+        ChunkType *chunk = (ChunkType*) allocator.allocate();
+        chunk->next = nullptr;
+        return chunk;
+      }
+
+      // Returns a whole chain of chunks in O(1).
+      void releaseChain(ChunkType *first, ChunkType *last, uint64_t count) {
+        allocator.releaseChain(first, last, count);
+      }
+
+      const AllocatorStats& getStats() const {
+        return allocator.getStats();
+      }
+
+    private:
+      SlabAllocator allocator;
+  };
+
+
+  // Append-only list that stores its elements in fixed-size chunks.
+  //
+  // Growing never moves existing elements (unlike std::vector) and
+  // clearing returns all chunks to the arena in O(1). Without an arena,
+  // chunks are taken from the heap. T must be trivially destructible.
+  template <typename T, uint64_t N>
+  class ChunkedList {
+
+    public:
+      typedef Chunk<T, N> ChunkType;
+      typedef ChunkArena<T, N> Arena;
+
+      class const_iterator {
+        public:
+          const_iterator(const ChunkType *chunk_, uint64_t pos_)
+              : chunk(chunk_), pos(pos_) {}
+
+          const T& operator*() const {
+            return chunk->items[pos % N];
+          }
+
+          const T* operator->() const {
+            return &chunk->items[pos % N];
+          }
+
+          const_iterator& operator++() {
+            if (++pos % N == 0) {
+              chunk = chunk->next;
+            }
+            return *this;
+          }
+
+          bool operator==(const const_iterator &it) const {
+            return pos == it.pos;
+          }
+
+          bool operator!=(const const_iterator &it) const {
+            return pos != it.pos;
+          }
+
+        private:
+          const ChunkType *chunk;
+          uint64_t pos;
+      };
+
+    public:
+      explicit ChunkedList(Arena *arena_ = nullptr)
+          : head(nullptr), tail(nullptr), num_elements(0), arena(arena_) {}
+
+      ~ChunkedList(){
+        clear();
+      }
+
+      template <typename... Args>
+      void emplace_back(Args&&... args) {
+        if (num_elements % N == 0) {
+          ChunkType *chunk = newChunk();
+          if (tail) {
+            tail->next = chunk;
+          } else {
+            head = chunk;
+          }
+          tail = chunk;
+        }
+        new (&tail->items[num_elements % N]) T(std::forward<Args>(args)...);
+        ++num_elements;
+      }
+
+      void clear() {
+        if (!head) {
+          return;
+        }
+        if (arena) {
+          arena->releaseChain(head, tail, numChunks());
+        } else {
+          while (head) {
+            ChunkType *next = head->next;
+            delete head;
+            head = next;
+          }
+        }
+        head = tail = nullptr;
+        num_elements = 0;
+      }
+
+      const T& front() const {
+        return head->items[0];
+      }
+
+      const T& back() const {
+        return tail->items[(num_elements - 1) % N];
+      }
+
+      uint64_t size() const {
+        return num_elements;
+      }
+
+      bool empty() const {
+        return num_elements == 0;
+      }
+
+      uint64_t numChunks() const {
+        return (num_elements + N - 1) / N;
+      }
+
+      const_iterator begin() const {
+        return const_iterator(head, 0);
+      }
+
+      const_iterator end() const {
+        return const_iterator(nullptr, num_elements);
+      }
+
+    private:
+      ChunkedList(const ChunkedList&);
+      ChunkedList& operator=(const ChunkedList&);
+
+      ChunkType* newChunk() {
+        if (arena) {
+          return arena->allocate();
+        }
+        ChunkType *chunk = new ChunkType;
+        chunk->next = nullptr;
+        return chunk;
+      }
+
+    private:
+      ChunkType *head;
+      ChunkType *tail;
+      uint64_t num_elements;
+      Arena *arena;
+  };
+
+} // namespace pnet
+
+#endif // PNET_ALLOCATOR_HPP_
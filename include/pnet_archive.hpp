@@ -0,0 +1,745 @@
+#ifndef PNET_ARCHIVE_HPP_
+#define PNET_ARCHIVE_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <pnet_hash.hpp>
+#include <pnet_packet.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Layout of .pka packet archives. All integers are little-endian.
+  //
+  //   file   = header block* index footer
+  //   header = "PNETPKA" version:u8 block_packets:u32 reserved:u32
+  //   block  = magic:u32 num_packets:u32 payload_size:u32 crc32:u32
+  //            t_min:u64 t_max:u64 num_endpoints:u32 num_flows:u32
+  //            bloom_bytes:u32 reserved:u32 payload
+  //   payload = Bloom filter, columns, padding
+  //   index  = (offset:u64 num_packets:u32 size:u32 t_min:u64 t_max:u64)*
+  //   footer = index_offset:u64 num_blocks:u64 num_packets:u64 "PKAINDEX"
+  //
+  // A block holds up to block_packets packets stored column by column:
+  //   - arrival times, as zigzag varint deltas from the previous packet
+  //     (the first one from the block t_min),
+  //   - a dictionary of the endpoint addresses of the block, then the
+  //     bit-packed dictionary indices of the sources and destinations,
+  //   - source ports, destination ports, protocols, flags and sizes, each
+  //     bit-packed either as offsets from the column minimum or as indices
+  //     into a dictionary of the column, whichever is smaller.
+  // Block headers carry the time range of the block and its number of
+  // endpoints and flows. The payload starts with a Bloom filter of the
+  // flow keys (8 bits per flow), so blocks can be skipped by time or by
+  // flow without decoding them.
+  // The index is written on close(); files that were not closed are
+  // recovered by walking the blocks.
+  namespace archive {
+
+    const uint8_t VERSION = 1;
+    const uint32_t HEADER_SIZE = 16;
+    const uint32_t BLOCK_HEADER_SIZE = 48;
+    const uint32_t INDEX_ENTRY_SIZE = 32;
+    const uint32_t FOOTER_SIZE = 32;
+    const uint32_t BLOCK_MAGIC = 0x424b4150;   // "PAKB"
+    const char FILE_MAGIC[] = "PNETPKA";
+    const char INDEX_MAGIC[] = "PKAINDEX";
+    // Columns are followed by this many zero bytes, so that bit-packed
+    // values can always be read with one 64-bit load.
+    const uint32_t PADDING = 8;
+
+    enum ColumnMode { PACKED = 0, DICTIONARY = 1 };
+
+    inline void put8(std::string &out, uint8_t x) {
+      out.push_back(x);
+    }
+
+    inline void put32(std::string &out, uint32_t x) {
+      for (int i = 0; i < 4; ++i) {
+        out.push_back((x >> (8 * i)) & 0xff);
+      }
+    }
+
+    inline void put64(std::string &out, uint64_t x) {
+      put32(out, x & 0xffffffff);
+      put32(out, x >> 32);
+    }
+
+    inline uint32_t load32(const uint8_t *p) {
+      return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    inline uint64_t load64(const uint8_t *p) {
+      return load32(p) | ((uint64_t) load32(p + 4) << 32);
+    }
+
+    // Bits needed for values up to x.
+    inline uint32_t bitWidth(uint32_t x) {
+      return x ? 32 - __builtin_clz(x) : 0;
+    }
+
+    // Appends n values of the given width, LSB first.
+    inline void putPacked(std::string &out, const uint32_t *values,
+                          uint64_t n, uint32_t width) {
+      uint64_t buffer = 0;
+      uint32_t bits = 0;
+      for (uint64_t i = 0; i < n; ++i) {
+        buffer |= (uint64_t) values[i] << bits;
+        bits += width;
+        while (bits >= 8) {
+          out.push_back(buffer & 0xff);
+          buffer >>= 8;
+          bits -= 8;
+        }
+      }
+      if (bits > 0) {
+        out.push_back(buffer & 0xff);
+      }
+    }
+
+    inline uint64_t packedSize(uint64_t n, uint32_t width) {
+      return (n * width + 7) / 8;
+    }
+
+    // Value i of a packed array. Reads 8 bytes, see PADDING.
+    inline uint32_t unpack(const uint8_t *p, uint64_t i, uint32_t width) {
+      uint64_t bit = i * width;
+      uint64_t word;
+      std::memcpy(&word, p + bit / 8, sizeof(word));
+      return (word >> (bit & 7)) & ((1ull << width) - 1);
+    }
+
+    inline void putVarint(std::string &out, uint64_t x) {
+      while (x >= 0x80) {
+        out.push_back((x & 0x7f) | 0x80);
+        x >>= 7;
+      }
+      out.push_back(x);
+    }
+
+    inline const uint8_t* getVarint(const uint8_t *p, uint64_t &x) {
+      x = 0;
+      for (uint32_t shift = 0; ; shift += 7) {
+        x |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+          return p;
+        }
+      }
+    }
+
+    inline uint64_t zigzag(int64_t x) {
+      return ((uint64_t) x << 1) ^ (uint64_t) (x >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t x) {
+      return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+    }
+
+    // Open addressing map from values to their order of insertion, for
+    // the dictionaries of a block. Buffers are reused from block to block.
+    template <class T>
+    class Dictionary {
+
+      public:
+        // Empties the dictionary, to hold up to max_size values.
+        void reset(uint64_t max_size) {
+          uint64_t capacity = 16;
+          while (capacity < 2 * max_size) {
+            capacity *= 2;
+          }
+          slots.assign(capacity, (uint32_t) EMPTY);
+          values.clear();
+        }
+
+        // Code of x, which is added if new.
+        uint32_t insert(T x) {
+          const uint64_t mask = slots.size() - 1;
+          for (uint64_t i = hash::mix64(x) & mask; ; i = (i + 1) & mask) {
+            uint32_t code = slots[i];
+            if (code == EMPTY) {
+              slots[i] = values.size();
+              values.push_back(x);
+              return slots[i];
+            }
+            if (values[code] == x) {
+              return code;
+            }
+          }
+        }
+
+        uint64_t size() const {
+          return values.size();
+        }
+
+      public:
+        std::vector<T> values;     // in order of insertion
+
+      private:
+        static const uint32_t EMPTY = 0xffffffff;
+        std::vector<uint32_t> slots;
+    };
+
+    // Appends a column of n values, see the layout above. dictionary and
+    // codes are scratch space.
+    inline void putColumn(std::string &out, const uint32_t *values,
+                          uint64_t n, Dictionary<uint32_t> &dictionary,
+                          std::vector<uint32_t> &codes) {
+      uint32_t low = n ? values[0] : 0;
+      uint32_t high = low;
+      for (uint64_t i = 1; i < n; ++i) {
+        low = std::min(low, values[i]);
+        high = std::max(high, values[i]);
+      }
+      uint32_t width = bitWidth(high - low);
+      codes.resize(n);
+      // A dictionary only pays off with fewer than 2^(width - 1) distinct
+      // values; building it stops as soon as it cannot.
+      if (width > 1 && n > 0) {
+        const uint64_t max_size = 1ull << (width - 1);
+        dictionary.reset(std::min<uint64_t>(n, max_size + 1));
+        for (uint64_t i = 0; i < n && dictionary.size() <= max_size; ++i) {
+          codes[i] = dictionary.insert(values[i]);
+        }
+        uint32_t dictionary_width = bitWidth(dictionary.size() - 1);
+        if (dictionary.size() <= max_size
+            && 4 * dictionary.size() + packedSize(n, dictionary_width)
+               < packedSize(n, width)) {
+          put8(out, DICTIONARY);
+          put8(out, dictionary_width);
+          put32(out, dictionary.size());
+          for (uint32_t entry : dictionary.values) {
+            put32(out, entry);
+          }
+          putPacked(out, codes.data(), n, dictionary_width);
+          return;
+        }
+      }
+      for (uint64_t i = 0; i < n; ++i) {
+        codes[i] = values[i] - low;
+      }
+      put8(out, PACKED);
+      put8(out, width);
+      put32(out, low);
+      putPacked(out, codes.data(), n, width);
+    }
+
+    // Reads a column written by putColumn, calling set(i, value) for each
+    // value. Returns the end of the column.
+    template <class Setter>
+    const uint8_t* getColumn(const uint8_t *p, uint64_t n, Setter set) {
+      uint8_t mode = p[0];
+      uint32_t width = p[1];
+      p += 2;
+      if (mode == DICTIONARY) {
+        uint32_t size = load32(p);
+        const uint8_t *entries = p + 4;
+        p = entries + 4 * (uint64_t) size;
+        for (uint64_t i = 0; i < n; ++i) {
+          set(i, load32(entries + 4 * (uint64_t) unpack(p, i, width)));
+        }
+      } else {
+        uint32_t low = load32(p);
+        p += 4;
+        for (uint64_t i = 0; i < n; ++i) {
+          set(i, low + unpack(p, i, width));
+        }
+      }
+      return p + packedSize(n, width);
+    }
+
+    // Bloom filter of flow keys, direction independent: three bits per
+    // key, taken from one hash. The size is a power of two.
+    const uint32_t BLOOM_HASHES = 3;
+
+    inline uint64_t bloomBit(uint64_t hash, uint32_t k, uint64_t num_bits) {
+      return (hash >> (21 * k)) & (num_bits - 1);
+    }
+
+    inline uint32_t bloomBytes(uint64_t num_flows) {
+      uint32_t bytes = 8;
+      while (bytes < num_flows) {
+        bytes *= 2;
+      }
+      return bytes;
+    }
+
+  } // namespace archive
+
+
+  // Writes packets into a .pka archive, see namespace archive.
+  class PacketArchiveWriter {
+
+    public:
+      static const uint32_t BLOCK_PACKETS = 1 << 16;
+
+    public:
+      PacketArchiveWriter(const std::string &filename_,
+                          uint32_t block_packets_ = BLOCK_PACKETS)
+          : filename(filename_), block_packets(block_packets_),
+            num_packets(0), bytes_out(0) {
+        if (block_packets == 0) {
+          FATAL("PacketArchiveWriter:: empty blocks");
+        }
+        file = std::fopen(filename.c_str(), "wb");
+        if (!file) {
+          FATAL("PacketArchiveWriter:: cannot open file : " + filename);
+        }
+        std::string header(archive::FILE_MAGIC, 7);
+        archive::put8(header, archive::VERSION);
+        archive::put32(header, block_packets);
+        archive::put32(header, 0);
+        emit(header);
+        buffer.reserve(block_packets);
+      }
+
+      ~PacketArchiveWriter() {
+        close();
+      }
+
+      void write(const Packet &packet) {
+        buffer.push_back(packet);
+        if (buffer.size() == block_packets) {
+          writeBlock();
+        }
+      }
+
+      void write(const Packet *packets, uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+          write(packets[i]);
+        }
+      }
+
+      // Writes the last block, the index and the footer.
+      void close() {
+        if (!file) {
+          return;
+        }
+        if (!buffer.empty()) {
+          writeBlock();
+        }
+        std::string index;
+        for (const std::string &entry : entries) {
+          index += entry;
+        }
+        uint64_t index_offset = bytes_out;
+        archive::put64(index, index_offset);
+        archive::put64(index, entries.size());
+        archive::put64(index, num_packets);
+        index.append(archive::INDEX_MAGIC, 8);
+        emit(index);
+        std::fclose(file);
+        file = nullptr;
+      }
+
+      uint64_t numPackets() const {
+        return num_packets + buffer.size();
+      }
+
+      uint64_t bytesOut() const {
+        return bytes_out;
+      }
+
+    private:
+      PacketArchiveWriter(const PacketArchiveWriter&);
+      PacketArchiveWriter& operator=(const PacketArchiveWriter&);
+
+      void emit(const std::string &data) {
+        if (std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+          FATAL("PacketArchiveWriter:: write failed : " + filename);
+        }
+        bytes_out += data.size();
+      }
+
+      void writeBlock() {
+        const uint64_t n = buffer.size();
+        uint64_t t_min = buffer[0].t_arrival.microseconds();
+        uint64_t t_max = t_min;
+        flows.reset(n);
+        for (const Packet &packet : buffer) {
+          uint64_t t = packet.t_arrival.microseconds();
+          t_min = std::min(t_min, t);
+          t_max = std::max(t_max, t);
+          flows.insert(packet.hash());
+        }
+
+        payload.clear();
+        const uint32_t bloom_bytes = archive::bloomBytes(flows.size());
+        payload.resize(bloom_bytes);
+        for (uint64_t hash : flows.values) {
+          for (uint32_t k = 0; k < archive::BLOOM_HASHES; ++k) {
+            uint64_t bit = archive::bloomBit(hash, k, 8 * bloom_bytes);
+            payload[bit / 8] |= 1 << (bit % 8);
+          }
+        }
+        std::string times;
+        uint64_t previous = t_min;
+        for (const Packet &packet : buffer) {
+          uint64_t t = packet.t_arrival.microseconds();
+          archive::putVarint(times, archive::zigzag(t - previous));
+          previous = t;
+        }
+        archive::put32(payload, times.size());
+        payload += times;
+
+        // Endpoints, shared by sources and destinations.
+        dictionary.reset(2 * n);
+        src.resize(n);
+        dst.resize(n);
+        for (uint64_t i = 0; i < n; ++i) {
+          src[i] = dictionary.insert(buffer[i].ip_src.s_addr);
+          dst[i] = dictionary.insert(buffer[i].ip_dst.s_addr);
+        }
+        const uint32_t num_endpoints = dictionary.size();
+        uint32_t width = archive::bitWidth(num_endpoints - 1);
+        archive::put32(payload, num_endpoints);
+        archive::put8(payload, width);
+        for (uint32_t address : dictionary.values) {
+          archive::put32(payload, address);
+        }
+        archive::putPacked(payload, src.data(), n, width);
+        archive::putPacked(payload, dst.data(), n, width);
+
+        putColumn(n, [](const Packet &p) -> uint32_t { return p.port_src; });
+        putColumn(n, [](const Packet &p) -> uint32_t { return p.port_dst; });
+        putColumn(n, [](const Packet &p) -> uint32_t { return p.protocol; });
+        putColumn(n, [](const Packet &p) -> uint32_t { return p.flags; });
+        putColumn(n, [](const Packet &p) -> uint32_t { return p.size; });
+        payload.append(archive::PADDING, '\0');
+
+        std::string header;
+        archive::put32(header, archive::BLOCK_MAGIC);
+        archive::put32(header, n);
+        archive::put32(header, payload.size());
+        archive::put32(header, crc32(0, reinterpret_cast<const Bytef*>(
+                                            payload.data()), payload.size()));
+        archive::put64(header, t_min);
+        archive::put64(header, t_max);
+        archive::put32(header, num_endpoints);
+        archive::put32(header, flows.size());
+        archive::put32(header, bloom_bytes);
+        archive::put32(header, 0);
+
+        std::string entry;
+        archive::put64(entry, bytes_out);
+        archive::put32(entry, n);
+        archive::put32(entry, header.size() + payload.size());
+        archive::put64(entry, t_min);
+        archive::put64(entry, t_max);
+        entries.push_back(entry);
+
+        emit(header);
+        emit(payload);
+        num_packets += n;
+        buffer.clear();
+      }
+
+      template <class Field>
+      void putColumn(uint64_t n, Field field) {
+        column.resize(n);
+        for (uint64_t i = 0; i < n; ++i) {
+          column[i] = field(buffer[i]);
+        }
+        archive::putColumn(payload, column.data(), n, dictionary, codes);
+      }
+
+    private:
+      std::string filename;
+      std::FILE *file;
+      uint32_t block_packets;
+      uint64_t num_packets;         // in written blocks
+      uint64_t bytes_out;
+
+      std::vector<Packet> buffer;   // packets of the current block
+      std::vector<std::string> entries;
+      // Scratch space of writeBlock().
+      std::string payload;
+      std::vector<uint32_t> column, codes, src, dst;
+      archive::Dictionary<uint32_t> dictionary;
+      archive::Dictionary<uint64_t> flows;    // key hashes of the block
+  };
+
+
+  // Reads a .pka archive, see namespace archive.
+  //
+  // The file is memory-mapped and blocks are decoded on demand, so a time
+  // range is read by decoding only the blocks that overlap it. Decoding is
+  // const: several threads can decode different blocks of one reader.
+  class PacketArchiveReader {
+
+    public:
+      struct Block {
+        uint64_t offset;        // of the block header in the file
+        uint32_t num_packets;
+        uint32_t size;          // header and payload, in bytes
+        Time t_min;
+        Time t_max;
+      };
+
+    public:
+      explicit PacketArchiveReader(const std::string &filename_)
+          : filename(filename_), data(nullptr), file_size(0),
+            num_packets(0), recovered(false) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+          FATAL("PacketArchiveReader:: cannot open file: " + filename);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          file_size = st.st_size;
+          void *memory = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE,
+                              fd, 0);
+          if (memory == MAP_FAILED) {
+            ::close(fd);
+            FATAL("PacketArchiveReader:: cannot map file: " + filename);
+          }
+          data = static_cast<const uint8_t*>(memory);
+        }
+        ::close(fd);
+        if (file_size < archive::HEADER_SIZE
+            || std::memcmp(data, archive::FILE_MAGIC, 7) != 0) {
+          FATAL("PacketArchiveReader:: not a packet archive: " + filename);
+        }
+        if (data[7] > archive::VERSION) {
+          FATAL("PacketArchiveReader:: unsupported version: " + filename);
+        }
+        if (!readIndex()) {
+          recoverIndex();
+        }
+        // Blocks are in arrival order, but may overlap in time.
+        t_max_before.resize(blocks.size());
+        uint64_t t_max = 0;
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+          t_max = std::max(t_max, blocks[i].t_max.microseconds());
+          t_max_before[i] = t_max;
+          num_packets += blocks[i].num_packets;
+        }
+      }
+
+      ~PacketArchiveReader() {
+        if (data) {
+          munmap(const_cast<uint8_t*>(data), file_size);
+        }
+      }
+
+      uint64_t size() const {
+        return num_packets;
+      }
+
+      uint64_t numBlocks() const {
+        return blocks.size();
+      }
+
+      const Block& block(uint64_t i) const {
+        return blocks[i];
+      }
+
+      // True if the file had no index (it was not closed) and the blocks
+      // were found by walking the file.
+      bool isRecovered() const {
+        return recovered;
+      }
+
+      // First block that can hold packets that arrived at t or later.
+      uint64_t findBlock(Time t) const {
+        return std::lower_bound(t_max_before.begin(), t_max_before.end(),
+                                t.microseconds()) - t_max_before.begin();
+      }
+
+      // False if block i has no packet of the flow (in either direction),
+      // true if it may have some.
+      bool mayContain(uint64_t i, const Key &key) const {
+        const uint8_t *header = data + blocks[i].offset;
+        const uint8_t *bloom = header + archive::BLOCK_HEADER_SIZE;
+        const uint64_t num_bits = 8 * (uint64_t) archive::load32(header + 40);
+        const uint64_t hash = key.hash();
+        for (uint32_t k = 0; k < archive::BLOOM_HASHES; ++k) {
+          uint64_t bit = archive::bloomBit(hash, k, num_bits);
+          if (!((bloom[bit / 8] >> (bit % 8)) & 1)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      // Decodes the block(i).num_packets packets of block i into out.
+      uint64_t decodeBlock(uint64_t i, Packet *out) const {
+        const Block &b = blocks[i];
+        const uint8_t *header = data + b.offset;
+        const uint64_t n = b.num_packets;
+        const uint8_t *p = header + archive::BLOCK_HEADER_SIZE
+                           + archive::load32(header + 40);
+
+        uint32_t times_size = archive::load32(p);
+        p += 4;
+        const uint8_t *times_end = p + times_size;
+        uint64_t t = archive::load64(header + 16);
+        for (uint64_t j = 0; j < n && p < times_end; ++j) {
+          uint64_t delta;
+          p = archive::getVarint(p, delta);
+          t += archive::unzigzag(delta);
+          out[j].t_arrival = Time(t);
+        }
+        p = times_end;
+
+        uint32_t num_endpoints = archive::load32(p);
+        uint32_t width = p[4];
+        const uint8_t *endpoints = p + 5;
+        const uint8_t *src = endpoints + 4 * (uint64_t) num_endpoints;
+        const uint8_t *dst = src + archive::packedSize(n, width);
+        for (uint64_t j = 0; j < n; ++j) {
+          out[j].ip_src.s_addr = archive::load32(
+              endpoints + 4 * (uint64_t) archive::unpack(src, j, width));
+          out[j].ip_dst.s_addr = archive::load32(
+              endpoints + 4 * (uint64_t) archive::unpack(dst, j, width));
+        }
+        p = dst + archive::packedSize(n, width);
+
+        p = archive::getColumn(p, n, [out](uint64_t j, uint32_t x) {
+          out[j].port_src = x;
+        });
+        p = archive::getColumn(p, n, [out](uint64_t j, uint32_t x) {
+          out[j].port_dst = x;
+        });
+        p = archive::getColumn(p, n, [out](uint64_t j, uint32_t x) {
+          out[j].protocol = x;
+        });
+        p = archive::getColumn(p, n, [out](uint64_t j, uint32_t x) {
+          out[j].flags = x;
+        });
+        archive::getColumn(p, n, [out](uint64_t j, uint32_t x) {
+          out[j].size = x;
+        });
+        return n;
+      }
+
+      // Decodes all size() packets.
+      void readAll(Packet *out) const {
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+          out += decodeBlock(i, out);
+        }
+      }
+
+      // Appends the packets with t_begin <= t_arrival < t_end to out, in
+      // file order. Returns the number of packets appended.
+      uint64_t readRange(Time t_begin, Time t_end,
+                         std::vector<Packet> &out) const {
+        const uint64_t begin = t_begin.microseconds();
+        const uint64_t end = t_end.microseconds();
+        uint64_t count = 0;
+        std::vector<Packet> decoded;
+        for (uint64_t i = findBlock(t_begin); i < blocks.size(); ++i) {
+          const Block &b = blocks[i];
+          if (b.t_min.microseconds() >= end
+              || b.t_max.microseconds() < begin) {
+            continue;
+          }
+          decoded.resize(b.num_packets);
+          decodeBlock(i, decoded.data());
+          for (const Packet &packet : decoded) {
+            uint64_t t = packet.t_arrival.microseconds();
+            if (t >= begin && t < end) {
+              out.push_back(packet);
+              ++count;
+            }
+          }
+        }
+        return count;
+      }
+
+      // Verifies the checksum of block i.
+      bool verifyBlock(uint64_t i) const {
+        const uint8_t *header = data + blocks[i].offset;
+        uint32_t size = archive::load32(header + 8);
+        return archive::load32(header + 12)
+               == crc32(0, header + archive::BLOCK_HEADER_SIZE, size);
+      }
+
+    private:
+      PacketArchiveReader(const PacketArchiveReader&);
+      PacketArchiveReader& operator=(const PacketArchiveReader&);
+
+      bool readIndex() {
+        using namespace archive;
+        if (file_size < HEADER_SIZE + FOOTER_SIZE) {
+          return false;
+        }
+        const uint8_t *footer = data + file_size - FOOTER_SIZE;
+        if (std::memcmp(footer + 24, INDEX_MAGIC, 8) != 0) {
+          return false;
+        }
+        uint64_t index_offset = load64(footer);
+        uint64_t num_blocks = load64(footer + 8);
+        if (index_offset < HEADER_SIZE
+            || index_offset + num_blocks * INDEX_ENTRY_SIZE
+               != file_size - FOOTER_SIZE) {
+          return false;
+        }
+        blocks.resize(num_blocks);
+        const uint8_t *entry = data + index_offset;
+        for (uint64_t i = 0; i < num_blocks; ++i, entry += INDEX_ENTRY_SIZE) {
+          Block &b = blocks[i];
+          b.offset = load64(entry);
+          b.num_packets = load32(entry + 8);
+          b.size = load32(entry + 12);
+          b.t_min = Time(load64(entry + 16));
+          b.t_max = Time(load64(entry + 24));
+          if (b.offset + b.size > index_offset) {
+            FATAL("PacketArchiveReader:: corrupt index: " + filename);
+          }
+        }
+        return true;
+      }
+
+      // Walks the blocks from the start of the file, up to the first one
+      // that is incomplete or damaged.
+      void recoverIndex() {
+        using namespace archive;
+        blocks.clear();
+        recovered = true;
+        uint64_t offset = HEADER_SIZE;
+        while (offset + BLOCK_HEADER_SIZE <= file_size) {
+          const uint8_t *header = data + offset;
+          if (load32(header) != BLOCK_MAGIC) {
+            break;
+          }
+          Block b;
+          b.offset = offset;
+          b.num_packets = load32(header + 4);
+          b.size = BLOCK_HEADER_SIZE + load32(header + 8);
+          b.t_min = Time(load64(header + 16));
+          b.t_max = Time(load64(header + 24));
+          if (offset + b.size > file_size) {
+            break;
+          }
+          blocks.push_back(b);
+          if (!verifyBlock(blocks.size() - 1)) {
+            blocks.pop_back();
+            break;
+          }
+          offset += b.size;
+        }
+      }
+
+    private:
+      std::string filename;
+      const uint8_t *data;
+      uint64_t file_size;
+      uint64_t num_packets;
+      bool recovered;
+      std::vector<Block> blocks;
+      std::vector<uint64_t> t_max_before;   // max t_max of blocks [0, i]
+  };
+
+} // namespace pnet
+
+#endif // PNET_ARCHIVE_HPP_
@@ -0,0 +1,415 @@
+#ifndef PNET_CARDINALITY_HPP_
+#define PNET_CARDINALITY_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <pnet_hash.hpp>
+#include <pnet_packet.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  namespace hll {
+
+    // 2^-r for every register value r.
+    struct InversePowers {
+      InversePowers() {
+        for (int r = 0; r < 65; ++r) {
+          values[r] = std::ldexp(1.0, -r);
+        }
+      }
+      double values[65];
+    };
+
+    inline const double* inversePowers() {
+      static const InversePowers powers;
+      return powers.values;
+    }
+
+    // Raw estimate from the harmonic sum of the registers and the number
+    // of zero registers, with the small range correction.
+    inline double estimate(uint64_t m, double sum, uint64_t zeros) {
+      double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709
+                     : 0.7213 / (1 + 1.079 / m);
+      double e = alpha * m * m / sum;
+      if (e <= 2.5 * m && zeros > 0) {
+        e = m * std::log((double) m / zeros);
+      }
+      return e;
+    }
+
+    // Register index and rank of a hashed element.
+    inline void position(uint64_t hash, uint32_t precision, uint64_t &index,
+                         uint8_t &rank) {
+      index = hash >> (64 - precision);
+      uint64_t rest = (hash << precision) | (1ULL << (precision - 1));
+      rank = __builtin_clzll(rest) + 1;
+    }
+
+    // dst[i] = max(dst[i], src[i]). A plain byte loop, vectorized by the
+    // compiler (one max instruction per 16 or 32 registers).
+    inline void mergeRegisters(uint8_t *__restrict__ dst,
+                               const uint8_t *__restrict__ src, uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i) {
+        dst[i] = dst[i] > src[i] ? dst[i] : src[i];
+      }
+    }
+
+  } // namespace hll
+
+
+  // Distinct count of a stream of hashed elements in 2^precision one-byte
+  // registers, with a standard error of 1.04 / sqrt(2^precision).
+  // Sketches of the same precision merge into the sketch of the union of
+  // their streams.
+  class HyperLogLog {
+
+    public:
+      explicit HyperLogLog(uint32_t precision_ = 12)
+          : precision(precision_), registers(1ULL << precision_, 0) {
+        ASSERT_TRUE(precision >= 4 && precision <= 18,
+                    "HyperLogLog:: precision out of range");
+      }
+
+      HyperLogLog(uint32_t precision_, const uint8_t *registers_)
+          : precision(precision_),
+            registers(registers_, registers_ + (1ULL << precision_)) {}
+
+      // Hash is a 64-bit hash of the element, e.g. hash::mix64().
+      void add(uint64_t hash) {
+        uint64_t index;
+        uint8_t rank;
+        hll::position(hash, precision, index, rank);
+        registers[index] = std::max(registers[index], rank);
+      }
+
+      void merge(const HyperLogLog &other) {
+        ASSERT_TRUE(precision == other.precision,
+                    "HyperLogLog:: cannot merge different precisions");
+        hll::mergeRegisters(registers.data(), other.registers.data(),
+                            registers.size());
+      }
+
+      double estimate() const {
+        const double *powers = hll::inversePowers();
+        double sum = 0;
+        uint64_t zeros = 0;
+        for (uint8_t r : registers) {
+          sum += powers[r];
+          zeros += r == 0;
+        }
+        return hll::estimate(registers.size(), sum, zeros);
+      }
+
+      void clear() {
+        std::fill(registers.begin(), registers.end(), 0);
+      }
+
+      uint32_t getPrecision() const {
+        return precision;
+      }
+
+      const std::vector<uint8_t>& getRegisters() const {
+        return registers;
+      }
+
+    private:
+      uint32_t precision;
+      std::vector<uint8_t> registers;
+  };
+
+
+  // Configuration of a CardinalityEstimator.
+  struct CardinalityConfig {
+    CardinalityConfig()
+        : precision(8), memory_budget(16 << 20), window(60000000),
+          max_reports(60), top_n(20), eviction_probes(8), seed(0) {}
+
+    uint32_t precision;         // of the sketch of each key
+    uint64_t memory_budget;     // bytes, sets the number of keys tracked
+    uint64_t window;            // microseconds, zero for a single window
+    uint32_t max_reports;       // of past windows kept
+    uint32_t top_n;             // keys reported per window
+    uint32_t eviction_probes;   // slots sampled to find one to reuse
+    uint64_t seed;              // of the element hash
+  };
+
+  // A key of a CardinalityEstimator and its distinct count. Port and
+  // protocol are only set for DESTINATION_PORT keys, the port in host byte
+  // order.
+  struct CardinalityEntry {
+    struct in_addr ip;
+    uint16_t port;
+    uint32_t protocol;
+    double estimate;
+    double error;   // the estimate may be too high by this much
+  };
+
+  // Distinct counts of a window, largest first.
+  struct CardinalityReport {
+    Time t_start;
+    uint64_t num_packets;
+    std::vector<CardinalityEntry> top;
+  };
+
+
+  // Distinct counts per key in fixed memory, for scan and DDoS detection:
+  //    - SOURCE: distinct destinations of each source (fan-out),
+  //    - DESTINATION: distinct sources of each destination (fan-in),
+  //    - DESTINATION_PORT: distinct sources of each destination, port and
+  //      protocol.
+  // Packets are fed as they are captured, e.g. next to FlowTable::insert().
+  //
+  // Each tracked key has a HyperLogLog sketch in a single register array,
+  // sized by the memory budget. The harmonic sum of each sketch is kept up
+  // to date as registers change, so that estimates cost O(1). When all
+  // slots are taken, a new key takes over the slot with the smallest
+  // estimate among a few sampled ones, together with its registers, as in
+  // Space-Saving: the estimates of the keys with a large fan-out stay upper
+  // bounds, and the estimate inherited is reported as the error.
+  //
+  // Counts are per window of packet time. At the end of a window, its
+  // top-N keys are kept as a CardinalityReport and all slots are cleared.
+  class CardinalityEstimator {
+
+    public:
+      enum Mode { SOURCE, DESTINATION, DESTINATION_PORT };
+
+    public:
+      explicit CardinalityEstimator(Mode mode_,
+          const CardinalityConfig &config_ = CardinalityConfig())
+          : mode(mode_), config(config_), num_used(0), started(false),
+            t_window(0), num_packets(0), num_evictions(0),
+            random(config_.seed + 1) {
+        ASSERT_TRUE(config.precision >= 4 && config.precision <= 18,
+                    "CardinalityEstimator:: precision out of range");
+        num_registers = 1ULL << config.precision;
+        num_slots = std::max<uint64_t>(1, config.memory_budget
+                                          / (num_registers + slotOverhead()));
+        registers.assign(num_slots * num_registers, 0);
+        slots.resize(num_slots);
+        index.reserve(num_slots);
+        clearSlots();
+      }
+
+      void insert(const Packet &packet) {
+        uint64_t t = packet.t_arrival.microseconds();
+        if (config.window) {
+          if (!started) {
+            t_window = t - t % config.window;
+          } else if (t >= t_window + config.window) {
+            closeWindow();
+            t_window = t - t % config.window;
+          }
+        }
+        started = true;
+        ++num_packets;
+        uint64_t key = keyOf(packet);
+        uint64_t element = mode == SOURCE ? packet.ip_dst.s_addr
+                                          : packet.ip_src.s_addr;
+        uint64_t s = slotOf(key);
+        Slot &slot = slots[s];
+        uint64_t i;
+        uint8_t rank;
+        hll::position(hash::mix64(element ^ config.seed), config.precision,
+                      i, rank);
+        uint8_t &r = registers[s * num_registers + i];
+        if (rank > r) {
+          const double *powers = hll::inversePowers();
+          slot.sum += powers[rank] - powers[r];
+          slot.zeros -= r == 0;
+          r = rank;
+        }
+      }
+
+      // Distinct count of the key of the packet in the current window, see
+      // Mode. Zero if the key is not tracked.
+      double estimate(const Key &key) const {
+        std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+            index.find(keyOf(key));
+        return it == index.end() ? 0 : estimate(slots[it->second]);
+      }
+
+      // Sketch of the key of the packet in the current window, to be
+      // merged over windows or with other estimators of the same precision.
+      HyperLogLog sketch(const Key &key) const {
+        std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+            index.find(keyOf(key));
+        if (it == index.end()) {
+          return HyperLogLog(config.precision);
+        }
+        return HyperLogLog(config.precision,
+                           &registers[it->second * num_registers]);
+      }
+
+      // Keys of the current window with the largest estimates.
+      std::vector<CardinalityEntry> top(uint32_t n) const {
+        std::vector<CardinalityEntry> entries;
+        entries.reserve(num_used);
+        for (uint64_t i = 0; i < num_used; ++i) {
+          entries.push_back(entry(slots[i]));
+        }
+        n = std::min<uint64_t>(n, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                          [](const CardinalityEntry &a,
+                             const CardinalityEntry &b) {
+                            return a.estimate > b.estimate;
+                          });
+        entries.resize(n);
+        return entries;
+      }
+
+      // Reports of the past windows, oldest first, at most max_reports.
+      const std::deque<CardinalityReport>& windows() const {
+        return reports;
+      }
+
+      // Ends the current window, e.g. when capture stops.
+      void closeWindow() {
+        CardinalityReport report;
+        report.t_start = Time(t_window);
+        report.num_packets = num_packets;
+        report.top = top(config.top_n);
+        reports.push_back(report);
+        while (reports.size() > config.max_reports) {
+          reports.pop_front();
+        }
+        clearSlots();
+        num_packets = 0;
+      }
+
+      // Keys tracked at most.
+      uint64_t capacity() const {
+        return num_slots;
+      }
+
+      uint64_t numKeys() const {
+        return num_used;
+      }
+
+      uint64_t numEvictions() const {
+        return num_evictions;
+      }
+
+      // Bytes of registers and slots.
+      uint64_t memoryUsage() const {
+        return num_slots * (num_registers + slotOverhead());
+      }
+
+    private:
+      struct Slot {
+        uint64_t key;
+        double sum;         // of 2^-register
+        uint32_t zeros;     // registers
+        double inherited;   // estimate when the key took the slot
+      };
+
+      // Slot and index entry of a key.
+      static uint64_t slotOverhead() {
+        return sizeof(Slot) + 32;
+      }
+
+      uint64_t keyOf(const Key &key) const {
+        switch (mode) {
+          case SOURCE:
+            return key.ip_src.s_addr;
+          case DESTINATION:
+            return key.ip_dst.s_addr;
+          default:
+            return (uint64_t) key.ip_dst.s_addr
+                   | ((uint64_t) ntohs(key.port_dst) << 32)
+                   | ((uint64_t) (key.protocol & 0xffff) << 48);
+        }
+      }
+
+      double estimate(const Slot &slot) const {
+        return hll::estimate(num_registers, slot.sum, slot.zeros);
+      }
+
+      CardinalityEntry entry(const Slot &slot) const {
+        CardinalityEntry e;
+        e.ip.s_addr = (uint32_t) slot.key;
+        e.port = mode == DESTINATION_PORT ? (slot.key >> 32) & 0xffff : 0;
+        e.protocol = mode == DESTINATION_PORT ? slot.key >> 48 : 0;
+        e.estimate = estimate(slot);
+        e.error = slot.inherited;
+        return e;
+      }
+
+      // Slot of the key: its own, a free one or the smallest of a sample.
+      uint64_t slotOf(uint64_t key) {
+        std::unordered_map<uint64_t, uint32_t>::iterator it = index.find(key);
+        if (it != index.end()) {
+          return it->second;
+        }
+        uint64_t i;
+        if (num_used < num_slots) {
+          i = num_used++;
+          slots[i].inherited = 0;
+        } else {
+          i = nextRandom() % num_slots;
+          double smallest = estimate(slots[i]);
+          for (uint32_t k = 1; k < config.eviction_probes; ++k) {
+            uint64_t j = nextRandom() % num_slots;
+            double e = estimate(slots[j]);
+            if (e < smallest) {
+              i = j;
+              smallest = e;
+            }
+          }
+          index.erase(slots[i].key);
+          slots[i].inherited = smallest;
+          ++num_evictions;
+        }
+        slots[i].key = key;
+        index[key] = i;
+        return i;
+      }
+
+      void clearSlots() {
+        std::fill(registers.begin(), registers.end(), 0);
+        for (Slot &slot : slots) {
+          slot.key = 0;
+          slot.sum = num_registers;
+          slot.zeros = num_registers;
+          slot.inherited = 0;
+        }
+        index.clear();
+        num_used = 0;
+      }
+
+      uint64_t nextRandom() {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return random;
+      }
+
+    private:
+      CardinalityEstimator(const CardinalityEstimator&);
+      CardinalityEstimator& operator=(const CardinalityEstimator&);
+
+    private:
+      Mode mode;
+      CardinalityConfig config;
+      uint64_t num_registers;   // per key
+      uint64_t num_slots;
+      uint64_t num_used;
+      std::vector<uint8_t> registers;
+      std::vector<Slot> slots;
+      std::unordered_map<uint64_t, uint32_t> index;   // key to slot
+      bool started;             // by the first packet
+      uint64_t t_window;        // start of the current window
+      uint64_t num_packets;     // of the current window
+      uint64_t num_evictions;
+      uint64_t random;
+      std::deque<CardinalityReport> reports;
+  };
+
+} // namespace pnet
+
+#endif // PNET_CARDINALITY_HPP_
@@ -0,0 +1,328 @@
+#ifndef PNET_CATALOG_HPP_
+#define PNET_CATALOG_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <pnet_time.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Index of the record files of a recording directory, kept by the
+  // recorders as they close their files.
+  //
+  // Two append-only files per kind of record ("packets", "flows"):
+  //   - <kind>.catalog: a header and one fixed-size Entry per record file,
+  //     in the order the files were written,
+  //   - <kind>.marks: Marks, the position of the first record of a file at
+  //     or after each multiple of the mark interval.
+  // Lookups binary search the mapped catalog, so locating a time range in
+  // a month of recordings only touches a few pages.
+  //
+  // Records are expected in (nearly) increasing time order, as produced by
+  // the recorders. Disorder within a file is measured when the file is
+  // recorded (Entry::lag) and taken into account by lookups.
+  namespace catalog {
+
+    const char MAGIC[] = "PNETCAT";
+    const uint32_t VERSION = 1;
+    const uint64_t HEADER_SIZE = 64;
+    const uint64_t NAME_SIZE = 56;
+    const uint64_t DEFAULT_INTERVAL = 1000000;   // microseconds
+
+    // One record file. Times are in microseconds.
+    struct Entry {
+      uint64_t t_first;      // earliest record
+      uint64_t t_last;       // latest record
+      uint64_t t_base;       // first mark is at t_base + interval
+      uint64_t lag;          // records are at most lag older than a
+                             // record written before them
+      uint64_t num_records;
+      uint64_t num_bytes;    // uncompressed
+      uint64_t first_mark;   // index in the marks file
+      uint64_t num_marks;
+      uint64_t interval;
+      char name[NAME_SIZE];  // file name in the directory
+    };
+
+    // Records [0, record) of a file, which take offset bytes (uncompressed),
+    // are all older than the time of the mark.
+    struct Mark {
+      Mark() : record(0), offset(0) {}
+      Mark(uint64_t record_, uint64_t offset_)
+          : record(record_), offset(offset_) {}
+      uint64_t record;
+      uint64_t offset;
+    };
+
+    inline std::string catalogFile(const std::string &dir,
+                                   const std::string &kind) {
+      return utils::pathJoin(dir, kind + ".catalog");
+    }
+
+    inline std::string marksFile(const std::string &dir,
+                                 const std::string &kind) {
+      return utils::pathJoin(dir, kind + ".marks");
+    }
+
+  } // namespace catalog
+
+
+  // Builds the catalog entry of the file being recorded, and appends it to
+  // the catalog of the directory once the file is closed.
+  class CatalogWriter {
+
+    public:
+      CatalogWriter(const std::string &dir_, const std::string &kind_,
+                    uint64_t interval_ = catalog::DEFAULT_INTERVAL)
+          : dir(dir_), kind(kind_), interval(interval_), is_open(false),
+            next_mark(0), t_max(0) {
+        if (interval == 0) {
+          FATAL("CatalogWriter:: zero mark interval");
+        }
+      }
+
+      ~CatalogWriter() {
+        close();
+      }
+
+      // Starts the entry of a new record file of the directory.
+      void open(const std::string &filename) {
+        close();
+        if (filename.size() >= catalog::NAME_SIZE) {
+          FATAL("CatalogWriter:: file name too long: " + filename);
+        }
+        std::memset(&entry, 0, sizeof(entry));
+        std::strcpy(entry.name, filename.c_str());
+        entry.interval = interval;
+        marks.clear();
+        is_open = true;
+      }
+
+      // Accounts for the next record of the file, of the given time and
+      // size in bytes.
+      void add(Time t, uint64_t size) {
+        const uint64_t us = t.microseconds();
+        if (entry.num_records == 0) {
+          entry.t_first = entry.t_last = t_max = us;
+          entry.t_base = us / interval * interval;
+          next_mark = entry.t_base + interval;
+        }
+        while (us >= next_mark) {
+          marks.push_back(catalog::Mark(entry.num_records, entry.num_bytes));
+          next_mark += interval;
+        }
+        entry.t_first = std::min(entry.t_first, us);
+        entry.t_last = std::max(entry.t_last, us);
+        entry.lag = std::max(entry.lag, t_max - std::min(t_max, us));
+        t_max = std::max(t_max, us);
+        ++entry.num_records;
+        entry.num_bytes += size;
+      }
+
+      // Appends the entry of the current file, if any, to the catalog.
+      void close() {
+        if (!is_open) {
+          return;
+        }
+        is_open = false;
+        if (entry.num_records == 0) {
+          return;
+        }
+        std::string marks_file = catalog::marksFile(dir, kind);
+        std::FILE *file = std::fopen(marks_file.c_str(), "ab");
+        if (!file) {
+          FATAL("CatalogWriter:: cannot open file : " + marks_file);
+        }
+        std::fseek(file, 0, SEEK_END);
+        entry.first_mark = std::ftell(file) / sizeof(catalog::Mark);
+        entry.num_marks = marks.size();
+        write(file, marks.data(), marks.size() * sizeof(catalog::Mark),
+              marks_file);
+        std::fclose(file);
+
+        std::string catalog_file = catalog::catalogFile(dir, kind);
+        file = std::fopen(catalog_file.c_str(), "ab");
+        if (!file) {
+          FATAL("CatalogWriter:: cannot open file : " + catalog_file);
+        }
+        std::fseek(file, 0, SEEK_END);
+        if (std::ftell(file) == 0) {
+          char header[catalog::HEADER_SIZE] = {0};
+          std::memcpy(header, catalog::MAGIC, sizeof(catalog::MAGIC));
+          std::memcpy(header + 8, &catalog::VERSION, 4);
+          write(file, header, sizeof(header), catalog_file);
+        }
+        write(file, &entry, sizeof(entry), catalog_file);
+        std::fclose(file);
+      }
+
+    private:
+      CatalogWriter(const CatalogWriter&);
+      CatalogWriter& operator=(const CatalogWriter&);
+
+      static void write(std::FILE *file, const void *data, uint64_t n,
+                        const std::string &filename) {
+        if (std::fwrite(data, 1, n, file) != n) {
+          FATAL("CatalogWriter:: write failed : " + filename);
+        }
+      }
+
+    private:
+      std::string dir;
+      std::string kind;
+      uint64_t interval;
+      bool is_open;
+      catalog::Entry entry;
+      std::vector<catalog::Mark> marks;
+      uint64_t next_mark;    // time of the next mark
+      uint64_t t_max;        // latest record so far
+  };
+
+
+  // Read-only view of the catalog of a recording directory, as of its
+  // construction. An empty catalog if the directory has none.
+  class Catalog {
+
+    public:
+      Catalog(const std::string &dir_, const std::string &kind)
+          : dir(dir_), entries(nullptr), num_entries(0), marks(nullptr),
+            num_marks(0) {
+        const uint8_t *data = map(catalog::catalogFile(dir, kind),
+                                  catalog_map);
+        if (catalog_map.second >= catalog::HEADER_SIZE) {
+          if (std::memcmp(data, catalog::MAGIC, sizeof(catalog::MAGIC))) {
+            FATAL("Catalog:: not a catalog: "
+                  + catalog::catalogFile(dir, kind));
+          }
+          entries = reinterpret_cast<const catalog::Entry*>(
+              data + catalog::HEADER_SIZE);
+          num_entries = (catalog_map.second - catalog::HEADER_SIZE)
+                        / sizeof(catalog::Entry);
+        }
+        marks = reinterpret_cast<const catalog::Mark*>(
+            map(catalog::marksFile(dir, kind), marks_map));
+        num_marks = marks_map.second / sizeof(catalog::Mark);
+      }
+
+      ~Catalog() {
+        unmap(catalog_map);
+        unmap(marks_map);
+      }
+
+      uint64_t size() const {
+        return num_entries;
+      }
+
+      const catalog::Entry& entry(uint64_t i) const {
+        return entries[i];
+      }
+
+      std::string path(uint64_t i) const {
+        return utils::pathJoin(dir, entries[i].name);
+      }
+
+      // Entries that hold records with t_begin <= t < t_end, in the order
+      // they were written.
+      std::vector<uint64_t> find(Time t_begin, Time t_end) const {
+        const uint64_t begin = t_begin.microseconds();
+        const uint64_t end = t_end.microseconds();
+        // Latest records only grow from file to file, up to disorder.
+        uint64_t i = std::partition_point(entries, entries + num_entries,
+            [begin](const catalog::Entry &e) { return e.t_last < begin; })
+            - entries;
+        while (i > 0 && entries[i - 1].t_last >= begin) {
+          --i;
+        }
+        std::vector<uint64_t> result;
+        for (; i < num_entries && entries[i].t_first < end; ++i) {
+          if (entries[i].t_last >= begin) {
+            result.push_back(i);
+          }
+        }
+        return result;
+      }
+
+      // Position in file i before which all records are older than t.
+      catalog::Mark seek(uint64_t i, Time t) const {
+        const catalog::Entry &e = entries[i];
+        const uint64_t us = t.microseconds();
+        catalog::Mark start;
+        uint64_t num = e.first_mark < num_marks
+                       ? std::min(e.num_marks, num_marks - e.first_mark) : 0;
+        if (us >= e.t_base + e.interval && num > 0) {
+          // Mark k is at t_base + (k + 1) * interval.
+          uint64_t k = (us - e.t_base) / e.interval - 1;
+          start = marks[e.first_mark + std::min(k, num - 1)];
+        }
+        return start;
+      }
+
+      // Position in file i after which all records are at t or later.
+      catalog::Mark seekEnd(uint64_t i, Time t) const {
+        const catalog::Entry &e = entries[i];
+        // Records written after a mark are at most lag older than it.
+        const uint64_t us = t.microseconds() + e.lag;
+        if (us <= e.t_base) {
+          return catalog::Mark();
+        }
+        uint64_t k = (us - e.t_base + e.interval - 1) / e.interval - 1;
+        if (k < e.num_marks && e.first_mark + k < num_marks) {
+          return marks[e.first_mark + k];
+        }
+        return catalog::Mark(e.num_records, e.num_bytes);
+      }
+
+    private:
+      typedef std::pair<void*, uint64_t> Mapping;
+
+      Catalog(const Catalog&);
+      Catalog& operator=(const Catalog&);
+
+      static const uint8_t* map(const std::string &filename,
+                                Mapping &mapping) {
+        mapping = Mapping(nullptr, 0);
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+          return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          void *memory = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                              fd, 0);
+          if (memory != MAP_FAILED) {
+            mapping = Mapping(memory, st.st_size);
+          }
+        }
+        ::close(fd);
+        return static_cast<const uint8_t*>(mapping.first);
+      }
+
+      static void unmap(const Mapping &mapping) {
+        if (mapping.first) {
+          munmap(mapping.first, mapping.second);
+        }
+      }
+
+    private:
+      std::string dir;
+      const catalog::Entry *entries;
+      uint64_t num_entries;
+      const catalog::Mark *marks;
+      uint64_t num_marks;
+      Mapping catalog_map;
+      Mapping marks_map;
+  };
+
+} // namespace pnet
+
+#endif // PNET_CATALOG_HPP_
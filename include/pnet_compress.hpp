@@ -0,0 +1,515 @@
+#ifndef PNET_COMPRESS_HPP_
+#define PNET_COMPRESS_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Gzip member layout shared by GzipWriter and GzipReader: a header with
+  // a single extra subfield 'P','N' holding the size of the whole member,
+  // raw deflate data, and the CRC32 and input size trailer.
+  namespace gzip {
+
+    const uint32_t HEADER_SIZE = 20;
+    const uint32_t TRAILER_SIZE = 8;
+
+    inline void store32(uint8_t *p, uint32_t x) {
+      p[0] = x & 0xff;
+      p[1] = (x >> 8) & 0xff;
+      p[2] = (x >> 16) & 0xff;
+      p[3] = x >> 24;
+    }
+
+    inline uint32_t load32(const uint8_t *p) {
+      return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    inline uint32_t defaultThreads() {
+      uint32_t n = std::thread::hardware_concurrency();
+      return std::max(1u, std::min(n, 8u));
+    }
+
+  } // namespace gzip
+
+
+  // Writes gzip files, compressing blocks on worker threads.
+  //
+  // Input is cut into BLOCK_SIZE blocks and each block becomes an
+  // independent gzip member, as with pigz, so the output is read by
+  // gunzip, zcat or zlib alike. Every member also records its compressed
+  // size in a header extra field, which lets GzipReader find all members
+  // without inflating and decompress them in parallel.
+  class GzipWriter {
+
+    public:
+      static const uint64_t BLOCK_SIZE = 1 << 20;
+
+    public:
+      // With num_threads = 0 blocks are compressed by the caller.
+      GzipWriter(const std::string &filename_,
+                 uint32_t num_threads = gzip::defaultThreads(),
+                 int level_ = Z_DEFAULT_COMPRESSION)
+          : filename(filename_), level(level_), current(nullptr),
+            stopping(false), bytes_in(0), bytes_out(0) {
+        file = std::fopen(filename.c_str(), "wb");
+        if (!file) {
+          FATAL("GzipWriter:: cannot open file : " + filename);
+        }
+        max_pending = 2 * num_threads + 1;
+        for (uint32_t i = 0; i < num_threads; ++i) {
+          workers.push_back(std::thread(&GzipWriter::work, this));
+        }
+      }
+
+      ~GzipWriter() {
+        close();
+      }
+
+      void write(const void *data, uint64_t n) {
+        const char *p = static_cast<const char*>(data);
+        while (n > 0) {
+          if (!current) {
+            current = new Block();
+            current->input.reserve(BLOCK_SIZE);
+          }
+          uint64_t m = std::min(n, BLOCK_SIZE - current->input.size());
+          current->input.append(p, m);
+          p += m;
+          n -= m;
+          if (current->input.size() == BLOCK_SIZE) {
+            submit();
+          }
+        }
+      }
+
+      // Compresses what is left and closes the file.
+      void close() {
+        if (!file) {
+          return;
+        }
+        // An empty file still gets a member, gunzip rejects empty input.
+        if (current || bytes_in == 0) {
+          if (!current) {
+            current = new Block();
+          }
+          submit();
+        }
+        writeBlocks(true);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        work_ready.notify_all();
+        for (std::thread &worker : workers) {
+          worker.join();
+        }
+        workers.clear();
+        std::fclose(file);
+        file = nullptr;
+      }
+
+      uint64_t bytesIn() const {
+        return bytes_in;
+      }
+
+      uint64_t bytesOut() const {
+        return bytes_out;
+      }
+
+    private:
+      struct Block {
+        Block() : done(false) {}
+        std::string input;
+        std::vector<uint8_t> output;
+        bool done;
+      };
+
+      GzipWriter(const GzipWriter&);
+      GzipWriter& operator=(const GzipWriter&);
+
+      void submit() {
+        Block *block = current;
+        current = nullptr;
+        bytes_in += block->input.size();
+        if (workers.empty()) {
+          compress(block, level);
+          flush(block);
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          queue.push_back(block);
+          pending.push_back(block);
+        }
+        work_ready.notify_one();
+        writeBlocks(false);
+      }
+
+      // Writes compressed blocks in order. Waits for all blocks if
+      // all is set, otherwise only while too many are pending.
+      void writeBlocks(bool all) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!pending.empty()) {
+          Block *block = pending.front();
+          if (!block->done) {
+            if (!all && pending.size() < max_pending) {
+              return;
+            }
+            block_done.wait(lock);
+            continue;
+          }
+          pending.pop_front();
+          lock.unlock();
+          flush(block);
+          lock.lock();
+        }
+      }
+
+      void flush(Block *block) {
+        if (std::fwrite(block->output.data(), 1, block->output.size(), file)
+            != block->output.size()) {
+          FATAL("GzipWriter:: cannot write file : " + filename);
+        }
+        bytes_out += block->output.size();
+        delete block;
+      }
+
+      void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+          work_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+          if (queue.empty()) {
+            return;
+          }
+          Block *block = queue.front();
+          queue.pop_front();
+          lock.unlock();
+          compress(block, level);
+          lock.lock();
+          block->done = true;
+          block_done.notify_all();
+        }
+      }
+
+      static void compress(Block *block, int level) {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+          FATAL("GzipWriter:: deflateInit2 failed");
+        }
+        const std::string &input = block->input;
+        std::vector<uint8_t> &output = block->output;
+        output.resize(gzip::HEADER_SIZE + deflateBound(&zs, input.size())
+                      + gzip::TRAILER_SIZE);
+        zs.next_in = (Bytef*) input.data();
+        zs.avail_in = input.size();
+        zs.next_out = output.data() + gzip::HEADER_SIZE;
+        zs.avail_out = output.size() - gzip::HEADER_SIZE;
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+          FATAL("GzipWriter:: deflate failed");
+        }
+        uint32_t size = gzip::HEADER_SIZE + zs.total_out + gzip::TRAILER_SIZE;
+        deflateEnd(&zs);
+
+        uint8_t *header = output.data();
+        const uint8_t fixed[16] = {
+          0x1f, 0x8b, 8, 0x04,   // magic, deflate, FEXTRA
+          0, 0, 0, 0, 0, 3,      // no mtime, no xfl, unix
+          8, 0,                  // extra length
+          'P', 'N', 4, 0         // subfield id and length
+        };
+        std::memcpy(header, fixed, sizeof(fixed));
+        gzip::store32(header + 16, size);
+        uint8_t *trailer = output.data() + size - gzip::TRAILER_SIZE;
+        uLong crc = crc32(0L, (const Bytef*) input.data(), input.size());
+        gzip::store32(trailer, crc);
+        gzip::store32(trailer + 4, input.size());
+        output.resize(size);
+      }
+
+    private:
+      std::string filename;
+      std::FILE *file;
+      int level;
+      Block *current;                // block being filled
+      uint64_t max_pending;
+
+      std::mutex mutex;
+      std::condition_variable work_ready;
+      std::condition_variable block_done;
+      std::deque<Block*> queue;      // blocks to compress
+      std::deque<Block*> pending;    // blocks to write, in order
+      std::vector<std::thread> workers;
+      bool stopping;
+
+      uint64_t bytes_in;
+      uint64_t bytes_out;
+  };
+
+
+  // Reads gzip files, including files of several members (pigz, cat).
+  //
+  // The file is memory-mapped. read() inflates it as a stream. Files
+  // written by GzipWriter are indexed: their uncompressed size is known
+  // up front and readAll() inflates their members on several threads.
+  class GzipReader {
+
+    public:
+      explicit GzipReader(const std::string &filename_)
+          : filename(filename_), data(nullptr), size(0), position(0),
+            in_stream(false), total_size(0) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+          FATAL("GzipReader:: cannot open file : " + filename);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          size = st.st_size;
+          void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (memory == MAP_FAILED) {
+            ::close(fd);
+            FATAL("GzipReader:: cannot map file : " + filename);
+          }
+          madvise(memory, size, MADV_SEQUENTIAL);
+          data = static_cast<const uint8_t*>(memory);
+        }
+        ::close(fd);
+        std::memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+          FATAL("GzipReader:: inflateInit2 failed");
+        }
+        buildIndex();
+      }
+
+      ~GzipReader() {
+        inflateEnd(&zs);
+        if (data) {
+          munmap(const_cast<uint8_t*>(data), size);
+        }
+      }
+
+      // Inflates up to n bytes into buffer. Returns 0 at the end.
+      uint64_t read(void *buffer, uint64_t n) {
+        uint8_t *out = static_cast<uint8_t*>(buffer);
+        uint64_t total = 0;
+        while (total < n) {
+          if (!in_stream) {
+            if (position >= size) {
+              break;
+            }
+            inflateReset(&zs);
+            in_stream = true;
+          }
+          const uint64_t MAX_CHUNK = 1 << 30;
+          uint64_t in = std::min(size - position, MAX_CHUNK);
+          uint64_t avail = std::min(n - total, MAX_CHUNK);
+          zs.next_in = (Bytef*) data + position;
+          zs.avail_in = in;
+          zs.next_out = out + total;
+          zs.avail_out = avail;
+          int ret = inflate(&zs, Z_NO_FLUSH);
+          position += in - zs.avail_in;
+          total += avail - zs.avail_out;
+          if (ret == Z_STREAM_END) {
+            in_stream = false;       // another member may follow
+          } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            FATAL("GzipReader:: corrupt file : " + filename);
+          } else if (ret == Z_BUF_ERROR && position >= size) {
+            FATAL("GzipReader:: truncated file : " + filename);
+          }
+        }
+        return total;
+      }
+
+      // True if the members are known, see readAll().
+      bool indexed() const {
+        return !members.empty();
+      }
+
+      // Uncompressed size of an indexed file.
+      uint64_t uncompressedSize() const {
+        return total_size;
+      }
+
+      // Inflates a whole indexed file into dst, which holds
+      // uncompressedSize() bytes.
+      void readAll(void *dst, uint32_t num_threads = gzip::defaultThreads()) {
+        ASSERT_TRUE(indexed(), "GzipReader:: file is not indexed");
+        uint8_t *out = static_cast<uint8_t*>(dst);
+        std::atomic<uint64_t> next(0);
+        auto inflateMembers = [this, out, &next]() {
+          uint64_t i;
+          while ((i = next.fetch_add(1)) < members.size()) {
+            inflateMember(members[i], out + members[i].out_offset);
+          }
+        };
+        num_threads = std::max(1u, std::min<uint32_t>(num_threads,
+                                                      members.size()));
+        std::vector<std::thread> threads;
+        for (uint32_t t = 1; t < num_threads; ++t) {
+          threads.push_back(std::thread(inflateMembers));
+        }
+        inflateMembers();
+        for (std::thread &thread : threads) {
+          thread.join();
+        }
+      }
+
+    private:
+      struct Member {
+        uint64_t offset;       // in the file
+        uint32_t size;         // compressed, with header and trailer
+        uint32_t out_size;
+        uint64_t out_offset;   // in the uncompressed data
+      };
+
+      GzipReader(const GzipReader&);
+      GzipReader& operator=(const GzipReader&);
+
+      // Walks the member headers. Any member without our size field, e.g.
+      // from gzip or pigz, leaves the file unindexed.
+      void buildIndex() {
+        static const uint8_t fixed[4] = {0x1f, 0x8b, 8, 0x04};
+        uint64_t offset = 0, out_offset = 0;
+        while (offset < size) {
+          const uint8_t *p = data + offset;
+          if (size - offset < gzip::HEADER_SIZE + gzip::TRAILER_SIZE
+              || std::memcmp(p, fixed, 4) != 0
+              || p[10] != 8 || p[11] != 0 || p[12] != 'P' || p[13] != 'N') {
+            members.clear();
+            return;
+          }
+          Member member;
+          member.offset = offset;
+          member.size = gzip::load32(p + 16);
+          if (member.size < gzip::HEADER_SIZE + gzip::TRAILER_SIZE
+              || member.size > size - offset) {
+            members.clear();
+            return;
+          }
+          member.out_size = gzip::load32(p + member.size - 4);
+          member.out_offset = out_offset;
+          members.push_back(member);
+          offset += member.size;
+          out_offset += member.out_size;
+        }
+        total_size = out_offset;
+      }
+
+      void inflateMember(const Member &member, uint8_t *out) const {
+        const uint8_t *p = data + member.offset;
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -15) != Z_OK) {
+          FATAL("GzipReader:: inflateInit2 failed");
+        }
+        stream.next_in = (Bytef*) p + gzip::HEADER_SIZE;
+        stream.avail_in = member.size - gzip::HEADER_SIZE
+                          - gzip::TRAILER_SIZE;
+        stream.next_out = out;
+        stream.avail_out = member.out_size;
+        int ret = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        uint32_t crc = gzip::load32(p + member.size - gzip::TRAILER_SIZE);
+        if (ret != Z_STREAM_END || stream.total_out != member.out_size
+            || crc32(0L, out, member.out_size) != crc) {
+          FATAL("GzipReader:: corrupt file : " + filename);
+        }
+      }
+
+    private:
+      std::string filename;
+      const uint8_t *data;
+      uint64_t size;
+
+      // read() state
+      z_stream zs;
+      uint64_t position;
+      bool in_stream;
+
+      std::vector<Member> members;
+      uint64_t total_size;
+  };
+
+  // Inflates a whole gzip file, or only its first max_size bytes, into
+  // anonymous memory, on several threads if written by GzipWriter and
+  // inflated whole. Returns the memory, nullptr for an empty file, and its
+  // size; it is given back with munmap(memory, size).
+  inline void* inflateFile(const std::string &filename, uint64_t &size,
+                           uint64_t max_size = UINT64_MAX) {
+    GzipReader gz(filename);
+    size = 0;
+    if (max_size == 0) {
+      return nullptr;
+    }
+    auto allocate = [&filename](uint64_t n) {
+      void *memory = mmap(nullptr, n, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED) {
+        FATAL("inflateFile:: out of memory: " + filename);
+      }
+      return memory;
+    };
+    if (gz.indexed() && gz.uncompressedSize() <= max_size) {
+      if (gz.uncompressedSize() == 0) {
+        return nullptr;
+      }
+      size = gz.uncompressedSize();
+      void *memory = allocate(size);
+      gz.readAll(memory);
+      return memory;
+    }
+    // Other gzip files, and prefixes, are inflated as a stream into a
+    // growing mapping, which stops at max_size.
+    uint64_t capacity = std::min<uint64_t>(1 << 26, max_size);
+    uint8_t *memory = static_cast<uint8_t*>(allocate(capacity));
+    uint64_t n;
+    while (size < max_size
+           && (n = gz.read(memory + size, capacity - size)) > 0) {
+      size += n;
+      if (size == capacity && size < max_size) {
+        uint64_t grown_capacity = std::min(2 * capacity, max_size);
+        void *grown = mremap(memory, capacity, grown_capacity,
+                             MREMAP_MAYMOVE);
+        if (grown == MAP_FAILED) {
+          FATAL("inflateFile:: out of memory: " + filename);
+        }
+        memory = static_cast<uint8_t*>(grown);
+        capacity = grown_capacity;
+      }
+    }
+    if (size == 0) {
+      munmap(memory, capacity);
+      return nullptr;
+    }
+    // Give back the unused tail.
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t used = (size + page - 1) / page * page;
+    if (used < capacity) {
+      munmap(memory + used, capacity - used);
+    }
+    return memory;
+  }
+
+} // namespace pnet
+
+#endif // PNET_COMPRESS_HPP_
@@ -0,0 +1,366 @@
+#ifndef PNET_DECODER_HPP_
+#define PNET_DECODER_HPP_
+
+#include <cstdint>
+#include <cstring>
+
+#include <pnet_flow.hpp>
+#include <pnet_hash.hpp>
+
+namespace pnet {
+
+  // Link-layer header types (see pcap-linktype(7)).
+  enum LinkType {
+    LINKTYPE_NULL      = 0,     // BSD loopback
+    LINKTYPE_ETHERNET  = 1,
+    LINKTYPE_RAW       = 101,   // raw IPv4/IPv6
+    LINKTYPE_LINUX_SLL = 113,   // Linux "cooked" capture
+  };
+
+  // Why a frame could not be decoded.
+  enum DecodeError {
+    DECODE_OK = 0,
+    DECODE_TRUNCATED,           // frame ends inside a header
+    DECODE_BAD_LINKTYPE,        // unknown link-layer type
+    DECODE_BAD_ETHERTYPE,       // not IP (ARP, LLDP, ...)
+    DECODE_BAD_IP_HEADER,       // wrong version, header or total length
+    DECODE_BAD_IPV6_EXTENSION,  // too many IPv6 extension headers
+    DECODE_BAD_TUNNEL,          // unsupported GRE version or flags
+    DECODE_TOO_DEEP,            // too many nested encapsulations
+    NUM_DECODE_ERRORS
+  };
+
+  // A captured link-layer frame. Data is not owned.
+  struct Frame {
+    const uint8_t *data;
+    uint32_t caplen;     // captured bytes
+    uint32_t wirelen;    // original length on the wire
+    uint32_t linktype;
+    Time timestamp;
+  };
+
+  // Decodes captured frames into Packets.
+  //
+  // Fills the 5-tuple (addresses and ports in network byte order, as in
+  // the rest of the library), TCP flags, IP datagram length as size and
+  // the capture timestamp. Understands VLAN and QinQ tags, MPLS label
+  // stacks, IPv4, IPv6 with extension headers, and GRE, ERSPAN and VXLAN
+  // tunnels, which are decoded down to the innermost IP packet.
+  //
+  // IPv6 addresses do not fit into a Key: each one is folded into a 32-bit
+  // value with a hash, so flows keep apart while both directions of a flow
+  // still get the same Key.
+  //
+  // Frames that cannot be decoded are skipped and counted by DecodeError.
+  class FrameDecoder {
+
+    public:
+      static const uint32_t MAX_ENCAPSULATIONS = 4;
+      static const uint32_t MAX_IPV6_EXTENSIONS = 8;
+      static const uint16_t VXLAN_PORT = 4789;
+
+    public:
+      FrameDecoder() : num_decoded(0), num_failed(0), decap_tunnels(true) {
+        std::memset(num_errors, 0, sizeof(num_errors));
+      }
+
+      // Returns false if the frame cannot be decoded.
+      bool decode(const Frame &frame, Packet &pkt) {
+        const uint8_t *p = frame.data;
+        const uint8_t *end = frame.data + frame.caplen;
+        pkt.t_arrival = frame.timestamp;
+        if (frame.linktype == LINKTYPE_ETHERNET && decodeFast(p, end, pkt)) {
+          ++num_decoded;
+          return true;
+        }
+        DecodeError error;
+        switch (frame.linktype) {
+          case LINKTYPE_ETHERNET:
+            error = decodeEthernet(p, end, pkt, 0);
+            break;
+          case LINKTYPE_LINUX_SLL:
+            if (end - p < 16) {
+              error = DECODE_TRUNCATED;
+            } else {
+              error = decodeEthertype(load16(p + 14), p + 16, end, pkt, 0);
+            }
+            break;
+          case LINKTYPE_NULL:
+            error = end - p < 4 ? DECODE_TRUNCATED
+                                : decodeIP(p + 4, end, pkt, 0);
+            break;
+          case LINKTYPE_RAW:
+            error = decodeIP(p, end, pkt, 0);
+            break;
+          default:
+            error = DECODE_BAD_LINKTYPE;
+        }
+        if (error != DECODE_OK) {
+          ++num_errors[error];
+          ++num_failed;
+          return false;
+        }
+        ++num_decoded;
+        return true;
+      }
+
+      // Decodes n frames into pkts, skipping undecodable frames.
+      // Returns the number of packets written.
+      uint64_t decode(const Frame *frames, uint64_t n, Packet *pkts) {
+        const uint64_t PREFETCH = 4;
+        uint64_t num_packets = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+          if (i + PREFETCH < n) {
+            __builtin_prefetch(frames[i + PREFETCH].data);
+          }
+          num_packets += decode(frames[i], pkts[num_packets]);
+        }
+        return num_packets;
+      }
+
+      static const char* errorName(DecodeError error) {
+        static const char *names[NUM_DECODE_ERRORS] = {
+          "ok", "truncated", "bad link type", "bad ethertype",
+          "bad IP header", "bad IPv6 extension", "bad tunnel", "too deep"
+        };
+        return error < NUM_DECODE_ERRORS ? names[error] : "unknown";
+      }
+
+      // Failure counts, e.g. "truncated=2, bad ethertype=10".
+      std::string errorsToString() const {
+        std::string str;
+        for (int i = 1; i < NUM_DECODE_ERRORS; ++i) {
+          if (num_errors[i]) {
+            if (!str.empty()) str += ", ";
+            str += std::string(errorName((DecodeError) i)) + "="
+                   + std::to_string(num_errors[i]);
+          }
+        }
+        return str;
+      }
+
+    public:
+      uint64_t num_decoded;
+      uint64_t num_failed;
+      uint64_t num_errors[NUM_DECODE_ERRORS];
+      bool decap_tunnels;   // decode tunnel payloads instead of the outer IP
+
+    private:
+      static uint16_t load16(const uint8_t *p) {
+        return (uint16_t) ((p[0] << 8) | p[1]);
+      }
+
+      // Untagged Ethernet, IPv4 without options, TCP or UDP, not a tunnel.
+      // Covers most traffic with few branches, everything else takes the
+      // general path.
+      bool decodeFast(const uint8_t *p, const uint8_t *end, Packet &pkt) {
+        if (end - p < 14 + 20 + 14 || load16(p + 12) != 0x0800
+            || p[14] != 0x45 || (load16(p + 20) & 0x1fff) != 0) {
+          return false;
+        }
+        const uint8_t *ip = p + 14;
+        uint8_t protocol = ip[9];
+        uint16_t port_dst;
+        std::memcpy(&port_dst, ip + 22, 2);
+        bool tcp = protocol == IPPROTO_TCP;
+        bool udp = protocol == IPPROTO_UDP && port_dst != htons(VXLAN_PORT);
+        uint16_t size = load16(ip + 2);
+        if (!(tcp | udp) || size < 20) {
+          return false;
+        }
+        pkt.size = size;
+        pkt.protocol = protocol;
+        std::memcpy(&pkt.ip_src, ip + 12, 4);
+        std::memcpy(&pkt.ip_dst, ip + 16, 4);
+        std::memcpy(&pkt.port_src, ip + 20, 2);
+        pkt.port_dst = port_dst;
+        pkt.flags = tcp ? ip[33] : 0;
+        return true;
+      }
+
+      DecodeError decodeEthernet(const uint8_t *p, const uint8_t *end,
+                                 Packet &pkt, uint32_t depth) {
+        if (end - p < 14) return DECODE_TRUNCATED;
+        return decodeEthertype(load16(p + 12), p + 14, end, pkt, depth);
+      }
+
+      DecodeError decodeEthertype(uint16_t ethertype, const uint8_t *p,
+                                  const uint8_t *end, Packet &pkt,
+                                  uint32_t depth) {
+        // 802.1Q, 802.1ad and the old QinQ tag, any number of them.
+        while (ethertype == 0x8100 || ethertype == 0x88a8
+               || ethertype == 0x9100) {
+          if (end - p < 4) return DECODE_TRUNCATED;
+          ethertype = load16(p + 2);
+          p += 4;
+        }
+        switch (ethertype) {
+          case 0x0800:
+            return decodeIPv4(p, end, pkt, depth);
+          case 0x86dd:
+            return decodeIPv6(p, end, pkt, depth);
+          case 0x8847:
+          case 0x8848:
+            return decodeMPLS(p, end, pkt, depth);
+          default:
+            return DECODE_BAD_ETHERTYPE;
+        }
+      }
+
+      // MPLS does not name its payload: the IP version nibble does.
+      DecodeError decodeMPLS(const uint8_t *p, const uint8_t *end,
+                             Packet &pkt, uint32_t depth) {
+        bool bottom = false;
+        while (!bottom) {
+          if (end - p < 4) return DECODE_TRUNCATED;
+          bottom = p[2] & 0x01;
+          p += 4;
+        }
+        return decodeIP(p, end, pkt, depth);
+      }
+
+      DecodeError decodeIP(const uint8_t *p, const uint8_t *end, Packet &pkt,
+                           uint32_t depth) {
+        if (end - p < 1) return DECODE_TRUNCATED;
+        switch (p[0] >> 4) {
+          case 4:
+            return decodeIPv4(p, end, pkt, depth);
+          case 6:
+            return decodeIPv6(p, end, pkt, depth);
+          default:
+            return DECODE_BAD_ETHERTYPE;
+        }
+      }
+
+      DecodeError decodeIPv4(const uint8_t *p, const uint8_t *end,
+                             Packet &pkt, uint32_t depth) {
+        if (end - p < 20) return DECODE_TRUNCATED;
+        uint32_t header_len = (p[0] & 0x0f) * 4;
+        uint16_t total_len = load16(p + 2);
+        if ((p[0] >> 4) != 4 || header_len < 20 || total_len < header_len) {
+          return DECODE_BAD_IP_HEADER;
+        }
+        if (end - p < header_len) return DECODE_TRUNCATED;
+        pkt.size = total_len;
+        std::memcpy(&pkt.ip_src, p + 12, 4);
+        std::memcpy(&pkt.ip_dst, p + 16, 4);
+        // Ports are only present in the first fragment.
+        bool first_fragment = (load16(p + 6) & 0x1fff) == 0;
+        return decodeTransport(p[9], p + header_len, end, pkt,
+                               first_fragment, depth);
+      }
+
+      DecodeError decodeIPv6(const uint8_t *p, const uint8_t *end,
+                             Packet &pkt, uint32_t depth) {
+        if (end - p < 40) return DECODE_TRUNCATED;
+        if ((p[0] >> 4) != 6) return DECODE_BAD_IP_HEADER;
+        uint32_t size = 40 + load16(p + 4);
+        pkt.size = size > 0xffff ? 0xffff : size;
+        pkt.ip_src = foldIPv6(p + 8);
+        pkt.ip_dst = foldIPv6(p + 24);
+        uint8_t next = p[6];
+        p += 40;
+        bool first_fragment = true;
+        for (uint32_t i = 0; ; ++i) {
+          uint32_t length;
+          switch (next) {
+            case 0:     // hop-by-hop options
+            case 43:    // routing
+            case 60:    // destination options
+              if (end - p < 8) return DECODE_TRUNCATED;
+              length = (p[1] + 1) * 8;
+              break;
+            case 44:    // fragment
+              if (end - p < 8) return DECODE_TRUNCATED;
+              first_fragment = (load16(p + 2) & 0xfff8) == 0;
+              length = 8;
+              break;
+            case 51:    // authentication header
+              if (end - p < 8) return DECODE_TRUNCATED;
+              length = (p[1] + 2) * 4;
+              break;
+            default:
+              return decodeTransport(next, p, end, pkt, first_fragment,
+                                     depth);
+          }
+          if (i == MAX_IPV6_EXTENSIONS) return DECODE_BAD_IPV6_EXTENSION;
+          if (end - p < length) return DECODE_TRUNCATED;
+          next = p[0];
+          p += length;
+        }
+      }
+
+      DecodeError decodeTransport(uint8_t protocol, const uint8_t *p,
+                                  const uint8_t *end, Packet &pkt,
+                                  bool first_fragment, uint32_t depth) {
+        pkt.protocol = protocol;
+        pkt.port_src = pkt.port_dst = 0;
+        pkt.flags = 0;
+        if (!first_fragment) {
+          return DECODE_OK;
+        }
+        switch (protocol) {
+          case IPPROTO_TCP:
+            if (end - p < 4) return DECODE_TRUNCATED;
+            std::memcpy(&pkt.port_src, p, 2);
+            std::memcpy(&pkt.port_dst, p + 2, 2);
+            if (end - p >= 14) {
+              pkt.flags = p[13];
+            }
+            return DECODE_OK;
+          case IPPROTO_UDP:
+            if (end - p < 4) return DECODE_TRUNCATED;
+            std::memcpy(&pkt.port_src, p, 2);
+            std::memcpy(&pkt.port_dst, p + 2, 2);
+            // VXLAN carries Ethernet after its 8 byte header.
+            if (decap_tunnels && pkt.port_dst == htons(VXLAN_PORT)
+                && end - p >= 16 && (p[8] & 0x08)) {
+              if (depth == MAX_ENCAPSULATIONS) return DECODE_TOO_DEEP;
+              return decodeEthernet(p + 16, end, pkt, depth + 1);
+            }
+            return DECODE_OK;
+          case IPPROTO_GRE:
+            return decap_tunnels ? decodeGRE(p, end, pkt, depth) : DECODE_OK;
+          default:
+            return DECODE_OK;
+        }
+      }
+
+      DecodeError decodeGRE(const uint8_t *p, const uint8_t *end, Packet &pkt,
+                            uint32_t depth) {
+        if (end - p < 4) return DECODE_TRUNCATED;
+        uint16_t flags = load16(p);
+        uint16_t type = load16(p + 2);
+        // Version 0 only, without the obsolete routing field.
+        if ((flags & 0x4007) != 0) return DECODE_BAD_TUNNEL;
+        uint32_t length = 4 + ((flags & 0x8000) ? 4 : 0)    // checksum
+                            + ((flags & 0x2000) ? 4 : 0)    // key
+                            + ((flags & 0x1000) ? 4 : 0);   // sequence
+        if (end - p < length) return DECODE_TRUNCATED;
+        p += length;
+        if (depth == MAX_ENCAPSULATIONS) return DECODE_TOO_DEEP;
+        switch (type) {
+          case 0x6558:    // transparent Ethernet bridging
+            return decodeEthernet(p, end, pkt, depth + 1);
+          case 0x88be:    // ERSPAN type II
+            if (end - p < 8) return DECODE_TRUNCATED;
+            return decodeEthernet(p + 8, end, pkt, depth + 1);
+          default:
+            return decodeEthertype(type, p, end, pkt, depth + 1);
+        }
+      }
+
+      static struct in_addr foldIPv6(const uint8_t *address) {
+        uint64_t high, low;
+        std::memcpy(&high, address, 8);
+        std::memcpy(&low, address + 8, 8);
+        uint64_t h = hash::combine(hash::mix64(high), low);
+        struct in_addr folded;
+        folded.s_addr = (uint32_t) (h ^ (h >> 32));
+        return folded;
+      }
+  };
+
+} // namespace pnet
+
+#endif // PNET_DECODER_HPP_
@@ -0,0 +1,268 @@
+#ifndef PNET_DISTRIBUTION_HPP_
+#define PNET_DISTRIBUTION_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <thread>
+#include <vector>
+
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Bins of a histogram of non-negative integers.
+  //    - LINEAR: bin i holds [first + i * width, first + (i + 1) * width),
+  //    - LOG2:   bin i holds [first * 2^i, first * 2^(i + 1)).
+  // Values below the first bin are counted in bin 0 and values beyond the
+  // last bin in the last one.
+  struct Binning {
+
+    enum Scale { LINEAR, LOG2 };
+
+    Binning(uint64_t num_bins_ = 50, Scale scale_ = LINEAR,
+            uint64_t first_ = 1, uint64_t width_ = 1)
+        : num_bins(num_bins_), scale(scale_), first(first_), width(width_) {
+      ASSERT_TRUE(num_bins > 0 && width > 0 && (scale == LINEAR || first > 0),
+                  "Binning:: empty bins");
+    }
+
+    uint64_t bin(uint64_t value) const {
+      if (value < first) {
+        return 0;
+      }
+      uint64_t i;
+      if (scale == LINEAR) {
+        i = width == 1 ? value - first : (value - first) / width;
+      } else {
+        i = 63 - __builtin_clzll(value / first);
+      }
+      return std::min(i, num_bins - 1);
+    }
+
+    // Smallest value of bin i.
+    uint64_t lowerBound(uint64_t i) const {
+      if (scale == LINEAR) {
+        return first + i * width;
+      }
+      return i < 64 ? first << i : ~0ULL;
+    }
+
+    uint64_t num_bins;
+    Scale scale;
+    uint64_t first;
+    uint64_t width;
+  };
+
+  // Binning of the distributions of a FlowDistributions. The default
+  // packet bins are those of the former FSD: flows of 1 to 49 packets,
+  // then 50 or more.
+  struct FlowBinning {
+    FlowBinning()
+        : packets(50), bytes(40, Binning::LOG2), duration(40, Binning::LOG2) {}
+
+    Binning packets;
+    Binning bytes;
+    Binning duration;   // microseconds from the first to the last packet
+  };
+
+  // Distributions of the flows of one protocol (or all), see
+  // FlowDistributions::snapshot().
+  struct FlowDistributionSnapshot {
+    FlowDistributionSnapshot() : num_flows(0) {}
+
+    uint64_t num_flows;
+    std::vector<uint64_t> packets;
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> duration;
+  };
+
+
+  // Size, byte and duration distributions of the live flows of a table,
+  // overall and per protocol, kept up to date as flows are created, grow
+  // and expire. Reads cost O(bins) instead of a walk over all flows.
+  //
+  // A single thread updates the distributions. Snapshots can be taken
+  // from any thread: updates are wrapped in a sequence lock, so that a
+  // snapshot never sees half of an update and all its distributions are
+  // of the same moment.
+  class FlowDistributions {
+
+    public:
+      static const uint32_t NUM_PROTOCOLS = 256;
+
+    public:
+      explicit FlowDistributions(const FlowBinning &binning_ = FlowBinning())
+          : binning(binning_), sequence(0) {
+        bins_per_table = 1 + binning.packets.num_bins + binning.bytes.num_bins
+                         + binning.duration.num_bins;
+        overall = newTable();
+        for (uint32_t i = 0; i < NUM_PROTOCOLS; ++i) {
+          protocols[i].store(nullptr, std::memory_order_relaxed);
+        }
+      }
+
+      ~FlowDistributions() {
+        delete[] overall;
+        for (uint32_t i = 0; i < NUM_PROTOCOLS; ++i) {
+          delete[] protocols[i].load(std::memory_order_relaxed);
+        }
+      }
+
+      const FlowBinning& getBinning() const {
+        return binning;
+      }
+
+      // A new flow.
+      void add(uint32_t protocol, uint64_t packets, uint64_t bytes,
+               uint64_t duration) {
+        beginWrite();
+        for (Counter *table : {overall, protocolTable(protocol)}) {
+          increment(table[0], 1);
+          increment(table[packetBin(packets)], 1);
+          increment(table[byteBin(bytes)], 1);
+          increment(table[durationBin(duration)], 1);
+        }
+        endWrite();
+      }
+
+      // A flow grew from old to new values.
+      void update(uint32_t protocol, uint64_t old_packets, uint64_t old_bytes,
+                  uint64_t old_duration, uint64_t packets, uint64_t bytes,
+                  uint64_t duration) {
+        uint64_t bins[3][2] = {
+          {packetBin(old_packets), packetBin(packets)},
+          {byteBin(old_bytes), byteBin(bytes)},
+          {durationBin(old_duration), durationBin(duration)}};
+        if (bins[0][0] == bins[0][1] && bins[1][0] == bins[1][1]
+            && bins[2][0] == bins[2][1]) {
+          return;
+        }
+        beginWrite();
+        for (Counter *table : {overall, protocolTable(protocol)}) {
+          for (auto &bin : bins) {
+            if (bin[0] != bin[1]) {
+              increment(table[bin[0]], -1);
+              increment(table[bin[1]], 1);
+            }
+          }
+        }
+        endWrite();
+      }
+
+      // An expired flow.
+      void remove(uint32_t protocol, uint64_t packets, uint64_t bytes,
+                  uint64_t duration) {
+        beginWrite();
+        for (Counter *table : {overall, protocolTable(protocol)}) {
+          increment(table[0], -1);
+          increment(table[packetBin(packets)], -1);
+          increment(table[byteBin(bytes)], -1);
+          increment(table[durationBin(duration)], -1);
+        }
+        endWrite();
+      }
+
+      // Distributions of the flows of a protocol, of all flows if
+      // protocol is zero.
+      FlowDistributionSnapshot snapshot(uint32_t protocol = 0) const {
+        std::vector<uint64_t> values(bins_per_table, 0);
+        while (true) {
+          uint64_t before = sequence.load(std::memory_order_acquire);
+          if (before & 1) {
+            std::this_thread::yield();
+            continue;
+          }
+          const Counter *table = protocol == 0 ? overall
+              : protocols[protocol % NUM_PROTOCOLS].load(
+                    std::memory_order_acquire);
+          if (table) {
+            for (uint64_t i = 0; i < bins_per_table; ++i) {
+              values[i] = table[i].load(std::memory_order_relaxed);
+            }
+          }
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (sequence.load(std::memory_order_relaxed) == before) {
+            break;
+          }
+        }
+        FlowDistributionSnapshot result;
+        result.num_flows = values[0];
+        std::vector<uint64_t>::const_iterator p = values.begin() + 1;
+        result.packets.assign(p, p + binning.packets.num_bins);
+        p += binning.packets.num_bins;
+        result.bytes.assign(p, p + binning.bytes.num_bins);
+        p += binning.bytes.num_bins;
+        result.duration.assign(p, p + binning.duration.num_bins);
+        return result;
+      }
+
+    private:
+      // Written by a single thread, read by any.
+      typedef std::atomic<uint64_t> Counter;
+
+      FlowDistributions(const FlowDistributions&);
+      FlowDistributions& operator=(const FlowDistributions&);
+
+      // Counters of a protocol: number of flows, then the bins of the
+      // packet, byte and duration distributions.
+      Counter* newTable() const {
+        Counter *table = new Counter[bins_per_table];
+        for (uint64_t i = 0; i < bins_per_table; ++i) {
+          table[i].store(0, std::memory_order_relaxed);
+        }
+        return table;
+      }
+
+      Counter* protocolTable(uint32_t protocol) {
+        std::atomic<Counter*> &slot = protocols[protocol % NUM_PROTOCOLS];
+        Counter *table = slot.load(std::memory_order_relaxed);
+        if (!table) {
+          table = newTable();
+          slot.store(table, std::memory_order_release);
+        }
+        return table;
+      }
+
+      uint64_t packetBin(uint64_t packets) const {
+        return 1 + binning.packets.bin(packets);
+      }
+
+      uint64_t byteBin(uint64_t bytes) const {
+        return 1 + binning.packets.num_bins + binning.bytes.bin(bytes);
+      }
+
+      uint64_t durationBin(uint64_t duration) const {
+        return 1 + binning.packets.num_bins + binning.bytes.num_bins
+               + binning.duration.bin(duration);
+      }
+
+      // Not a read-modify-write: there is a single writer.
+      static void increment(Counter &counter, int64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta,
+                      std::memory_order_relaxed);
+      }
+
+      void beginWrite() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+      }
+
+      void endWrite() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+      }
+
+    private:
+      FlowBinning binning;
+      uint64_t bins_per_table;
+      Counter *overall;
+      std::atomic<Counter*> protocols[NUM_PROTOCOLS];
+      std::atomic<uint64_t> sequence;   // odd during updates
+  };
+
+} // namespace pnet
+
+#endif // PNET_DISTRIBUTION_HPP_
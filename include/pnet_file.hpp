@@ -0,0 +1,154 @@
+#ifndef PNET_FILE_HPP_
+#define PNET_FILE_HPP_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Append-only file written with large sequential writes.
+  //
+  // Data is staged in an aligned buffer and written BUFFER_SIZE bytes at a
+  // time. With direct I/O the file is opened with O_DIRECT and bypasses
+  // the page cache: the tail is padded to ALIGNMENT and the file truncated
+  // to its real size on close. File systems without O_DIRECT (tmpfs) get
+  // buffered writes. A preallocated size is reserved with fallocate on
+  // open, so that the file is laid out contiguously; what is not used is
+  // given back on close.
+  class SequentialFile {
+
+    public:
+      static const uint64_t ALIGNMENT = 4096;
+      static const uint64_t BUFFER_SIZE = 1 << 22;
+
+    public:
+      SequentialFile()
+          : fd(-1), buffer(nullptr), used(0), size(0), direct(false) {}
+
+      ~SequentialFile() {
+        close();
+        std::free(buffer);
+      }
+
+      // Returns false if the file cannot be created.
+      bool open(const std::string &filename_, bool direct_io = false,
+                uint64_t preallocate = 0) {
+        close();
+        filename = filename_;
+        const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        direct = false;
+#ifdef O_DIRECT
+        if (direct_io) {
+          fd = ::open(filename.c_str(), flags | O_DIRECT, 0644);
+          direct = fd != -1;
+        }
+#endif
+        if (fd == -1) {
+          fd = ::open(filename.c_str(), flags, 0644);
+        }
+        if (fd == -1) {
+          return false;
+        }
+        if (preallocate > 0) {
+          // Best effort, not every file system supports it.
+          fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, preallocate);
+        }
+        if (!buffer && posix_memalign(&buffer, ALIGNMENT, BUFFER_SIZE) != 0) {
+          FATAL("SequentialFile:: out of memory");
+        }
+        used = 0;
+        size = 0;
+        return true;
+      }
+
+      void write(const void *data, uint64_t n) {
+        const char *p = static_cast<const char*>(data);
+        while (n > 0) {
+          uint64_t m = std::min(n, BUFFER_SIZE - used);
+          std::memcpy(static_cast<char*>(buffer) + used, p, m);
+          used += m;
+          p += m;
+          n -= m;
+          if (used == BUFFER_SIZE) {
+            flush(BUFFER_SIZE);
+          }
+        }
+      }
+
+      // Writes what is left and closes the file.
+      void close() {
+        if (fd == -1) {
+          return;
+        }
+        uint64_t file_size = size + used;
+        if (used > 0) {
+          uint64_t length = used;
+          if (direct) {
+            length = (used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            std::memset(static_cast<char*>(buffer) + used, 0, length - used);
+          }
+          flush(length);
+        }
+        // Drops the padding and the unused preallocated space.
+        if (ftruncate(fd, file_size) != 0) {
+          FATAL("SequentialFile:: cannot truncate file : " + filename);
+        }
+        ::close(fd);
+        fd = -1;
+      }
+
+      bool isOpen() const {
+        return fd != -1;
+      }
+
+      bool isDirect() const {
+        return direct;
+      }
+
+      // Bytes written so far.
+      uint64_t bytes() const {
+        return size + used;
+      }
+
+    private:
+      SequentialFile(const SequentialFile&);
+      SequentialFile& operator=(const SequentialFile&);
+
+      void flush(uint64_t length) {
+        const char *p = static_cast<const char*>(buffer);
+        uint64_t done = 0;
+        while (done < length) {
+          ssize_t n = ::write(fd, p + done, length - done);
+          if (n < 0 && errno == EINTR) {
+            continue;
+          }
+          if (n <= 0) {
+            FATAL("SequentialFile:: write failed : " + filename + ": "
+                  + std::strerror(errno));
+          }
+          done += n;
+        }
+        size += std::min(used, length);
+        used = 0;
+      }
+
+    private:
+      int fd;
+      std::string filename;
+      void *buffer;         // ALIGNMENT aligned, BUFFER_SIZE bytes
+      uint64_t used;        // bytes in buffer
+      uint64_t size;        // bytes written to the file
+      bool direct;
+  };
+
+} // namespace pnet
+
+#endif // PNET_FILE_HPP_
@@ -3,260 +3,704 @@
 
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <inttypes.h>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <unordered_map>
 #include <sstream>
-
+#include <thread>
+
+#include <pnet_allocator.hpp>
+#include <pnet_archive.hpp>
+#include <pnet_catalog.hpp>
+#include <pnet_compress.hpp>
+#include <pnet_distribution.hpp>
+#include <pnet_file.hpp>
+#include <pnet_flow_history.hpp>
+#include <pnet_metrics.hpp>
+#include <pnet_flow_index.hpp>
+#include <pnet_flow_record.hpp>
+#include <pnet_hash.hpp>
+#include <pnet_packet.hpp>
 #include <pnet_time.hpp>
+#include <pnet_timer_wheel.hpp>
 #include <pnet_utils.hpp>
 
 
 namespace pnet {
 
-  // 5-tuple describing the communication link.
-  //   - Source and Destination IP's
-  //   - Source and Destination Ports
-  //   - Level-3 protocol : UDP, TCP, etc..
-  class Key{
-
-    public:
-      Key(){}
-
-      Key(struct in_addr ip1, struct in_addr ip2,
-          uint16_t port1, uint16_t port2, uint32_t proto)
-          : ip_src(ip1), ip_dst(ip2),
-            port_src(port1), port_dst(port2), protocol(proto) {}
-
-      Key(const Key& key): ip_src(key.ip_src), ip_dst(key.ip_dst),
-                           port_src(key.port_src), port_dst(key.port_dst),
-                           protocol(key.protocol) {}
-
-      // Equality of two keys regardless of direction.
-      // If the source and destination directions are reversed,
-      // it's still the same key.
-      bool operator==(const Key& k) const {
-        if (protocol != k.protocol) {
-          return false;
-        }
-        if ((port_src == k.port_src) && (port_dst == k.port_dst)
-            && (ip_src.s_addr == k.ip_src.s_addr)
-            && (ip_dst.s_addr == k.ip_dst.s_addr)) {
-          return true;
-        }
-        if ((port_src == k.port_dst) && (port_dst == k.port_src)
-            && (ip_src.s_addr == k.ip_dst.s_addr)
-            && (ip_dst.s_addr == k.ip_src.s_addr)) {
-          return true;
-        }
-        return false;
-      }
-
-
-    public:
-      struct in_addr  ip_src;     // 4 bytes
-      struct in_addr  ip_dst;     // 4 bytes
-      uint16_t        port_src;   // 2 bytes
-      uint16_t        port_dst;   // 2 bytes
-      uint32_t        protocol;   // 4 byte
-      // 16 bytes in total.
-  };
-
-  // IP packet is a Key together with size, arrival time and TCP flag info.
-  class Packet : public Key{
-
-    public:
-      Packet(){}
-
-      Packet(const Key &key): Key(key), flags(0), size(0), t_arrival(0){}
-
-      // Binary stream input.
-      friend std::istream& operator>>(std::istream &in, Packet &packet) {
-        in.read(reinterpret_cast<char *>(&packet), sizeof(Packet));
-        return in;
-      }
-
-      // Binary stream output.
-      // Use "std::cout << packet.to_string();" for printing.
-      friend std::ostream& operator<<(std::ostream &out, const Packet &packet) {
-        out.write(reinterpret_cast<const char *>(&packet), sizeof(Packet));
-        return out;
-      }
-
-      // Packets are compared with their arrival times
-      bool operator<(const Packet &rhs) const {
-        return t_arrival  < rhs.t_arrival;
-      }
-
-      // Pretty formats packet info into a string.
-      std::string toString() const {
-        char buffer[250];
-        std::sprintf(buffer, "%-15s\t%5d\t",
-                     inet_ntoa(ip_src), ntohs(port_src));
-        std::sprintf(buffer+strlen(buffer), "%-15s\t%5d\t",
-                     inet_ntoa(ip_dst),  ntohs(port_dst));
-        std::sprintf(buffer+strlen(buffer), "%2d\t%hu\t%4hu\t",
-                     protocol, flags, size);
-        std::sprintf(buffer+strlen(buffer), "%s",
-                     t_arrival.toString().c_str());
-        return std::string(buffer);
-      }
-
-      bool fromString(std::string source){
-
-        std::istringstream sin(source);
-        std::string tmp;
-
-        sin >> tmp >> port_src ;
-        inet_pton(AF_INET, tmp.c_str(), &ip_src);
-        port_src = htons(port_src);
-
-        sin >> tmp >> port_dst ;
-        inet_pton(AF_INET, tmp.c_str(), &ip_dst);
-        port_dst= htons(port_dst);
-
-        sin >> protocol >> flags >> size >> tmp;
-        t_arrival = Time(tmp);
-        return true;
-      }
-
-
-  public:
-      uint16_t flags;   // 2 bytes: TCP flags (zero for non-TCP packets)
-      uint16_t size;    // 2 bytes: packet size [
-      Time t_arrival;   // 8 bytes: seconds + microseconds
-      // 28 bytes in total.
-  };
-
   // Records packet information into binary files.
   // File names are created by using timestamps.
   // Each file contains at most "max_packets_per_file_" packets.
-  // Packet files end with .pkt or .pkt.gz (if gzipped) extensions.
+  // Packet files end with .pkt, .pkt.gz (if gzipped) or .pka (packet
+  // archive, see PacketArchiveWriter) extensions.
+  // Closed files are added to the "packets" catalog of the directory, see
+  // readRange().
+  // .pkt files can be written with direct I/O and preallocated, see
+  // SequentialFile. AsyncPacketRecorder moves all the writing, rotation
+  // and compression to a separate thread.
   class PacketRecorder {
 
     public:
       static const uint64_t max_records_per_file = 1000000;
 
+      enum Format { PKT, PKT_GZ, PKA };
+
     public:
       // Input:
       //    - output_dir: to store record files.
       //    - compressed: for compressed storage.
       PacketRecorder(const std::string &output_dir_,
-                     bool compressed_ = false){
+                     bool compressed_ = false)
+          : PacketRecorder(output_dir_, compressed_ ? PKT_GZ : PKT) {}
+
+      PacketRecorder(const std::string &output_dir_, Format format_)
+          : catalog(output_dir_, "packets") {
         if(!utils::directoryExists(output_dir_)){
           FATAL("Recorder:: output directory does not exits: " + output_dir );
         }
         output_dir = output_dir_;
-        compressed = compressed_;
+        format = format_;
         filename = "";
         record_counter = max_records_per_file;
+        gz_out = nullptr;
+        archive_out = nullptr;
+        direct_io = false;
+        preallocate = false;
       }
 
       ~PacketRecorder(){
         close();
       }
 
+      // .pkt files opened from now on bypass the page cache.
+      void setDirectIO(bool enable){
+        direct_io = enable;
+      }
+
+      // .pkt files opened from now on reserve space for a full file.
+      void setPreallocate(bool enable){
+        preallocate = enable;
+      }
+
       void write(const Packet &packet) {
-        // Packet limit per file reached.
-        // Save current file and open a new one.
-        if (record_counter == max_records_per_file) {
-          close();
-          filename = utils::pathJoin(output_dir,
-                                     packet.t_arrival.toDateString() + ".pkt");
-          out.open(filename, std::ios::binary);
-          if(!out.is_open()){
-            FATAL("Recorder:: cannot open file : " + filename );
+        write(&packet, 1);
+      }
+
+      void write(const Packet *packets, uint64_t n) {
+        PNET_METRIC_ADD(PACKETS_RECORDED, n);
+        while (n > 0) {
+          // Packet limit per file reached.
+          // Save current file and open a new one.
+          if (record_counter == max_records_per_file) {
+            open(packets[0].t_arrival);
+          }
+          uint64_t m = std::min(n, max_records_per_file - record_counter);
+          if(archive_out){
+            archive_out->write(packets, m);
+          } else if(gz_out){
+            gz_out->write(packets, m * sizeof(Packet));
+          } else {
+            out.write(packets, m * sizeof(Packet));
           }
-          record_counter = 0;
+          for (uint64_t i = 0; i < m; ++i) {
+            catalog.add(packets[i].t_arrival, sizeof(Packet));
+          }
+          record_counter += m;
+          packets += m;
+          n -= m;
         }
-        out << packet;
-        ++record_counter;
       }
 
-    private:
+      // Closes the current file, the next packet starts a new one.
       void close(){
-        if(out.is_open()){
-          out.close();
-          if(compressed){
-            std::string dest = filename+".gz";
-            utils::zip(filename, dest);
-            utils::rm(filename);
+        out.close();
+        delete gz_out;
+        gz_out = nullptr;
+        delete archive_out;
+        archive_out = nullptr;
+        catalog.close();
+        record_counter = max_records_per_file;
+      }
+
+    private:
+      void open(Time t_first){
+        close();
+        std::string name = t_first.toDateString();
+        name += format == PKA ? ".pka" : format == PKT_GZ ? ".pkt.gz"
+                                                          : ".pkt";
+        filename = utils::pathJoin(output_dir, name);
+        catalog.open(name);
+        if(format == PKA){
+          archive_out = new PacketArchiveWriter(filename);
+        } else if(format == PKT_GZ){
+          // Compressed on the fly, see GzipWriter.
+          gz_out = new GzipWriter(filename);
+        } else {
+          uint64_t reserved = preallocate
+                              ? max_records_per_file * sizeof(Packet) : 0;
+          if(!out.open(filename, direct_io, reserved)){
+            FATAL("Recorder:: cannot open file : " + filename );
           }
         }
+        record_counter = 0;
       }
 
     private:
       // current # packets in the current record file
       uint64_t record_counter;
 
-      bool compressed;
+      Format format;
+      bool direct_io;
+      bool preallocate;
       std::string output_dir;
       std::string filename;
-      std::ofstream out;
+      SequentialFile out;
+      GzipWriter *gz_out;
+      PacketArchiveWriter *archive_out;
+      CatalogWriter catalog;
+  };
+
+  // Buffering of an AsyncPacketRecorder.
+  struct AsyncRecorderConfig {
+    // What write() does when all buffers are waiting for the disk.
+    enum OverflowPolicy { BLOCK, DROP };
+
+    AsyncRecorderConfig()
+        : buffer_packets(1 << 20), num_buffers(2), policy(BLOCK),
+          direct_io(false), preallocate(false) {}
+
+    uint64_t buffer_packets;   // packets per buffer
+    uint32_t num_buffers;      // memory is num_buffers * buffer_packets
+                               // packets, allocated up front
+    OverflowPolicy policy;     // BLOCK waits for a buffer, DROP discards
+                               // packets (see dropped())
+    bool direct_io;            // see PacketRecorder::setDirectIO
+    bool preallocate;          // see PacketRecorder::setPreallocate
   };
 
+  // PacketRecorder running on its own thread.
+  //
+  // write() only copies the packet into the current buffer. Full buffers
+  // are handed to a writer thread, which writes them with large sequential
+  // writes and does all file rotation and compression, and then gives them
+  // back. When the disk falls behind and no buffer is free, write() either
+  // waits for one or drops packets, as configured.
+  //
+  // write() and flush() are called from a single thread.
+  class AsyncPacketRecorder {
 
-  // Reads a .pkt or .pkt.gz file into memory.
-  class PacketReader {
+    public:
+      AsyncPacketRecorder(const std::string &output_dir,
+                          PacketRecorder::Format format = PacketRecorder::PKT,
+                          const AsyncRecorderConfig &config_ =
+                              AsyncRecorderConfig())
+          : config(config_), recorder(output_dir, format), current(nullptr),
+            stopping(false), num_dropped(0), num_written(0), num_stalls(0),
+            num_backlog(0) {
+        if (config.buffer_packets == 0 || config.num_buffers == 0) {
+          FATAL("AsyncPacketRecorder:: no buffers");
+        }
+        recorder.setDirectIO(config.direct_io);
+        recorder.setPreallocate(config.preallocate);
+        for (uint32_t i = 0; i < config.num_buffers; ++i) {
+          Buffer *buffer = new Buffer();
+          buffer->packets = static_cast<Packet*>(
+              allocate(config.buffer_packets * sizeof(Packet)));
+          buffer->size = 0;
+          buffers.push_back(buffer);
+          free_buffers.push_back(buffer);
+        }
+        writer = std::thread(&AsyncPacketRecorder::run, this);
+      }
+
+      ~AsyncPacketRecorder() {
+        close();
+        for (Buffer *buffer : buffers) {
+          munmap(buffer->packets, config.buffer_packets * sizeof(Packet));
+          delete buffer;
+        }
+      }
+
+      void write(const Packet &packet) {
+        if (!current && !acquire()) {
+          ++num_dropped;
+          PNET_METRIC_ADD(RECORDER_DROPS, 1);
+          return;
+        }
+        current->packets[current->size++] = packet;
+        if (current->size == config.buffer_packets) {
+          submit();
+        }
+      }
+
+      // Hands the packets written so far to the writer thread.
+      void flush() {
+        if (current && current->size > 0) {
+          submit();
+        }
+      }
+
+      // Writes all packets and closes the current file.
+      void close() {
+        if (!writer.joinable()) {
+          return;
+        }
+        flush();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        full_ready.notify_one();
+        writer.join();
+        recorder.close();
+      }
+
+      // Packets discarded by the DROP policy.
+      uint64_t dropped() const {
+        return num_dropped;
+      }
+
+      // Packets written to files.
+      uint64_t written() const {
+        return num_written.load(std::memory_order_relaxed);
+      }
+
+      // Times write() had to wait for a buffer (BLOCK policy).
+      uint64_t stalls() const {
+        return num_stalls;
+      }
+
+    private:
+      struct Buffer {
+        Packet *packets;
+        uint64_t size;
+      };
+
+      AsyncPacketRecorder(const AsyncPacketRecorder&);
+      AsyncPacketRecorder& operator=(const AsyncPacketRecorder&);
+
+      // Buffers are mapped and touched up front, so that write() does not
+      // page fault.
+      static void* allocate(uint64_t size) {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (memory == MAP_FAILED) {
+          FATAL("AsyncPacketRecorder:: out of memory");
+        }
+        return memory;
+      }
+
+      bool acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (free_buffers.empty()) {
+          if (config.policy == AsyncRecorderConfig::DROP) {
+            return false;
+          }
+          ++num_stalls;
+          PNET_METRIC_ADD(RECORDER_STALLS, 1);
+          free_ready.wait(lock, [this] { return !free_buffers.empty(); });
+        }
+        current = free_buffers.front();
+        free_buffers.pop_front();
+        current->size = 0;
+        return true;
+      }
+
+      void submit() {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          full_buffers.push_back(current);
+          num_backlog += current->size;
+          PNET_METRIC_SET(RECORDER_BACKLOG, num_backlog);
+        }
+        current = nullptr;
+        full_ready.notify_one();
+      }
+
+      void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+          full_ready.wait(lock, [this] {
+            return stopping || !full_buffers.empty();
+          });
+          if (full_buffers.empty()) {
+            return;
+          }
+          Buffer *buffer = full_buffers.front();
+          full_buffers.pop_front();
+          lock.unlock();
+          recorder.write(buffer->packets, buffer->size);
+          num_written.fetch_add(buffer->size, std::memory_order_relaxed);
+          lock.lock();
+          num_backlog -= buffer->size;
+          PNET_METRIC_SET(RECORDER_BACKLOG, num_backlog);
+          free_buffers.push_back(buffer);
+          free_ready.notify_one();
+        }
+      }
+
+    private:
+      AsyncRecorderConfig config;
+      PacketRecorder recorder;      // used by the writer thread
+      std::vector<Buffer*> buffers;
+      Buffer *current;              // being filled by write()
+
+      std::mutex mutex;
+      std::condition_variable full_ready;
+      std::condition_variable free_ready;
+      std::deque<Buffer*> full_buffers;
+      std::deque<Buffer*> free_buffers;
+      bool stopping;
+      std::thread writer;
+
+      uint64_t num_dropped;
+      std::atomic<uint64_t> num_written;
+      uint64_t num_stalls;
+      uint64_t num_backlog;         // packets submitted, not yet written
+  };
+
+
+  // Read-only view of consecutive packet records, e.g. inside a mapped
+  // .pkt file. Nothing is copied.
+  class PacketSpan {
 
     public:
-      static const std::string temp_file;
+      typedef const Packet* const_iterator;
 
     public:
+      PacketSpan() : first(nullptr), count(0) {}
+      PacketSpan(const Packet *first_, uint64_t count_)
+          : first(first_), count(count_) {}
+
+      const_iterator begin() const { return first; }
+      const_iterator end() const { return first + count; }
+      const Packet& operator[](uint64_t i) const { return first[i]; }
+      const Packet* data() const { return first; }
+      uint64_t size() const { return count; }
+      bool empty() const { return count == 0; }
+
+      // Records [offset, offset + n), clipped to the span.
+      PacketSpan subspan(uint64_t offset, uint64_t n) const {
+        offset = std::min(offset, count);
+        return PacketSpan(first + offset, std::min(n, count - offset));
+      }
 
-      // Reads all packets from file unless max_packets is set.
-      PacketReader(const std::string &filename, int64_t max_packets = -1){
+    private:
+      const Packet *first;
+      uint64_t count;
+  };
+
+  // Reads a .pkt or .pkt.gz file.
+  //
+  // The file is memory-mapped and its records are used in place, through
+  // PacketSpans. Several threads can read disjoint ranges of one reader,
+  // see range(). Pages that have been read can be given back with
+  // release(), or automatically by streaming the file with next(): memory
+  // use then stays constant whatever the file size.
+  //
+  // Compressed files are inflated in-process into anonymous memory, on
+  // several threads if written by GzipWriter. Packet archives (.pka) are
+  // decoded into anonymous memory as well, PacketArchiveReader reads them
+  // block by block or by time range instead.
+  class PacketReader {
+
+    public:
+      // Maps all packets from file, or the first max_packets if set.
+      PacketReader(const std::string &filename, int64_t max_packets = -1)
+          : is_compressed(false), data(nullptr), map_size(0), cursor(0),
+            released(0) {
 
         // Pkt file does not exist, break;
         if( !utils::fileExists(filename) ){
           FATAL("PacketReader:: file not found: " + filename );
         }
 
-        if( !utils::stringEndsWith(filename, {"pkt", "pkt.gz"}) ){
+        if( !utils::stringEndsWith(filename, {"pkt", "pkt.gz", "pka"}) ){
           FATAL("PacketReader:: not a pkt file: "  + filename);
         }
 
-        // Pkt is compressed, uncompress in temporary location;
-        is_compressed = utils::stringEndsWith(filename, {".gz"});
-
-        // Open file:
-        std::ifstream fin;
-        std::string file_to_open = filename;
-        if(is_compressed) {
-          utils::unzip(filename, temp_file);
-          file_to_open = temp_file;
+        is_compressed = utils::stringEndsWith(filename, {".gz", ".pka"});
+        if( utils::stringEndsWith(filename, {".pka"}) ){
+          decodeArchive(filename, max_packets);
+        } else if( is_compressed ){
+          inflateFile(filename, max_packets);
+        } else {
+          mapFile(filename);
         }
-        fin.open(file_to_open, std::ios::binary);
-        if( !fin.is_open() ){
-          FATAL("PacketReader:: cannot open file: " + file_to_open);
+
+        // A truncated last record is ignored.
+        uint64_t num_packets = map_size / sizeof(Packet);
+        if( max_packets >= 0 ){
+          num_packets = std::min(num_packets, (uint64_t) max_packets);
         }
+        packets = PacketSpan(data, num_packets);
+      }
 
-        // Read all packets into memory;
-        Packet temp;
-        while(max_packets != 0){
-          fin >> temp;
-          if(fin.eof()){
-            break;
-          }
-          packets.push_back(temp);
-          max_packets--;
+      ~PacketReader(){
+        if( data ){
+          munmap(const_cast<Packet*>(data), map_size);
         }
+      }
 
-        // Remove temp file if used.
-        if( is_compressed ) {
-          utils::rm(temp_file);
+      uint64_t size() const {
+        return packets.size();
+      }
+
+      // Records [offset, offset + n), e.g. one part of the file per thread.
+      PacketSpan range(uint64_t offset, uint64_t n) const {
+        return packets.subspan(offset, n);
+      }
+
+      // Streams the file: returns the next (at most) max_packets records,
+      // an empty span at the end. Pages of earlier calls are released.
+      PacketSpan next(uint64_t max_packets) {
+        release(range(released, cursor - released));
+        // The page holding the cursor is released by a later call.
+        const uint64_t page = sysconf(_SC_PAGESIZE);
+        released = cursor * sizeof(Packet) / page * page / sizeof(Packet);
+        PacketSpan span = range(cursor, max_packets);
+        cursor += span.size();
+        return span;
+      }
+
+      // Gives the pages that lie entirely within span back to the kernel.
+      // Records of the span must not be used afterwards.
+      void release(const PacketSpan &span) const {
+        const uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(span.begin());
+        uintptr_t end = reinterpret_cast<uintptr_t>(span.end());
+        begin = (begin + page - 1) / page * page;
+        end = end / page * page;
+        if( begin < end ){
+          madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
         }
       }
 
     public:
-      std::vector<Packet> packets;
+      PacketSpan packets;
       bool is_compressed;
 
+    private:
+      PacketReader(const PacketReader&);
+      PacketReader& operator=(const PacketReader&);
+
+      void mapFile(const std::string &filename){
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if( fd == -1 ){
+          FATAL("PacketReader:: cannot open file: " + filename);
+        }
+        struct stat st;
+        if( fstat(fd, &st) == 0 && st.st_size > 0 ){
+          map_size = st.st_size;
+          void *memory = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if( memory == MAP_FAILED ){
+            ::close(fd);
+            FATAL("PacketReader:: cannot map file: " + filename);
+          }
+          madvise(memory, map_size, MADV_SEQUENTIAL);
+          data = static_cast<const Packet*>(memory);
+        }
+        ::close(fd);
+      }
+
+      // Inflates the first max_packets packets (all if negative).
+      void inflateFile(const std::string &filename, int64_t max_packets){
+        uint64_t max_size = max_packets >= 0
+                            ? max_packets * sizeof(Packet) : UINT64_MAX;
+        data = static_cast<const Packet*>(pnet::inflateFile(filename,
+                                                            map_size,
+                                                            max_size));
+      }
+
+      // Decodes the blocks holding the first max_packets packets (all if
+      // negative).
+      void decodeArchive(const std::string &filename, int64_t max_packets){
+        PacketArchiveReader archive(filename);
+        uint64_t num_packets = archive.size();
+        if( max_packets >= 0 ){
+          num_packets = std::min(num_packets, (uint64_t) max_packets);
+        }
+        uint64_t num_blocks = 0, num_decoded = 0;
+        while( num_decoded < num_packets ){
+          num_decoded += archive.block(num_blocks++).num_packets;
+        }
+        if( num_decoded == 0 ){
+          return;
+        }
+        map_size = num_decoded * sizeof(Packet);
+        Packet *packets_ = static_cast<Packet*>(allocate(map_size));
+        for( uint64_t i = 0, j = 0; i < num_blocks; ++i ){
+          j += archive.decodeBlock(i, packets_ + j);
+        }
+        data = packets_;
+      }
+
+      static void* allocate(uint64_t size){
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( memory == MAP_FAILED ){
+          FATAL("PacketReader:: out of memory");
+        }
+        return memory;
+      }
+
+    private:
+      const Packet *data;
+      uint64_t map_size;
+      uint64_t cursor;      // next record for next()
+      uint64_t released;    // records before it are released
   };
-  const std::string PacketReader::temp_file = "/tmp/temp.pkt";
 
+  // Converts between packet file formats, chosen by file extension:
+  // .pkt, .pkt.gz and .pka. Returns the number of packets converted.
+  inline uint64_t convertPacketFile(const std::string &src,
+                                    const std::string &dst){
+    PacketReader reader(src);
+    if( utils::stringEndsWith(dst, {".pka"}) ){
+      PacketArchiveWriter writer(dst);
+      writer.write(reader.packets.data(), reader.size());
+    } else if( utils::stringEndsWith(dst, {".pkt.gz"}) ){
+      GzipWriter writer(dst);
+      writer.write(reader.packets.data(), reader.size() * sizeof(Packet));
+    } else if( utils::stringEndsWith(dst, {".pkt"}) ){
+      std::ofstream out(dst, std::ios::binary);
+      if( !out.write(reinterpret_cast<const char*>(reader.packets.data()),
+                     reader.size() * sizeof(Packet)) ){
+        FATAL("convertPacketFile:: cannot write file: " + dst);
+      }
+    } else {
+      FATAL("convertPacketFile:: unknown packet file type: " + dst);
+    }
+    return reader.size();
+  }
+
+  // Appends the packets recorded in dir with t_begin <= t_arrival < t_end
+  // to out, in the order they were recorded. The catalog of the directory
+  // tells which files to open and where to start: .pkt files are mapped
+  // and only the pages of the range are read, .pka files decode only the
+  // blocks of the range and .pkt.gz files are inflated up to the end mark
+  // of the range.
+  // Returns the number of packets appended.
+  inline uint64_t readRange(const std::string &dir, Time t_begin, Time t_end,
+                            std::vector<Packet> &out){
+    Catalog catalog(dir, "packets");
+    uint64_t count = 0;
+    for( uint64_t i : catalog.find(t_begin, t_end) ){
+      std::string filename = catalog.path(i);
+      if( utils::stringEndsWith(filename, {".pka"}) ){
+        count += PacketArchiveReader(filename).readRange(t_begin, t_end, out);
+        continue;
+      }
+      uint64_t first = catalog.seek(i, t_begin).record;
+      uint64_t last = catalog.seekEnd(i, t_end).record;
+      PacketReader reader(filename, last);
+      for( const Packet &packet : reader.range(first, last - first) ){
+        if( !(packet.t_arrival < t_begin) && packet.t_arrival < t_end ){
+          out.push_back(packet);
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+
+  // Appends the flows recorded in dir (see FlowRecorder) whose last
+  // packet arrived in [t_begin, t_end) to out, through the catalog of the
+  // directory. .flr files are mapped and only the pages of the range are
+  // read, .flr.gz and .flw.gz files are inflated up to the end mark of the
+  // range, text files are parsed (without TCP flags).
+  // Returns the number of flows appended.
+  inline uint64_t readFlowRange(const std::string &dir, Time t_begin,
+                                Time t_end, std::vector<FlowRecord> &out){
+    Catalog catalog(dir, "flows");
+    const uint64_t begin_us = t_begin.microseconds();
+    const uint64_t end_us = t_end.microseconds();
+    uint64_t count = 0;
+    for( uint64_t i : catalog.find(t_begin, t_end) ){
+      std::string filename = catalog.path(i);
+      if( utils::stringEndsWith(filename, {".flr", ".flr.gz"}) ){
+        uint64_t end = catalog.seekEnd(i, t_end).record;
+        FlowRecordReader reader(filename, end);
+        uint64_t last = std::min(end, reader.size());
+        for( uint64_t j = catalog.seek(i, t_begin).record; j < last; ++j ){
+          const FlowRecord &record = reader[j];
+          if( record.t_last >= begin_us && record.t_last < end_us ){
+            out.push_back(record);
+            ++count;
+          }
+        }
+        continue;
+      }
+      uint64_t begin = catalog.seek(i, t_begin).offset;
+      uint64_t end = catalog.seekEnd(i, t_end).offset;
+      std::string text(end - begin, 0);
+      if( utils::stringEndsWith(filename, {".gz"}) ){
+        GzipReader gz(filename);
+        std::vector<char> skipped(std::min<uint64_t>(begin, 1 << 20));
+        for( uint64_t n = 0; n < begin; ){
+          uint64_t m = gz.read(skipped.data(),
+                               std::min<uint64_t>(begin - n, skipped.size()));
+          if( m == 0 ){
+            break;
+          }
+          n += m;
+        }
+        text.resize(gz.read(&text[0], text.size()));
+      } else {
+        std::ifstream in(filename, std::ios::binary);
+        in.seekg(begin);
+        in.read(&text[0], text.size());
+        text.resize(in.gcount());
+      }
+      std::istringstream lines(text);
+      std::string line;
+      FlowRecord record;
+      while( std::getline(lines, line) ){
+        if( record.fromString(line) && record.t_last >= begin_us
+            && record.t_last < end_us ){
+          out.push_back(record);
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+
+  // Exports a binary flow record file (.flr or .flr.gz) as text, one line
+  // per flow (.flw or .flw.gz). Returns the number of flows exported.
+  inline uint64_t exportFlowText(const std::string &src,
+                                 const std::string &dst){
+    FlowRecordReader reader(src);
+    std::string text;
+    for( const FlowRecord &record : reader ){
+      text += record.toString();
+      text += '\n';
+    }
+    if( utils::stringEndsWith(dst, {".flw.gz"}) ){
+      GzipWriter writer(dst);
+      writer.write(text.data(), text.size());
+    } else if( utils::stringEndsWith(dst, {".flw"}) ){
+      std::ofstream out(dst, std::ios::binary);
+      if( !out.write(text.data(), text.size()) ){
+        FATAL("exportFlowText:: cannot write file: " + dst);
+      }
+    } else {
+      FATAL("exportFlowText:: unknown flow text file type: " + dst);
+    }
+    return reader.size();
+  }
 
   class Flow : public Key{
 
@@ -264,28 +708,35 @@ namespace pnet {
       static const uint32_t TimeOutInMicroseconds = 60000000; // 60 seconds
 
     public:
-      // A small struct to store necessary information for each packet.
-      // Since keys of each packet is the same, we store only a vector of
-      // PacketInfo inside the flow.
-      struct PacketInfo{
-          PacketInfo():updown(0), size(0), t_arrival(0){}
-          PacketInfo(int16_t updown_ ,uint16_t size_, Time t_arrival_):
-              updown(updown_), size(size_), t_arrival(t_arrival_){}
-          int16_t updown;
-          uint16_t size;
-          Time t_arrival;
-      };
+      typedef pnet::PacketInfo PacketInfo;
+
+      // Packet history chunks can be drawn from an arena shared by all
+      // flows of a FlowTable, see PacketHistory.
+      typedef PacketHistory::Arena PacketArena;
 
     public:
       // A flow is always constructed with its first packet.
-      explicit Flow(const Packet & packet)
-          : Key(packet), nbytes(0), prev(nullptr), next(nullptr) {
+      // Packet history is allocated from 'arena' if given, and keeps the
+      // packets that the history policy says. Features are updated with
+      // each packet if an extractor is given, the flow does not own it.
+      explicit Flow(const Packet & packet, PacketArena *arena = nullptr,
+                    const HistoryPolicy &history = HistoryPolicy(),
+                    FlowFeatureExtractor *features_ = nullptr)
+          : Key(packet), num_packets(0), nbytes(0), packets_up(0),
+            bytes_up(0), t_first(packet.t_arrival), t_last(packet.t_arrival),
+            packets(arena, history), features(features_),
+            idle_timeout(TimeOutInMicroseconds), tcp_flags(0), fin_mask(0),
+            sampling_rate(1), sampling_mode(sampling::NONE),
+            t_expire(0), prev(nullptr), next(nullptr),
+            timer_prev(nullptr), timer_next(nullptr),
+            timer_slot(TimerWheel<Flow>::NOT_SCHEDULED), timer_deadline(0) {
         insert(packet);
       }
 
       // Size is the number of packets.
+      // Packets of the history may be fewer, see HistoryPolicy.
       uint64_t size() const{
-        return packets.size();
+        return num_packets;
       }
 
       // Bytes is the number of total packet sizes.
@@ -293,24 +744,29 @@ namespace pnet {
         return nbytes;
       }
 
-      Time t_firstPacket(){
-        return packets.front().t_arrival;
+      Time t_firstPacket() const{
+        return t_first;
       }
 
-      Time t_lastPacket(){
-        return packets.back().t_arrival;
+      Time t_lastPacket() const{
+        return t_last;
       }
 
       // A flow expires if its last packet has arrived
-      // earlier than TimeOutInMicroseconds before.
+      // earlier than idle_timeout (TimeOutInMicroseconds by default) before.
       bool expired(Time t_now) const {
-        Time elapsed = t_now - packets.back().t_arrival;
-        return elapsed > TimeOutInMicroseconds;
+        Time elapsed = t_now - t_last;
+        return elapsed > idle_timeout;
+      }
+
+      // TCP connection is closed by a reset or by FIN's in both directions.
+      bool closed() const {
+        return (tcp_flags & Packet::TCP_RST) || fin_mask == 3;
       }
 
       // Flows are compared according to the arrival of their last packets.
       bool operator<(const Flow &rhs) const {
-        return packets.back().t_arrival  < rhs.packets.back().t_arrival;
+        return t_last < rhs.t_last;
       }
 
       // Determines the direction of the packet inside the flow.
@@ -326,120 +782,362 @@ namespace pnet {
       // Insert a new packet to the flow.
       // Determine the packet direction and accumulate stats.
       void insert(const Packet &packet) {
+        int16_t updown = direction(packet);
+        ++num_packets;
         nbytes += packet.size;
-        packets.emplace_back(direction(packet),
-                             packet.size,
-                             packet.t_arrival);
+        t_last = packet.t_arrival;
+        if (updown == 1) {
+          ++packets_up;
+          bytes_up += packet.size;
+        }
+        tcp_flags |= packet.flags;
+        if (packet.flags & Packet::TCP_FIN) {
+          fin_mask |= (updown == 1) ? 1 : 2;
+        }
+        packets.add(PacketInfo(updown, packet.size, packet.t_arrival));
+        if (features) {
+          features->add(updown, packet.size, packet.t_arrival.microseconds());
+        }
+      }
+
+      // Summary of the flow, as recorded by FlowRecorder.
+      FlowRecord toRecord() const {
+        FlowRecord record = FlowRecord();
+        record.key = *this;
+        record.packets = size();
+        record.bytes = bytes();
+        record.t_first = t_firstPacket().microseconds();
+        record.t_last = t_lastPacket().microseconds();
+        record.tcp_flags = tcp_flags;
+        record.sampling_rate = sampling_rate;
+        record.sampling_mode = sampling_mode;
+        return record;
+      }
+
+      FlowRecordExtra extraCounters() const {
+        FlowRecordExtra extra;
+        extra.packets_up = packets_up;
+        extra.bytes_up = bytes_up;
+        return extra;
+      }
+
+      // Zero if the flow does not extract features.
+      FlowFeatures getFeatures() const {
+        return features ? features->features() : FlowFeatures();
       }
 
       std::string toString() const {
-        char buffer[500];
-        std::sprintf(buffer, "%-15s\t%5d\t",
-                     inet_ntoa(ip_src), ntohs(port_src));
-        std::sprintf(buffer+strlen(buffer), "%-15s\t%5d\t",
-                     inet_ntoa(ip_dst),  ntohs(port_dst));
-        std::sprintf(buffer+strlen(buffer), "%2d\t%" PRIu64 "\t%" PRIu64 "\t",
-                     protocol, size(), bytes());
-        std::sprintf(buffer+strlen(buffer), "%s\t",
-                     packets.front().t_arrival.toString().c_str());
-        std::sprintf(buffer+strlen(buffer), "%s",
-                     packets.back().t_arrival.toString().c_str());
-        return std::string(buffer);
+        return toRecord().toString();
       }
 
     public:
+      uint64_t num_packets;
       uint64_t nbytes;
-      std::vector<PacketInfo> packets;
+      uint64_t packets_up;     // in the direction of the first packet
+      uint64_t bytes_up;
+      Time t_first;            // first packet
+      Time t_last;             // last packet
+      PacketHistory packets;
+      FlowFeatureExtractor *features;   // optional
+
+    public:
+      // Expiry state, maintained by the FlowTable.
+      uint64_t idle_timeout;   // microseconds
+      uint16_t tcp_flags;      // union of the TCP flags of all packets
+      uint8_t fin_mask;        // FIN seen in up (1) and down (2) directions
+      uint16_t sampling_rate;  // see FlowRecord
+      uint8_t sampling_mode;
+      uint64_t t_expire;       // current deadline in microseconds
 
     public:
       Flow *prev;
       Flow *next;
+
+    public:
+      // Timing wheel links.
+      Flow *timer_prev;
+      Flow *timer_next;
+      uint32_t timer_slot;
+      uint64_t timer_deadline;
   };
 
 
+  // Flow time-out configuration of a FlowTable.
+  // All timeouts are in microseconds.
+  //
+  // A flow expires when it has been idle for its idle timeout, which is
+  // chosen once, when the flow is created, in the following order:
+  //    1. the port class timeout of the protocol and one of its ports
+  //       (e.g. UDP port 53 for DNS),
+  //    2. the protocol timeout,
+  //    3. the default timeout.
+  // TCP flows terminate early: tcp_rst_timeout after a RST and
+  // tcp_fin_timeout after FIN's in both directions.
+  // If active_timeout is set, long lived flows are expired (and recorded)
+  // that long after their first packet, even if they are still active.
+  class ExpiryPolicy {
+
+    public:
+      ExpiryPolicy()
+          : default_timeout(Flow::TimeOutInMicroseconds),
+            tcp_fin_timeout(5000000), tcp_rst_timeout(1000000),
+            active_timeout(0), protocol_timeouts(256, 0) {
+        setPortTimeout(IPPROTO_UDP, 53, 10000000);  // DNS
+      }
+
+      void setProtocolTimeout(uint8_t protocol, uint64_t timeout) {
+        protocol_timeouts[protocol] = timeout;
+      }
+
+      // Port is in host byte order.
+      void setPortTimeout(uint8_t protocol, uint16_t port, uint64_t timeout) {
+        port_timeouts[portClass(protocol, port)] = timeout;
+      }
+
+      // Idle timeout of a new flow.
+      uint64_t idleTimeout(const Key &key) const {
+        if (!port_timeouts.empty()) {
+          auto it = port_timeouts.find(portClass(key.protocol,
+                                                 ntohs(key.port_dst)));
+          if (it == port_timeouts.end()) {
+            it = port_timeouts.find(portClass(key.protocol,
+                                              ntohs(key.port_src)));
+          }
+          if (it != port_timeouts.end()) {
+            return it->second;
+          }
+        }
+        uint64_t timeout = protocol_timeouts[key.protocol & 0xff];
+        return timeout ? timeout : default_timeout;
+      }
+
+      // Time (in microseconds) at which the flow expires.
+      uint64_t deadline(const Flow &flow) const {
+        uint64_t t_last = flow.t_lastPacket().microseconds();
+        uint64_t timeout = flow.idle_timeout;
+        if (flow.protocol == IPPROTO_TCP && flow.closed()) {
+          timeout = std::min(timeout, (flow.tcp_flags & Packet::TCP_RST)
+                                      ? tcp_rst_timeout : tcp_fin_timeout);
+        }
+        uint64_t t_deadline = t_last + timeout;
+        if (active_timeout) {
+          t_deadline = std::min(t_deadline,
+                     flow.t_firstPacket().microseconds() + active_timeout);
+        }
+        return t_deadline;
+      }
+
+    private:
+      static uint32_t portClass(uint32_t protocol, uint16_t port) {
+        return ((protocol & 0xff) << 16) | port;
+      }
+
+    public:
+      uint64_t default_timeout;
+      uint64_t tcp_fin_timeout;
+      uint64_t tcp_rst_timeout;
+      uint64_t active_timeout;   // zero disables active timeouts
+
+    private:
+      std::vector<uint64_t> protocol_timeouts;
+      std::unordered_map<uint32_t, uint64_t> port_timeouts;
+  };
+
+
+  // Records flows into binary files of fixed-width records (.flr or
+  // .flr.gz, see FlowRecord and FlowRecordReader), or exports them as text,
+  // one line per flow (Flow::toString(), .flw or .flw.gz).
+  // Closed files are added to the "flows" catalog of the directory, by the
+  // time of the last packet of their flows, see readFlowRange().
   class FlowRecorder {
 
     public:
       static const uint64_t max_records_per_file = 1000000;
 
+      enum Format { FLR, FLR_GZ, TEXT, TEXT_GZ };
+
     public:
       // Input:
       //    - output_dir: to store record files.
       //    - compressed: for compressed storage.
       FlowRecorder(const std::string &output_dir_,
-                   bool compressed_ = false){
+                   bool compressed_ = false)
+          : FlowRecorder(output_dir_, compressed_ ? FLR_GZ : FLR) {}
+
+      FlowRecorder(const std::string &output_dir_, Format format_)
+          : catalog(output_dir_, "flows") {
         if(!utils::directoryExists(output_dir_)){
           FATAL("FlowRecorder:: output directory does not exits: "
                 + output_dir );
         }
-        compressed = compressed_;
+        format = format_;
         output_dir = output_dir_;
         filename = "";
         record_counter = max_records_per_file;
+        gz_out = nullptr;
+        extra_counters = false;
+        with_features = false;
+        record_size = 0;
+        record_flags = 0;
       }
 
       ~FlowRecorder(){
         close();
       }
 
+      // Binary files opened from now on also hold the per-direction
+      // counters of the flows (FlowRecordExtra).
+      void setExtraCounters(bool enable){
+        std::lock_guard<std::mutex> lock(mutex);
+        extra_counters = enable;
+      }
+
+      // Binary files opened from now on also hold the features of the
+      // flows (FlowFeatures), see FlowTable::setFeatureExtraction().
+      void setFeatures(bool enable){
+        std::lock_guard<std::mutex> lock(mutex);
+        with_features = enable;
+      }
+
+      // Thread-safe, so that the shards of a ShardedFlowTable can share
+      // a single recorder.
       void write(const Flow &flow) {
+        PNET_METRIC_TIMER(FLOW_RECORD_NS);
+        PNET_METRIC_ADD(FLOWS_RECORDED, 1);
+        std::lock_guard<std::mutex> lock(mutex);
         // Packet limit per file reached.
         // Save current file and open a new one.
         if (record_counter == max_records_per_file) {
-          close();
-          filename = utils::pathJoin(output_dir,
-                       flow.packets.back().t_arrival.toDateString() + ".flw");
-          out.open(filename, std::ios::out);
-          if(!out.is_open()){
-            FATAL("FlowRecorder:: cannot open file : " + filename );
+          open(flow.t_lastPacket());
+        }
+        if (format == TEXT || format == TEXT_GZ) {
+          std::string line = flow.toString() + "\n";
+          put(line.data(), line.size());
+          catalog.add(flow.t_lastPacket(), line.size());
+        } else {
+          uint8_t record[sizeof(FlowRecord) + sizeof(FlowRecordExtra)
+                         + sizeof(FlowFeatures)];
+          FlowRecord base = flow.toRecord();
+          std::memcpy(record, &base, sizeof(FlowRecord));
+          uint64_t offset = sizeof(FlowRecord);
+          if (record_flags & flow_record::EXTRA_COUNTERS) {
+            FlowRecordExtra extra = flow.extraCounters();
+            std::memcpy(record + offset, &extra, sizeof(extra));
+            offset += sizeof(extra);
           }
-          record_counter = 0;
+          if (record_flags & flow_record::FEATURES) {
+            FlowFeatures features = flow.getFeatures();
+            std::memcpy(record + offset, &features, sizeof(features));
+          }
+          put(record, record_size);
+          catalog.add(flow.t_lastPacket(), record_size);
         }
-        out << flow.toString() << std::endl;
         ++record_counter;
       }
 
     private:
-      void close(){
-        if(out.is_open()){
-          out.close();
-          if(compressed){
-            std::string dest = filename+".gz";
-            utils::zip(filename, dest);
-            utils::rm(filename);
+      void open(Time t_last){
+        close();
+        std::string name = t_last.toDateString();
+        name += format == FLR ? ".flr" : format == FLR_GZ ? ".flr.gz"
+                : format == TEXT ? ".flw" : ".flw.gz";
+        filename = utils::pathJoin(output_dir, name);
+        catalog.open(name);
+        if(format == FLR_GZ || format == TEXT_GZ){
+          gz_out = new GzipWriter(filename);
+        } else if(!out.open(filename)){
+          FATAL("FlowRecorder:: cannot open file : " + filename );
+        }
+        if(format == FLR || format == FLR_GZ){
+          flow_record::Header header;
+          std::memset(&header, 0, sizeof(header));
+          std::memcpy(header.magic, flow_record::MAGIC,
+                      sizeof(flow_record::MAGIC));
+          header.version = flow_record::VERSION;
+          header.record_size = sizeof(FlowRecord);
+          if(extra_counters){
+            header.flags |= flow_record::EXTRA_COUNTERS;
+            header.record_size += sizeof(FlowRecordExtra);
           }
+          if(with_features){
+            header.flags |= flow_record::FEATURES;
+            header.record_size += sizeof(FlowFeatures);
+          }
+          record_size = header.record_size;
+          record_flags = header.flags;
+          put(&header, sizeof(header));
         }
+        record_counter = 0;
+      }
+
+      void put(const void *data, uint64_t n){
+        if(gz_out){
+          gz_out->write(data, n);
+        } else {
+          out.write(data, n);
+        }
+      }
+
+      void close(){
+        out.close();
+        delete gz_out;
+        gz_out = nullptr;
+        catalog.close();
       }
 
     private:
       // current # packets in the current record file
       uint64_t record_counter;
-      bool compressed;
+      Format format;
+      bool extra_counters;
+      bool with_features;
+      uint32_t record_size;   // of the binary records of the current file
+      uint32_t record_flags;
       std::string output_dir;
       std::string filename;
-      std::ofstream out;
+      SequentialFile out;
+      GzipWriter *gz_out;
+      CatalogWriter catalog;
+      std::mutex mutex;
   };
 
+  // Doubly linked list of flows.
+  // The queue owns its flows: Flow objects come from a slab pool and their
+  // packet histories from a shared chunk arena, so creating and destroying
+  // flows does not go through malloc/free.
   class FlowQueue{
 
     public:
-      FlowQueue(): head(nullptr),tail(nullptr),num_elements(0){}
+      FlowQueue(): head(nullptr),tail(nullptr),num_elements(0),
+                   extract_features(false){}
+
+      ~FlowQueue(){
+        while(head){
+          del(head);
+        }
+      }
 
     public:
       // Insert flow at the end of the doubly linked list.
       // Clearly, this is O(1) time.
       // Returns pointer to the inserted Node
       Flow* emplace_back(const Packet &packet) {
-        Flow *new_flow= new Flow(packet);
+        Flow *new_flow = flow_pool.create(packet, &packet_arena,
+            history_policy,
+            extract_features ? feature_pool.create() : nullptr);
         insert(new_flow);
         return new_flow;
       }
 
-      // Remove and destroy arbitrary Flow by its pointer
+      // Remove and destroy arbitrary Flow by its pointer.
+      // Its packet history goes back to the arena in O(1).
       void del(Flow *flow){
         ASSERT_TRUE(flow, "FlowQueue:: Trying to remove null Flow*");
         remove(flow);
-        delete flow;
+        if(flow->features){
+          feature_pool.destroy(flow->features);
+        }
+        flow_pool.destroy(flow);
       }
 
       // Take a Flow from an arbitrary position and push it at the end
@@ -500,49 +1198,116 @@ namespace pnet {
         return out;
       }
 
+      // Allocator statistics for Flow objects.
+      const AllocatorStats& flowStats() const{
+        return flow_pool.getStats();
+      }
+
+      // Allocator statistics for packet history chunks.
+      const AllocatorStats& packetStats() const{
+        return packet_arena.getStats();
+      }
+
     public:
       Flow* head;
       Flow* tail;
       uint64_t num_elements;
+      HistoryPolicy history_policy;   // of new flows
+      bool extract_features;          // by new flows
+
+    private:
+      FlowQueue(const FlowQueue&);
+      FlowQueue& operator=(const FlowQueue&);
+
+      ObjectPool<Flow> flow_pool;
+      ObjectPool<FlowFeatureExtractor> feature_pool;
+      Flow::PacketArena packet_arena;
 
   };
 
 
   // A time-out map for flows.
+  // Flow deadlines are kept in a hierarchical timing wheel, so that each
+  // flow expires according to the ExpiryPolicy of the table at an O(1)
+  // amortized cost per packet.
   class FlowTable{
     public:
       static const uint64_t HASH_SIZE_HINT;
       static const uint64_t NUM_FSD_BINS;
 
     public:
-      // Custom hash function for Keys.
-      class KeyHash {
-      public:
-          std::size_t operator()(const Key& key) const {
-            return (key.ip_src.s_addr + key.ip_dst.s_addr + key.port_src
-                    + key.port_dst + key.protocol);
-          }
-      };
-
-    public:
-      FlowTable(FlowRecorder *recorder_=nullptr) {
+      // Input:
+      //    - recorder_: records the flows on expiry (optional).
+      //    - hash_seed_: keys the flow hash, zero for an unkeyed hash.
+      //    - hash_size_hint: expected maximum number of concurrent flows.
+      FlowTable(FlowRecorder *recorder_=nullptr, uint64_t hash_seed_ = 0,
+                uint64_t hash_size_hint = HASH_SIZE_HINT)
+          : flow_hash(hash_size_hint), distributions(new FlowDistributions) {
         flow_recorder = recorder_;
-        flow_hash.reserve(HASH_SIZE_HINT);
+        hash_seed = hash_seed_;
         packet_counter = 0;
+        num_expired_flows = 0;
+        sampling_rate = 1;
+        sampling_mode = sampling::NONE;
+      }
+
+      // Sets the expiry policy for the flows created from now on.
+      void setExpiryPolicy(const ExpiryPolicy &policy_){
+        policy = policy_;
+      }
+
+      // Sets which packets the flows created from now on keep in their
+      // history. Flow counters are exact whatever the policy.
+      void setHistoryPolicy(const HistoryPolicy &history){
+        flows.history_policy = history;
+      }
+
+      // Sampling of the flows created from now on, recorded with them so
+      // that counts can be scaled back, see AdmissionControl.
+      void setSampling(sampling::Mode mode, uint16_t rate){
+        sampling_mode = mode;
+        sampling_rate = rate;
+      }
+
+      // Whether the flows created from now on extract their features
+      // (Flow::getFeatures()), to be recorded with them, see
+      // FlowRecorder::setFeatures().
+      void setFeatureExtraction(bool enable){
+        flows.extract_features = enable;
       }
 
       ~FlowTable(){
         Flush();
+        delete distributions;
+      }
+
+      // Sets the bins of the flow distributions, see getDistributions().
+      // The distributions are rebuilt from the current flows. Snapshots
+      // must not be taken from other threads meanwhile.
+      void setFlowBinning(const FlowBinning &binning){
+        FlowDistributions *rebuilt = new FlowDistributions(binning);
+        for(Flow *flow = flows.head; flow; flow = flow->next){
+          rebuilt->add(flow->protocol, flow->size(), flow->bytes(),
+                       duration(flow));
+        }
+        std::swap(distributions, rebuilt);
+        delete rebuilt;
       }
 
       // Clear the flow table and record the flows (if recorder is set)
       void Flush(){
         while(!flows.empty()){
+          Flow *flow = flows.head;
           if(flow_recorder){
-            flow_recorder->write(*flows.head);
+            flow_recorder->write(*flow);
           }
-          flows.del(flows.head);
+          distributions->remove(flow->protocol, flow->size(), flow->bytes(),
+                                duration(flow));
+          flows.del(flow);
+          PNET_METRIC_ADD(FLOWS_ACTIVE, -1);
         }
+        flow_hash.clear();
+        timers.clear();
       }
 
       friend std::ostream& operator<<(std::ostream &out,
@@ -555,23 +1320,27 @@ namespace pnet {
         return out;
       }
 
-      // Iterates over the FlowQueue and collects FSD statistics.
-      // If no protocol is given, overall FSD is returned.
+      // Flow size distribution of the current flows: the packets
+      // distribution of getDistributions(). With the default binning, bin i
+      // counts flows of i + 1 packets and the last bin flows of
+      // NUM_FSD_BINS packets or more. If no protocol is given, overall FSD
+      // is returned.
       std::vector<uint64_t> getCurrentFSD(uint16_t proto = 0) const{
-        std::vector<uint64_t> counts(NUM_FSD_BINS,0);
-        Flow *current = flows.head;
-        while(current) {
-          if (proto == 0 || current->protocol == proto) {
-            counts[std::min(NUM_FSD_BINS, current->size()) - 1]++;
-          }
-          current = current->next;
-        }
-        return counts;
+        return distributions->snapshot(proto).packets;
+      }
+
+      // Packet, byte and duration distributions of the current flows of a
+      // protocol (all flows if zero), maintained as packets arrive and
+      // flows expire. Reads are O(bins) and may come from another thread.
+      FlowDistributionSnapshot getDistributions(uint16_t proto = 0) const{
+        return distributions->snapshot(proto);
       }
 
       // Insert a new packet to the hash table.
       // Create a new flow if necessary, otherwise update an existing flow.
       bool insert(const Packet &pkt){
+        PNET_METRIC_TIMER_IF(FLOW_INSERT_NS, packet_counter % 64 == 0);
+        PNET_METRIC_ADD(FLOW_PACKETS, 1);
         // Update timers and counters
         if(packet_counter == 0){
           t_first_packet = pkt.t_arrival;
@@ -583,52 +1352,105 @@ namespace pnet {
         expireFlows(pkt.t_arrival);
 
         Flow *flow = find(pkt);
+        if(flow && flow->t_expire <= pkt.t_arrival.microseconds()){
+          // Expired within the current tick of the timing wheel.
+          removeFlow(flow);
+          flow = nullptr;
+        }
         if(flow){
+          uint64_t old_packets = flow->size(), old_bytes = flow->bytes();
+          uint64_t old_duration = duration(flow);
           flow->insert(pkt);
-          // Update time-out location by putting the flow at the back of the
-          // queue. The flow_hash location should also get updated.
+          distributions->update(flow->protocol, old_packets, old_bytes,
+                                old_duration, flow->size(), flow->bytes(),
+                                duration(flow));
+          // Keep the queue in least recently used order.
           flows.move_back(flow);
+          updateDeadline(flow);
           return false;
         } else {
           Flow *new_flow = flows.emplace_back(pkt);
-          flow_hash.insert({pkt, new_flow});
+          new_flow->idle_timeout = policy.idleTimeout(pkt);
+          new_flow->sampling_rate = sampling_rate;
+          new_flow->sampling_mode = sampling_mode;
+          flow_hash.insert(pkt.hash(hash_seed), new_flow);
+          distributions->add(new_flow->protocol, 1, new_flow->bytes(), 0);
+          updateDeadline(new_flow);
+          PNET_METRIC_ADD(FLOWS_CREATED, 1);
+          PNET_METRIC_ADD(FLOWS_ACTIVE, 1);
           return true;
         }
       }
 
       // Remove all expired flows from the table.
       void expireFlows(Time t_now) {
-        while (!flows.empty()) {
-          if (flows.head->expired(t_now)) {
-            // record flow just before deleting from table:
-            if(flow_recorder){
-              flow_recorder->write(*flows.head);
-            }
-            flow_hash.erase(*flows.head); // remove from flow hash
-            flows.del(flows.head);        // delete flow
+        uint64_t now = t_now.microseconds();
+        timers.advance(now, [this, now](Flow *flow) {
+          if (flow->t_expire <= now) {
+            removeFlow(flow);
           } else {
-            break;
+            // Deadline was extended by later packets.
+            timers.schedule(flow, flow->t_expire);
           }
-        }
+        });
       }
 
       Flow* find(const Key &key){
-        auto it = flow_hash.find(key);
-        if ( it  == flow_hash.end() ) {
-          return nullptr;
-        }
-        return it->second;
+        return flow_hash.find(key, key.hash(hash_seed));
       }
 
       Time upTime(){
         return t_last_packet - t_first_packet;
       }
 
+    private:
+      FlowTable(const FlowTable&);
+      FlowTable& operator=(const FlowTable&);
+
+      // Later deadlines are applied lazily when the timer fires, so most
+      // packets do not touch the timing wheel. Earlier deadlines (e.g. after
+      // a TCP RST) re-schedule the timer right away.
+      void updateDeadline(Flow *flow){
+        flow->t_expire = policy.deadline(*flow);
+        if (!timers.scheduled(flow) || flow->t_expire < flow->timer_deadline){
+          timers.schedule(flow, flow->t_expire);
+        }
+      }
+
+      // Microseconds from the first to the last packet of the flow.
+      static uint64_t duration(const Flow *flow){
+        uint64_t t_first = flow->t_firstPacket().microseconds();
+        uint64_t t_last = flow->t_lastPacket().microseconds();
+        return t_last > t_first ? t_last - t_first : 0;
+      }
+
+      // Record the flow (if recorder is set) and delete it.
+      void removeFlow(Flow *flow){
+        if(flow_recorder){
+          flow_recorder->write(*flow);
+        }
+        distributions->remove(flow->protocol, flow->size(), flow->bytes(),
+                              duration(flow));
+        timers.cancel(flow);
+        flow_hash.erase(flow, flow->hash(hash_seed));
+        flows.del(flow);
+        ++num_expired_flows;
+        PNET_METRIC_ADD(FLOWS_EXPIRED, 1);
+        PNET_METRIC_ADD(FLOWS_ACTIVE, -1);
+      }
+
     public:
       FlowQueue flows;
-      std::unordered_map<Key, Flow*, KeyHash> flow_hash;
+      FlowIndex<Key, Flow> flow_hash;
+      TimerWheel<Flow> timers;
+      ExpiryPolicy policy;
+      uint64_t hash_seed;
       FlowRecorder *flow_recorder;
+      FlowDistributions *distributions;
+      uint16_t sampling_rate;   // of new flows
+      sampling::Mode sampling_mode;
       uint64_t packet_counter;
+      uint64_t num_expired_flows;
       Time t_first_packet;
       Time t_last_packet;
 
@@ -0,0 +1,405 @@
+#ifndef PNET_FLOW_FEATURES_HPP_
+#define PNET_FLOW_FEATURES_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <pnet_packet.hpp>
+
+namespace pnet {
+
+  // Fixed-size feature vector of a flow, see FlowFeatureExtractor.
+  // Times are in microseconds, sizes in bytes. Up is the direction of the
+  // first packet of the flow. Deviations are population deviations.
+  struct FlowFeatures {
+
+    enum Index {
+      DURATION,
+      PACKETS_UP, PACKETS_DOWN, BYTES_UP, BYTES_DOWN,
+      BYTES_UP_RATIO,                  // bytes up / bytes
+      IAT_MEAN, IAT_STD, IAT_MINIMUM, IAT_MAXIMUM,   // inter-arrival times
+      IAT_UP_MEAN, IAT_UP_STD, IAT_DOWN_MEAN, IAT_DOWN_STD,
+      SIZE_MEAN, SIZE_STD, SIZE_MINIMUM, SIZE_MAXIMUM,
+      SIZE_UP_MEAN, SIZE_UP_STD, SIZE_DOWN_MEAN, SIZE_DOWN_STD,
+      SIZE_P25, SIZE_P50, SIZE_P75, SIZE_P90,
+      NUM_BURSTS, MAX_BURST,           // runs of packets close in time
+      NUM_FEATURES
+    };
+
+    float operator[](uint32_t i) const {
+      return values[i];
+    }
+
+    static const char* name(uint32_t i) {
+      static const char *names[NUM_FEATURES] = {
+        "duration",
+        "packets_up", "packets_down", "bytes_up", "bytes_down",
+        "bytes_up_ratio",
+        "iat_mean", "iat_std", "iat_min", "iat_max",
+        "iat_up_mean", "iat_up_std", "iat_down_mean", "iat_down_std",
+        "size_mean", "size_std", "size_min", "size_max",
+        "size_up_mean", "size_up_std", "size_down_mean", "size_down_std",
+        "size_p25", "size_p50", "size_p75", "size_p90",
+        "num_bursts", "max_burst"};
+      return names[i];
+    }
+
+    // Tab separated values, in Index order.
+    std::string toString() const {
+      std::string out;
+      char buffer[32];
+      for (uint32_t i = 0; i < NUM_FEATURES; ++i) {
+        int n = std::snprintf(buffer, sizeof(buffer), i ? "\t%g" : "%g",
+                              values[i]);
+        out.append(buffer, n);
+      }
+      return out;
+    }
+
+    float values[NUM_FEATURES];
+    // 112 bytes in total.
+  };
+
+  // Mean and variance of a stream (Welford).
+  struct RunningStats {
+    RunningStats() : n(0), mean(0), m2(0) {}
+
+    void add(double x) {
+      ++n;
+      double delta = x - mean;
+      mean += delta / n;
+      m2 += delta * (x - mean);
+    }
+
+    // Both streams together (Chan et al.).
+    RunningStats merged(const RunningStats &other) const {
+      RunningStats result;
+      result.n = n + other.n;
+      if (result.n == 0) {
+        return result;
+      }
+      double delta = other.mean - mean;
+      result.mean = mean + delta * other.n / result.n;
+      result.m2 = m2 + other.m2 + delta * delta * n * other.n / result.n;
+      return result;
+    }
+
+    double deviation() const {
+      return n > 1 ? std::sqrt(m2 / n) : 0;
+    }
+
+    uint64_t n;
+    double mean;
+    double m2;    // sum of squared deviations from the mean
+  };
+
+
+  inline void extractFlowFeatures(const Packet *packets, uint64_t n,
+                                  std::vector<Key> &keys,
+                                  std::vector<FlowFeatures> &result);
+
+  // Streaming features of a flow, updated in O(1) per packet so that the
+  // packet history is not needed to compute them, see FlowFeatures.
+  //
+  // Packet size percentiles are interpolated in a histogram of
+  // SIZE_BIN_WIDTH byte bins. A burst is a run of packets less than
+  // BURST_GAP apart.
+  class FlowFeatureExtractor {
+
+    public:
+      static const uint32_t NUM_SIZE_BINS = 16;
+      static const uint32_t SIZE_BIN_WIDTH = 100;   // last bin: 1500 and more
+      static const int64_t BURST_GAP = 1000;        // microseconds
+
+    public:
+      FlowFeatureExtractor()
+          : t_first(0), t_last(0), iat_min(0), iat_max(0), size_min(0),
+            size_max(0), num_bursts(0), burst(0), max_burst(0) {
+        for (uint32_t d = 0; d < 2; ++d) {
+          bytes[d] = 0;
+          t_last_dir[d] = 0;
+        }
+        std::fill(size_bins, size_bins + NUM_SIZE_BINS, 0);
+      }
+
+      // Direction is that of Flow::direction().
+      void add(int16_t updown, uint16_t size, uint64_t t_arrival) {
+        uint32_t d = updown == 1 ? 0 : 1;
+        if (packets() == 0) {
+          t_first = t_arrival;
+          size_min = size_max = size;
+          num_bursts = burst = max_burst = 1;
+        } else {
+          int64_t gap = (int64_t) (t_arrival - t_last);
+          if (iat.n == 0) {
+            iat_min = iat_max = gap;
+          }
+          iat.add(gap);
+          iat_min = std::min(iat_min, gap);
+          iat_max = std::max(iat_max, gap);
+          if (gap > BURST_GAP) {
+            ++num_bursts;
+            burst = 0;
+          }
+          max_burst = std::max(max_burst, ++burst);
+          size_min = std::min(size_min, size);
+          size_max = std::max(size_max, size);
+        }
+        if (sizes[d].n > 0) {
+          iat_dir[d].add((int64_t) (t_arrival - t_last_dir[d]));
+        }
+        sizes[d].add(size);
+        bytes[d] += size;
+        t_last_dir[d] = t_arrival;
+        t_last = t_arrival;
+        ++size_bins[sizeBin(size)];
+      }
+
+      uint64_t packets() const {
+        return sizes[0].n + sizes[1].n;
+      }
+
+      FlowFeatures features() const {
+        FlowFeatures f;
+        float *v = f.values;
+        uint64_t total_bytes = bytes[0] + bytes[1];
+        RunningStats size = sizes[0].merged(sizes[1]);
+        v[FlowFeatures::DURATION] = t_last > t_first ? t_last - t_first : 0;
+        v[FlowFeatures::PACKETS_UP] = sizes[0].n;
+        v[FlowFeatures::PACKETS_DOWN] = sizes[1].n;
+        v[FlowFeatures::BYTES_UP] = bytes[0];
+        v[FlowFeatures::BYTES_DOWN] = bytes[1];
+        v[FlowFeatures::BYTES_UP_RATIO] =
+            total_bytes ? (double) bytes[0] / total_bytes : 0;
+        v[FlowFeatures::IAT_MEAN] = iat.mean;
+        v[FlowFeatures::IAT_STD] = iat.deviation();
+        v[FlowFeatures::IAT_MINIMUM] = iat_min;
+        v[FlowFeatures::IAT_MAXIMUM] = iat_max;
+        v[FlowFeatures::IAT_UP_MEAN] = iat_dir[0].mean;
+        v[FlowFeatures::IAT_UP_STD] = iat_dir[0].deviation();
+        v[FlowFeatures::IAT_DOWN_MEAN] = iat_dir[1].mean;
+        v[FlowFeatures::IAT_DOWN_STD] = iat_dir[1].deviation();
+        v[FlowFeatures::SIZE_MEAN] = size.mean;
+        v[FlowFeatures::SIZE_STD] = size.deviation();
+        v[FlowFeatures::SIZE_MINIMUM] = size_min;
+        v[FlowFeatures::SIZE_MAXIMUM] = size_max;
+        v[FlowFeatures::SIZE_UP_MEAN] = sizes[0].mean;
+        v[FlowFeatures::SIZE_UP_STD] = sizes[0].deviation();
+        v[FlowFeatures::SIZE_DOWN_MEAN] = sizes[1].mean;
+        v[FlowFeatures::SIZE_DOWN_STD] = sizes[1].deviation();
+        v[FlowFeatures::SIZE_P25] = sizePercentile(0.25);
+        v[FlowFeatures::SIZE_P50] = sizePercentile(0.50);
+        v[FlowFeatures::SIZE_P75] = sizePercentile(0.75);
+        v[FlowFeatures::SIZE_P90] = sizePercentile(0.90);
+        v[FlowFeatures::NUM_BURSTS] = num_bursts;
+        v[FlowFeatures::MAX_BURST] = max_burst;
+        return f;
+      }
+
+      static uint32_t sizeBin(uint16_t size) {
+        return std::min<uint32_t>(size / SIZE_BIN_WIDTH, NUM_SIZE_BINS - 1);
+      }
+
+    private:
+      friend void extractFlowFeatures(const Packet*, uint64_t,
+                                      std::vector<Key>&,
+                                      std::vector<FlowFeatures>&);
+
+      // Interpolated within the bin, and kept within the observed sizes.
+      double sizePercentile(double p) const {
+        uint64_t n = packets();
+        if (n == 0) {
+          return 0;
+        }
+        double target = p * n, below = 0;
+        uint32_t i = 0;
+        while (i + 1 < NUM_SIZE_BINS && below + size_bins[i] < target) {
+          below += size_bins[i++];
+        }
+        double value = i * SIZE_BIN_WIDTH;
+        if (size_bins[i]) {
+          value += SIZE_BIN_WIDTH * (target - below) / size_bins[i];
+        }
+        return std::max<double>(size_min, std::min<double>(size_max, value));
+      }
+
+    private:
+      RunningStats iat;          // between consecutive packets
+      RunningStats iat_dir[2];   // between packets of the same direction
+      RunningStats sizes[2];     // per direction
+      uint64_t bytes[2];
+      uint64_t t_first;
+      uint64_t t_last;
+      uint64_t t_last_dir[2];
+      int64_t iat_min;
+      int64_t iat_max;
+      uint16_t size_min;
+      uint16_t size_max;
+      uint32_t num_bursts;
+      uint32_t burst;            // packets of the current burst
+      uint32_t max_burst;
+      uint32_t size_bins[NUM_SIZE_BINS];
+  };
+
+
+  namespace features {
+
+    // Mean and squared deviations of a column. Sums run over independent
+    // lanes so that the compiler vectorizes them.
+    inline RunningStats columnStats(const int64_t *x, uint64_t n) {
+      const uint64_t LANES = 4;
+      RunningStats stats;
+      stats.n = n;
+      if (n == 0) {
+        return stats;
+      }
+      int64_t sum[LANES] = {0, 0, 0, 0};
+      uint64_t i = 0;
+      for (; i + LANES <= n; i += LANES) {
+        for (uint64_t l = 0; l < LANES; ++l) {
+          sum[l] += x[i + l];
+        }
+      }
+      for (; i < n; ++i) {
+        sum[0] += x[i];
+      }
+      stats.mean = (double) (sum[0] + sum[1] + sum[2] + sum[3]) / n;
+      double m2[LANES] = {0, 0, 0, 0};
+      for (i = 0; i + LANES <= n; i += LANES) {
+        for (uint64_t l = 0; l < LANES; ++l) {
+          double d = x[i + l] - stats.mean;
+          m2[l] += d * d;
+        }
+      }
+      for (; i < n; ++i) {
+        double d = x[i] - stats.mean;
+        m2[0] += d * d;
+      }
+      stats.m2 = m2[0] + m2[1] + m2[2] + m2[3];
+      return stats;
+    }
+
+    // Differences of consecutive values: y[i] = x[i + 1] - x[i].
+    inline void differences(const int64_t *x, uint64_t n, int64_t *y) {
+      for (uint64_t i = 0; i + 1 < n; ++i) {
+        y[i] = x[i + 1] - x[i];
+      }
+    }
+
+  } // namespace features
+
+  // Features of the flows of a packet sequence, e.g. the packets of a
+  // PacketReader, equal (up to rounding) to those FlowFeatureExtractor
+  // computes as the packets arrive. All packets of a connection make a
+  // single flow, whatever their time: to apply timeouts, replay the packets
+  // through a FlowTable with feature extraction instead.
+  //
+  // Packets are grouped by flow first, then the features of each flow are
+  // computed column by column (arrival times, inter-arrival times, sizes)
+  // rather than packet by packet. Flows come in the order of their first
+  // packet; keys are those of their first packet.
+  inline void extractFlowFeatures(const Packet *packets, uint64_t n,
+                                  std::vector<Key> &keys,
+                                  std::vector<FlowFeatures> &result) {
+    keys.clear();
+    result.clear();
+    // Direction-independent key, then arrival order.
+    struct Entry {
+      uint64_t low, high;
+      uint64_t index;
+      bool operator<(const Entry &rhs) const {
+        if (high != rhs.high) return high < rhs.high;
+        if (low != rhs.low) return low < rhs.low;
+        return index < rhs.index;
+      }
+    };
+    std::vector<Entry> entries(n);
+    for (uint64_t i = 0; i < n; ++i) {
+      const Packet &p = packets[i];
+      uint64_t a = ((uint64_t) p.ip_src.s_addr << 16) | p.port_src;
+      uint64_t b = ((uint64_t) p.ip_dst.s_addr << 16) | p.port_dst;
+      if (b < a) {
+        std::swap(a, b);
+      }
+      entries[i].low = a | ((uint64_t) (p.protocol & 0xffff) << 48);
+      entries[i].high = b;
+      entries[i].index = i;
+    }
+    std::sort(entries.begin(), entries.end());
+
+    // Flows as [begin, end) ranges of entries, in order of first packet.
+    std::vector<std::pair<uint64_t, uint64_t> > flows;
+    for (uint64_t i = 0; i < n; ) {
+      uint64_t j = i + 1;
+      while (j < n && entries[j].low == entries[i].low
+             && entries[j].high == entries[i].high) {
+        ++j;
+      }
+      flows.push_back(std::make_pair(i, j));
+      i = j;
+    }
+    std::sort(flows.begin(), flows.end(),
+              [&entries](const std::pair<uint64_t, uint64_t> &x,
+                         const std::pair<uint64_t, uint64_t> &y) {
+                return entries[x.first].index < entries[y.first].index;
+              });
+
+    std::vector<int64_t> times, gaps, dir_times[2], sizes[2];
+    for (const std::pair<uint64_t, uint64_t> &flow : flows) {
+      const Packet &first = packets[entries[flow.first].index];
+      uint64_t m = flow.second - flow.first;
+      times.resize(m);
+      for (uint32_t d = 0; d < 2; ++d) {
+        dir_times[d].clear();
+        sizes[d].clear();
+      }
+      FlowFeatureExtractor x;
+      x.size_min = x.size_max = packets[entries[flow.first].index].size;
+      for (uint64_t k = 0; k < m; ++k) {
+        const Packet &p = packets[entries[flow.first + k].index];
+        uint32_t d = p.ip_src.s_addr == first.ip_src.s_addr ? 0 : 1;
+        times[k] = p.t_arrival.microseconds();
+        dir_times[d].push_back(times[k]);
+        sizes[d].push_back(p.size);
+        x.bytes[d] += p.size;
+        x.size_min = std::min(x.size_min, p.size);
+        x.size_max = std::max(x.size_max, p.size);
+        ++x.size_bins[FlowFeatureExtractor::sizeBin(p.size)];
+      }
+      x.t_first = times[0];
+      x.t_last = times[m - 1];
+
+      gaps.resize(m);
+      features::differences(times.data(), m, gaps.data());
+      x.iat = features::columnStats(gaps.data(), m - 1);
+      x.num_bursts = x.burst = x.max_burst = 1;
+      if (m > 1) {
+        x.iat_min = *std::min_element(gaps.begin(), gaps.begin() + m - 1);
+        x.iat_max = *std::max_element(gaps.begin(), gaps.begin() + m - 1);
+      }
+      for (uint64_t k = 0; k + 1 < m; ++k) {
+        if (gaps[k] > FlowFeatureExtractor::BURST_GAP) {
+          ++x.num_bursts;
+          x.burst = 0;
+        }
+        x.max_burst = std::max(x.max_burst, ++x.burst);
+      }
+      for (uint32_t d = 0; d < 2; ++d) {
+        uint64_t k = dir_times[d].size();
+        x.sizes[d] = features::columnStats(sizes[d].data(), k);
+        if (k > 1) {
+          features::differences(dir_times[d].data(), k, gaps.data());
+          x.iat_dir[d] = features::columnStats(gaps.data(), k - 1);
+        }
+      }
+      keys.push_back(first);
+      result.push_back(x.features());
+    }
+  }
+
+} // namespace pnet
+
+#endif // PNET_FLOW_FEATURES_HPP_
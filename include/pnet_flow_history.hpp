@@ -0,0 +1,442 @@
+#ifndef PNET_FLOW_HISTORY_HPP_
+#define PNET_FLOW_HISTORY_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <pnet_allocator.hpp>
+#include <pnet_archive.hpp>
+#include <pnet_hash.hpp>
+#include <pnet_time.hpp>
+
+namespace pnet {
+
+  // A packet of the history of a flow. Since keys of each packet are the
+  // same, a flow only keeps direction, size and arrival of its packets.
+  struct PacketInfo{
+      PacketInfo():updown(0), size(0), t_arrival(0){}
+      PacketInfo(int16_t updown_ ,uint16_t size_, Time t_arrival_):
+          updown(updown_), size(size_), t_arrival(t_arrival_){}
+      int16_t updown;     // 1: direction of the first packet, -1: reverse
+      uint16_t size;
+      Time t_arrival;
+  };
+
+  // Which packets a flow keeps in its history:
+  //    - FULL: all of them,
+  //    - FIRST_N: the first max_packets,
+  //    - RESERVOIR: a uniform random sample of max_packets (reservoir
+  //      sampling), in arrival order,
+  //    - SUMMARY: none, only the counters of the flow.
+  // The counters of a flow (packets, bytes, first and last packet) are
+  // exact whatever the policy.
+  struct HistoryPolicy {
+
+    enum Mode { FULL, FIRST_N, RESERVOIR, SUMMARY };
+
+    HistoryPolicy(Mode mode_ = FULL, uint32_t max_packets_ = 0,
+                  uint64_t seed_ = 0)
+        : mode(mode_), max_packets(max_packets_), seed(seed_) {}
+
+    Mode mode;
+    uint32_t max_packets;   // FIRST_N and RESERVOIR
+    uint64_t seed;          // RESERVOIR sampling
+  };
+
+
+  // Packet history of a flow.
+  //
+  // FULL and FIRST_N histories are encoded as a byte stream of varints:
+  // the zigzag delta of the arrival time to the previous packet, then the
+  // size shifted left by one with the direction in the low bit. Packets
+  // of a flow are close in time, so an entry takes 3 to 4 bytes instead
+  // of the 16 of a PacketInfo. The stream runs through fixed-size chunks
+  // from a shared arena, like ChunkedList, and is decoded on iteration.
+  //
+  // Long histories are block-compressed: every BLOCK_PACKETS packets of
+  // the stream are sealed into a block of two columns, time deltas and
+  // sizes, bit-packed or dictionary coded as in packet archives (see
+  // archive::putColumn()), and their chunks go back to the arena.
+  // Iteration decodes one block at a time, then reads the open chunks.
+  // Most flows are short and never seal a block.
+  //
+  // RESERVOIR histories are bounded and keep plain PacketInfos, since
+  // samples are replaced at random positions.
+  class PacketHistory {
+
+    public:
+      static const uint64_t CHUNK_BYTES = 56;   // 64 byte chunks
+      static const uint64_t BLOCK_PACKETS = 4096;
+      typedef Chunk<uint8_t, CHUNK_BYTES> ChunkType;
+      typedef ChunkArena<uint8_t, CHUNK_BYTES> Arena;
+
+      // Decodes the history in order.
+      class const_iterator {
+        public:
+          const_iterator(const PacketHistory *history_, uint64_t index_)
+              : history(history_), chunk(history_->head), offset(0),
+                index(index_), block(0), position(0) {
+            if (index < history->num_entries) {
+              decode();
+            }
+          }
+
+          const PacketInfo& operator*() const {
+            return current;
+          }
+
+          const PacketInfo* operator->() const {
+            return &current;
+          }
+
+          const_iterator& operator++() {
+            if (++index < history->num_entries) {
+              decode();
+            }
+            return *this;
+          }
+
+          bool operator==(const const_iterator &it) const {
+            return index == it.index;
+          }
+
+          bool operator!=(const const_iterator &it) const {
+            return index != it.index;
+          }
+
+        private:
+          uint8_t nextByte() {
+            if (offset == CHUNK_BYTES) {
+              chunk = chunk->next;
+              offset = 0;
+            }
+            return chunk->items[offset++];
+          }
+
+          uint64_t nextVarint() {
+            uint64_t x = 0;
+            for (uint32_t shift = 0; ; shift += 7) {
+              uint8_t byte = nextByte();
+              x |= (uint64_t) (byte & 0x7f) << shift;
+              if (!(byte & 0x80)) {
+                return x;
+              }
+            }
+          }
+
+          void decode() {
+            if (!history->samples.empty()) {
+              current = history->samples[index];
+              return;
+            }
+            if (position < buffer.size() || block < history->blocks.size()) {
+              if (position == buffer.size()) {
+                history->decodeBlock(block++, current.t_arrival.microseconds(),
+                                     buffer);
+                position = 0;
+              }
+              current = buffer[position++];
+              return;
+            }
+            uint64_t t = current.t_arrival.microseconds()
+                         + archive::unzigzag(nextVarint());
+            uint64_t size = nextVarint();
+            current = PacketInfo(size & 1 ? -1 : 1, size >> 1, Time(t));
+          }
+
+        private:
+          const PacketHistory *history;
+          const ChunkType *chunk;
+          uint64_t offset;        // in chunk
+          uint64_t index;
+          uint64_t block;         // next block to decode
+          uint64_t position;      // in buffer
+          std::vector<PacketInfo> buffer;   // decoded block
+          PacketInfo current;
+      };
+
+    public:
+      explicit PacketHistory(Arena *arena_ = nullptr,
+                             const HistoryPolicy &policy_ = HistoryPolicy())
+          : head(nullptr), tail(nullptr), num_bytes(0), num_entries(0),
+            num_seen(0), random(0), block_bytes(0), t_sealed(0),
+            arena(arena_), policy(policy_) {}
+
+      ~PacketHistory() {
+        clear();
+      }
+
+      void add(const PacketInfo &info) {
+        ++num_seen;
+        switch (policy.mode) {
+          case HistoryPolicy::FULL:
+            append(info);
+            break;
+          case HistoryPolicy::FIRST_N:
+            if (num_entries < policy.max_packets) {
+              append(info);
+            }
+            break;
+          case HistoryPolicy::RESERVOIR:
+            sample(info);
+            break;
+          case HistoryPolicy::SUMMARY:
+            break;
+        }
+      }
+
+      // Gives the chunks back to the arena in O(1).
+      void clear() {
+        releaseChunks();
+        num_entries = 0;
+        std::vector<Block>().swap(blocks);
+        block_bytes = t_sealed = 0;
+        std::vector<PacketInfo>().swap(samples);
+      }
+
+      // Packets kept, see HistoryPolicy. Flow::size() counts all of them.
+      uint64_t size() const {
+        return num_entries;
+      }
+
+      bool empty() const {
+        return num_entries == 0;
+      }
+
+      // First and last packets kept, the history must not be empty.
+      PacketInfo front() const {
+        return *begin();
+      }
+
+      PacketInfo back() const {
+        return last;
+      }
+
+      const_iterator begin() const {
+        return const_iterator(this, 0);
+      }
+
+      const_iterator end() const {
+        return const_iterator(this, num_entries);
+      }
+
+      const HistoryPolicy& getPolicy() const {
+        return policy;
+      }
+
+      // Size of the encoded history: sealed blocks and open chunks.
+      uint64_t encodedBytes() const {
+        return block_bytes + num_bytes;
+      }
+
+      // Chunks of the stream not sealed into blocks yet.
+      uint64_t numChunks() const {
+        return (num_bytes + CHUNK_BYTES - 1) / CHUNK_BYTES;
+      }
+
+      uint64_t numBlocks() const {
+        return blocks.size();
+      }
+
+      // Size of the sealed blocks.
+      uint64_t blockBytes() const {
+        return block_bytes;
+      }
+
+    private:
+      // BLOCK_PACKETS packets of the stream. The first packet is at
+      // t_first, the columns hold the zigzag time delta to the previous
+      // packet (0 for the first one) and the size shifted left by one with
+      // the direction in the low bit. Blocks with a time gap too large for
+      // a column, or that columns do not make smaller, keep the stream.
+      struct Block {
+        uint64_t t_first;
+        bool columns;
+        std::string data;
+      };
+
+    private:
+      PacketHistory(const PacketHistory&);
+      PacketHistory& operator=(const PacketHistory&);
+
+      void putByte(uint8_t byte) {
+        if (num_bytes % CHUNK_BYTES == 0) {
+          ChunkType *chunk = newChunk();
+          if (tail) {
+            tail->next = chunk;
+          } else {
+            head = chunk;
+          }
+          tail = chunk;
+        }
+        tail->items[num_bytes++ % CHUNK_BYTES] = byte;
+      }
+
+      void putVarint(uint64_t x) {
+        while (x >= 0x80) {
+          putByte((x & 0x7f) | 0x80);
+          x >>= 7;
+        }
+        putByte(x);
+      }
+
+      void append(const PacketInfo &info) {
+        uint64_t t = info.t_arrival.microseconds();
+        uint64_t t_previous = num_entries ? last.t_arrival.microseconds() : 0;
+        putVarint(archive::zigzag(t - t_previous));
+        putVarint(((uint64_t) info.size << 1) | (info.updown == -1));
+        last = info;
+        if (++num_entries % BLOCK_PACKETS == 0) {
+          seal();
+        }
+      }
+
+      // Turns the stream in the chunks, BLOCK_PACKETS packets, into a
+      // block and gives the chunks back.
+      void seal() {
+        std::string stream(num_bytes, 0);
+        const ChunkType *chunk = head;
+        for (uint64_t offset = 0; offset < num_bytes; offset += CHUNK_BYTES) {
+          std::memcpy(&stream[offset], chunk->items,
+                      std::min(CHUNK_BYTES, num_bytes - offset));
+          chunk = chunk->next;
+        }
+        std::vector<uint32_t> deltas(BLOCK_PACKETS), sizes(BLOCK_PACKETS);
+        const uint8_t *p = reinterpret_cast<const uint8_t*>(stream.data());
+        uint64_t t_first = 0, delta, size;
+        bool fits = true;
+        for (uint64_t i = 0; i < BLOCK_PACKETS; ++i) {
+          p = archive::getVarint(p, delta);
+          p = archive::getVarint(p, size);
+          if (i == 0) {
+            t_first = t_sealed + archive::unzigzag(delta);
+            delta = 0;
+          }
+          fits = fits && delta <= UINT32_MAX;
+          deltas[i] = delta;
+          sizes[i] = size;
+        }
+        blocks.push_back(Block());
+        Block &block = blocks.back();
+        block.t_first = t_first;
+        block.columns = false;
+        if (fits) {
+          archive::Dictionary<uint32_t> dictionary;
+          std::vector<uint32_t> codes;
+          archive::putColumn(block.data, deltas.data(), BLOCK_PACKETS,
+                             dictionary, codes);
+          archive::putColumn(block.data, sizes.data(), BLOCK_PACKETS,
+                             dictionary, codes);
+          block.data.append(archive::PADDING, 0);
+          block.columns = block.data.size() < stream.size();
+        }
+        if (!block.columns) {
+          block.data.swap(stream);
+        }
+        block.data.shrink_to_fit();
+        block_bytes += block.data.size();
+        t_sealed = last.t_arrival.microseconds();
+        releaseChunks();
+      }
+
+      // Decodes block i, whose first packet follows one at t_previous.
+      void decodeBlock(uint64_t i, uint64_t t_previous,
+                       std::vector<PacketInfo> &out) const {
+        const Block &block = blocks[i];
+        const uint8_t *p = reinterpret_cast<const uint8_t*>(
+            block.data.data());
+        out.resize(BLOCK_PACKETS);
+        if (!block.columns) {
+          uint64_t t = t_previous, delta, size;
+          for (uint64_t j = 0; j < BLOCK_PACKETS; ++j) {
+            p = archive::getVarint(p, delta);
+            p = archive::getVarint(p, size);
+            t += archive::unzigzag(delta);
+            out[j] = PacketInfo(size & 1 ? -1 : 1, size >> 1, Time(t));
+          }
+          return;
+        }
+        uint64_t t = block.t_first;
+        p = archive::getColumn(p, BLOCK_PACKETS,
+                               [&out, &t](uint64_t j, uint32_t delta) {
+                                 t += archive::unzigzag(delta);
+                                 out[j].t_arrival = Time(t);
+                               });
+        archive::getColumn(p, BLOCK_PACKETS,
+                           [&out](uint64_t j, uint32_t size) {
+                             out[j].updown = size & 1 ? -1 : 1;
+                             out[j].size = size >> 1;
+                           });
+      }
+
+      void releaseChunks() {
+        if (head) {
+          if (arena) {
+            arena->releaseChain(head, tail, numChunks());
+          } else {
+            while (head) {
+              ChunkType *next = head->next;
+              delete head;
+              head = next;
+            }
+          }
+        }
+        head = tail = nullptr;
+        num_bytes = 0;
+      }
+
+      // Packet k (from 1) replaces a random sample with probability
+      // max_packets / k. The replaced sample is dropped and the new one
+      // goes at the end, which keeps samples in arrival order.
+      void sample(const PacketInfo &info) {
+        if (policy.max_packets == 0) {
+          return;
+        }
+        if (num_seen == 1) {
+          // Flows draw different samples.
+          random = hash::mix64(policy.seed ^ info.t_arrival.microseconds());
+        }
+        if (samples.size() < policy.max_packets) {
+          samples.push_back(info);
+        } else {
+          uint64_t j = hash::combine(random, num_seen) % num_seen;
+          if (j >= policy.max_packets) {
+            return;
+          }
+          samples.erase(samples.begin() + j);
+          samples.push_back(info);
+        }
+        num_entries = samples.size();
+        last = info;
+      }
+
+      ChunkType* newChunk() {
+        if (arena) {
+          return arena->allocate();
+        }
+        ChunkType *chunk = new ChunkType;
+        chunk->next = nullptr;
+        return chunk;
+      }
+
+    private:
+      ChunkType *head;
+      ChunkType *tail;
+      uint64_t num_bytes;      // of the stream in chunks
+      uint64_t num_entries;    // packets kept
+      uint64_t num_seen;       // packets added
+      uint64_t random;         // RESERVOIR sampling seed of the flow
+      PacketInfo last;         // last packet kept
+      std::vector<Block> blocks;         // sealed stream
+      uint64_t block_bytes;              // of the blocks
+      uint64_t t_sealed;                 // last packet of the blocks
+      std::vector<PacketInfo> samples;   // RESERVOIR
+      Arena *arena;
+      HistoryPolicy policy;
+  };
+
+} // namespace pnet
+
+#endif // PNET_FLOW_HISTORY_HPP_
@@ -0,0 +1,199 @@
+#ifndef PNET_FLOW_INDEX_HPP_
+#define PNET_FLOW_INDEX_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <pnet_metrics.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Flat open-addressing hash index from keys of type K to pointers of T.
+  //
+  // Each slot keeps a pointer to the stored object together with its full
+  // hash (0 marks an empty slot). The low bits of the hash pick the home
+  // slot, and the entries of a probe run share most of them; ShardedFlowTable
+  // picks shards by the top bits, shared by all entries of a shard. Probes
+  // compare the whole hash, so the remaining bits still tell entries apart.
+  // Probes walk the slots linearly (4 slots per cache line) and touch the
+  // object only when the hash matches, so a lookup costs one cache miss for
+  // the slot and one for the object, and failed probes almost never touch
+  // the objects.
+  //
+  // Collisions are resolved with linear probing. Deletions shift the
+  // following entries backwards, hence there are no tombstones and probe
+  // lengths do not degrade under heavy insert/expire traffic.
+  //
+  // The caller provides the hash value. T must be comparable to K via
+  // K::operator==(const K&), which is the case for Flow and Key.
+  template <typename K, typename T>
+  class FlowIndex {
+
+    public:
+      static const uint64_t MIN_CAPACITY = 16;
+
+    public:
+      explicit FlowIndex(uint64_t size_hint = 0)
+          : slots(nullptr), mask(0), num_elements(0) {
+        allocate(capacityFor(size_hint));
+      }
+
+      ~FlowIndex(){
+        std::free(slots);
+      }
+
+      // Returns the object with the given key, nullptr if not found.
+      T* find(const K &key, uint64_t hash) const {
+        hash = slotHash(hash);
+        uint64_t probes = 1;
+        for (uint64_t i = hash & mask; slots[i].hash;
+             i = (i + 1) & mask, ++probes) {
+          if (slots[i].hash == hash && key == *slots[i].value) {
+            PNET_METRIC_RECORD(PROBE_LENGTH, probes);
+            return slots[i].value;
+          }
+        }
+        PNET_METRIC_RECORD(PROBE_LENGTH, probes);
+        return nullptr;
+      }
+
+      // Inserts a new object. The key must not be in the index already.
+      void insert(uint64_t hash, T *value) {
+        ASSERT_TRUE(value, "FlowIndex:: Trying to insert null pointer");
+        if ((num_elements + 1) * 4 > capacity() * 3) {
+          rehash(capacity() * 2);
+        }
+        place(slotHash(hash), value);
+        ++num_elements;
+      }
+
+      // Removes the entry pointing to the given object.
+      // Returns false if the object is not in the index.
+      bool erase(const T *value, uint64_t hash) {
+        hash = slotHash(hash);
+        for (uint64_t i = hash & mask; slots[i].hash; i = (i + 1) & mask) {
+          if (slots[i].value == value) {
+            shiftBack(i);
+            --num_elements;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      // Removes all entries, keeps the capacity.
+      void clear() {
+        for (uint64_t i = 0; i <= mask; ++i) {
+          slots[i].hash = 0;
+        }
+        num_elements = 0;
+      }
+
+      uint64_t size() const {
+        return num_elements;
+      }
+
+      bool empty() const {
+        return num_elements == 0;
+      }
+
+      uint64_t capacity() const {
+        return mask + 1;
+      }
+
+      // Average number of slots visited by a successful lookup.
+      double averageProbeLength() const {
+        if (num_elements == 0) {
+          return 0;
+        }
+        uint64_t total = 0;
+        for (uint64_t i = 0; i <= mask; ++i) {
+          if (slots[i].hash != 0) {
+            total += ((i - (slots[i].hash & mask)) & mask) + 1;
+          }
+        }
+        return (double) total / num_elements;
+      }
+
+    private:
+      struct Slot {
+        uint64_t hash;
+        T *value;
+      };
+
+    private:
+      FlowIndex(const FlowIndex&);
+      FlowIndex& operator=(const FlowIndex&);
+
+      // Zero is reserved for empty slots.
+      static uint64_t slotHash(uint64_t hash) {
+        return hash ? hash : 1;
+      }
+
+      // Smallest power of two keeping the load factor below 3/4.
+      static uint64_t capacityFor(uint64_t size_hint) {
+        uint64_t capacity = MIN_CAPACITY;
+        while (capacity * 3 < size_hint * 4) {
+          capacity *= 2;
+        }
+        return capacity;
+      }
+
+      void allocate(uint64_t capacity) {
+        // calloc'ed memory is mapped lazily, so large size hints do not
+        // cost resident memory until the slots are actually used.
+        slots = (Slot*) std::calloc(capacity, sizeof(Slot));
+        ASSERT_TRUE(slots, "FlowIndex:: Unable to allocate memory");
+        mask = capacity - 1;
+      }
+
+      void place(uint64_t hash, T *value) {
+        uint64_t i = hash & mask;
+        while (slots[i].hash != 0) {
+          i = (i + 1) & mask;
+        }
+        slots[i].hash = hash;
+        slots[i].value = value;
+      }
+
+      // Slots keep the hashes, so growing never touches the stored objects.
+      void rehash(uint64_t new_capacity) {
+        Slot *old_slots = slots;
+        uint64_t old_capacity = capacity();
+        allocate(new_capacity);
+        for (uint64_t i = 0; i < old_capacity; ++i) {
+          if (old_slots[i].hash != 0) {
+            place(old_slots[i].hash, old_slots[i].value);
+          }
+        }
+        std::free(old_slots);
+      }
+
+      // Backward shift deletion: pull each following entry of the cluster
+      // into the hole unless that would move it before its home slot.
+      void shiftBack(uint64_t hole) {
+        uint64_t j = hole;
+        while (true) {
+          j = (j + 1) & mask;
+          if (slots[j].hash == 0) {
+            break;
+          }
+          uint64_t home = slots[j].hash & mask;
+          if (((j - home) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots[j];
+            hole = j;
+          }
+        }
+        slots[hole].hash = 0;
+      }
+
+    private:
+      Slot *slots;
+      uint64_t mask;
+      uint64_t num_elements;
+  };
+
+} // namespace pnet
+
+#endif // PNET_FLOW_INDEX_HPP_
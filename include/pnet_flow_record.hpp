@@ -0,0 +1,318 @@
+#ifndef PNET_FLOW_RECORD_HPP_
+#define PNET_FLOW_RECORD_HPP_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <inttypes.h>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <pnet_compress.hpp>
+#include <pnet_flow_features.hpp>
+#include <pnet_packet.hpp>
+#include <pnet_time.hpp>
+#include <pnet_utils.hpp>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "flow record files are little-endian"
+#endif
+
+namespace pnet {
+
+  // Binary flow record files (.flr, .flr.gz), written by FlowRecorder.
+  //
+  // A HEADER_SIZE header followed by fixed-width records of record_size
+  // bytes: a FlowRecord, then a FlowRecordExtra if the EXTRA_COUNTERS flag
+  // is set, then FlowFeatures if the FEATURES flag is set. Integers are
+  // little-endian, addresses and ports are kept as in Key, in network byte
+  // order. Readers skip whatever follows the fields they know in a record,
+  // so that fields can be added later.
+  namespace flow_record {
+
+    const char MAGIC[] = "PNETFLR";
+    const uint32_t VERSION = 1;
+    const uint64_t HEADER_SIZE = 32;
+
+    // Header flags.
+    const uint32_t EXTRA_COUNTERS = 0x1;
+    const uint32_t FEATURES = 0x2;
+
+    struct Header {
+      char magic[8];
+      uint32_t version;
+      uint32_t record_size;
+      uint32_t flags;
+      uint32_t reserved[3];
+    };
+
+  } // namespace flow_record
+
+  // How a flow was admitted into its table, see AdmissionControl:
+  //    - NONE: every flow is kept,
+  //    - FLOW: the flow was kept with probability 1 / rate, with all its
+  //      packets,
+  //    - HOLD: each packet before the first kept one was kept with
+  //      probability 1 / rate, and all packets from then on.
+  namespace sampling {
+    enum Mode { NONE = 0, FLOW = 1, HOLD = 2 };
+  } // namespace sampling
+
+  // Summary of a flow. Times are in microseconds.
+  struct FlowRecord {
+    Key key;              // 16 bytes
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t t_first;     // first packet
+    uint64_t t_last;      // last packet
+    uint16_t tcp_flags;   // union of the TCP flags of all packets
+    uint16_t sampling_rate;   // 1-in-N, zero or one if not sampled
+    uint8_t sampling_mode;    // sampling::Mode
+    uint8_t reserved[3];
+    // 56 bytes in total.
+
+    // Unbiased estimates from a sampled flow: the number of flows it
+    // stands for, and its number of packets. With HOLD sampling, the
+    // packets missed before the flow was held are 1 / p - 1 on average,
+    // and the flow is kept with probability 1 - (1 - p)^packets.
+    double weight() const {
+      if (sampling_rate <= 1) {
+        return 1;
+      }
+      if (sampling_mode == sampling::FLOW) {
+        return sampling_rate;
+      }
+      double p = 1.0 / sampling_rate;
+      return 1 / (1 - std::pow(1 - p, estimatedPackets()));
+    }
+
+    double estimatedPackets() const {
+      if (sampling_mode == sampling::HOLD && sampling_rate > 1) {
+        return packets + sampling_rate - 1;
+      }
+      return packets;
+    }
+
+    // Text form of Flow::toString(), tab separated:
+    //   ip_src port_src ip_dst port_dst protocol packets bytes t_first t_last
+    std::string toString() const {
+      char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &key.ip_src, src, sizeof(src));
+      inet_ntop(AF_INET, &key.ip_dst, dst, sizeof(dst));
+      char buffer[160];
+      int n = std::snprintf(buffer, sizeof(buffer),
+          "%-15s\t%5d\t%-15s\t%5d\t%2d\t%" PRIu64 "\t%" PRIu64
+          "\t%010" PRIu64 ".%06" PRIu64 "\t%010" PRIu64 ".%06" PRIu64,
+          src, ntohs(key.port_src), dst, ntohs(key.port_dst), key.protocol,
+          packets, bytes, t_first / 1000000, t_first % 1000000,
+          t_last / 1000000, t_last % 1000000);
+      return std::string(buffer, n);
+    }
+
+    // Parses toString(). TCP flags are not part of the text form.
+    bool fromString(const std::string &source) {
+      std::istringstream sin(source);
+      std::string src, dst, first, last;
+      uint16_t port1, port2;
+      *this = FlowRecord();
+      if (!(sin >> src >> port1 >> dst >> port2 >> key.protocol >> packets
+                >> bytes >> first >> last)
+          || inet_pton(AF_INET, src.c_str(), &key.ip_src) != 1
+          || inet_pton(AF_INET, dst.c_str(), &key.ip_dst) != 1) {
+        return false;
+      }
+      key.port_src = htons(port1);
+      key.port_dst = htons(port2);
+      t_first = Time(first).microseconds();
+      t_last = Time(last).microseconds();
+      return true;
+    }
+  };
+
+  // Optional per-direction counters, up is the direction of the first
+  // packet of the flow.
+  struct FlowRecordExtra {
+    uint64_t packets_up;
+    uint64_t bytes_up;
+  };
+
+  // Reads a .flr or .flr.gz file.
+  //
+  // .flr files are memory-mapped and records are used in place, nothing
+  // is copied or parsed. Compressed files are inflated in-process into
+  // anonymous memory first.
+  class FlowRecordReader {
+
+    public:
+      class const_iterator
+          : public std::iterator<std::forward_iterator_tag, FlowRecord,
+                                 int64_t, const FlowRecord*,
+                                 const FlowRecord&> {
+        public:
+          const_iterator(const uint8_t *p_, uint64_t stride_)
+              : p(p_), stride(stride_) {}
+          const FlowRecord& operator*() const {
+            return *reinterpret_cast<const FlowRecord*>(p);
+          }
+          const FlowRecord* operator->() const { return &**this; }
+          const_iterator& operator++() { p += stride; return *this; }
+          bool operator==(const const_iterator &rhs) const {
+            return p == rhs.p;
+          }
+          bool operator!=(const const_iterator &rhs) const {
+            return p != rhs.p;
+          }
+        private:
+          const uint8_t *p;
+          uint64_t stride;
+      };
+
+    public:
+      // Reads all records, or the first max_records if set: compressed
+      // files are then inflated only up to there.
+      explicit FlowRecordReader(const std::string &filename,
+                                int64_t max_records = -1)
+          : data(nullptr), map_size(0), records(nullptr), num_records(0),
+            record_size(0), flags(0), features_offset(0) {
+        if (!utils::fileExists(filename)) {
+          FATAL("FlowRecordReader:: file not found: " + filename);
+        }
+        if (utils::stringEndsWith(filename, {".flr.gz"})) {
+          uint64_t max_size = UINT64_MAX;
+          if (max_records >= 0) {
+            // The record size is in the header, inflated on its own first.
+            flow_record::Header header;
+            GzipReader gz(filename);
+            if (gz.read(&header, sizeof(header)) == sizeof(header)) {
+              max_size = flow_record::HEADER_SIZE
+                         + max_records * header.record_size;
+            }
+          }
+          data = static_cast<uint8_t*>(inflateFile(filename, map_size,
+                                                   max_size));
+        } else if (utils::stringEndsWith(filename, {".flr"})) {
+          mapFile(filename);
+        } else {
+          FATAL("FlowRecordReader:: not a flr file: " + filename);
+        }
+        if (map_size == 0) {
+          return;
+        }
+        flow_record::Header header;
+        if (map_size < flow_record::HEADER_SIZE
+            || std::memcmp(data, flow_record::MAGIC,
+                           sizeof(flow_record::MAGIC))) {
+          FATAL("FlowRecordReader:: not a flr file: " + filename);
+        }
+        std::memcpy(&header, data, sizeof(header));
+        record_size = header.record_size;
+        flags = header.flags;
+        features_offset = sizeof(FlowRecord)
+                          + (hasExtraCounters() ? sizeof(FlowRecordExtra) : 0);
+        uint64_t min_size = hasFeatures()
+                            ? features_offset + sizeof(FlowFeatures)
+                            : features_offset;
+        if (header.version != flow_record::VERSION
+            || record_size < min_size || record_size % 8 != 0) {
+          FATAL("FlowRecordReader:: unsupported flr file: " + filename);
+        }
+        records = data + flow_record::HEADER_SIZE;
+        // A truncated last record is ignored.
+        num_records = (map_size - flow_record::HEADER_SIZE) / record_size;
+        if (max_records >= 0) {
+          num_records = std::min(num_records, (uint64_t) max_records);
+        }
+      }
+
+      ~FlowRecordReader() {
+        if (data) {
+          munmap(data, map_size);
+        }
+      }
+
+      uint64_t size() const {
+        return num_records;
+      }
+
+      const FlowRecord& operator[](uint64_t i) const {
+        return *reinterpret_cast<const FlowRecord*>(records
+                                                    + i * record_size);
+      }
+
+      const_iterator begin() const {
+        return const_iterator(records, record_size);
+      }
+
+      const_iterator end() const {
+        return const_iterator(records + num_records * record_size,
+                              record_size);
+      }
+
+      bool hasExtraCounters() const {
+        return flags & flow_record::EXTRA_COUNTERS;
+      }
+
+      // Only if hasExtraCounters().
+      const FlowRecordExtra& extra(uint64_t i) const {
+        return *reinterpret_cast<const FlowRecordExtra*>(
+            records + i * record_size + sizeof(FlowRecord));
+      }
+
+      bool hasFeatures() const {
+        return flags & flow_record::FEATURES;
+      }
+
+      // Only if hasFeatures().
+      const FlowFeatures& features(uint64_t i) const {
+        return *reinterpret_cast<const FlowFeatures*>(
+            records + i * record_size + features_offset);
+      }
+
+      uint32_t recordSize() const {
+        return record_size;
+      }
+
+    private:
+      FlowRecordReader(const FlowRecordReader&);
+      FlowRecordReader& operator=(const FlowRecordReader&);
+
+      void mapFile(const std::string &filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+          FATAL("FlowRecordReader:: cannot open file: " + filename);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          map_size = st.st_size;
+          void *memory = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (memory == MAP_FAILED) {
+            ::close(fd);
+            FATAL("FlowRecordReader:: cannot map file: " + filename);
+          }
+          madvise(memory, map_size, MADV_SEQUENTIAL);
+          data = static_cast<uint8_t*>(memory);
+        }
+        ::close(fd);
+      }
+
+    private:
+      uint8_t *data;
+      uint64_t map_size;
+      const uint8_t *records;
+      uint64_t num_records;
+      uint32_t record_size;
+      uint32_t flags;
+      uint32_t features_offset;   // in a record
+  };
+
+} // namespace pnet
+
+#endif // PNET_FLOW_RECORD_HPP_
@@ -0,0 +1,260 @@
+#ifndef PNET_FLOW_SHARDS_HPP_
+#define PNET_FLOW_SHARDS_HPP_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <pnet_flow.hpp>
+#include <pnet_spsc_ring.hpp>
+
+namespace pnet {
+
+  // Multi-core flow table.
+  //
+  // Packets are partitioned by the direction-symmetric hash of their Key
+  // over N FlowTable shards, so both directions of a flow always land in
+  // the same shard. Each shard is owned by its own worker thread and fed
+  // through a single-producer/single-consumer ring. The thread calling
+  // insert() is the only producer: it collects packets into per-shard
+  // batches and hands over a whole batch at once.
+  //
+  // Aggregated results (FSD, flow counts) are read after sync(), which
+  // drains all rings and brings every shard to the same time.
+  //
+  // Idle workers sleep in SpscRing::popWait() (see WaitPolicy) and are
+  // woken by the next batch; the destructor closes the rings to stop them.
+  class ShardedFlowTable {
+
+    public:
+      static const uint64_t BATCH_SIZE = 256;
+      static const uint64_t QUEUE_SIZE = 65536;  // packets per shard
+
+    public:
+      // Input:
+      //    - num_shards: number of shards (worker threads).
+      //    - recorder_: shared by all shards to record expired flows.
+      //    - hash_seed_: keys the flow hash.
+      ShardedFlowTable(uint32_t num_shards, FlowRecorder *recorder_ = nullptr,
+                       uint64_t hash_seed_ = 0)
+          : hash_seed(hash_seed_), packet_counter(0) {
+        ASSERT_TRUE(num_shards > 0, "ShardedFlowTable:: No shards");
+        for (uint32_t i = 0; i < num_shards; ++i) {
+          shards.push_back(new Shard(recorder_, hash_seed,
+                           FlowTable::HASH_SIZE_HINT / num_shards));
+        }
+        for (Shard *shard : shards) {
+          shard->worker = std::thread(&ShardedFlowTable::work, this, shard);
+        }
+      }
+
+      ~ShardedFlowTable(){
+        sync();
+        for (Shard *shard : shards) {
+          shard->queue.close();
+        }
+        for (Shard *shard : shards) {
+          shard->worker.join();
+          delete shard;
+        }
+      }
+
+      // Must be called before the first packet.
+      void setExpiryPolicy(const ExpiryPolicy &policy){
+        for (Shard *shard : shards) {
+          shard->table.setExpiryPolicy(policy);
+        }
+      }
+
+      // Must be called before the first packet.
+      void setHistoryPolicy(const HistoryPolicy &history){
+        for (Shard *shard : shards) {
+          shard->table.setHistoryPolicy(history);
+        }
+      }
+
+      // Dispatches the packet to its shard.
+      void insert(const Packet &pkt){
+        if (packet_counter == 0) {
+          t_first_packet = pkt.t_arrival;
+        }
+        t_last_packet = pkt.t_arrival;
+        ++packet_counter;
+
+        Shard *shard = shards[shardOf(pkt)];
+        shard->batch[shard->batch_size++] = pkt;
+        if (shard->batch_size == BATCH_SIZE) {
+          send(shard);
+        }
+      }
+
+      // Sends all pending batches and waits until every shard has processed
+      // them. Then expires flows of all shards up to the last packet time,
+      // so that shards with little traffic are not behind the others.
+      // Shards are idle until the next insert(), so their tables can be
+      // read safely from the calling thread.
+      void sync(){
+        for (Shard *shard : shards) {
+          send(shard);
+        }
+        for (Shard *shard : shards) {
+          while (shard->processed.load(std::memory_order_acquire)
+                 != shard->sent) {
+            std::this_thread::yield();
+          }
+          if (packet_counter > 0) {
+            shard->table.expireFlows(t_last_packet);
+          }
+        }
+      }
+
+      // Must be called before the first packet.
+      void setFeatureExtraction(bool enable){
+        for (Shard *shard : shards) {
+          shard->table.setFeatureExtraction(enable);
+        }
+      }
+
+      // Must be called before the first packet.
+      void setFlowBinning(const FlowBinning &binning){
+        for (Shard *shard : shards) {
+          shard->table.setFlowBinning(binning);
+        }
+      }
+
+      // Sum of the FSD's of all shards.
+      std::vector<uint64_t> getCurrentFSD(uint16_t proto = 0){
+        return getDistributions(proto).packets;
+      }
+
+      // Sum of the flow distributions of all shards.
+      FlowDistributionSnapshot getDistributions(uint16_t proto = 0){
+        sync();
+        FlowDistributionSnapshot sum;
+        for (Shard *shard : shards) {
+          FlowDistributionSnapshot counts =
+              shard->table.getDistributions(proto);
+          if (sum.packets.empty()) {
+            sum = counts;
+            continue;
+          }
+          sum.num_flows += counts.num_flows;
+          add(sum.packets, counts.packets);
+          add(sum.bytes, counts.bytes);
+          add(sum.duration, counts.duration);
+        }
+        return sum;
+      }
+
+      // Number of flows currently in the table.
+      uint64_t numFlows(){
+        sync();
+        uint64_t num_flows = 0;
+        for (Shard *shard : shards) {
+          num_flows += shard->table.flows.num_elements;
+        }
+        return num_flows;
+      }
+
+      // Number of flows expired so far.
+      uint64_t numExpiredFlows(){
+        sync();
+        uint64_t num_expired = 0;
+        for (Shard *shard : shards) {
+          num_expired += shard->table.num_expired_flows;
+        }
+        return num_expired;
+      }
+
+      // Records and removes all flows of all shards.
+      void Flush(){
+        sync();
+        for (Shard *shard : shards) {
+          shard->table.Flush();
+        }
+      }
+
+      Time upTime(){
+        return t_last_packet - t_first_packet;
+      }
+
+      uint64_t numShards() const {
+        return shards.size();
+      }
+
+      // Direct access to a shard. Call sync() first.
+      FlowTable& shard(uint32_t i){
+        return shards[i]->table;
+      }
+
+    private:
+      struct Shard {
+        Shard(FlowRecorder *recorder, uint64_t seed, uint64_t size_hint)
+            : table(recorder, seed, size_hint), queue(QUEUE_SIZE),
+              batch_size(0), sent(0), processed(0) {}
+
+        FlowTable table;
+        SpscRing<Packet> queue;
+        std::thread worker;
+        // Producer side
+        Packet batch[BATCH_SIZE];
+        uint64_t batch_size;
+        uint64_t sent;
+        // Consumer side
+        char padding[PNET_CACHE_LINE];
+        std::atomic<uint64_t> processed;
+      };
+
+    private:
+      // The flow index inside each shard picks home slots by the low bits
+      // of the same hash, so shards are chosen by the top bits. All flows
+      // of a shard share those, FlowIndex compares whole hashes anyway.
+      uint32_t shardOf(const Key &key) const {
+        uint64_t high = key.hash(hash_seed) >> 32;
+        return (uint32_t) ((high * shards.size()) >> 32);
+      }
+
+      static void add(std::vector<uint64_t> &sum,
+                      const std::vector<uint64_t> &counts){
+        for (uint64_t i = 0; i < sum.size(); ++i) {
+          sum[i] += counts[i];
+        }
+      }
+
+      void send(Shard *shard){
+        if (shard->batch_size > 0) {
+          shard->queue.pushAll(shard->batch, shard->batch_size);
+          shard->sent += shard->batch_size;
+          shard->batch_size = 0;
+        }
+      }
+
+      // Runs until the ring is closed and drained.
+      void work(Shard *shard){
+        Packet batch[BATCH_SIZE];
+        while (true) {
+          uint64_t n = shard->queue.popWait(batch, BATCH_SIZE);
+          if (n == 0) {
+            if (shard->queue.closed()) {
+              break;
+            }
+            continue;   // interrupted by a signal
+          }
+          for (uint64_t i = 0; i < n; ++i) {
+            shard->table.insert(batch[i]);
+          }
+          shard->processed.fetch_add(n, std::memory_order_release);
+        }
+      }
+
+    private:
+      std::vector<Shard*> shards;
+      uint64_t hash_seed;
+      uint64_t packet_counter;
+      Time t_first_packet;
+      Time t_last_packet;
+  };
+
+} // namespace pnet
+
+#endif // PNET_FLOW_SHARDS_HPP_
@@ -0,0 +1,30 @@
+#ifndef PNET_HASH_HPP_
+#define PNET_HASH_HPP_
+
+#include <cstdint>
+
+namespace pnet {
+
+  namespace hash {
+
+    // 64-bit finalizer of MurmurHash3. Every input bit affects every output
+    // bit, so low bits of the result can be used directly as table indices.
+    inline uint64_t mix64(uint64_t x) {
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdULL;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53ULL;
+      x ^= x >> 33;
+      return x;
+    }
+
+    // Combines two 64-bit words into a single well mixed hash value.
+    inline uint64_t combine(uint64_t h, uint64_t word) {
+      return mix64(h ^ (word + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+    }
+
+  } // namespace hash
+
+} // namespace pnet
+
+#endif // PNET_HASH_HPP_
@@ -1,13 +1,17 @@
 #ifndef PNET_INTERFACE_HPP_
 #define PNET_INTERFACE_HPP_
 
+#include <pnet_afpacket.hpp>
+#include <pnet_decoder.hpp>
+#include <pnet_pcap.hpp>
 #include <pnet_shared_buffer.hpp>
+#include <pnet_text.hpp>
 
 /*  This class is implemented with a Factory Design pattern
   You cannot create a NetworkInterface by calling constructor.
   The only way to create one is to call the static function
-  FSDServerController::CreateInterface() which creates one for
-  you according to the Flags.
+  NetworkInterface::createInterface() which creates one for
+  you according to the name of the device or file.
 */
 
 namespace pnet {
@@ -17,10 +21,18 @@ namespace pnet {
     friend class NetworkListener;
 
     public:
-      NetworkInterface() : listening_(false), live_(false) { }
+      // Packets are produced in batches of BATCH_SIZE.
+      static const uint64_t BATCH_SIZE = 256;
+
+    public:
+      NetworkInterface()
+          : shared_buffer_(nullptr), flow_table_(nullptr), is_open_(false),
+            listening_(false), live_(false), num_packets_(0) { }
       virtual ~NetworkInterface() {}
 
-    protected:
+      static NetworkInterface* createInterface(const std::string &name);
+
+    public:
       virtual bool open(const std::string dev) = 0;
       virtual void loop() = 0;
       virtual void logStats() = 0;
@@ -29,36 +41,519 @@ namespace pnet {
         is_open_ = false;
         logStats();
         Logger::STDOUT("NetworkListener > Packets produced = "
-                       + std::to_string(shared_buffer_->getNumPacketsProcessed()));
+                       + std::to_string(num_packets_));
         Logger::STDOUT("NetworkListener > Closed.");
       }
 
+      // Packets go straight into the given table instead of the shared
+      // buffer, e.g. for offline processing in a single process.
+      void setFlowTable(FlowTable *flow_table) {
+        flow_table_ = flow_table;
+      }
+
+      void setSharedBuffer(SharedBuffer *shared_buffer) {
+        shared_buffer_ = shared_buffer;
+      }
+
+      void stop() {
+        listening_ = false;
+      }
+
+      uint64_t getNumPacketsProduced() const {
+        return num_packets_;
+      }
+
     protected:
       void scheduler();
-      void stop();
+
+      // Hands a batch of packets to the flow table or the shared buffer.
+      bool produce(const Packet *pkts, uint64_t n) {
+        num_packets_ += n;
+        PNET_METRIC_ADD(PACKETS_CAPTURED, n);
+        if (flow_table_) {
+          for (uint64_t i = 0; i < n; ++i) {
+            flow_table_->insert(pkts[i]);
+          }
+          return true;
+        }
+        return shared_buffer_->produce(pkts, n);
+      }
 
     protected:
       SharedBuffer *shared_buffer_;
+      FlowTable *flow_table_;
       bool is_open_;
       volatile bool listening_;  // is interface in listening mode?
       bool live_;                // is interface a live (or file) interface?
+      uint64_t num_packets_;     // packets produced
+
+  };
+
+
+  // Offline interface reading .pcap/.pcapng files (see PcapFile).
+  // Frames are decoded into Packets in batches, without per packet
+  // allocation.
+  class PcapInterface : public NetworkInterface {
+
+    public:
+      PcapInterface() : file_(nullptr) {}
+
+      ~PcapInterface() {
+        delete file_;
+      }
+
+      bool open(const std::string dev) {
+        if (!utils::fileExists(dev)) {
+          Logger::ERROR("PcapInterface > File not found: " + dev);
+          return false;
+        }
+        file_ = new PcapFile(dev);
+        filename_ = dev;
+        is_open_ = true;
+        live_ = false;
+        return true;
+      }
+
+      // Reads the whole file, or until stop() is called.
+      void loop() {
+        ASSERT_TRUE(is_open_, "PcapInterface:: not open");
+        Frame frames[BATCH_SIZE];
+        Packet packets[BATCH_SIZE];
+        listening_ = true;
+        timer_.tic();
+        while (listening_) {
+          uint64_t num_frames = file_->next(frames, BATCH_SIZE);
+          if (num_frames == 0) {
+            break;
+          }
+          uint64_t n = decoder_.decode(frames, num_frames, packets);
+          if (n > 0 && !produce(packets, n)) {
+            break;
+          }
+        }
+        elapsed_ = timer_.toc();
+        listening_ = false;
+      }
 
+      void logStats() {
+        double seconds = elapsed_.microseconds() / 1e6;
+        double pps = seconds > 0 ? num_packets_ / seconds : 0;
+        double mbps = seconds > 0 ? file_->position() / seconds / 1e6 : 0;
+        Logger::STDOUT("PcapInterface > " + filename_ + ": "
+                       + std::to_string(decoder_.num_decoded) + " packets, "
+                       + std::to_string(decoder_.num_failed)
+                       + " undecodable frames in "
+                       + elapsed_.toString() + " seconds ("
+                       + std::to_string((uint64_t) pps) + " packets/s, "
+                       + std::to_string((uint64_t) mbps) + " MB/s)");
+        if (decoder_.num_failed) {
+          Logger::STDOUT("PcapInterface > undecodable frames: "
+                         + decoder_.errorsToString());
+        }
+      }
+
+      const FrameDecoder& decoder() const {
+        return decoder_;
+      }
+
+    private:
+      PcapFile *file_;
+      std::string filename_;
+      FrameDecoder decoder_;
+      TicTocTimer timer_;
+      Time elapsed_;
   };
 
 
+  // Live capture from a network device through an AF_PACKET TPACKET_V3
+  // ring (see AfPacketRing). Frames are decoded straight from the ring.
+  //
+  // To spread an interface over several capture threads, open one
+  // LiveInterface per thread with the same fanout_group, each feeding its
+  // own FlowTable or buffer.
+  class LiveInterface : public NetworkInterface {
+
+    public:
+      static const int POLL_TIMEOUT_MS = 100;
+
+    public:
+      explicit LiveInterface(const AfPacketConfig &config = AfPacketConfig())
+          : config_(config) {}
+
+      void setConfig(const AfPacketConfig &config) {
+        config_ = config;
+      }
+
+      bool open(const std::string dev) {
+        if (!ring_.open(dev, config_)) {
+          Logger::ERROR("LiveInterface > " + dev + ": " + ring_.error());
+          return false;
+        }
+        dev_ = dev;
+        is_open_ = true;
+        live_ = true;
+        return true;
+      }
+
+      // Captures until stop() is called.
+      void loop() {
+        ASSERT_TRUE(is_open_, "LiveInterface:: not open");
+        Frame frames[BATCH_SIZE];
+        Packet packets[BATCH_SIZE];
+        listening_ = true;
+        timer_.tic();
+        while (listening_) {
+          uint64_t num_frames = ring_.next(frames, BATCH_SIZE,
+                                           POLL_TIMEOUT_MS);
+          uint64_t n = decoder_.decode(frames, num_frames, packets);
+          if (n > 0 && !produce(packets, n)) {
+            break;
+          }
+        }
+        elapsed_ = timer_.toc();
+        listening_ = false;
+      }
+
+      void close() {
+        NetworkInterface::close();
+        ring_.close();
+      }
+
+      void logStats() {
+        const AfPacketRing::Stats &stats = ring_.stats();
+        double seconds = elapsed_.microseconds() / 1e6;
+        double pps = seconds > 0 ? num_packets_ / seconds : 0;
+        Logger::STDOUT("LiveInterface > " + dev_ + ": "
+                       + std::to_string(stats.packets) + " received, "
+                       + std::to_string(stats.drops) + " dropped by kernel, "
+                       + std::to_string(stats.freezes) + " ring full, "
+                       + std::to_string(decoder_.num_failed)
+                       + " undecodable frames ("
+                       + std::to_string((uint64_t) pps) + " packets/s)");
+        if (decoder_.num_failed) {
+          Logger::STDOUT("LiveInterface > undecodable frames: "
+                         + decoder_.errorsToString());
+        }
+      }
+
+      // Kernel counters of the ring.
+      AfPacketRing::Stats stats() {
+        return ring_.stats();
+      }
+
+      const FrameDecoder& decoder() const {
+        return decoder_;
+      }
+
+    private:
+      AfPacketConfig config_;
+      AfPacketRing ring_;
+      std::string dev_;
+      FrameDecoder decoder_;
+      TicTocTimer timer_;
+      Time elapsed_;
+  };
+
+
+  // Configuration of a PktInterface.
+  //    - speed: 1 replays at the original speed, N at N times the original
+  //      speed, 0 as fast as the consumer takes the packets.
+  //    - SLEEP waits with nanosleep(), cheap but late by the scheduler
+  //      latency. SPIN polls the clock, precise but holds a core. HYBRID
+  //      sleeps until spin_threshold before the deadline, then spins.
+  //    - rewrite_timestamps: packets get the (wall clock) time at which
+  //      they are replayed, as a live capture would give them, instead of
+  //      the recorded one.
+  struct ReplayConfig {
+
+    enum Pacing { SLEEP, SPIN, HYBRID };
+
+    ReplayConfig(double speed_ = 1.0, Pacing pacing_ = HYBRID)
+        : speed(speed_), pacing(pacing_), spin_threshold(200),
+          rewrite_timestamps(false) {}
+
+    double speed;
+    Pacing pacing;
+    uint64_t spin_threshold;    // microseconds, HYBRID
+    bool rewrite_timestamps;
+  };
+
+
+  // Replays .pkt/.pkt.gz/.pka traces, as written by PacketRecorder, and
+  // .txt/.pkta/.pkta.gz text traces (see PacketTextCodec), into
+  // the shared buffer (or a flow table) for load tests and to reproduce
+  // incidents. Opens a trace file or a directory, whose files are replayed
+  // in order as one trace.
+  //
+  // Packets are scheduled against Time::now(): packet i is due at
+  // t_start + (t_i - t_0) / speed. Packets already due are produced in
+  // batches of up to BATCH_SIZE; a batch is handed over before waiting
+  // for a later packet, so that no packet is held back past its deadline.
+  // The lateness of each packet against its deadline is the pacing jitter.
+  class PktInterface : public NetworkInterface {
+
+    public:
+      // Lateness histogram, in microseconds.
+      static const uint64_t MAX_JITTER = 1024;
+
+    public:
+      explicit PktInterface(const ReplayConfig &config = ReplayConfig())
+          : config_(config), t_first_(0), t_last_(0),
+            jitter_(MAX_JITTER + 1, 0), max_jitter_(0) {
+        ASSERT_TRUE(config.speed >= 0, "PktInterface:: negative speed");
+      }
+
+      void setConfig(const ReplayConfig &config) {
+        ASSERT_TRUE(config.speed >= 0, "PktInterface:: negative speed");
+        config_ = config;
+      }
+
+      bool open(const std::string dev) {
+        const std::vector<std::string> extensions = {".pkt", ".pkt.gz",
+                                                     ".pka", ".txt", ".pkta",
+                                                     ".pkta.gz"};
+        files_.clear();
+        if (utils::directoryExists(dev)) {
+          files_ = utils::ls(dev, true, extensions);
+        } else if (utils::fileExists(dev)
+                   && utils::stringEndsWith(dev, extensions)) {
+          files_.push_back(dev);
+        }
+        if (files_.empty()) {
+          Logger::ERROR("PktInterface > No trace found: " + dev);
+          return false;
+        }
+        dev_ = dev;
+        is_open_ = true;
+        live_ = false;
+        return true;
+      }
+
+      // Replays all files, or until stop() is called.
+      void loop() {
+        ASSERT_TRUE(is_open_, "PktInterface:: not open");
+        Packet packets[BATCH_SIZE];
+        uint64_t n = 0;
+        bool first = true;
+        listening_ = true;
+        timer_.tic();
+        uint64_t t_start = Time::now().microseconds();
+        uint64_t wall_start = wallClock();
+        for (uint64_t f = 0; f < files_.size() && listening_; ++f) {
+          TraceFile reader(files_[f]);
+          PacketSpan span;
+          while (listening_ && !(span = reader.next(BATCH_SIZE)).empty()) {
+            for (const Packet &pkt : span) {
+              uint64_t t = pkt.t_arrival.microseconds();
+              if (first) {
+                t_first_ = t;
+                first = false;
+              }
+              t_last_ = std::max(t_last_, t);
+              uint64_t now = 0;
+              if (config_.speed > 0) {
+                // Traces may go back in time: such packets are due now.
+                uint64_t deadline = t_start + (t > t_first_
+                    ? (uint64_t) ((t - t_first_) / config_.speed) : 0);
+                now = Time::now().microseconds();
+                if (now < deadline) {
+                  if (n > 0 && !produce(packets, n)) {
+                    listening_ = false;
+                    break;
+                  }
+                  n = 0;
+                  now = waitUntil(deadline);
+                }
+                uint64_t late = now > deadline ? now - deadline : 0;
+                ++jitter_[std::min(late, MAX_JITTER)];
+                max_jitter_ = std::max(max_jitter_, late);
+              }
+              packets[n] = pkt;
+              if (config_.rewrite_timestamps) {
+                if (now == 0) {
+                  now = Time::now().microseconds();
+                }
+                packets[n].t_arrival = Time(wall_start + now - t_start);
+              }
+              if (++n == BATCH_SIZE) {
+                if (!produce(packets, n)) {
+                  listening_ = false;
+                  break;
+                }
+                n = 0;
+              }
+            }
+          }
+        }
+        if (n > 0 && listening_) {
+          produce(packets, n);
+        }
+        elapsed_ = timer_.toc();
+        listening_ = false;
+      }
+
+      void logStats() {
+        double seconds = elapsed_.microseconds() / 1e6;
+        Logger::STDOUT("PktInterface > " + dev_ + ": "
+                       + std::to_string(num_packets_) + " packets from "
+                       + std::to_string(files_.size()) + " files in "
+                       + elapsed_.toString() + " seconds ("
+                       + std::to_string((uint64_t) achievedRate())
+                       + " packets/s, target "
+                       + (config_.speed > 0
+                          ? std::to_string((uint64_t) targetRate())
+                            + " packets/s)"
+                          : std::string("max)")));
+        if (config_.speed > 0 && seconds > 0) {
+          Logger::STDOUT("PktInterface > jitter p50 "
+                         + std::to_string(jitter(0.5)) + " us, p99 "
+                         + std::to_string(jitter(0.99)) + " us, p99.9 "
+                         + std::to_string(jitter(0.999)) + " us, max "
+                         + std::to_string(max_jitter_) + " us");
+        }
+      }
+
+      // Packets per second of the recorded trace, times the speed.
+      double targetRate() const {
+        uint64_t duration = t_last_ - t_first_;
+        return duration > 0 ? num_packets_ * 1e6 * config_.speed / duration
+                            : 0;
+      }
+
+      // Packets per second actually produced.
+      double achievedRate() const {
+        uint64_t elapsed = elapsed_.microseconds();
+        return elapsed > 0 ? num_packets_ * 1e6 / elapsed : 0;
+      }
+
+      // Percentile p of the lateness of the packets against their
+      // deadlines, in microseconds, capped at MAX_JITTER.
+      uint64_t jitter(double p) const {
+        uint64_t total = 0;
+        for (uint64_t count : jitter_) {
+          total += count;
+        }
+        uint64_t rank = p * total, seen = 0;
+        for (uint64_t i = 0; i < jitter_.size(); ++i) {
+          seen += jitter_[i];
+          if (seen > rank) {
+            return i;
+          }
+        }
+        return 0;
+      }
+
+      uint64_t maxJitter() const {
+        return max_jitter_;
+      }
+
+      const std::vector<std::string>& files() const {
+        return files_;
+      }
+
+    private:
+      // Returns the time at which the wait ended.
+      uint64_t waitUntil(uint64_t deadline) {
+        uint64_t now = Time::now().microseconds();
+        uint64_t margin = config_.pacing == ReplayConfig::HYBRID
+                          ? config_.spin_threshold : 0;
+        if (config_.pacing != ReplayConfig::SPIN) {
+          while (now + margin < deadline && listening_) {
+            uint64_t wait = deadline - margin - now;
+            struct timespec ts = {(time_t) (wait / 1000000),
+                                  (long) (wait % 1000000 * 1000)};
+            nanosleep(&ts, nullptr);
+            now = Time::now().microseconds();
+          }
+        }
+        while (now < deadline && listening_) {
+          now = Time::now().microseconds();
+        }
+        return now;
+      }
+
+      // Time::now() is monotonic, packets carry wall clock times.
+      static uint64_t wallClock() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return Time(ts).microseconds();
+      }
+
+    private:
+      // One file of the trace: binary traces are streamed by PacketReader,
+      // text traces are parsed whole by PacketTextCodec.
+      class TraceFile {
+
+        public:
+          explicit TraceFile(const std::string &filename)
+              : reader(nullptr), cursor(0) {
+            if (utils::stringEndsWith(filename,
+                                      {".txt", ".pkta", ".pkta.gz"})) {
+              PacketTextCodec codec;
+              codec.readFile(filename, text);
+              if (codec.num_failed > 0) {
+                Logger::ERROR("PktInterface > "
+                              + std::to_string(codec.num_failed)
+                              + " malformed lines in " + filename);
+              }
+            } else {
+              reader = new PacketReader(filename);
+            }
+          }
+
+          ~TraceFile() { delete reader; }
+
+          PacketSpan next(uint64_t max_packets) {
+            if (reader) {
+              return reader->next(max_packets);
+            }
+            PacketSpan span = PacketSpan(text.data(), text.size())
+                .subspan(cursor, max_packets);
+            cursor += span.size();
+            return span;
+          }
+
+        private:
+          PacketReader *reader;
+          std::vector<Packet> text;
+          uint64_t cursor;
+
+          TraceFile(const TraceFile&);
+          TraceFile& operator=(const TraceFile&);
+      };
+
+    private:
+      ReplayConfig config_;
+      std::string dev_;
+      std::vector<std::string> files_;
+      uint64_t t_first_;         // first and last packet times of the trace
+      uint64_t t_last_;
+      std::vector<uint64_t> jitter_;
+      uint64_t max_jitter_;
+      TicTocTimer timer_;
+      Time elapsed_;
+  };
+
 
+  // Creates a PktInterface if name is a directory, a .pkt/.pkt.gz/.pka
+  // trace or a .txt/.pkta/.pkta.gz text trace, a PcapInterface if name is
+  // another existing capture file, and a LiveInterface on the device called
+  // name otherwise.
   NetworkInterface* NetworkInterface::createInterface(const std::string &name){
     NetworkInterface *net_iface = nullptr;
-    std::vector<std::string> pkt_extentsions = {".txt", ".pkt", ".pkta", ".pkt.gz", ".pkta.gz"};
-    if (utils::dir_exists(iname) || utils::ends_with(name, pkt_extentsions )){
-      net_iface = new PktInterface(name);
+    if (utils::directoryExists(name)
+        || utils::stringEndsWith(name, {".pkt", ".pkt.gz", ".pka", ".txt",
+                                        ".pkta", ".pkta.gz"})) {
+      net_iface = new PktInterface();
+    } else if (utils::fileExists(name)) {
+      net_iface = new PcapInterface();
     } else {
-      net_iface = new PcapInterface(name);
+      net_iface = new LiveInterface();
     }
-    net_iface->shared_buffer_ = SharedBuffer::CreateOrGet();
+    net_iface->shared_buffer_ = SharedBuffer::createOrGet();
     return net_iface;
   }
 
 } // namespace pnet
 
-#endif  // NETWORKINTERFACE_H_
\ No newline at end of file
+#endif  // NETWORKINTERFACE_H_
@@ -1,45 +1,134 @@
 #ifndef PNET_LOGGER_HPP_
 #define PNET_LOGGER_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
 #include <pnet_utils.hpp>
 #include <pnet_time.hpp>
 
+// Messages below this severity are compiled out (see severity::Level and
+// the PNET_LOG_* macros). Defaults to INFO.
+#ifndef PNET_LOG_LEVEL
+#define PNET_LOG_LEVEL 1
+#endif
+
 namespace pnet {
 
+  namespace severity {
+    enum Level { DEBUG = 0, INFO = 1, ERROR = 2, FATAL = 3 };
+  }
+
+  // Asynchronous logger.
+  //
+  // Callers copy the preformatted message, with a timestamp of the coarse
+  // wall clock, into a lock-free multi-producer ring and return; nothing
+  // blocks and no system call is made on the calling thread. A background
+  // thread formats the timestamps and writes the messages in batches to
+  // the log file (and to stdout for STDOUT()).
+  //
+  //    - Messages longer than MAX_MESSAGE are truncated. When the ring is
+  //      full, messages are dropped and the count is logged later on.
+  //    - An identical message is logged at most rate_limit times per
+  //      rate_window; the number of repeats suppressed meanwhile is
+  //      appended to its next occurrence.
+  //    - FATAL() and CLOSE() write all pending messages before returning,
+  //      and so does exit() once INIT() has been called.
+  //    - A forked child drops the pending messages of its parent and logs
+  //      through a writer thread of its own.
   class Logger {
     public:
-      static void INIT( std::string filename ) {
+      static const uint64_t DEFAULT_CAPACITY = 4096;   // messages
+      static const uint64_t MAX_MESSAGE = 480;         // bytes
+      static const uint64_t RATE_LIMIT = 10;           // messages per window
+      static const uint64_t RATE_WINDOW = 1000000;     // microseconds
+
+    public:
+      static void INIT(std::string filename,
+                       uint64_t capacity = DEFAULT_CAPACITY) {
         ASSERT_TRUE(!logger_instance_, "Logger Already Initialized");
-        logger_instance_ = new Logger(filename);
+        logger_instance_ = new Logger(filename, capacity);
+        static bool registered = false;
+        if (!registered) {
+          registered = true;
+          atexit(CLOSE);
+          pthread_atfork(nullptr, nullptr, afterFork);
+        }
+      }
+
+      static constexpr bool enabled(severity::Level level) {
+        return level >= PNET_LOG_LEVEL;
+      }
+
+      static void DEBUG(const std::string &message) {
+        if (enabled(severity::DEBUG)) {
+          instance()->log(severity::DEBUG, message, false);
+        }
       }
 
       static void INFO(const std::string &message) {
-        ASSERT_TRUE(logger_instance_, "Logger Uninitialized");
-        fprintf(logger_instance_->file_, "[INFO] %s\n", message.c_str());
+        if (enabled(severity::INFO)) {
+          instance()->log(severity::INFO, message, false);
+        }
       }
 
+      // INFO, also printed to stdout.
       static void STDOUT(const std::string &message) {
-        ASSERT_TRUE(logger_instance_, "Logger Uninitialized");
-        fprintf(logger_instance_->file_, "[INFO] %s\n", message.c_str());
-        printf("[INFO] %s\n", message.c_str());
+        if (enabled(severity::INFO)) {
+          instance()->log(severity::INFO, message, true);
+        }
       }
 
       static void ERROR(const std::string &message) {
-        ASSERT_TRUE(logger_instance_, "Logger Uninitialized");
-        fprintf(logger_instance_->file_, "<<ERROR>> %s\n", message.c_str());
+        if (enabled(severity::ERROR)) {
+          instance()->log(severity::ERROR, message, false);
+        }
       }
 
+      // Writes all pending messages and this one, then exits.
       static void FATAL(const std::string &message) {
+        if (!logger_instance_) {
+          printf("FATAL: %s\n", message.c_str());
+        }
+        Logger *logger = instance();
+        logger->stopWriter();
         printf("FATAL: %s\n", message.c_str());
-        ASSERT_TRUE(logger_instance_, "Logger Uninitialized");
-        fprintf(logger_instance_->file_, "<<---FATAL--->> %s\n",
-                message.c_str());
+        Record record;
+        record.t = coarseTime();
+        record.severity = severity::FATAL;
+        record.to_stdout = false;
+        record.length = std::min<uint64_t>(message.size(),
+                                           (uint64_t) MAX_MESSAGE);
+        memcpy(record.text, message.data(), record.length);
+        logger->format(record);
+        logger->flushBatch();
         printf("Terminated with FATAL error.\nSee log file: %s\n",
-               logger_instance_->filename_.c_str());
+               logger->filename_.c_str());
         CLOSE();
         exit(-1);
       }
 
+      // Blocks until the messages logged so far are written.
+      static void FLUSH() {
+        Logger *logger = instance();
+        uint64_t target = logger->tail_.load(std::memory_order_acquire);
+        while (logger->written_.load(std::memory_order_acquire) < target) {
+          logger->startWriter();
+          usleep(100);
+        }
+      }
+
+      // Writes all pending messages and closes the log file.
       static void CLOSE() {
         if (logger_instance_) {
           delete logger_instance_;
@@ -47,27 +136,335 @@ namespace pnet {
         }
       }
 
+      // Identical messages pass limit times per window (microseconds),
+      // zero for no limit.
+      static void setRateLimit(uint64_t limit, uint64_t window) {
+        instance()->rate_limit_ = limit;
+        instance()->rate_window_ = window;
+      }
+
+      // Messages lost because the ring was full.
+      static uint64_t numDropped() {
+        return instance()->num_dropped_.load(std::memory_order_relaxed);
+      }
+
+      // Messages suppressed by the rate limit.
+      static uint64_t numSuppressed() {
+        return instance()->num_suppressed_.load(std::memory_order_relaxed);
+      }
+
       ~Logger() {
-        if (file_ != stdout && file_ != nullptr) {
-          fclose(file_);
-          file_ = nullptr;
+        stopWriter();
+        if (fd_ >= 0) {
+          ::close(fd_);
+          fd_ = -1;
         }
+        delete[] ring_;
+        delete[] repeats_;
       }
 
     private:
-      Logger(std::string filename) {
-        filename_ = filename;
-        file_ = utils::fopenOrDie(filename_, "w");
-        setvbuf(file_, nullptr, _IONBF, 0);
+      // A preformatted message in the ring. sequence tells producers and
+      // the writer whose turn it is (see log() and drain()).
+      struct Record {
+        std::atomic<uint64_t> sequence;
+        uint64_t t;               // microseconds
+        uint16_t length;
+        uint8_t severity;
+        bool to_stdout;
+        char text[MAX_MESSAGE];
+      };
+
+      // Recent occurrences of a message, by hash. Updates from concurrent
+      // producers may race, which only makes the limit approximate.
+      struct Repeats {
+        std::atomic<uint64_t> hash;
+        std::atomic<uint64_t> t_window;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> suppressed;
+      };
+
+      static const uint64_t NUM_REPEATS = 256;
+
+    private:
+      Logger(std::string filename, uint64_t capacity)
+          : filename_(filename), fd_(-1), rate_limit_(RATE_LIMIT),
+            rate_window_(RATE_WINDOW), writer_(nullptr),
+            writer_started_(false), stopping_(false), date_sec_(0),
+            num_dropped_(0), num_suppressed_(0), num_reported_dropped_(0) {
+        fd_ = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+                                        | O_APPEND, 0644);
+        ASSERT_TRUE(fd_ >= 0, "Cannot open file: " + filename_);
+        capacity_ = 1;
+        while (capacity_ < capacity) {
+          capacity_ <<= 1;
+        }
+        ring_ = new Record[capacity_];
+        repeats_ = new Repeats[NUM_REPEATS];
+        for (uint64_t i = 0; i < NUM_REPEATS; ++i) {
+          repeats_[i].hash = 0;
+          repeats_[i].t_window = 0;
+          repeats_[i].count = 0;
+          repeats_[i].suppressed = 0;
+        }
+        reset();
+      }
+
+      Logger(const Logger&);
+      Logger& operator=(const Logger&);
+
+      static Logger* instance() {
+        ASSERT_TRUE(logger_instance_, "Logger Uninitialized");
+        return logger_instance_;
+      }
+
+      // Cheap wall clock: no system call, a few milliseconds resolution.
+      static uint64_t coarseTime() {
+        struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+        clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+        return Time(ts).microseconds();
+      }
+
+      void log(severity::Level level, const std::string &message,
+               bool to_stdout) {
+        uint64_t t = coarseTime();
+        uint64_t suppressed = 0;
+        if (rate_limit_ && !admit(message, t, suppressed)) {
+          return;
+        }
+        startWriter();
+        // Bounded MPMC queue of D. Vyukov, with a single consumer.
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        Record *record;
+        while (true) {
+          record = &ring_[pos & (capacity_ - 1)];
+          uint64_t seq = record->sequence.load(std::memory_order_acquire);
+          int64_t diff = (int64_t) seq - (int64_t) pos;
+          if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            num_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+          } else {
+            pos = tail_.load(std::memory_order_relaxed);
+          }
+        }
+        record->t = t;
+        record->severity = level;
+        record->to_stdout = to_stdout;
+        uint64_t length = std::min<uint64_t>(message.size(),
+                                             (uint64_t) MAX_MESSAGE);
+        memcpy(record->text, message.data(), length);
+        if (suppressed) {
+          char note[64];
+          int n = snprintf(note, sizeof(note),
+                           " [repeated %" PRIu64 " more times]", suppressed);
+          uint64_t m = std::min<uint64_t>(n, MAX_MESSAGE - length);
+          memcpy(record->text + length, note, m);
+          length += m;
+        }
+        record->length = length;
+        record->sequence.store(pos + 1, std::memory_order_release);
+      }
+
+      // Rate limit of identical messages. On the first message of a new
+      // window, suppressed is set to the repeats left out of the last one.
+      bool admit(const std::string &message, uint64_t t,
+                 uint64_t &suppressed) {
+        uint64_t h = std::hash<std::string>()(message) | 1;
+        Repeats &r = repeats_[h % NUM_REPEATS];
+        if (r.hash.load(std::memory_order_relaxed) != h
+            || t >= r.t_window.load(std::memory_order_relaxed)
+                    + rate_window_) {
+          suppressed = r.hash.load(std::memory_order_relaxed) == h
+                       ? r.suppressed.exchange(0) : 0;
+          if (r.hash.load(std::memory_order_relaxed) != h) {
+            r.suppressed.store(0, std::memory_order_relaxed);
+          }
+          r.hash.store(h, std::memory_order_relaxed);
+          r.t_window.store(t, std::memory_order_relaxed);
+          r.count.store(1, std::memory_order_relaxed);
+          return true;
+        }
+        if (r.count.fetch_add(1, std::memory_order_relaxed) < rate_limit_) {
+          return true;
+        }
+        r.suppressed.fetch_add(1, std::memory_order_relaxed);
+        num_suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      // The first producer to log starts the writer thread.
+      void startWriter() {
+        if (!writer_started_.load(std::memory_order_relaxed)
+            && !writer_started_.exchange(true)) {
+          stopping_ = false;
+          writer_ = new std::thread(&Logger::run, this);
+        }
+      }
+
+      // Writes everything pending and stops the writer thread. Not to be
+      // called concurrently, see CLOSE() and FATAL().
+      void stopWriter() {
+        if (writer_started_) {
+          std::thread *writer;
+          while (!(writer = writer_.load())) {
+            // Being started by a producer.
+          }
+          stopping_ = true;
+          writer->join();
+          delete writer;
+          writer_ = nullptr;
+          writer_started_ = false;
+        }
+        drain();
+      }
+
+      // Sleeps longer and longer while there is nothing to write.
+      void run() {
+        uint64_t sleep_us = 100;
+        while (!stopping_.load(std::memory_order_acquire)) {
+          if (drain()) {
+            sleep_us = 100;
+          } else {
+            sleep_us = std::min<uint64_t>(sleep_us * 2, 10000);
+          }
+          usleep(sleep_us);
+        }
+        drain();
+      }
+
+      // Writes the records ready in the ring. Returns false if none were.
+      bool drain() {
+        uint64_t n = 0;
+        while (true) {
+          Record &record = ring_[head_ & (capacity_ - 1)];
+          if (record.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            break;
+          }
+          format(record);
+          record.sequence.store(head_ + capacity_, std::memory_order_release);
+          ++head_;
+          ++n;
+        }
+        uint64_t dropped = num_dropped_.load(std::memory_order_relaxed);
+        if (dropped != num_reported_dropped_) {
+          batch_ += "<<ERROR>> Logger > "
+                    + std::to_string(dropped - num_reported_dropped_)
+                    + " messages dropped, ring full\n";
+          num_reported_dropped_ = dropped;
+        }
+        flushBatch();
+        written_.store(head_, std::memory_order_release);
+        return n > 0;
+      }
+
+      // Time as in Time::toDateString(), the date being formatted once
+      // per second only.
+      void format(const Record &record) {
+        static const char *prefixes[] = {"[DEBUG] ", "[INFO] ", "<<ERROR>> ",
+                                         "<<---FATAL--->> "};
+        Time t(record.t);
+        if (t.sec != date_sec_ || date_.empty()) {
+          date_ = t.toDateString();
+          date_.resize(date_.size() - 7);
+          date_sec_ = t.sec;
+        }
+        char usec[16];
+        snprintf(usec, sizeof(usec), ".%06u ", t.usec);
+        batch_.append(date_).append(usec).append(prefixes[record.severity])
+              .append(record.text, record.length).append(1, '\n');
+        if (record.to_stdout) {
+          stdout_batch_.append(prefixes[record.severity])
+                       .append(record.text, record.length).append(1, '\n');
+        }
+      }
+
+      void flushBatch() {
+        for (uint64_t off = 0; off < batch_.size(); ) {
+          ssize_t n = ::write(fd_, batch_.data() + off, batch_.size() - off);
+          if (n <= 0) {
+            break;
+          }
+          off += n;
+        }
+        batch_.clear();
+        if (!stdout_batch_.empty()) {
+          fwrite(stdout_batch_.data(), 1, stdout_batch_.size(), stdout);
+          fflush(stdout);
+          stdout_batch_.clear();
+        }
+      }
+
+      // Empty ring, all slots free for the first round.
+      void reset() {
+        for (uint64_t i = 0; i < capacity_; ++i) {
+          ring_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        tail_.store(0, std::memory_order_relaxed);
+        head_ = 0;
+        written_.store(0, std::memory_order_relaxed);
+        batch_.clear();
+        stdout_batch_.clear();
+      }
+
+      // The writer thread does not survive fork(): the child starts its
+      // own, without the messages of the parent, which writes them.
+      static void afterFork() {
+        if (logger_instance_) {
+          logger_instance_->writer_ = nullptr;
+          logger_instance_->writer_started_ = false;
+          logger_instance_->reset();
+        }
       }
 
     private:
       static Logger *logger_instance_;
-      FILE *file_;
       std::string filename_;
+      int fd_;
+      uint64_t rate_limit_;
+      uint64_t rate_window_;
+
+      Record *ring_;
+      uint64_t capacity_;                 // power of two
+      std::atomic<uint64_t> tail_;        // next position to claim
+      char padding_[64];                  // producers and writer apart
+      uint64_t head_;                     // next position to write
+      std::atomic<uint64_t> written_;
+      Repeats *repeats_;
+
+      std::atomic<std::thread*> writer_;
+      std::atomic<bool> writer_started_;
+      std::atomic<bool> stopping_;
+      std::string batch_;
+      std::string stdout_batch_;
+      std::string date_;                  // of date_sec_, to the second
+      uint32_t date_sec_;
+      std::atomic<uint64_t> num_dropped_;
+      std::atomic<uint64_t> num_suppressed_;
+      uint64_t num_reported_dropped_;
   };
 
   Logger *Logger::logger_instance_ = nullptr;
 }
 
+// Logging below PNET_LOG_LEVEL compiles to nothing, the message is not
+// even built.
+#define PNET_LOG_DEBUG(message) \
+    do { if (::pnet::Logger::enabled(::pnet::severity::DEBUG)) \
+           ::pnet::Logger::DEBUG(message); } while (0)
+#define PNET_LOG_INFO(message) \
+    do { if (::pnet::Logger::enabled(::pnet::severity::INFO)) \
+           ::pnet::Logger::INFO(message); } while (0)
+#define PNET_LOG_ERROR(message) \
+    do { if (::pnet::Logger::enabled(::pnet::severity::ERROR)) \
+           ::pnet::Logger::ERROR(message); } while (0)
+
 #endif // PNET_LOGGER_HPP_
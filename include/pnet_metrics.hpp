@@ -0,0 +1,482 @@
+#ifndef PNET_METRICS_HPP_
+#define PNET_METRICS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pnet_utils.hpp>
+
+// Hot path metrics: counters, gauges and latency histograms of the packet
+// path, published in a shared memory page that pnet-top (or any
+// MetricsReader) reads while the pipeline runs.
+//
+// The library records metrics through the PNET_METRIC_* macros only. They
+// are compiled in when PNET_METRICS is defined (the PNET_METRICS CMake
+// option) and expand to nothing otherwise, their arguments not even
+// evaluated, so a build without metrics has no trace of them.
+
+namespace pnet {
+
+  namespace metrics {
+
+    // Per thread, monotonic unless noted.
+    enum Counter {
+      PACKETS_CAPTURED,     // produced by network interfaces
+      PACKETS_CONSUMED,     // taken from the shared buffer
+      FLOW_PACKETS,         // inserted into flow tables
+      FLOWS_CREATED,
+      FLOWS_EXPIRED,
+      FLOWS_ACTIVE,         // signed, created minus removed
+      FLOWS_RECORDED,
+      PACKETS_RECORDED,
+      RECORDER_DROPS,       // AsyncPacketRecorder, DROP policy
+      RECORDER_STALLS,      // AsyncPacketRecorder, BLOCK policy
+      NUM_COUNTERS
+    };
+
+    // Process wide, last value set.
+    enum Gauge {
+      RING_OCCUPANCY,       // packets in the shared buffer
+      RING_CAPACITY,
+      RECORDER_BACKLOG,     // packets waiting for the disk
+      NUM_GAUGES
+    };
+
+    // Per thread distributions. Times are in nanoseconds.
+    enum Histogram {
+      PRODUCE_NS,           // SharedBuffer::produce() of a batch
+      CONSUME_NS,           // SharedBuffer::consume(), waits included
+      FLOW_INSERT_NS,       // FlowTable::insert(), 1 in 64 packets
+      FLOW_RECORD_NS,       // FlowRecorder::write()
+      PROBE_LENGTH,         // slots visited by FlowIndex::find()
+      NUM_HISTOGRAMS
+    };
+
+    inline const char* name(Counter c) {
+      static const char *names[] = {
+          "packets_captured", "packets_consumed", "flow_packets",
+          "flows_created", "flows_expired", "flows_active", "flows_recorded",
+          "packets_recorded", "recorder_drops", "recorder_stalls"};
+      return names[c];
+    }
+
+    inline const char* name(Gauge g) {
+      static const char *names[] = {
+          "ring_occupancy", "ring_capacity", "recorder_backlog"};
+      return names[g];
+    }
+
+    inline const char* name(Histogram h) {
+      static const char *names[] = {
+          "produce_ns", "consume_ns", "flow_insert_ns", "flow_record_ns",
+          "probe_length"};
+      return names[h];
+    }
+
+    inline uint64_t nanoseconds() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+  } // namespace metrics
+
+
+  // Log-linear histogram in the spirit of HdrHistogram: values below
+  // SUB_BUCKETS have a bucket each, larger values SUB_BUCKETS buckets per
+  // power of two, i.e. a relative error below 1 / SUB_BUCKETS over the
+  // whole uint64 range, in a fixed 8 KB.
+  //
+  // Written by a single thread, read by any process: updates are relaxed
+  // stores, no read-modify-write.
+  class MetricsHistogram {
+
+    public:
+      static const uint64_t SUB_BUCKET_BITS = 4;
+      static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+      static const uint64_t NUM_BUCKETS =
+          (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    public:
+      void record(uint64_t value) {
+        add(buckets[bucket(value)], 1);
+        add(count, 1);
+        add(sum, value);
+        if (value > max.load(std::memory_order_relaxed)) {
+          max.store(value, std::memory_order_relaxed);
+        }
+      }
+
+      static uint64_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+          return value;
+        }
+        uint64_t exponent = 63 - __builtin_clzll(value);
+        uint64_t shift = exponent - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS
+               + ((value >> shift) & (SUB_BUCKETS - 1));
+      }
+
+      // Smallest value of bucket i.
+      static uint64_t lowerBound(uint64_t i) {
+        if (i < SUB_BUCKETS) {
+          return i;
+        }
+        uint64_t shift = i / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS | (i % SUB_BUCKETS)) << shift;
+      }
+
+    private:
+      static void add(std::atomic<uint64_t> &x, uint64_t n) {
+        x.store(x.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+      }
+
+    public:
+      std::atomic<uint64_t> buckets[NUM_BUCKETS];
+      std::atomic<uint64_t> count;
+      std::atomic<uint64_t> sum;
+      std::atomic<uint64_t> max;
+  };
+
+
+  // Sum of a histogram over all threads, see MetricsReader.
+  struct HistogramSnapshot {
+
+    HistogramSnapshot()
+        : buckets(MetricsHistogram::NUM_BUCKETS, 0), count(0), sum(0),
+          max(0) {}
+
+    void add(const MetricsHistogram &h) {
+      for (uint64_t i = 0; i < buckets.size(); ++i) {
+        buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+      }
+      count += h.count.load(std::memory_order_relaxed);
+      sum += h.sum.load(std::memory_order_relaxed);
+      max = std::max(max, h.max.load(std::memory_order_relaxed));
+    }
+
+    // Lower bound of the bucket holding the p-quantile.
+    uint64_t percentile(double p) const {
+      uint64_t total = 0;
+      for (uint64_t n : buckets) {
+        total += n;
+      }
+      uint64_t rank = p * total, seen = 0;
+      for (uint64_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen > rank) {
+          return MetricsHistogram::lowerBound(i);
+        }
+      }
+      return 0;
+    }
+
+    double mean() const {
+      return count ? (double) sum / count : 0;
+    }
+
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+  };
+
+
+  // Metrics of one thread. Threads never share a slot, and slots are
+  // cache line aligned, so that recording never bounces a line between
+  // cores.
+  struct alignas(64) ThreadMetrics {
+    std::atomic<uint64_t> counters[metrics::NUM_COUNTERS];
+    MetricsHistogram histograms[metrics::NUM_HISTOGRAMS];
+  };
+
+
+  // Layout of the shared memory page. Readers check magic and version.
+  struct MetricsPage {
+
+    static const uint64_t MAGIC = 0x5343495254454d50ull;  // "PMETRICS"
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_THREADS = 64;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t max_threads;
+    uint64_t pid;
+    uint64_t t_start;                        // wall clock, microseconds
+    std::atomic<uint64_t> num_threads;       // slots claimed
+    alignas(64) std::atomic<int64_t> gauges[metrics::NUM_GAUGES];
+    ThreadMetrics threads[MAX_THREADS];
+  };
+
+
+  // Recording side. Each thread claims a slot of the page on first use;
+  // slots are not reused, so counts of finished threads remain. Beyond
+  // MAX_THREADS, the remaining threads share the last slot and some of
+  // their updates may be lost.
+  //
+  // Until publish() is called the page is anonymous memory, still shared
+  // with the processes forked later on; a child claims new slots for its
+  // threads.
+  class Metrics {
+
+    public:
+      static const std::string DEFAULT_NAME;
+
+    public:
+      static void add(metrics::Counter c, int64_t n) {
+        std::atomic<uint64_t> &x = slot()->counters[c];
+        x.store(x.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+      }
+
+      static void set(metrics::Gauge g, int64_t value) {
+        page()->gauges[g].store(value, std::memory_order_relaxed);
+      }
+
+      static void record(metrics::Histogram h, uint64_t value) {
+        slot()->histograms[h].record(value);
+      }
+
+      // Moves the metrics into /dev/shm/<name>, where readers find them.
+      // Metrics recorded so far are kept. Call it at startup, before the
+      // pipeline threads start.
+      static bool publish(const std::string &name = DEFAULT_NAME) {
+        std::string path = "/dev/shm/" + name;
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+          return false;
+        }
+        void *memory = MAP_FAILED;
+        if (ftruncate(fd, sizeof(MetricsPage)) == 0) {
+          memory = mmap(nullptr, sizeof(MetricsPage), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+          unlink(path.c_str());
+          return false;
+        }
+        MetricsPage *published = static_cast<MetricsPage*>(memory);
+        if (page_) {
+          // The old page stays mapped: other threads may be writing to it
+          // until they see the new generation.
+          std::memcpy(static_cast<void*>(published), page_,
+                      sizeof(MetricsPage));
+        } else {
+          initialize(published);
+        }
+        page_ = published;
+        published_ = path;
+        newGeneration();
+        return true;
+      }
+
+      // Removes the published page, readers keep their mapping.
+      static void unpublish() {
+        if (!published_.empty()) {
+          unlink(published_.c_str());
+          published_.clear();
+        }
+      }
+
+      static MetricsPage* page() {
+        if (!page_) {
+          void *memory = mmap(nullptr, sizeof(MetricsPage),
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+          ASSERT_TRUE(memory != MAP_FAILED, "Metrics:: out of memory");
+          page_ = static_cast<MetricsPage*>(memory);
+          initialize(page_);
+          pthread_atfork(nullptr, nullptr, newGeneration);
+        }
+        return page_;
+      }
+
+    private:
+      static ThreadMetrics* slot() {
+        if (slot_generation_ != generation_) {
+          MetricsPage *p = page();
+          uint64_t i = p->num_threads.fetch_add(1);
+          slot_ = &p->threads[std::min<uint64_t>(
+              i, MetricsPage::MAX_THREADS - 1)];
+          slot_generation_ = generation_;
+        }
+        return slot_;
+      }
+
+      static void initialize(MetricsPage *p) {
+        // Fresh mappings are zeroed.
+        p->magic = MetricsPage::MAGIC;
+        p->version = MetricsPage::VERSION;
+        p->max_threads = MetricsPage::MAX_THREADS;
+        p->pid = getpid();
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        p->t_start = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+      }
+
+      // Threads claim new slots, e.g. in a forked child.
+      static void newGeneration() {
+        ++generation_;
+        if (page_) {
+          page_->pid = getpid();
+        }
+      }
+
+    private:
+      static MetricsPage *page_;
+      static std::string published_;
+      static uint64_t generation_;
+      static thread_local ThreadMetrics *slot_;
+      static thread_local uint64_t slot_generation_;
+  };
+  const std::string Metrics::DEFAULT_NAME = "pnet_metrics";
+  MetricsPage* Metrics::page_ = nullptr;
+  std::string Metrics::published_;
+  uint64_t Metrics::generation_ = 1;
+  thread_local ThreadMetrics* Metrics::slot_ = nullptr;
+  thread_local uint64_t Metrics::slot_generation_ = 0;
+
+
+  namespace metrics {
+
+    // Records the time spent in its scope, if enabled.
+    class ScopedTimer {
+      public:
+        explicit ScopedTimer(Histogram h_, bool enabled = true)
+            : h(h_), t_start(enabled ? nanoseconds() : 0) {}
+
+        ~ScopedTimer() {
+          if (t_start) {
+            Metrics::record(h, nanoseconds() - t_start);
+          }
+        }
+
+      private:
+        ScopedTimer(const ScopedTimer&);
+        ScopedTimer& operator=(const ScopedTimer&);
+
+        Histogram h;
+        uint64_t t_start;
+    };
+
+  } // namespace metrics
+
+
+  // Reading side: maps a published page read-only. Reads take no lock and
+  // never block the pipeline; values of a running process are a few
+  // updates apart from each other.
+  class MetricsReader {
+
+    public:
+      MetricsReader() : page(nullptr) {}
+
+      ~MetricsReader() {
+        close();
+      }
+
+      bool open(const std::string &name = Metrics::DEFAULT_NAME) {
+        close();
+        int fd = ::open(("/dev/shm/" + name).c_str(), O_RDONLY);
+        if (fd < 0) {
+          return false;
+        }
+        void *memory = mmap(nullptr, sizeof(MetricsPage), PROT_READ,
+                            MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+          return false;
+        }
+        page = static_cast<const MetricsPage*>(memory);
+        if (page->magic != MetricsPage::MAGIC
+            || page->version != MetricsPage::VERSION) {
+          close();
+          return false;
+        }
+        return true;
+      }
+
+      void close() {
+        if (page) {
+          munmap(const_cast<MetricsPage*>(page), sizeof(MetricsPage));
+          page = nullptr;
+        }
+      }
+
+      int64_t counter(metrics::Counter c) const {
+        int64_t total = 0;
+        for (uint64_t i = 0; i < numThreads(); ++i) {
+          total += page->threads[i].counters[c].load(
+              std::memory_order_relaxed);
+        }
+        return total;
+      }
+
+      int64_t gauge(metrics::Gauge g) const {
+        return page->gauges[g].load(std::memory_order_relaxed);
+      }
+
+      HistogramSnapshot histogram(metrics::Histogram h) const {
+        HistogramSnapshot snapshot;
+        for (uint64_t i = 0; i < numThreads(); ++i) {
+          snapshot.add(page->threads[i].histograms[h]);
+        }
+        return snapshot;
+      }
+
+      uint64_t numThreads() const {
+        return std::min<uint64_t>(
+            page->num_threads.load(std::memory_order_relaxed),
+            MetricsPage::MAX_THREADS);
+      }
+
+      uint64_t pid() const {
+        return page->pid;
+      }
+
+      uint64_t startTime() const {
+        return page->t_start;
+      }
+
+    private:
+      MetricsReader(const MetricsReader&);
+      MetricsReader& operator=(const MetricsReader&);
+
+      const MetricsPage *page;
+  };
+
+} // namespace pnet
+
+#ifdef PNET_METRICS
+#define PNET_METRIC_ADD(counter, n) \
+    ::pnet::Metrics::add(::pnet::metrics::counter, (n))
+#define PNET_METRIC_SET(gauge, value) \
+    ::pnet::Metrics::set(::pnet::metrics::gauge, (value))
+#define PNET_METRIC_RECORD(histogram, value) \
+    ::pnet::Metrics::record(::pnet::metrics::histogram, (value))
+// Times the rest of the enclosing scope, if the condition holds.
+#define PNET_METRIC_TIMER_IF(histogram, condition) \
+    ::pnet::metrics::ScopedTimer pnet_metric_timer_##histogram( \
+        ::pnet::metrics::histogram, (condition))
+#else
+#define PNET_METRIC_ADD(counter, n) do { (void) sizeof(n); } while (0)
+#define PNET_METRIC_SET(gauge, value) do { (void) sizeof(value); } while (0)
+#define PNET_METRIC_RECORD(histogram, value) \
+    do { (void) sizeof(value); } while (0)
+#define PNET_METRIC_TIMER_IF(histogram, condition) \
+    do { (void) sizeof(condition); } while (0)
+#endif
+#define PNET_METRIC_TIMER(histogram) PNET_METRIC_TIMER_IF(histogram, true)
+
+#endif // PNET_METRICS_HPP_
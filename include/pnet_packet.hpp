@@ -0,0 +1,157 @@
+#ifndef PNET_PACKET_HPP_
+#define PNET_PACKET_HPP_
+
+#include <arpa/inet.h>
+
+#include <cstdio>
+#include <cstring>
+#include <inttypes.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <pnet_hash.hpp>
+#include <pnet_time.hpp>
+
+
+namespace pnet {
+
+  // 5-tuple describing the communication link.
+  //   - Source and Destination IP's
+  //   - Source and Destination Ports
+  //   - Level-3 protocol : UDP, TCP, etc..
+  class Key{
+
+    public:
+      Key(){}
+
+      Key(struct in_addr ip1, struct in_addr ip2,
+          uint16_t port1, uint16_t port2, uint32_t proto)
+          : ip_src(ip1), ip_dst(ip2),
+            port_src(port1), port_dst(port2), protocol(proto) {}
+
+      // Keys (and Packets) are trivially copyable, so that they can be
+      // moved around with memcpy and mapped from files and shared memory.
+      Key(const Key& key) = default;
+
+      // Equality of two keys regardless of direction.
+      // If the source and destination directions are reversed,
+      // it's still the same key.
+      bool operator==(const Key& k) const {
+        if (protocol != k.protocol) {
+          return false;
+        }
+        if ((port_src == k.port_src) && (port_dst == k.port_dst)
+            && (ip_src.s_addr == k.ip_src.s_addr)
+            && (ip_dst.s_addr == k.ip_dst.s_addr)) {
+          return true;
+        }
+        if ((port_src == k.port_dst) && (port_dst == k.port_src)
+            && (ip_src.s_addr == k.ip_dst.s_addr)
+            && (ip_dst.s_addr == k.ip_src.s_addr)) {
+          return true;
+        }
+        return false;
+      }
+
+      // Direction-symmetric hash of the key: both directions of the same
+      // connection hash to the same value. Endpoints are ordered before
+      // mixing, so swapping ports or addresses does not collide in general.
+      // A non-zero seed makes the hash keyed (unpredictable from outside).
+      uint64_t hash(uint64_t seed = 0) const {
+        uint64_t a = ((uint64_t) ip_src.s_addr << 16) | port_src;
+        uint64_t b = ((uint64_t) ip_dst.s_addr << 16) | port_dst;
+        if (b < a) {
+          std::swap(a, b);
+        }
+        uint64_t h = hash::mix64(seed ^ a ^ ((uint64_t) protocol << 48));
+        return hash::combine(h, b);
+      }
+
+
+    public:
+      struct in_addr  ip_src;     // 4 bytes
+      struct in_addr  ip_dst;     // 4 bytes
+      uint16_t        port_src;   // 2 bytes
+      uint16_t        port_dst;   // 2 bytes
+      uint32_t        protocol;   // 4 byte
+      // 16 bytes in total.
+  };
+
+  // IP packet is a Key together with size, arrival time and TCP flag info.
+  class Packet : public Key{
+
+    public:
+      // TCP flag bits of the flags field.
+      static const uint16_t TCP_FIN = 0x01;
+      static const uint16_t TCP_SYN = 0x02;
+      static const uint16_t TCP_RST = 0x04;
+      static const uint16_t TCP_PSH = 0x08;
+      static const uint16_t TCP_ACK = 0x10;
+
+    public:
+      Packet(){}
+
+      Packet(const Key &key): Key(key), flags(0), size(0), t_arrival(0){}
+
+      // Binary stream input.
+      friend std::istream& operator>>(std::istream &in, Packet &packet) {
+        in.read(reinterpret_cast<char *>(&packet), sizeof(Packet));
+        return in;
+      }
+
+      // Binary stream output.
+      // Use "std::cout << packet.to_string();" for printing.
+      friend std::ostream& operator<<(std::ostream &out, const Packet &packet) {
+        out.write(reinterpret_cast<const char *>(&packet), sizeof(Packet));
+        return out;
+      }
+
+      // Packets are compared with their arrival times
+      bool operator<(const Packet &rhs) const {
+        return t_arrival  < rhs.t_arrival;
+      }
+
+      // Pretty formats packet info into a string.
+      std::string toString() const {
+        char buffer[250];
+        std::sprintf(buffer, "%-15s\t%5d\t",
+                     inet_ntoa(ip_src), ntohs(port_src));
+        std::sprintf(buffer+strlen(buffer), "%-15s\t%5d\t",
+                     inet_ntoa(ip_dst),  ntohs(port_dst));
+        std::sprintf(buffer+strlen(buffer), "%2d\t%hu\t%4hu\t",
+                     protocol, flags, size);
+        std::sprintf(buffer+strlen(buffer), "%s",
+                     t_arrival.toString().c_str());
+        return std::string(buffer);
+      }
+
+      bool fromString(std::string source){
+
+        std::istringstream sin(source);
+        std::string tmp;
+
+        sin >> tmp >> port_src ;
+        inet_pton(AF_INET, tmp.c_str(), &ip_src);
+        port_src = htons(port_src);
+
+        sin >> tmp >> port_dst ;
+        inet_pton(AF_INET, tmp.c_str(), &ip_dst);
+        port_dst= htons(port_dst);
+
+        sin >> protocol >> flags >> size >> tmp;
+        t_arrival = Time(tmp);
+        return true;
+      }
+
+
+  public:
+      uint16_t flags;   // 2 bytes: TCP flags (zero for non-TCP packets)
+      uint16_t size;    // 2 bytes: packet size [
+      Time t_arrival;   // 8 bytes: seconds + microseconds
+      // 28 bytes in total.
+  };
+
+} // namespace pnet
+
+#endif // PNET_PACKET_HPP_
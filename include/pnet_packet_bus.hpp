@@ -0,0 +1,304 @@
+#ifndef PNET_PACKET_BUS_HPP_
+#define PNET_PACKET_BUS_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pnet_flow.hpp>
+#include <pnet_spsc_ring.hpp>
+
+namespace pnet {
+
+  // Packet bus over named POSIX shared memory.
+  //
+  // One producer (e.g. the capture process) creates the bus under a name
+  // and any number of unrelated processes attach to it by that name, each
+  // as one of the K consumers. Every consumer has its own lock-free SPSC
+  // ring inside the segment. The bus works in one of two modes:
+  //    - BROADCAST  : every consumer receives every packet.
+  //    - PARTITIONED: each packet goes to one consumer, chosen by the
+  //                   direction-symmetric flow hash, so that each consumer
+  //                   sees whole flows.
+  // The producer never waits for a consumer: when a consumer's ring is
+  // full, the packets for that consumer are dropped and counted, so a slow
+  // consumer never stalls the others.
+  class PacketBus {
+
+    public:
+      enum Mode { BROADCAST = 0, PARTITIONED = 1 };
+
+      static const uint64_t DEFAULT_CAPACITY = 65536;  // packets per consumer
+      static const uint64_t MAGIC = 0x5355424e54454e50ULL;  // "PNETNBUS"
+      static const uint32_t VERSION = 1;
+
+      // Per consumer counters.
+      struct ConsumerStats {
+        uint64_t published;   // packets addressed to the consumer
+        uint64_t delivered;   // packets taken by the consumer
+        uint64_t dropped;     // packets dropped because its ring was full
+        uint64_t lag;         // packets waiting in its ring
+      };
+
+    public:
+      // Producer side: creates the bus, replacing a stale one of the same
+      // name. Names follow shm_open(3), e.g. "/pnet_bus".
+      static PacketBus* create(const std::string &name, uint32_t num_consumers,
+                               Mode mode,
+                               uint64_t capacity = DEFAULT_CAPACITY,
+                               uint64_t hash_seed = 0){
+        ASSERT_TRUE(num_consumers > 0, "PacketBus:: No consumers");
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd == -1){
+          FATAL("PacketBus:: cannot create shared memory: " + name);
+        }
+        uint64_t slot_size = slotSize(capacity);
+        uint64_t size = sizeof(Header) + num_consumers * slot_size;
+        if(ftruncate(fd, size) != 0){
+          close(fd);
+          FATAL("PacketBus:: cannot resize shared memory: " + name);
+        }
+        PacketBus *bus = new PacketBus(name, fd, size, true, 0);
+        Header *header = bus->header;
+        header->version = VERSION;
+        header->mode = mode;
+        header->num_consumers = num_consumers;
+        header->capacity = capacity;
+        header->slot_size = slot_size;
+        header->hash_seed = hash_seed;
+        for(uint32_t i = 0; i < num_consumers; ++i){
+          new (bus->slot(i)) Slot();
+          bus->rings.push_back(new SpscRing<Packet>(bus->slot(i) + 1,
+                                                    capacity, true));
+        }
+        bus->batches.resize(num_consumers);
+        // Publish the header last: consumers check the magic number.
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = MAGIC;
+        return bus;
+      }
+
+      // Consumer side: attaches to an existing bus as consumer 'consumer_id'.
+      static PacketBus* attach(const std::string &name, uint32_t consumer_id){
+        int fd = shm_open(name.c_str(), O_RDWR, 0644);
+        if(fd == -1){
+          FATAL("PacketBus:: no such bus: " + name);
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(Header)){
+          close(fd);
+          FATAL("PacketBus:: bus is not initialized: " + name);
+        }
+        PacketBus *bus = new PacketBus(name, fd, st.st_size, false,
+                                       consumer_id);
+        Header *header = bus->header;
+        if(header->magic != MAGIC || header->version != VERSION){
+          delete bus;
+          FATAL("PacketBus:: bus is not initialized: " + name);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(consumer_id >= header->num_consumers){
+          delete bus;
+          FATAL("PacketBus:: no such consumer: " + std::to_string(consumer_id));
+        }
+        for(uint32_t i = 0; i < header->num_consumers; ++i){
+          bus->rings.push_back(new SpscRing<Packet>(bus->slot(i) + 1,
+                                                    header->capacity, false));
+        }
+        bus->slot(consumer_id)->attached.store(1);
+        return bus;
+      }
+
+      // The producer removes the bus name; attached consumers keep their
+      // mapping until they detach.
+      ~PacketBus(){
+        if(is_producer){
+          flush();
+          shm_unlink(name.c_str());
+        } else if(header->magic == MAGIC) {
+          slot(consumer)->attached.store(0);
+        }
+        for(SpscRing<Packet> *ring : rings){
+          delete ring;
+        }
+        munmap(header, size);
+      }
+
+    public:
+      // Producer side: queues a packet, delivered in batches.
+      void publish(const Packet &pkt){
+        uint32_t target = 0;
+        if(header->mode == PARTITIONED){
+          target = consumerOf(pkt);
+        }
+        std::vector<Packet> &batch = batches[target];
+        batch.push_back(pkt);
+        if(batch.size() == BATCH_SIZE){
+          if(header->mode == BROADCAST){
+            send(batch.data(), batch.size());
+          } else {
+            sendTo(target, batch.data(), batch.size());
+          }
+          batch.clear();
+        }
+      }
+
+      // Producer side: publishes n packets right away.
+      void publish(const Packet *pkts, uint64_t n){
+        if(header->mode == BROADCAST){
+          flush();
+          send(pkts, n);
+        } else {
+          for(uint64_t i = 0; i < n; ++i){
+            publish(pkts[i]);
+          }
+          flush();
+        }
+      }
+
+      // Producer side: delivers queued packets.
+      void flush(){
+        for(uint32_t i = 0; i < batches.size(); ++i){
+          if(!batches[i].empty()){
+            if(header->mode == BROADCAST){
+              send(batches[i].data(), batches[i].size());
+            } else {
+              sendTo(i, batches[i].data(), batches[i].size());
+            }
+            batches[i].clear();
+          }
+        }
+      }
+
+      // Producer side: wakes up all consumers for good.
+      void shutdown(){
+        flush();
+        for(SpscRing<Packet> *ring : rings){
+          ring->close();
+        }
+      }
+
+      // Consumer side: blocks until packets are available and takes up to
+      // max_packets. Returns zero on interrupt or if the bus is shut down
+      // and drained.
+      uint64_t consume(Packet *pkts, uint64_t max_packets){
+        return rings[consumer]->popWait(pkts, max_packets);
+      }
+
+      bool consume(Packet &pkt){
+        return consume(&pkt, 1) == 1;
+      }
+
+      ConsumerStats stats(uint32_t consumer_id) const{
+        ConsumerStats result;
+        const Slot *s = slot(consumer_id);
+        result.published = s->published.load(std::memory_order_acquire);
+        result.dropped = s->dropped.load(std::memory_order_acquire);
+        result.delivered = rings[consumer_id]->numPopped();
+        result.lag = rings[consumer_id]->size();
+        return result;
+      }
+
+      bool attached(uint32_t consumer_id) const{
+        return slot(consumer_id)->attached.load() != 0;
+      }
+
+      uint32_t numConsumers() const{
+        return header->num_consumers;
+      }
+
+      Mode mode() const{
+        return (Mode) header->mode;
+      }
+
+    private:
+      static const uint64_t BATCH_SIZE = 256;
+
+      struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t mode;
+        uint32_t num_consumers;
+        uint32_t reserved;
+        uint64_t capacity;
+        uint64_t slot_size;
+        uint64_t hash_seed;
+        char padding[PNET_CACHE_LINE - 6 * sizeof(uint64_t)];
+      };
+
+      // Per consumer counters, followed by the consumer's ring.
+      struct Slot {
+        Slot() : published(0), dropped(0), attached(0) {}
+        std::atomic<uint64_t> published;   // written by the producer only
+        std::atomic<uint64_t> dropped;     // written by the producer only
+        std::atomic<uint32_t> attached;
+        char padding[PNET_CACHE_LINE - 3 * sizeof(uint64_t)];
+      };
+
+    private:
+      PacketBus(const std::string &name_, int fd, uint64_t size_,
+                bool is_producer_, uint32_t consumer_)
+          : name(name_), size(size_), is_producer(is_producer_),
+            consumer(consumer_) {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+        close(fd);
+        if(memory == MAP_FAILED){
+          FATAL("PacketBus:: cannot map shared memory: " + name);
+        }
+        header = static_cast<Header*>(memory);
+      }
+
+      PacketBus(const PacketBus&);
+      PacketBus& operator=(const PacketBus&);
+
+      static uint64_t slotSize(uint64_t capacity){
+        uint64_t bytes = sizeof(Slot)
+                         + SpscRing<Packet>::memorySize(capacity);
+        return (bytes + PNET_CACHE_LINE - 1) / PNET_CACHE_LINE
+               * PNET_CACHE_LINE;
+      }
+
+      Slot* slot(uint32_t i) const{
+        char *base = reinterpret_cast<char*>(header + 1);
+        return reinterpret_cast<Slot*>(base + i * header->slot_size);
+      }
+
+      uint32_t consumerOf(const Key &key) const{
+        uint64_t high = key.hash(header->hash_seed) >> 32;
+        return (uint32_t) ((high * header->num_consumers) >> 32);
+      }
+
+      void send(const Packet *pkts, uint64_t n){
+        for(uint32_t i = 0; i < rings.size(); ++i){
+          sendTo(i, pkts, n);
+        }
+      }
+
+      // Never blocks: what does not fit is dropped.
+      void sendTo(uint32_t i, const Packet *pkts, uint64_t n){
+        uint64_t pushed = rings[i]->push(pkts, n);
+        Slot *s = slot(i);
+        s->published.store(s->published.load(std::memory_order_relaxed) + n,
+                           std::memory_order_release);
+        if(pushed < n){
+          s->dropped.store(s->dropped.load(std::memory_order_relaxed)
+                           + n - pushed, std::memory_order_release);
+        }
+      }
+
+    private:
+      std::string name;
+      Header *header;
+      uint64_t size;
+      bool is_producer;
+      uint32_t consumer;
+      std::vector<SpscRing<Packet>*> rings;
+      std::vector<std::vector<Packet>> batches;   // producer side
+  };
+
+} // namespace pnet
+
+#endif // PNET_PACKET_BUS_HPP_
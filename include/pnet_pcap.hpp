@@ -0,0 +1,399 @@
+#ifndef PNET_PCAP_HPP_
+#define PNET_PCAP_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef PNET_HAVE_LIBPCAP
+#include <pcap/pcap.h>
+#endif
+
+#include <pnet_decoder.hpp>
+
+namespace pnet {
+
+  // Reads frames from .pcap and .pcapng capture files.
+  //
+  // Files are memory-mapped and parsed in place: returned frames point
+  // into the mapping, nothing is copied or allocated per frame. Both byte
+  // orders, microsecond and nanosecond pcap files and pcapng files with
+  // several sections and interfaces (if_tsresol, if_tsoffset) are
+  // supported.
+  //
+  // Files that cannot be mapped (pipes, special files) are read through
+  // libpcap if the library is built with PNET_HAVE_LIBPCAP. In that case
+  // frames are copied into an internal buffer, valid until the next call.
+  class PcapFile {
+
+    public:
+      explicit PcapFile(const std::string &filename_)
+          : filename(filename_), data(nullptr), size(0), offset(0),
+            swapped(false), nanosecond(false), linktype(0), is_pcapng(false),
+            handle(nullptr) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size > 0) {
+          size = st.st_size;
+          void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (memory != MAP_FAILED) {
+            data = static_cast<const uint8_t*>(memory);
+            madvise(memory, size, MADV_SEQUENTIAL);
+          }
+        }
+        if (fd != -1) {
+          ::close(fd);
+        }
+        if (data) {
+          parseFileHeader();
+        } else {
+          openLibpcap();
+        }
+      }
+
+      ~PcapFile(){
+        if (data) {
+          munmap(const_cast<uint8_t*>(data), size);
+        }
+#ifdef PNET_HAVE_LIBPCAP
+        if (handle) {
+          pcap_close(static_cast<pcap_t*>(handle));
+        }
+#endif
+      }
+
+      // Reads up to max_frames frames. Returns 0 at the end of the file.
+      uint64_t next(Frame *frames, uint64_t max_frames) {
+        if (!data) {
+          return nextLibpcap(frames, max_frames);
+        }
+        uint64_t n = 0;
+        while (n < max_frames && offset < size) {
+          bool ok = is_pcapng ? nextPcapng(frames[n]) : nextPcap(frames[n]);
+          if (ok) {
+            ++n;
+          }
+        }
+        return n;
+      }
+
+      // Bytes of the file consumed so far (memory-mapped files only).
+      uint64_t position() const {
+        return offset;
+      }
+
+      uint64_t fileSize() const {
+        return size;
+      }
+
+    private:
+      PcapFile(const PcapFile&);
+      PcapFile& operator=(const PcapFile&);
+
+      // pcapng per-interface parameters.
+      struct Interface {
+        uint32_t linktype;
+        uint64_t ticks_per_second;
+        int64_t offset_seconds;
+      };
+
+      static const uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+      static const uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+      static const uint32_t PCAPNG_SHB = 0x0a0d0d0a;
+      static const uint32_t PCAPNG_IDB = 0x00000001;
+      static const uint32_t PCAPNG_PB  = 0x00000002;
+      static const uint32_t PCAPNG_SPB = 0x00000003;
+      static const uint32_t PCAPNG_EPB = 0x00000006;
+      static const uint32_t PCAPNG_BYTE_ORDER = 0x1a2b3c4d;
+
+      uint32_t load32(uint64_t pos) const {
+        uint32_t value;
+        std::memcpy(&value, data + pos, 4);
+        return swapped ? __builtin_bswap32(value) : value;
+      }
+
+      uint16_t load16(uint64_t pos) const {
+        uint16_t value;
+        std::memcpy(&value, data + pos, 2);
+        return swapped ? __builtin_bswap16(value) : value;
+      }
+
+      void parseFileHeader() {
+        if (size < 24) {
+          FATAL("PcapFile:: file too short: " + filename);
+        }
+        uint32_t magic;
+        std::memcpy(&magic, data, 4);
+        if (magic == PCAPNG_SHB) {
+          is_pcapng = true;
+          return;   // sections are parsed as blocks
+        }
+        if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+          swapped = false;
+        } else if (__builtin_bswap32(magic) == PCAP_MAGIC_US
+                   || __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+          swapped = true;
+          magic = __builtin_bswap32(magic);
+        } else {
+          FATAL("PcapFile:: not a pcap or pcapng file: " + filename);
+        }
+        nanosecond = (magic == PCAP_MAGIC_NS);
+        linktype = load32(20) & 0x0fffffff;
+        offset = 24;
+      }
+
+      bool nextPcap(Frame &frame) {
+        if (size - offset < 16) {
+          offset = size;   // truncated record header
+          return false;
+        }
+        uint32_t sec = load32(offset);
+        uint32_t frac = load32(offset + 4);
+        uint32_t caplen = load32(offset + 8);
+        frame.wirelen = load32(offset + 12);
+        offset += 16;
+        if (caplen > size - offset) {
+          offset = size;   // truncated record
+          return false;
+        }
+        frame.data = data + offset;
+        frame.caplen = caplen;
+        frame.linktype = linktype;
+        frame.timestamp = Time(sec, nanosecond ? frac / 1000 : frac);
+        offset += caplen;
+        return true;
+      }
+
+      // Parses one block, returns true if it was a packet.
+      bool nextPcapng(Frame &frame) {
+        if (size - offset < 12) {
+          offset = size;
+          return false;
+        }
+        uint32_t type;
+        std::memcpy(&type, data + offset, 4);
+        if (type == PCAPNG_SHB) {
+          // Byte order may change with every section.
+          uint32_t byte_order;
+          std::memcpy(&byte_order, data + offset + 8, 4);
+          swapped = (byte_order != PCAPNG_BYTE_ORDER);
+          interfaces.clear();
+        } else {
+          type = swapped ? __builtin_bswap32(type) : type;
+        }
+        uint32_t length = load32(offset + 4);
+        if (length < 12 || length > size - offset) {
+          offset = size;   // corrupt or truncated block
+          return false;
+        }
+        uint64_t body = offset + 8;
+        uint64_t body_end = offset + length - 4;
+        offset += length;
+        switch (type) {
+          case PCAPNG_IDB:
+            parseInterface(body, body_end);
+            return false;
+          case PCAPNG_EPB:
+          case PCAPNG_PB: {
+            if (body_end - body < 20) return false;
+            uint32_t id = (type == PCAPNG_EPB) ? load32(body)
+                                               : load16(body);
+            if (id >= interfaces.size()) return false;
+            const Interface &iface = interfaces[id];
+            uint64_t ticks = ((uint64_t) load32(body + 4) << 32)
+                             | load32(body + 8);
+            uint32_t caplen = load32(body + 12);
+            if (caplen > body_end - body - 20) return false;
+            frame.data = data + body + 20;
+            frame.caplen = caplen;
+            frame.wirelen = load32(body + 16);
+            frame.linktype = iface.linktype;
+            frame.timestamp = toTime(ticks, iface);
+            return true;
+          }
+          case PCAPNG_SPB: {
+            if (body_end - body < 4 || interfaces.empty()) return false;
+            frame.wirelen = load32(body);
+            frame.caplen = std::min<uint64_t>(frame.wirelen,
+                                              body_end - body - 4);
+            frame.data = data + body + 4;
+            frame.linktype = interfaces[0].linktype;
+            frame.timestamp = Time();   // simple packets have no time
+            return true;
+          }
+          default:
+            return false;
+        }
+      }
+
+      void parseInterface(uint64_t body, uint64_t body_end) {
+        Interface iface;
+        iface.linktype = (body_end - body >= 8) ? load16(body) : 0;
+        iface.ticks_per_second = 1000000;
+        iface.offset_seconds = 0;
+        // Options: code (2), length (2), value padded to 4 bytes.
+        uint64_t pos = body + 8;
+        while (pos + 4 <= body_end) {
+          uint16_t code = load16(pos);
+          uint16_t length = load16(pos + 2);
+          pos += 4;
+          if (code == 0 || pos + length > body_end) {
+            break;
+          }
+          if (code == 9 && length >= 1) {   // if_tsresol
+            uint8_t resolution = data[pos];
+            bool binary = resolution & 0x80;
+            // Largest exponents that still fit in 64 bits.
+            int exponent = std::min(resolution & 0x7f, binary ? 63 : 19);
+            uint64_t ticks = 1;
+            for (int i = 0; i < exponent; ++i) {
+              ticks *= binary ? 2 : 10;
+            }
+            iface.ticks_per_second = ticks;
+          } else if (code == 14 && length >= 8) {   // if_tsoffset
+            uint64_t value;
+            std::memcpy(&value, data + pos, 8);
+            iface.offset_seconds =
+                (int64_t) (swapped ? __builtin_bswap64(value) : value);
+          }
+          pos += (length + 3) & ~3u;
+        }
+        interfaces.push_back(iface);
+      }
+
+      static Time toTime(uint64_t ticks, const Interface &iface) {
+        uint64_t sec = ticks / iface.ticks_per_second;
+        uint64_t rest = ticks % iface.ticks_per_second;
+        // Binary resolutions (if_tsresol with the top bit set) do not divide
+        // evenly into microseconds, so scale with a 128-bit intermediate.
+        uint64_t usec = (uint64_t) ((unsigned __int128) rest * 1000000
+                                    / iface.ticks_per_second);
+        return Time((uint32_t) (sec + iface.offset_seconds), (uint32_t) usec);
+      }
+
+      void openLibpcap() {
+#ifdef PNET_HAVE_LIBPCAP
+        char errbuf[PCAP_ERRBUF_SIZE];
+        pcap_t *pcap = pcap_open_offline(filename.c_str(), errbuf);
+        if (!pcap) {
+          FATAL("PcapFile:: cannot open " + filename + ": " + errbuf);
+        }
+        handle = pcap;
+        linktype = pcap_datalink(pcap);
+#else
+        FATAL("PcapFile:: cannot map file: " + filename);
+#endif
+      }
+
+      uint64_t nextLibpcap(Frame *frames, uint64_t max_frames) {
+        uint64_t n = 0;
+#ifdef PNET_HAVE_LIBPCAP
+        pcap_t *pcap = static_cast<pcap_t*>(handle);
+        if (copy_buffer.size() < max_frames * 65536) {
+          copy_buffer.resize(max_frames * 65536);
+        }
+        struct pcap_pkthdr *header;
+        const u_char *bytes;
+        while (n < max_frames && pcap_next_ex(pcap, &header, &bytes) == 1) {
+          uint32_t caplen = std::min<uint32_t>(header->caplen, 65536);
+          uint8_t *copy = copy_buffer.data() + n * 65536;
+          std::memcpy(copy, bytes, caplen);
+          frames[n].data = copy;
+          frames[n].caplen = caplen;
+          frames[n].wirelen = header->len;
+          frames[n].linktype = linktype;
+          frames[n].timestamp = Time(header->ts);
+          ++n;
+        }
+#else
+        (void) frames;
+        (void) max_frames;
+#endif
+        return n;
+      }
+
+    private:
+      std::string filename;
+      const uint8_t *data;
+      uint64_t size;
+      uint64_t offset;
+      bool swapped;
+      bool nanosecond;
+      uint32_t linktype;
+      bool is_pcapng;
+      std::vector<Interface> interfaces;
+      void *handle;                      // libpcap fallback
+      std::vector<uint8_t> copy_buffer;  // libpcap fallback
+  };
+
+
+  // Writes classic (microsecond, host byte order) .pcap files.
+  class PcapWriter {
+
+    public:
+      PcapWriter(const std::string &filename,
+                 uint32_t linktype = LINKTYPE_ETHERNET,
+                 uint32_t snaplen = 65535) {
+        out.open(filename, std::ios::binary);
+        if (!out.is_open()) {
+          FATAL("PcapWriter:: cannot open file : " + filename);
+        }
+        uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, snaplen, linktype};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+      }
+
+      void write(const Frame &frame) {
+        uint32_t header[4] = {frame.timestamp.sec, frame.timestamp.usec,
+                              frame.caplen, frame.wirelen};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(frame.data), frame.caplen);
+      }
+
+      // Writes a synthetic Ethernet/IPv4/(TCP|UDP) frame for the packet,
+      // with headers only: packet.size is kept as the IP length.
+      void write(const Packet &packet) {
+        uint8_t buffer[64];
+        std::memset(buffer, 0, sizeof(buffer));
+        buffer[12] = 0x08;                           // IPv4 ethertype
+        uint8_t *ip = buffer + 14;
+        ip[0] = 0x45;
+        ip[2] = packet.size >> 8;
+        ip[3] = packet.size & 0xff;
+        ip[8] = 64;
+        ip[9] = (uint8_t) packet.protocol;
+        std::memcpy(ip + 12, &packet.ip_src, 4);
+        std::memcpy(ip + 16, &packet.ip_dst, 4);
+        uint8_t *l4 = ip + 20;
+        std::memcpy(l4, &packet.port_src, 2);
+        std::memcpy(l4 + 2, &packet.port_dst, 2);
+        uint32_t length = 34;
+        if (packet.protocol == IPPROTO_TCP) {
+          l4[12] = 0x50;
+          l4[13] = (uint8_t) packet.flags;
+          length += 20;
+        } else if (packet.protocol == IPPROTO_UDP) {
+          length += 8;
+        }
+        Frame frame;
+        frame.data = buffer;
+        frame.caplen = length;
+        frame.wirelen = 14 + packet.size;
+        frame.linktype = LINKTYPE_ETHERNET;
+        frame.timestamp = packet.t_arrival;
+        write(frame);
+      }
+
+    private:
+      std::ofstream out;
+  };
+
+} // namespace pnet
+
+#endif // PNET_PCAP_HPP_
@@ -3,30 +3,36 @@
 
 #include <pnet_flow.hpp>
 #include <pnet_logger.hpp>
+#include <pnet_metrics.hpp>
+#include <pnet_spsc_ring.hpp>
 
 #include <csignal>
 #include <cstring>
 #include <fcntl.h>
-#include <semaphore.h>
+#include <inttypes.h>
 #include <sys/shm.h>
 
-#define NUM_PACKETS 50000
-
 namespace pnet{
 
-  // Block of memory to bu used as circular queue.
-  typedef struct memory{
-    Packet packets[NUM_PACKETS];
-    sem_t sem_read;
-    sem_t sem_write;
-  } Memory;
-
+  // Packet queue between a producer (capture) and a consumer (analysis)
+  // process. The ring, including its read and write positions, lives in a
+  // shared memory segment, so the buffer must be created before fork().
+  //
+  // Producer and consumer exchange packets through a lock-free
+  // single-producer/single-consumer ring. A blocked side spins shortly
+  // and then sleeps on a futex (see WaitPolicy), so no system call is made
+  // while packets flow.
   class SharedBuffer {
 
     public:
-      static SharedBuffer* createOrGet(){
+      static const uint64_t DEFAULT_CAPACITY = 65536;  // packets
+
+    public:
+      // Capacity is only used when the buffer is created, and is rounded
+      // up to a power of two.
+      static SharedBuffer* createOrGet(uint64_t capacity = DEFAULT_CAPACITY){
         if( !shared_buffer_ )
-          shared_buffer_ = new SharedBuffer();
+          shared_buffer_ = new SharedBuffer(capacity);
         return shared_buffer_;
       }
 
@@ -38,59 +44,85 @@ namespace pnet{
       }
 
     private:
-      SharedBuffer() {
+      SharedBuffer(uint64_t capacity) {
         // create or get a shared memory segment
-        shared_mem_id = shmget(IPC_PRIVATE, sizeof(Memory), 0644 );
+        uint64_t size = SpscRing<Packet>::memorySize(capacity);
+        shared_mem_id = shmget(IPC_PRIVATE, size, 0644 );
         if(shared_mem_id == -1)
           Logger::FATAL("SharedMemory > Unable to allocate memory\n");
         //attach
-        memory = (Memory*) shmat(shared_mem_id, (void *)0, 0);
+        memory = shmat(shared_mem_id, (void *)0, 0);
+        if(memory == (void*) -1)
+          Logger::FATAL("SharedMemory > Unable to attach memory\n");
         // mark for deletion after detaching
         shmctl(shared_mem_id, IPC_RMID, NULL);
-        // create or connect to a semaphore set
-        sem_init(&memory->sem_write, 1, NUM_PACKETS);
-        sem_init(&memory->sem_read, 1, 0);
-        // set counters
-        current_packet = memory->packets;
-        memory_end =  memory->packets +  NUM_PACKETS;
+        ring = new SpscRing<Packet>(memory, capacity, true);
         num_packets_processed = 0;
+        PNET_METRIC_SET(RING_CAPACITY, ring->capacity());
       }
 
       ~SharedBuffer() {
+        delete ring;
         shmdt(memory);
       }
 
     public:
-      bool produce(Packet &pkt) {
-        // Exit on interrupt
-        if(sem_wait(&memory->sem_write))
-          return false;
-        memcpy(current_packet, &pkt, sizeof(Packet));
-        // iterate current packet circularly
-        if(++current_packet == memory_end)
-          current_packet = memory->packets;
-        sem_post(&memory->sem_read);
-        return true;
+      void setWaitPolicy(const WaitPolicy &policy){
+        ring->setWaitPolicy(policy);
+      }
+
+      // Blocks until the packet is queued.
+      // Returns false on interrupt or if the buffer is closed.
+      bool produce(const Packet &pkt) {
+        return ring->pushWait(&pkt, 1);
+      }
+
+      // Blocks until all n packets are queued.
+      // Returns false on interrupt or if the buffer is closed.
+      bool produce(const Packet *pkts, uint64_t n) {
+        PNET_METRIC_TIMER(PRODUCE_NS);
+        return ring->pushWait(pkts, n);
       }
 
+      // Blocks until a packet is available.
+      // Returns false on interrupt or if the buffer is closed and empty.
       bool consume(Packet &pkt) {
-        // Exit on interrupt
-        if (sem_wait(&memory->sem_read))
-          return false;
-        memcpy(&pkt, current_packet, sizeof(Packet));
-        if(++current_packet == memory_end)
-          current_packet = memory->packets;
-        ++num_packets_processed;
-        sem_post(&memory->sem_write);
-        return true;
+        return consume(&pkt, 1) == 1;
+      }
+
+      // Blocks until at least one packet is available, then takes up to
+      // max_packets. Returns the number of packets taken, zero on interrupt
+      // or if the buffer is closed and empty.
+      uint64_t consume(Packet *pkts, uint64_t max_packets) {
+        PNET_METRIC_TIMER(CONSUME_NS);
+        uint64_t n = ring->popWait(pkts, max_packets);
+        num_packets_processed += n;
+        PNET_METRIC_ADD(PACKETS_CONSUMED, n);
+        PNET_METRIC_SET(RING_OCCUPANCY, ring->size());
+        return n;
+      }
+
+      // Wakes up both sides. After close, produce() fails and consume()
+      // returns the remaining packets.
+      void close() {
+        ring->close();
+      }
+
+      // Number of packets waiting in the buffer.
+      uint64_t occupancy() const {
+        return ring->size();
+      }
+
+      uint64_t capacity() const {
+        return ring->capacity();
       }
 
+      // Prints the number of queued packets (sem_read) and free slots
+      // (sem_write), as the former semaphore based buffer did.
       void printSemaphores(){
-        int sem_val;
-        if(!sem_getvalue(&memory->sem_read, &sem_val))
-          printf("sem_read : %d\n",sem_val);
-        if(!sem_getvalue(&memory->sem_write, &sem_val))
-          printf("sem_write : %d\n",sem_val);
+        uint64_t used = occupancy();
+        printf("sem_read : %" PRIu64 "\n", used);
+        printf("sem_write : %" PRIu64 "\n", capacity() - used);
       }
 
       uint64_t getNumPacketsProcessed(){
@@ -102,13 +134,12 @@ namespace pnet{
       static SharedBuffer* shared_buffer_;
 
     private:
-      Memory *memory;
-      Packet *current_packet;
-      Packet *memory_end;
+      void *memory;
+      SpscRing<Packet> *ring;
       uint64_t num_packets_processed;
 
   };
   SharedBuffer* SharedBuffer::shared_buffer_ = nullptr;
 }
 
-#endif // PNET_SHARED_BUFFER_HPP_
\ No newline at end of file
+#endif // PNET_SHARED_BUFFER_HPP_
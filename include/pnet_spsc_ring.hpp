@@ -0,0 +1,388 @@
+#ifndef PNET_SPSC_RING_HPP_
+#define PNET_SPSC_RING_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <pnet_utils.hpp>
+
+#define PNET_CACHE_LINE 64
+
+namespace pnet {
+
+  // Spins politely in busy-wait loops.
+  inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  // Blocks while *word == expected, for at most timeout_us microseconds.
+  // Works across processes if the word lives in shared memory.
+  // Returns false if interrupted by a signal.
+  inline bool futexWait(std::atomic<uint32_t> *word, uint32_t expected,
+                        uint64_t timeout_us) {
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+                       FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    return ret == 0 || errno != EINTR;
+#else
+    (void) expected;
+    std::this_thread::sleep_for(std::chrono::microseconds(
+        std::min<uint64_t>(timeout_us, 50)));
+    return true;
+#endif
+  }
+
+  inline void futexWakeAll(std::atomic<uint32_t> *word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+            FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    (void) word;
+#endif
+  }
+
+
+  // How a blocked side of an SpscRing waits: it first spins (up to
+  // max_spins rounds, adapted to how often spinning paid off recently),
+  // then sleeps on a futex until the other side signals progress.
+  struct WaitPolicy {
+    WaitPolicy(uint32_t max_spins_ = 20000, uint32_t min_spins_ = 100,
+               uint64_t sleep_timeout_us_ = 100000)
+        : max_spins(max_spins_), min_spins(min_spins_),
+          sleep_timeout_us(sleep_timeout_us_) {}
+
+    uint32_t max_spins;
+    uint32_t min_spins;
+    uint64_t sleep_timeout_us;   // upper bound on a single futex sleep
+  };
+
+
+  // Lock-free single-producer/single-consumer ring of trivially copyable T.
+  //
+  // The write position (tail) is owned by the producer and the read
+  // position (head) by the consumer. Each lives on its own cache line
+  // together with a cached copy of the other side's position, so the two
+  // sides touch each other's line only when the cached copy runs out.
+  // Items are moved in batches with a single release store per batch.
+  //
+  // The control block and the items can be placed in caller provided
+  // memory (e.g. a shared memory segment, see memorySize()), in which case
+  // producer and consumer may live in different processes.
+  template <typename T>
+  class SpscRing {
+
+    private:
+      struct Producer {
+        std::atomic<uint64_t> tail;
+        uint64_t cached_head;
+        std::atomic<uint32_t> waiting;     // producer sleeps on space_signal
+        std::atomic<uint32_t> data_signal; // bumped to wake the consumer
+        char padding[PNET_CACHE_LINE - 3 * sizeof(uint64_t)];
+      };
+
+      struct Consumer {
+        std::atomic<uint64_t> head;
+        uint64_t cached_tail;
+        std::atomic<uint32_t> waiting;      // consumer sleeps on data_signal
+        std::atomic<uint32_t> space_signal; // bumped to wake the producer
+        char padding[PNET_CACHE_LINE - 3 * sizeof(uint64_t)];
+      };
+
+      struct Control {
+        Producer producer;
+        Consumer consumer;
+        uint64_t capacity;
+        std::atomic<uint32_t> closed;
+        char padding[PNET_CACHE_LINE - 2 * sizeof(uint64_t)];
+      };
+
+    public:
+      // Bytes of memory needed for a ring of the given capacity.
+      static uint64_t memorySize(uint64_t capacity) {
+        return sizeof(Control) + roundCapacity(capacity) * sizeof(T);
+      }
+
+      // Creates a ring in its own heap memory.
+      // Capacity is rounded up to a power of two.
+      explicit SpscRing(uint64_t capacity)
+          : owns_memory(true) {
+        // Control pads its indices to cache lines, which malloc() does not
+        // align to.
+        void *memory = nullptr;
+        ASSERT_TRUE(posix_memalign(&memory, PNET_CACHE_LINE,
+                                   memorySize(capacity)) == 0,
+                    "SpscRing:: Unable to allocate memory");
+        attach(memory);
+        initialize(capacity);
+      }
+
+      // Creates (if initialize_ is set) or attaches to a ring placed in the
+      // given memory of at least memorySize(capacity) bytes.
+      SpscRing(void *memory, uint64_t capacity, bool initialize_)
+          : owns_memory(false) {
+        attach(memory);
+        if (initialize_) {
+          initialize(capacity);
+        }
+      }
+
+      ~SpscRing(){
+        if (owns_memory) {
+          free(control);   // from posix_memalign()
+        }
+      }
+
+      void setWaitPolicy(const WaitPolicy &policy_) {
+        policy = policy_;
+        spins[0] = spins[1] = policy.max_spins;
+      }
+
+      // Producer side: appends up to n items, returns the number appended.
+      uint64_t push(const T *src, uint64_t n) {
+        Producer &producer = control->producer;
+        uint64_t tail = producer.tail.load(std::memory_order_relaxed);
+        uint64_t free_slots = capacity() - (tail - producer.cached_head);
+        if (free_slots < n) {
+          producer.cached_head =
+              control->consumer.head.load(std::memory_order_acquire);
+          free_slots = capacity() - (tail - producer.cached_head);
+          n = std::min(n, free_slots);
+        }
+        if (n > 0) {
+          copyIn(tail, src, n);
+          producer.tail.store(tail + n, std::memory_order_release);
+          wake(control->consumer.waiting, producer.data_signal);
+        }
+        return n;
+      }
+
+      // Consumer side: removes up to n items, returns the number removed.
+      uint64_t pop(T *dst, uint64_t n) {
+        Consumer &consumer = control->consumer;
+        uint64_t head = consumer.head.load(std::memory_order_relaxed);
+        uint64_t available = consumer.cached_tail - head;
+        if (available < n) {
+          consumer.cached_tail =
+              control->producer.tail.load(std::memory_order_acquire);
+          available = consumer.cached_tail - head;
+          n = std::min(n, available);
+        }
+        if (n > 0) {
+          copyOut(dst, head, n);
+          consumer.head.store(head + n, std::memory_order_release);
+          wake(control->producer.waiting, consumer.space_signal);
+        }
+        return n;
+      }
+
+      // Producer side: appends all n items, spinning while the ring is full.
+      void pushAll(const T *src, uint64_t n) {
+        while (n > 0) {
+          uint64_t pushed = push(src, n);
+          if (pushed == 0) {
+            cpuRelax();
+          }
+          src += pushed;
+          n -= pushed;
+        }
+      }
+
+      // Producer side: appends all n items, waiting according to the wait
+      // policy while the ring is full. Returns false if interrupted by a
+      // signal or if the ring is closed.
+      bool pushWait(const T *src, uint64_t n) {
+        if (closed()) {
+          return false;
+        }
+        while (n > 0) {
+          uint64_t pushed = push(src, n);
+          if (pushed == 0) {
+            if (!waitFor(control->producer.waiting,
+                         control->consumer.space_signal, true)) {
+              return false;
+            }
+          }
+          src += pushed;
+          n -= pushed;
+        }
+        return true;
+      }
+
+      // Consumer side: removes up to n items, waiting according to the wait
+      // policy while the ring is empty. Returns zero if interrupted by a
+      // signal or if the ring is closed and drained.
+      uint64_t popWait(T *dst, uint64_t n) {
+        while (true) {
+          uint64_t popped = pop(dst, n);
+          if (popped > 0) {
+            return popped;
+          }
+          if (!waitFor(control->consumer.waiting,
+                       control->producer.data_signal, false)) {
+            return pop(dst, n);
+          }
+        }
+      }
+
+      // Wakes up and releases all waiters for good.
+      void close() {
+        control->closed.store(1, std::memory_order_seq_cst);
+        control->producer.data_signal.fetch_add(1);
+        control->consumer.space_signal.fetch_add(1);
+        futexWakeAll(&control->producer.data_signal);
+        futexWakeAll(&control->consumer.space_signal);
+      }
+
+      bool closed() const {
+        return control->closed.load(std::memory_order_acquire) != 0;
+      }
+
+      // Number of items in the ring. Exact only when both sides are idle.
+      uint64_t size() const {
+        return control->producer.tail.load(std::memory_order_acquire)
+               - control->consumer.head.load(std::memory_order_acquire);
+      }
+
+      bool empty() const {
+        return size() == 0;
+      }
+
+      uint64_t capacity() const {
+        return mask + 1;
+      }
+
+      // Total number of items pushed and popped so far.
+      uint64_t numPushed() const {
+        return control->producer.tail.load(std::memory_order_acquire);
+      }
+
+      uint64_t numPopped() const {
+        return control->consumer.head.load(std::memory_order_acquire);
+      }
+
+    private:
+      SpscRing(const SpscRing&);
+      SpscRing& operator=(const SpscRing&);
+
+      static uint64_t roundCapacity(uint64_t capacity) {
+        uint64_t rounded = 2;
+        while (rounded < capacity) {
+          rounded *= 2;
+        }
+        return rounded;
+      }
+
+      void attach(void *memory) {
+        spins[0] = spins[1] = policy.max_spins;
+        control = static_cast<Control*>(memory);
+        items = reinterpret_cast<T*>(control + 1);
+        mask = control->capacity - 1;
+      }
+
+      void initialize(uint64_t capacity) {
+        new (control) Control();
+        control->capacity = roundCapacity(capacity);
+        control->producer.tail.store(0);
+        control->producer.cached_head = 0;
+        control->producer.waiting.store(0);
+        control->producer.data_signal.store(0);
+        control->consumer.head.store(0);
+        control->consumer.cached_tail = 0;
+        control->consumer.waiting.store(0);
+        control->consumer.space_signal.store(0);
+        control->closed.store(0);
+        mask = control->capacity - 1;
+      }
+
+      // Signals the other side after progress, only if it is asleep.
+      // The fence orders the position store before the 'waiting' load,
+      // pairing with the fence in waitFor().
+      void wake(std::atomic<uint32_t> &waiting,
+                std::atomic<uint32_t> &signal) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed)) {
+          signal.fetch_add(1, std::memory_order_release);
+          futexWakeAll(&signal);
+        }
+      }
+
+      // Spins, then sleeps until 'signal' changes.
+      // Returns false on interrupt or close.
+      bool waitFor(std::atomic<uint32_t> &waiting,
+                   std::atomic<uint32_t> &signal, bool producer_side) {
+        uint32_t &limit = spins[producer_side];
+        for (uint32_t i = 0; i < limit; ++i) {
+          if (ready(producer_side)) {
+            limit = std::min(policy.max_spins, limit * 2);
+            return true;
+          }
+          cpuRelax();
+        }
+        limit = std::max(policy.min_spins, limit / 2);
+        if (closed()) {
+          return false;
+        }
+        uint32_t seen = signal.load(std::memory_order_acquire);
+        waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok = true;
+        if (!ready(producer_side) && !closed()) {
+          ok = futexWait(&signal, seen, policy.sleep_timeout_us);
+        }
+        waiting.store(0, std::memory_order_relaxed);
+        return ok && !closed();
+      }
+
+      // Whether the waiting side can make progress.
+      bool ready(bool producer_side) const {
+        uint64_t tail = control->producer.tail.load(std::memory_order_acquire);
+        uint64_t head = control->consumer.head.load(std::memory_order_acquire);
+        return producer_side ? (tail - head < capacity()) : (tail != head);
+      }
+
+      // Copies n items into the ring starting at position pos,
+      // in at most two pieces around the end of the ring.
+      void copyIn(uint64_t pos, const T *src, uint64_t n) {
+        uint64_t start = pos & mask;
+        uint64_t first = std::min(n, capacity() - start);
+        std::memcpy(items + start, src, first * sizeof(T));
+        std::memcpy(items, src + first, (n - first) * sizeof(T));
+      }
+
+      void copyOut(T *dst, uint64_t pos, uint64_t n) {
+        uint64_t start = pos & mask;
+        uint64_t first = std::min(n, capacity() - start);
+        std::memcpy(dst, items + start, first * sizeof(T));
+        std::memcpy(dst + first, items, (n - first) * sizeof(T));
+      }
+
+    private:
+      Control *control;
+      T *items;
+      uint64_t mask;
+      bool owns_memory;
+      WaitPolicy policy;
+      uint32_t spins[2];    // adaptive spin limits of consumer and producer
+  };
+
+} // namespace pnet
+
+#endif // PNET_SPSC_RING_HPP_
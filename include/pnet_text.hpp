@@ -0,0 +1,403 @@
+#ifndef PNET_TEXT_HPP_
+#define PNET_TEXT_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pnet_compress.hpp>
+#include <pnet_packet.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Hand-rolled formatting and parsing of the text form of packets, one
+  // line per packet as in Packet::toString():
+  //   ip_src port_src ip_dst port_dst protocol flags size seconds.micros
+  // Fields are tab separated and padded exactly as by toString(), so that
+  // text written here and by toString() is byte-identical. Parsing takes
+  // any run of spaces and tabs between fields, like Packet::fromString().
+  namespace text {
+
+    // Longest line written by formatPacket(), without the newline.
+    const uint64_t MAX_LINE = 96;
+
+    const char DIGITS[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    // Writes x in decimal, at least width wide, left padded with pad.
+    inline char* putDecimal(char *out, uint64_t x, uint32_t width = 0,
+                            char pad = ' ') {
+      char digits[20];
+      char *p = digits + sizeof(digits);
+      while (x >= 100) {
+        const char *d = DIGITS + 2 * (x % 100);
+        *--p = d[1];
+        *--p = d[0];
+        x /= 100;
+      }
+      if (x >= 10) {
+        *--p = DIGITS[2 * x + 1];
+        *--p = DIGITS[2 * x];
+      } else {
+        *--p = '0' + x;
+      }
+      uint32_t n = digits + sizeof(digits) - p;
+      for (; n < width; --width) {
+        *out++ = pad;
+      }
+      std::memcpy(out, p, n);
+      return out + n;
+    }
+
+    // printf("%*d") of a signed value.
+    inline char* putSigned(char *out, int64_t x, uint32_t width) {
+      if (x >= 0) {
+        return putDecimal(out, x, width);
+      }
+      char digits[24];
+      char *end = putDecimal(digits + 1, -(uint64_t) x);
+      digits[0] = '-';
+      uint32_t n = end - digits;
+      for (; n < width; --width) {
+        *out++ = ' ';
+      }
+      std::memcpy(out, digits, n);
+      return out + n;
+    }
+
+    // printf("%-15s") of inet_ntoa(ip).
+    inline char* putAddress(char *out, struct in_addr ip) {
+      const uint8_t *b = reinterpret_cast<const uint8_t*>(&ip.s_addr);
+      char *start = out;
+      out = putDecimal(out, b[0]);
+      for (int i = 1; i < 4; ++i) {
+        *out++ = '.';
+        out = putDecimal(out, b[i]);
+      }
+      while (out - start < 15) {
+        *out++ = ' ';
+      }
+      return out;
+    }
+
+    // Formats toString() of packet into out, which holds MAX_LINE bytes.
+    // Returns the end of the line.
+    inline char* formatPacket(const Packet &packet, char *out) {
+      out = putAddress(out, packet.ip_src);
+      *out++ = '\t';
+      out = putDecimal(out, ntohs(packet.port_src), 5);
+      *out++ = '\t';
+      out = putAddress(out, packet.ip_dst);
+      *out++ = '\t';
+      out = putDecimal(out, ntohs(packet.port_dst), 5);
+      *out++ = '\t';
+      out = putSigned(out, (int32_t) packet.protocol, 2);
+      *out++ = '\t';
+      out = putDecimal(out, packet.flags);
+      *out++ = '\t';
+      out = putDecimal(out, packet.size, 4);
+      *out++ = '\t';
+      out = putDecimal(out, packet.t_arrival.sec, 10, '0');
+      *out++ = '.';
+      return putDecimal(out, packet.t_arrival.usec, 6, '0');
+    }
+
+    inline bool isBlank(char c) {
+      return c == ' ' || c == '\t';
+    }
+
+    inline const char* skipBlanks(const char *p, const char *end) {
+      while (p < end && isBlank(*p)) {
+        ++p;
+      }
+      return p;
+    }
+
+    // Unsigned decimal of at most max. Returns nullptr if there is none.
+    inline const char* getDecimal(const char *p, const char *end,
+                                  uint64_t max, uint64_t &x) {
+      const char *start = p;
+      x = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        x = 10 * x + (*p++ - '0');
+        if (x > max) {
+          return nullptr;
+        }
+      }
+      return p == start ? nullptr : p;
+    }
+
+    inline const char* getAddress(const char *p, const char *end,
+                                  struct in_addr &ip) {
+      uint8_t *b = reinterpret_cast<uint8_t*>(&ip.s_addr);
+      for (int i = 0; i < 4; ++i) {
+        uint64_t x;
+        if (i > 0 && (p == end || *p++ != '.')) {
+          return nullptr;
+        }
+        if (!(p = getDecimal(p, end, 255, x))) {
+          return nullptr;
+        }
+        b[i] = x;
+      }
+      return p;
+    }
+
+    // seconds[.fraction], the fraction is truncated to microseconds.
+    inline const char* getTime(const char *p, const char *end, Time &t) {
+      uint64_t sec, usec = 0;
+      if (!(p = getDecimal(p, end, 0xffffffffull, sec))) {
+        return nullptr;
+      }
+      if (p < end && *p == '.') {
+        uint64_t scale = 100000;
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+          usec += (*p - '0') * scale;
+          scale /= 10;
+        }
+      }
+      t = Time((uint32_t) sec, (uint32_t) usec);
+      return p;
+    }
+
+    // Parses the line [p, end), without its newline. Returns false if it
+    // is malformed.
+    inline bool parsePacket(const char *p, const char *end, Packet &packet) {
+      uint64_t port_src, port_dst, protocol, flags, size;
+      p = skipBlanks(p, end);
+      if (!(p = getAddress(p, end, packet.ip_src))) return false;
+      p = skipBlanks(p, end);
+      if (!(p = getDecimal(p, end, 0xffff, port_src))) return false;
+      p = skipBlanks(p, end);
+      if (!(p = getAddress(p, end, packet.ip_dst))) return false;
+      p = skipBlanks(p, end);
+      if (!(p = getDecimal(p, end, 0xffff, port_dst))) return false;
+      p = skipBlanks(p, end);
+      // Written as a signed value by toString().
+      bool negative = p < end && *p == '-';
+      if (!(p = getDecimal(p + negative, end, 0xffffffffull, protocol))) {
+        return false;
+      }
+      if (negative) {
+        protocol = -protocol;
+      }
+      p = skipBlanks(p, end);
+      if (!(p = getDecimal(p, end, 0xffff, flags))) return false;
+      p = skipBlanks(p, end);
+      if (!(p = getDecimal(p, end, 0xffff, size))) return false;
+      p = skipBlanks(p, end);
+      if (!(p = getTime(p, end, packet.t_arrival))) return false;
+      while (p < end && (isBlank(*p) || *p == '\r')) {
+        ++p;
+      }
+      packet.port_src = htons(port_src);
+      packet.port_dst = htons(port_dst);
+      packet.protocol = protocol;
+      packet.flags = flags;
+      packet.size = size;
+      return p == end;
+    }
+
+    inline bool isEmptyLine(const char *p, const char *end) {
+      while (p < end && (isBlank(*p) || *p == '\r')) {
+        ++p;
+      }
+      return p == end;
+    }
+
+  } // namespace text
+
+
+  // Parses and formats whole buffers of text packets (see text::), on
+  // several threads for large inputs. Used for .txt and .pkta files.
+  //
+  // Input is split at line boundaries into one part per thread, and the
+  // parts are put back together in order: the result is the same as a
+  // line by line pass.
+  class PacketTextCodec {
+
+    public:
+      // Inputs smaller than this are handled on the calling thread.
+      static const uint64_t MIN_PARALLEL_BYTES = 1 << 20;
+
+    public:
+      explicit PacketTextCodec(uint32_t num_threads_ = gzip::defaultThreads())
+          : num_threads(std::max(1u, num_threads_)), num_parsed(0),
+            num_failed(0) {}
+
+      // Appends the packets of the lines of [data, data + size) to out.
+      // Malformed lines are skipped and counted in num_failed, empty lines
+      // are ignored. Returns the number of packets appended.
+      uint64_t parse(const char *data, uint64_t size,
+                     std::vector<Packet> &out) {
+        std::vector<const char*> bounds = split(data, size);
+        uint64_t num_parts = bounds.size() - 1;
+        std::vector<std::vector<Packet> > parts(num_parts);
+        std::vector<uint64_t> failed(num_parts, 0);
+        run(num_parts, [&](uint64_t i) {
+          // About 60 bytes per line.
+          parts[i].reserve((bounds[i + 1] - bounds[i]) / 50);
+          failed[i] = parseLines(bounds[i], bounds[i + 1], parts[i]);
+        });
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < num_parts; ++i) {
+          count += parts[i].size();
+          num_failed += failed[i];
+        }
+        out.reserve(out.size() + count);
+        for (const std::vector<Packet> &part : parts) {
+          out.insert(out.end(), part.begin(), part.end());
+        }
+        num_parsed += count;
+        return count;
+      }
+
+      // Appends one line per packet to out.
+      void format(const Packet *packets, uint64_t n, std::string &out) {
+        uint64_t num_parts = std::min<uint64_t>(
+            num_threads, n * (text::MAX_LINE / 2) / MIN_PARALLEL_BYTES + 1);
+        uint64_t part = (n + num_parts - 1) / std::max<uint64_t>(1, num_parts);
+        std::vector<std::string> parts(num_parts);
+        run(num_parts, [&](uint64_t i) {
+          uint64_t first = std::min(n, i * part);
+          formatLines(packets + first, std::min(n - first, part), parts[i]);
+        });
+        for (const std::string &text : parts) {
+          out += text;
+        }
+      }
+
+      // Appends the packets of a text file to out, see parse().
+      uint64_t readFile(const std::string &filename,
+                        std::vector<Packet> &out) {
+        uint64_t size = 0;
+        void *memory = nullptr;
+        if (utils::stringEndsWith(filename, {".gz"})) {
+          memory = inflateFile(filename, size);
+        } else {
+          int fd = ::open(filename.c_str(), O_RDONLY);
+          if (fd == -1) {
+            FATAL("PacketTextCodec:: cannot open file: " + filename);
+          }
+          struct stat st;
+          if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = st.st_size;
+            memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (memory == MAP_FAILED) {
+              ::close(fd);
+              FATAL("PacketTextCodec:: cannot map file: " + filename);
+            }
+            madvise(memory, size, MADV_SEQUENTIAL);
+          }
+          ::close(fd);
+        }
+        uint64_t count = parse(static_cast<const char*>(memory), size, out);
+        if (memory) {
+          munmap(memory, size);
+        }
+        return count;
+      }
+
+      // Writes one line per packet, gzipped if filename ends with .gz.
+      void writeFile(const std::string &filename, const Packet *packets,
+                     uint64_t n) {
+        std::string out;
+        out.reserve(n * 64);
+        format(packets, n, out);
+        if (utils::stringEndsWith(filename, {".gz"})) {
+          GzipWriter writer(filename);
+          writer.write(out.data(), out.size());
+          return;
+        }
+        std::FILE *file = std::fopen(filename.c_str(), "wb");
+        if (!file || std::fwrite(out.data(), 1, out.size(), file)
+                     != out.size()) {
+          FATAL("PacketTextCodec:: cannot write file: " + filename);
+        }
+        std::fclose(file);
+      }
+
+    public:
+      uint32_t num_threads;
+      uint64_t num_parsed;
+      uint64_t num_failed;   // malformed lines
+
+    private:
+      static uint64_t parseLines(const char *p, const char *end,
+                                 std::vector<Packet> &out) {
+        uint64_t failed = 0;
+        Packet packet;
+        while (p < end) {
+          const char *eol = static_cast<const char*>(
+              std::memchr(p, '\n', end - p));
+          if (!eol) {
+            eol = end;
+          }
+          if (text::parsePacket(p, eol, packet)) {
+            out.push_back(packet);
+          } else if (!text::isEmptyLine(p, eol)) {
+            ++failed;
+          }
+          p = eol + 1;
+        }
+        return failed;
+      }
+
+      static void formatLines(const Packet *packets, uint64_t n,
+                              std::string &out) {
+        out.resize(n * (text::MAX_LINE + 1));
+        char *start = &out[0], *p = start;
+        for (uint64_t i = 0; i < n; ++i) {
+          p = text::formatPacket(packets[i], p);
+          *p++ = '\n';
+        }
+        out.resize(p - start);
+      }
+
+      // Part boundaries, at the start of lines.
+      std::vector<const char*> split(const char *data, uint64_t size) const {
+        uint64_t num_parts = std::min<uint64_t>(
+            num_threads, size / MIN_PARALLEL_BYTES + 1);
+        std::vector<const char*> bounds(1, data);
+        const char *end = data + size;
+        for (uint64_t i = 1; i < num_parts; ++i) {
+          const char *p = std::max(bounds.back(), data + i * size / num_parts);
+          const char *eol = static_cast<const char*>(
+              std::memchr(p, '\n', end - p));
+          bounds.push_back(eol ? eol + 1 : end);
+        }
+        bounds.push_back(end);
+        return bounds;
+      }
+
+      template <typename Function>
+      static void run(uint64_t num_parts, Function function) {
+        std::vector<std::thread> threads;
+        for (uint64_t i = 1; i < num_parts; ++i) {
+          threads.push_back(std::thread(function, i));
+        }
+        if (num_parts > 0) {
+          function(0);
+        }
+        for (std::thread &thread : threads) {
+          thread.join();
+        }
+      }
+  };
+
+} // namespace pnet
+
+#endif // PNET_TEXT_HPP_
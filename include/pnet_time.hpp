@@ -26,10 +26,19 @@ namespace pnet {
       }
 
       // Time from string: ssssssssss.mmmmmm  (seconds.microseconds)
+      // The fraction is read up to microseconds, whatever the number of
+      // digits of the seconds.
       explicit Time(std::string str) {
         char *p;
         sec = (uint32_t)std::strtoul(str.c_str(), &p, 10);
-        usec = (uint32_t)std::strtoul(str.c_str() + 11, &p, 10);
+        usec = 0;
+        if (*p == '.') {
+          uint32_t scale = 100000;
+          for (++p; *p >= '0' && *p <= '9'; ++p) {
+            usec += (*p - '0') * scale;
+            scale /= 10;
+          }
+        }
       }
 
       // A time value that is accurate to the nearest
@@ -0,0 +1,189 @@
+#ifndef PNET_TIMER_WHEEL_HPP_
+#define PNET_TIMER_WHEEL_HPP_
+
+#include <algorithm>
+#include <cstdint>
+
+namespace pnet {
+
+  // Hierarchical timing wheel for intrusive timers.
+  //
+  // Time is divided into ticks of 2^TICK_BITS microseconds (about 1 ms).
+  // The wheel has LEVELS levels of SLOTS slots each. Level 0 holds timers
+  // due within the next 256 ticks, level 1 within the next 256^2 ticks and
+  // so on, covering about 51 days. When the lowest level wraps around, the
+  // next slot of the upper level is cascaded down. Scheduling, cancelling
+  // and firing a timer are O(1); advancing the clock over idle periods
+  // skips empty stretches of level 0.
+  //
+  // Deadlines are rounded up to the next tick, so a timer never fires
+  // before its deadline but may fire up to one tick late.
+  //
+  // T must provide the following members, owned by the wheel:
+  //    T *timer_prev, *timer_next;
+  //    uint32_t timer_slot;        // NOT_SCHEDULED if not in the wheel
+  //    uint64_t timer_deadline;    // scheduled deadline in microseconds
+  template <typename T>
+  class TimerWheel {
+
+    public:
+      static const uint32_t TICK_BITS = 10;
+      static const uint32_t SLOT_BITS = 8;
+      static const uint32_t SLOTS = 1 << SLOT_BITS;
+      static const uint32_t LEVELS = 4;
+      static const uint32_t NOT_SCHEDULED = 0xffffffff;
+
+    public:
+      // Input:
+      //    - t_start: time in microseconds the wheel starts from.
+      explicit TimerWheel(uint64_t t_start = 0)
+          : current(t_start >> TICK_BITS), num_timers(0) {
+        clear();
+      }
+
+      // Schedules (or re-schedules) a timer to fire at 'deadline' microsecs.
+      void schedule(T *timer, uint64_t deadline) {
+        if (timer->timer_slot != NOT_SCHEDULED) {
+          cancel(timer);
+        }
+        timer->timer_deadline = deadline;
+        place(timer);
+        ++num_timers;
+      }
+
+      void cancel(T *timer) {
+        uint32_t slot = timer->timer_slot;
+        if (slot == NOT_SCHEDULED) {
+          return;
+        }
+        unlink(timer);
+        --level_counts[slot / SLOTS];
+        --num_timers;
+      }
+
+      static bool scheduled(const T *timer) {
+        return timer->timer_slot != NOT_SCHEDULED;
+      }
+
+      // Advances the wheel up to time t_now (in microseconds) and calls
+      // callback(T*) for every timer whose deadline has passed. The timer
+      // is removed from the wheel before the callback, which may schedule
+      // it again (to a deadline later than t_now).
+      template <typename Callback>
+      void advance(uint64_t t_now, Callback callback) {
+        uint64_t target = t_now >> TICK_BITS;
+        while (current <= target) {
+          if (num_timers == 0) {
+            current = target + 1;
+            break;
+          }
+          uint32_t index = current & (SLOTS - 1);
+          if (index == 0) {
+            cascadeAll();
+          }
+          // Nothing can fire before level 0 wraps around again.
+          if (level_counts[0] == 0) {
+            current = std::min((current | (SLOTS - 1)) + 1, target + 1);
+            continue;
+          }
+          T **head = &slots[index];
+          while (*head) {
+            T *timer = *head;
+            unlink(timer);
+            --level_counts[0];
+            --num_timers;
+            callback(timer);
+          }
+          ++current;
+        }
+      }
+
+      // Forgets all timers without touching them.
+      void clear() {
+        std::fill(slots, slots + SLOTS * LEVELS, nullptr);
+        std::fill(level_counts, level_counts + LEVELS, 0);
+        num_timers = 0;
+      }
+
+      uint64_t size() const {
+        return num_timers;
+      }
+
+    private:
+      void place(T *timer) {
+        uint64_t expires = (timer->timer_deadline + (1 << TICK_BITS) - 1)
+                           >> TICK_BITS;
+        uint32_t slot;
+        if (expires < current) {
+          // Already due: fire on the next processed tick.
+          slot = current & (SLOTS - 1);
+        } else {
+          uint64_t delta = expires - current;
+          uint32_t level = 0;
+          while (level < LEVELS - 1 && delta >> (SLOT_BITS * (level + 1))) {
+            ++level;
+          }
+          uint64_t max_delta = (1ULL << (SLOT_BITS * LEVELS)) - 1;
+          if (delta > max_delta) {
+            expires = current + max_delta;
+          }
+          slot = level * SLOTS
+                 + ((expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+        }
+        link(timer, slot);
+      }
+
+      // Moves the timers of the current slot of each upper level down,
+      // as long as the lower level has just wrapped around.
+      void cascadeAll() {
+        for (uint32_t level = 1; level < LEVELS; ++level) {
+          uint32_t index = (current >> (SLOT_BITS * level)) & (SLOTS - 1);
+          T *timer = slots[level * SLOTS + index];
+          slots[level * SLOTS + index] = nullptr;
+          while (timer) {
+            T *next = timer->timer_next;
+            --level_counts[level];
+            place(timer);
+            timer = next;
+          }
+          if (index != 0) {
+            break;
+          }
+        }
+      }
+
+      void link(T *timer, uint32_t slot) {
+        T *head = slots[slot];
+        timer->timer_prev = nullptr;
+        timer->timer_next = head;
+        if (head) {
+          head->timer_prev = timer;
+        }
+        slots[slot] = timer;
+        timer->timer_slot = slot;
+        ++level_counts[slot / SLOTS];
+      }
+
+      void unlink(T *timer) {
+        if (timer->timer_prev) {
+          timer->timer_prev->timer_next = timer->timer_next;
+        } else {
+          slots[timer->timer_slot] = timer->timer_next;
+        }
+        if (timer->timer_next) {
+          timer->timer_next->timer_prev = timer->timer_prev;
+        }
+        timer->timer_prev = timer->timer_next = nullptr;
+        timer->timer_slot = NOT_SCHEDULED;
+      }
+
+    private:
+      T *slots[SLOTS * LEVELS];
+      uint64_t level_counts[LEVELS];
+      uint64_t current;      // next tick to be processed
+      uint64_t num_timers;
+  };
+
+} // namespace pnet
+
+#endif // PNET_TIMER_WHEEL_HPP_
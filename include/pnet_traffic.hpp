@@ -0,0 +1,257 @@
+#ifndef PNET_TRAFFIC_HPP_
+#define PNET_TRAFFIC_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <pnet_compress.hpp>
+#include <pnet_file.hpp>
+#include <pnet_packet.hpp>
+#include <pnet_utils.hpp>
+
+namespace pnet {
+
+  // Configuration of a TrafficGenerator. Times are in microseconds.
+  struct TrafficConfig {
+
+    // Distribution of the gaps between consecutive packets.
+    enum Arrivals { CONSTANT, POISSON, PARETO };
+
+    TrafficConfig()
+        : concurrent_flows(10000), zipf_exponent(1.2),
+          max_flow_packets(100000), tcp_share(0.8), udp_share(0.15),
+          down_share(0.4), rst_share(0.02), arrivals(POISSON), mean_gap(1.0),
+          pareto_shape(1.5), t_start(1500000000000000ull), seed(1) {}
+
+    uint64_t concurrent_flows;   // flows sending at any time
+    double zipf_exponent;        // of the number of packets per flow
+    uint64_t max_flow_packets;
+    double tcp_share;            // of the flows, the rest after UDP is ICMP
+    double udp_share;
+    double down_share;           // of the packets after the handshake
+    double rst_share;            // of the TCP flows, closed by a RST
+    Arrivals arrivals;
+    double mean_gap;
+    double pareto_shape;         // PARETO, heavier tail when closer to 1
+    uint64_t t_start;
+    uint64_t seed;
+  };
+
+
+  // Synthetic packet stream for benchmarks and tests.
+  //
+  // A fixed number of flows are active at any time; each packet comes
+  // from one of them at random, so flows interleave. When a flow has sent
+  // all its packets it is replaced by a new one. Flow sizes follow a
+  // bounded Zipf distribution: most flows are mice, a few elephants carry
+  // most of the packets.
+  //
+  // TCP flows open with SYN, SYN-ACK, ACK and close with FIN's in both
+  // directions, or a RST. Data packets are full-sized or pure ACKs.
+  // UDP packets have random sizes, ICMP ones are pings.
+  class TrafficGenerator {
+
+    public:
+      explicit TrafficGenerator(const TrafficConfig &config_ = TrafficConfig())
+          : config(config_), random(config_.seed),
+            t(config_.t_start), num_flows(0), num_packets(0) {
+        ASSERT_TRUE(config.concurrent_flows > 0 && config.max_flow_packets > 0,
+                    "TrafficGenerator:: no flows");
+        ASSERT_TRUE(config.arrivals != TrafficConfig::PARETO
+                    || config.pareto_shape > 1,
+                    "TrafficGenerator:: Pareto shape must be above one");
+        // Cumulative distribution of flow sizes 1..max_flow_packets.
+        zipf_cdf.resize(config.max_flow_packets);
+        double sum = 0;
+        for (uint64_t k = 1; k <= config.max_flow_packets; ++k) {
+          sum += std::pow((double) k, -config.zipf_exponent);
+          zipf_cdf[k - 1] = sum;
+        }
+        for (double &p : zipf_cdf) {
+          p /= sum;
+        }
+        flows.resize(config.concurrent_flows);
+        for (ActiveFlow &flow : flows) {
+          start(flow);
+        }
+      }
+
+      Packet next() {
+        uint64_t i = random() % flows.size();
+        ActiveFlow &flow = flows[i];
+        Packet packet = flow.key;
+        packet.flags = 0;
+        packet.size = 0;
+        bool down = false;
+        if (flow.key.protocol == IPPROTO_TCP) {
+          tcpPacket(flow, packet, down);
+        } else if (flow.key.protocol == IPPROTO_UDP) {
+          down = uniform() < config.down_share;
+          packet.size = 60 + random() % 1400;
+        } else {
+          down = flow.sent % 2 == 1;   // echo reply
+          packet.size = 84;
+        }
+        if (down) {
+          std::swap(packet.ip_src, packet.ip_dst);
+          std::swap(packet.port_src, packet.port_dst);
+        }
+        t += gap();
+        packet.t_arrival = Time((uint64_t) t);
+        ++num_packets;
+        if (++flow.sent == flow.size) {
+          start(flow);
+        }
+        return packet;
+      }
+
+      void generate(std::vector<Packet> &packets, uint64_t n) {
+        packets.resize(n);
+        for (Packet &packet : packets) {
+          packet = next();
+        }
+      }
+
+      // Writes n packets into a .pkt or .pkt.gz file, as PacketRecorder
+      // would, so that PacketReader and replays can read it.
+      void writeFile(const std::string &filename, uint64_t n) {
+        const uint64_t BATCH = 4096;
+        std::vector<Packet> batch;
+        bool compressed = utils::stringEndsWith(filename, {".pkt.gz"});
+        if (!compressed && !utils::stringEndsWith(filename, {".pkt"})) {
+          FATAL("TrafficGenerator:: not a pkt file: " + filename);
+        }
+        SequentialFile out;
+        GzipWriter *gz_out = nullptr;
+        if (compressed) {
+          gz_out = new GzipWriter(filename);
+        } else if (!out.open(filename)) {
+          FATAL("TrafficGenerator:: cannot open file: " + filename);
+        }
+        for (uint64_t i = 0; i < n; i += BATCH) {
+          generate(batch, std::min(BATCH, n - i));
+          if (gz_out) {
+            gz_out->write(batch.data(), batch.size() * sizeof(Packet));
+          } else {
+            out.write(batch.data(), batch.size() * sizeof(Packet));
+          }
+        }
+        delete gz_out;
+        out.close();
+      }
+
+      // Flows started so far.
+      uint64_t numFlows() const {
+        return num_flows;
+      }
+
+      uint64_t numPackets() const {
+        return num_packets;
+      }
+
+      // Draws a flow size, see TrafficConfig::zipf_exponent.
+      uint64_t flowSize() {
+        double u = uniform();
+        return std::lower_bound(zipf_cdf.begin(), zipf_cdf.end(), u)
+               - zipf_cdf.begin() + 1;
+      }
+
+    private:
+      struct ActiveFlow {
+        Key key;
+        uint64_t size;   // packets
+        uint64_t sent;
+        bool reset;      // TCP flow closed by a RST
+      };
+
+      void start(ActiveFlow &flow) {
+        ++num_flows;
+        uint64_t r = random();
+        flow.key.ip_src.s_addr = htonl(0x0a000000 | (r & 0xffffff));
+        flow.key.ip_dst.s_addr = htonl((uint32_t) (r >> 24) | 0x01000000);
+        r = random();
+        flow.key.port_src = htons(32768 + r % 28232);
+        double u = uniform();
+        if (u < config.tcp_share) {
+          flow.key.protocol = IPPROTO_TCP;
+          static const uint16_t ports[] = {443, 443, 443, 80, 22, 25, 8080};
+          flow.key.port_dst = htons(ports[(r >> 16) % 7]);
+        } else if (u < config.tcp_share + config.udp_share) {
+          flow.key.protocol = IPPROTO_UDP;
+          flow.key.port_dst = htons((r >> 16) % 2 ? 53 : 443);
+        } else {
+          flow.key.protocol = IPPROTO_ICMP;
+          flow.key.port_src = flow.key.port_dst = 0;
+        }
+        flow.size = flowSize();
+        flow.sent = 0;
+        flow.reset = uniform() < config.rst_share;
+        if (flow.key.protocol == IPPROTO_TCP && !flow.reset) {
+          // Handshake and closing FIN's.
+          flow.size = std::max<uint64_t>(flow.size, 5);
+        }
+      }
+
+      void tcpPacket(const ActiveFlow &flow, Packet &packet, bool &down) {
+        uint64_t k = flow.sent, last = flow.size - 1;
+        if (k == 0) {
+          packet.flags = Packet::TCP_SYN;
+        } else if (k == 1) {
+          packet.flags = Packet::TCP_SYN | Packet::TCP_ACK;
+          down = true;
+        } else if (k == last && flow.reset) {
+          packet.flags = Packet::TCP_RST;
+          down = uniform() < 0.5;
+        } else if (!flow.reset && k + 2 >= last) {
+          // FIN, FIN, last ACK.
+          packet.flags = k + 2 == last ? Packet::TCP_FIN | Packet::TCP_ACK
+                         : k + 1 == last ? Packet::TCP_FIN | Packet::TCP_ACK
+                         : Packet::TCP_ACK;
+          down = k + 1 == last;
+        } else {
+          down = uniform() < config.down_share;
+          bool data = random() % 3 != 0;
+          packet.flags = data ? Packet::TCP_PSH | Packet::TCP_ACK
+                              : Packet::TCP_ACK;
+          packet.size = data ? 1500 : 52;
+        }
+        if (packet.size == 0) {
+          packet.size = 60;
+        }
+      }
+
+      double gap() {
+        switch (config.arrivals) {
+          case TrafficConfig::CONSTANT:
+            return config.mean_gap;
+          case TrafficConfig::POISSON:
+            return -config.mean_gap * std::log(1 - uniform());
+          case TrafficConfig::PARETO: {
+            double a = config.pareto_shape;
+            double scale = config.mean_gap * (a - 1) / a;
+            return scale / std::pow(1 - uniform(), 1 / a);
+          }
+        }
+        return config.mean_gap;
+      }
+
+      double uniform() {
+        return (random() >> 11) * (1.0 / 9007199254740992.0);
+      }
+
+    private:
+      TrafficConfig config;
+      std::mt19937_64 random;
+      std::vector<double> zipf_cdf;
+      std::vector<ActiveFlow> flows;
+      double t;
+      uint64_t num_flows;
+      uint64_t num_packets;
+  };
+
+} // namespace pnet
+
+#endif // PNET_TRAFFIC_HPP_
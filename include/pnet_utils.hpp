@@ -26,10 +26,12 @@ namespace pnet {
   namespace utils {
 
     // Check whether the string ends with one of the given extensions.
-    bool stringEndsWith(std::string str, std::vector<std::string> extensions) {
+    // Plain suffix comparison: this runs for every entry of a directory.
+    bool stringEndsWith(const std::string &str,
+                        const std::vector<std::string> &extensions) {
       for(auto &ext : extensions){
-        std::regex e("(.*)" + ext);
-        if (std::regex_match(str, e)){
+        if (str.size() >= ext.size() &&
+            str.compare(str.size() - ext.size(), ext.size(), ext) == 0){
           return true;
         }
       }
@@ -0,0 +1,132 @@
+#include <pnet_interface.hpp>
+
+#include <thread>
+
+// Captures UDP datagrams sent over the loopback device. Needs CAP_NET_RAW,
+// the tests are skipped without it.
+
+const uint16_t test_port = 39917;
+
+pnet::AfPacketConfig testConfig(){
+  pnet::AfPacketConfig config;
+  config.block_size = 1 << 20;
+  config.num_blocks = 8;
+  config.ignore_outgoing = true;   // loopback shows every packet twice
+  return config;
+}
+
+// Sends num_packets datagrams from num_sources source ports to a bound
+// socket, so that no ICMP errors come back.
+void sendDatagrams(uint64_t num_packets, uint64_t num_sources){
+  int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+  std::vector<int> sockets;
+  for(uint64_t i = 0; i < num_sources; ++i){
+    sockets.push_back(socket(AF_INET, SOCK_DGRAM, 0));
+  }
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(test_port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int size = 1 << 22;
+  setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  pnet::ASSERT_TRUE(bind(receiver, (struct sockaddr*) &address,
+                         sizeof(address)) == 0, "cannot bind test port");
+  char payload[100] = {0};
+  for(uint64_t i = 0; i < num_packets; ++i){
+    sendto(sockets[i % num_sources], payload, sizeof(payload), 0,
+           (struct sockaddr*) &address, sizeof(address));
+  }
+  for(int sock : sockets){
+    close(sock);
+  }
+  close(receiver);
+}
+
+// Reads the ring until no packet arrives for a while, returns the number
+// of test datagrams.
+uint64_t receive(pnet::AfPacketRing &ring){
+  pnet::FrameDecoder decoder;
+  pnet::Frame frames[64];
+  pnet::Packet packets[64];
+  uint64_t count = 0, n;
+  while((n = ring.next(frames, 64, 200)) > 0){
+    n = decoder.decode(frames, n, packets);
+    for(uint64_t i = 0; i < n; ++i){
+      if(packets[i].protocol == IPPROTO_UDP &&
+         ntohs(packets[i].port_dst) == test_port){
+        pnet::ASSERT_TRUE(packets[i].size == 128, "wrong size");
+        pnet::ASSERT_TRUE(packets[i].ip_dst.s_addr == htonl(INADDR_LOOPBACK),
+                          "wrong destination");
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+void test_afpacket_ring(){
+  std::cout << "test_afpacket_ring...\n";
+  pnet::AfPacketRing ring;
+  pnet::ASSERT_TRUE(ring.open("lo", testConfig()), ring.error());
+  sendDatagrams(1000, 1);
+  pnet::ASSERT_TRUE(receive(ring) == 1000, "wrong number of packets");
+  const pnet::AfPacketRing::Stats &stats = ring.stats();
+  pnet::ASSERT_TRUE(stats.packets >= 1000, "wrong kernel packet count");
+  pnet::ASSERT_TRUE(stats.drops == 0, "kernel dropped packets");
+  pnet::ASSERT_TRUE(!ring.open("no_such_device0", testConfig()),
+                    "opened a missing device");
+  std::cout << "OK.\n";
+}
+
+void test_afpacket_fanout(){
+  std::cout << "test_afpacket_fanout...\n";
+  pnet::AfPacketConfig config = testConfig();
+  config.fanout_group = getpid() & 0xffff;
+  config.fanout_mode = PACKET_FANOUT_HASH;
+  pnet::AfPacketRing ring1, ring2;
+  pnet::ASSERT_TRUE(ring1.open("lo", config), ring1.error());
+  pnet::ASSERT_TRUE(ring2.open("lo", config), ring2.error());
+  sendDatagrams(1000, 32);
+  uint64_t n1 = receive(ring1);
+  uint64_t n2 = receive(ring2);
+  pnet::ASSERT_TRUE(n1 + n2 == 1000, "packets lost or duplicated");
+  pnet::ASSERT_TRUE(n1 > 0 && n2 > 0, "traffic was not spread");
+  std::cout << "OK.\n";
+}
+
+void test_live_interface(){
+  std::cout << "test_live_interface...\n";
+  pnet::LiveInterface iface(testConfig());
+  pnet::FlowTable table;
+  iface.setFlowTable(&table);
+  pnet::ASSERT_TRUE(iface.open("lo"), "cannot open lo");
+  std::thread capture(&pnet::LiveInterface::loop, &iface);
+  usleep(50000);
+  sendDatagrams(100, 10);
+  usleep(500000);
+  iface.stop();
+  capture.join();
+  // Other loopback traffic may show up as well.
+  pnet::ASSERT_TRUE(iface.getNumPacketsProduced() >= 100,
+                    "wrong number of packets");
+  pnet::ASSERT_TRUE(table.flow_hash.size() >= 10, "wrong number of flows");
+  pnet::ASSERT_TRUE(iface.stats().drops == 0, "kernel dropped packets");
+  iface.close();
+  std::cout << "OK.\n";
+}
+
+int main(){
+  int sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if(sock == -1){
+    std::cout << "AF_PACKET sockets not permitted, skipping.\n";
+    return 0;
+  }
+  close(sock);
+  pnet::Logger::INIT("/tmp/pnet_test_afpacket.log");
+  test_afpacket_ring();
+  test_afpacket_fanout();
+  test_live_interface();
+  pnet::Logger::CLOSE();
+  return 0;
+}
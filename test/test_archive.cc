@@ -0,0 +1,201 @@
+#include <pnet.hpp>
+
+const std::string archive_file = "/tmp/pnet_test_archive.pka";
+const std::string output_dir = "/tmp/pnet_test_archive";
+
+// Few hosts talking to many, timestamps mostly increasing with a few
+// packets out of order.
+std::vector<pnet::Packet> makePackets(uint64_t num_packets){
+  std::vector<pnet::Packet> packets(num_packets);
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::Packet &packet = packets[i];
+    packet.ip_src.s_addr = htonl(0x0a000000 + (i * 7) % 50);
+    packet.ip_dst.s_addr = htonl(0xc0a80000 + (i * 13) % 3000);
+    packet.port_src = htons(1024 + (i * 31) % 60000);
+    packet.port_dst = htons(i % 3 ? 443 : 53);
+    packet.protocol = i % 3 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.flags = i % 3 ? pnet::Packet::TCP_ACK : 0;
+    packet.size = 40 + (i * 7919) % 1460;
+    uint64_t t = 1500000000000000ull + i * 20 - (i % 100 == 99 ? 30 : 0);
+    packet.t_arrival = pnet::Time(t);
+  }
+  return packets;
+}
+
+bool samePacket(const pnet::Packet &a, const pnet::Packet &b){
+  return std::memcmp(&a, &b, sizeof(pnet::Packet)) == 0;
+}
+
+void writeArchive(const std::vector<pnet::Packet> &packets,
+                  uint32_t block_packets){
+  pnet::PacketArchiveWriter writer(archive_file, block_packets);
+  writer.write(packets.data(), packets.size());
+  writer.close();
+  pnet::ASSERT_TRUE(writer.numPackets() == packets.size(), "wrong count");
+}
+
+void test_archive_roundtrip(){
+  std::cout << "test_archive_roundtrip...\n";
+  std::vector<pnet::Packet> packets = makePackets(100000);
+  writeArchive(packets, 4096);
+  pnet::PacketArchiveReader reader(archive_file);
+  pnet::ASSERT_TRUE(!reader.isRecovered(), "index not found");
+  pnet::ASSERT_TRUE(reader.size() == packets.size(), "wrong size");
+  pnet::ASSERT_TRUE(reader.numBlocks() == 25, "wrong number of blocks");
+  std::vector<pnet::Packet> decoded(reader.size());
+  reader.readAll(decoded.data());
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(samePacket(decoded[i], packets[i]), "wrong packet");
+  }
+  for(uint64_t i = 0; i < reader.numBlocks(); ++i){
+    pnet::ASSERT_TRUE(reader.verifyBlock(i), "bad checksum");
+  }
+  // Well below the raw 28 bytes per packet.
+  std::ifstream in(archive_file, std::ios::binary | std::ios::ate);
+  pnet::ASSERT_TRUE((uint64_t) in.tellg() < packets.size() * 14,
+                    "archive too large");
+  std::cout << "OK.\n";
+}
+
+// Constant and single-packet columns, empty archives.
+void test_archive_edge_cases(){
+  std::cout << "test_archive_edge_cases...\n";
+  writeArchive(std::vector<pnet::Packet>(), 16);
+  {
+    pnet::PacketArchiveReader reader(archive_file);
+    pnet::ASSERT_TRUE(reader.size() == 0 && reader.numBlocks() == 0,
+                      "empty archive not empty");
+  }
+  std::vector<pnet::Packet> packets = makePackets(33);
+  for(pnet::Packet &packet : packets){
+    packet.size = 1500;
+    packet.ip_dst.s_addr = 0xffffffff;
+  }
+  packets[32].port_src = 0xffff;
+  writeArchive(packets, 16);
+  pnet::PacketArchiveReader reader(archive_file);
+  pnet::ASSERT_TRUE(reader.numBlocks() == 3, "wrong number of blocks");
+  std::vector<pnet::Packet> decoded(reader.size());
+  reader.readAll(decoded.data());
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(samePacket(decoded[i], packets[i]), "wrong packet");
+  }
+  std::cout << "OK.\n";
+}
+
+void test_archive_seek(){
+  std::cout << "test_archive_seek...\n";
+  std::vector<pnet::Packet> packets = makePackets(100000);
+  writeArchive(packets, 1000);
+  pnet::PacketArchiveReader reader(archive_file);
+
+  pnet::Time t1 = packets[41234].t_arrival;
+  pnet::Time t2 = packets[45678].t_arrival;
+  uint64_t first = reader.findBlock(t1);
+  pnet::ASSERT_TRUE(first == 41, "wrong first block");
+  std::vector<pnet::Packet> range;
+  reader.readRange(t1, t2, range);
+  std::vector<pnet::Packet> expected;
+  for(const pnet::Packet &packet : packets){
+    if(!(packet.t_arrival < t1) && packet.t_arrival < t2){
+      expected.push_back(packet);
+    }
+  }
+  pnet::ASSERT_TRUE(range.size() == expected.size(), "wrong range size");
+  for(uint64_t i = 0; i < range.size(); ++i){
+    pnet::ASSERT_TRUE(samePacket(range[i], expected[i]), "wrong range");
+  }
+
+  // Flow key summaries: no false negatives, some blocks skipped.
+  pnet::Packet reversed = packets[500];
+  std::swap(reversed.ip_src, reversed.ip_dst);
+  std::swap(reversed.port_src, reversed.port_dst);
+  pnet::ASSERT_TRUE(reader.mayContain(0, reversed), "false negative");
+  pnet::Packet other = packets[500];
+  other.ip_src.s_addr = htonl(0x08080808);
+  uint64_t skipped = 0;
+  for(uint64_t i = 0; i < reader.numBlocks(); ++i){
+    skipped += !reader.mayContain(i, other);
+  }
+  pnet::ASSERT_TRUE(skipped > 0, "no block skipped");
+  std::cout << "OK.\n";
+}
+
+// An archive that was not closed is read up to its last complete block.
+void test_archive_recovery(){
+  std::cout << "test_archive_recovery...\n";
+  std::vector<pnet::Packet> packets = makePackets(10000);
+  writeArchive(packets, 1000);
+  std::string data;
+  {
+    std::ifstream in(archive_file, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  }
+  uint64_t block_end;
+  {
+    pnet::PacketArchiveReader reader(archive_file);
+    block_end = reader.block(7).offset + reader.block(7).size;
+  }
+  {
+    std::ofstream out(archive_file, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), block_end + 100);   // part of block 8
+  }
+  pnet::PacketArchiveReader reader(archive_file);
+  pnet::ASSERT_TRUE(reader.isRecovered(), "not recovered");
+  pnet::ASSERT_TRUE(reader.numBlocks() == 8, "wrong number of blocks");
+  std::vector<pnet::Packet> decoded(reader.size());
+  reader.readAll(decoded.data());
+  pnet::ASSERT_TRUE(samePacket(decoded[7999], packets[7999]), "wrong packet");
+  std::cout << "OK.\n";
+}
+
+// Recorded .pka files, PacketReader and conversions both ways.
+void test_archive_recorder(){
+  std::cout << "test_archive_recorder...\n";
+  pnet::utils::findOrCreate(output_dir);
+  std::vector<pnet::Packet> packets = makePackets(150000);
+  {
+    pnet::PacketRecorder recorder(output_dir, pnet::PacketRecorder::PKA);
+    for(const pnet::Packet &packet : packets){
+      recorder.write(packet);
+    }
+  }
+  std::vector<std::string> files = pnet::utils::ls(output_dir, true,
+                                                   {".pka"});
+  pnet::ASSERT_TRUE(files.size() == 1, "wrong number of files");
+  pnet::PacketReader reader(files[0]);
+  pnet::PacketReader first(files[0], 10);
+  pnet::ASSERT_TRUE(reader.size() == packets.size(), "wrong size");
+  pnet::ASSERT_TRUE(first.size() == 10, "max_packets ignored");
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(samePacket(reader.packets[i], packets[i]),
+                      "wrong packet");
+  }
+
+  const std::string pkt = output_dir + "/converted.pkt";
+  const std::string pka = output_dir + "/converted.pka";
+  pnet::ASSERT_TRUE(pnet::convertPacketFile(files[0], pkt) == packets.size(),
+                    "conversion to pkt failed");
+  pnet::ASSERT_TRUE(pnet::convertPacketFile(pkt, pka) == packets.size(),
+                    "conversion to pka failed");
+  pnet::PacketReader converted(pka);
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(samePacket(converted.packets[i], packets[i]),
+                      "wrong converted packet");
+  }
+  pnet::utils::rm(files[0]);
+  pnet::utils::rm(pkt);
+  pnet::utils::rm(pka);
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_archive_roundtrip();
+  test_archive_edge_cases();
+  test_archive_seek();
+  test_archive_recovery();
+  test_archive_recorder();
+  pnet::utils::rm(archive_file);
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include <pnet.hpp>
+#include <pnet_cardinality.hpp>
+
+pnet::Packet makePacket(uint32_t src, uint32_t dst, uint16_t port,
+                        uint64_t t_us){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = src;
+  packet.ip_dst.s_addr = dst;
+  packet.port_src = htons(40000);
+  packet.port_dst = htons(port);
+  packet.protocol = IPPROTO_TCP;
+  packet.flags = pnet::Packet::TCP_SYN;
+  packet.size = 60;
+  packet.t_arrival = pnet::Time(t_us);
+  return packet;
+}
+
+bool within(double estimate, double exact, double error){
+  return std::fabs(estimate - exact) <= error * exact;
+}
+
+void test_hyperloglog(){
+  std::cout << "test_hyperloglog...\n";
+  pnet::HyperLogLog a(12), b(12), both(12);
+  pnet::ASSERT_TRUE(a.estimate() == 0, "empty sketch is not zero");
+  for(uint64_t i = 0; i < 100000; ++i){
+    uint64_t h = pnet::hash::mix64(i);
+    (i < 60000 ? a : b).add(h);
+    both.add(h);
+  }
+  // 1.6% standard error with 4096 registers.
+  pnet::ASSERT_TRUE(within(a.estimate(), 60000, 0.05), "wrong estimate");
+  a.merge(b);
+  pnet::ASSERT_TRUE(a.getRegisters() == both.getRegisters(),
+                    "merge differs from the union");
+  pnet::ASSERT_TRUE(within(a.estimate(), 100000, 0.05),
+                    "wrong merged estimate");
+  pnet::HyperLogLog small(12);
+  for(uint64_t i = 0; i < 10; ++i){
+    small.add(pnet::hash::mix64(i));
+  }
+  pnet::ASSERT_TRUE(within(small.estimate(), 10, 0.1),
+                    "wrong small estimate");
+  std::cout << "OK.\n";
+}
+
+// A scanner, a DDoS victim and background traffic: the scanner has the
+// largest fan-out, the victim the largest fan-in, and estimates are
+// close to the exact counts.
+void test_cardinality_estimator(){
+  std::cout << "test_cardinality_estimator...\n";
+  pnet::CardinalityConfig config;
+  config.window = 0;
+  pnet::CardinalityEstimator fanout(pnet::CardinalityEstimator::SOURCE,
+                                    config);
+  pnet::CardinalityEstimator fanin(
+      pnet::CardinalityEstimator::DESTINATION_PORT, config);
+  const uint32_t scanner = 0x01010101, victim = 0x02020202;
+  srand(6);
+  uint64_t t = 0;
+  for(uint32_t i = 0; i < 200000; ++i){
+    std::vector<pnet::Packet> packets = {
+      makePacket(scanner, 0x0a000000 + i % 5000, 22, t),
+      makePacket(0x0b000000 + i % 20000, victim, 80, t),
+      makePacket(0x0c000000 + rand() % 1000, 0x0d000000 + rand() % 1000,
+                 443, t)};
+    for(const pnet::Packet &p : packets){
+      fanout.insert(p);
+      fanin.insert(p);
+    }
+    ++t;
+  }
+  std::vector<pnet::CardinalityEntry> top = fanout.top(3);
+  pnet::ASSERT_TRUE(top.size() == 3u && top[0].ip.s_addr == scanner,
+                    "scanner is not the top source");
+  pnet::ASSERT_TRUE(within(top[0].estimate, 5000, 0.2),
+                    "wrong scanner estimate");
+  pnet::ASSERT_TRUE(within(fanout.estimate(makePacket(scanner, 0, 0, 0)),
+                           5000, 0.2), "wrong key estimate");
+  top = fanin.top(1);
+  pnet::ASSERT_TRUE(top[0].ip.s_addr == victim && top[0].port == 80
+                    && top[0].protocol == IPPROTO_TCP,
+                    "victim is not the top destination");
+  pnet::ASSERT_TRUE(within(top[0].estimate, 20000, 0.2),
+                    "wrong victim estimate");
+  pnet::HyperLogLog sketch = fanin.sketch(makePacket(0, victim, 80, 0));
+  pnet::ASSERT_TRUE(sketch.estimate() == top[0].estimate,
+                    "sketch differs from the running estimate");
+  std::cout << "OK.\n";
+}
+
+// With room for few keys, the keys of large fan-out stay tracked.
+void test_cardinality_budget(){
+  std::cout << "test_cardinality_budget...\n";
+  pnet::CardinalityConfig config;
+  config.window = 0;
+  config.memory_budget = 64 * 1024;
+  pnet::CardinalityEstimator fanout(pnet::CardinalityEstimator::SOURCE,
+                                    config);
+  pnet::ASSERT_TRUE(fanout.memoryUsage() <= config.memory_budget,
+                    "over the memory budget");
+  srand(7);
+  for(uint32_t i = 0; i < 500000; ++i){
+    uint32_t src = i % 10 == 0 ? 0x01000000 + rand() % 5
+                               : 0x0a000000 + rand() % 100000;
+    fanout.insert(makePacket(src, rand(), 22, i));
+  }
+  pnet::ASSERT_TRUE(fanout.numKeys() == fanout.capacity()
+                    && fanout.numEvictions() > 0, "no eviction");
+  std::vector<pnet::CardinalityEntry> top = fanout.top(5);
+  for(const pnet::CardinalityEntry &e : top){
+    pnet::ASSERT_TRUE(e.ip.s_addr >> 24 == 1, "scanner not in top 5");
+    pnet::ASSERT_TRUE(within(e.estimate, 10000, 0.25)
+                      && e.estimate - e.error < 10000 * 1.2,
+                      "wrong scanner estimate");
+  }
+  std::cout << "OK.\n";
+}
+
+void test_cardinality_windows(){
+  std::cout << "test_cardinality_windows...\n";
+  pnet::CardinalityConfig config;
+  config.max_reports = 2;
+  config.top_n = 1;
+  pnet::CardinalityEstimator fanout(pnet::CardinalityEstimator::SOURCE,
+                                    config);
+  const uint64_t minute = 60000000;
+  for(uint64_t w = 0; w < 4; ++w){
+    for(uint32_t i = 0; i < 100 * (w + 1); ++i){
+      fanout.insert(makePacket(1, i, 22, 1000 * minute + w * minute + i));
+    }
+  }
+  pnet::ASSERT_TRUE(fanout.windows().size() == 2u, "wrong number of windows");
+  const pnet::CardinalityReport &last = fanout.windows().back();
+  pnet::ASSERT_TRUE(last.t_start.microseconds() == 1002 * minute
+                    && last.num_packets == 300u, "wrong window");
+  pnet::ASSERT_TRUE(within(last.top[0].estimate, 300, 0.1),
+                    "wrong window estimate");
+  pnet::ASSERT_TRUE(within(fanout.top(1)[0].estimate, 400, 0.1),
+                    "wrong current window estimate");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_hyperloglog();
+  test_cardinality_estimator();
+  test_cardinality_budget();
+  test_cardinality_windows();
+  return 0;
+}
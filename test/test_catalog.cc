@@ -0,0 +1,169 @@
+#include <pnet.hpp>
+
+const std::string output_dir = "/tmp/pnet_test_catalog";
+const uint64_t t_start = 1500000000000000ull;
+
+void resetDirectory(){
+  pnet::utils::rm("-rf " + output_dir);
+  pnet::utils::findOrCreate(output_dir);
+}
+
+// A packet every 10 us, every 1000th is 2 ms late.
+std::vector<pnet::Packet> makePackets(uint64_t num_packets){
+  std::vector<pnet::Packet> packets(num_packets);
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::Packet &packet = packets[i];
+    packet.ip_src.s_addr = i;
+    packet.ip_dst.s_addr = 0x01020304;
+    packet.port_src = i & 0xffff;
+    packet.port_dst = 80;
+    packet.protocol = IPPROTO_TCP;
+    packet.flags = 0;
+    packet.size = i % 1500;
+    uint64_t t = t_start + 10 * i - (i % 1000 == 999 ? 2000 : 0);
+    packet.t_arrival = pnet::Time(t);
+  }
+  return packets;
+}
+
+void checkRange(const std::vector<pnet::Packet> &packets,
+                uint64_t us_begin, uint64_t us_end){
+  pnet::Time t_begin(us_begin), t_end(us_end);
+  std::vector<pnet::Packet> range;
+  uint64_t n = pnet::readRange(output_dir, t_begin, t_end, range);
+  pnet::ASSERT_TRUE(n == range.size(), "wrong count");
+  uint64_t j = 0;
+  for(const pnet::Packet &packet : packets){
+    if(!(packet.t_arrival < t_begin) && packet.t_arrival < t_end){
+      pnet::ASSERT_TRUE(j < range.size() &&
+                        range[j].ip_src.s_addr == packet.ip_src.s_addr,
+                        "wrong packet in range");
+      ++j;
+    }
+  }
+  pnet::ASSERT_TRUE(j == range.size(), "wrong range size");
+}
+
+void checkPackets(pnet::PacketRecorder::Format format){
+  resetDirectory();
+  std::vector<pnet::Packet> packets = makePackets(2200000);
+  {
+    pnet::PacketRecorder recorder(output_dir, format);
+    for(const pnet::Packet &packet : packets){
+      recorder.write(packet);
+    }
+  }
+  pnet::Catalog catalog(output_dir, "packets");
+  pnet::ASSERT_TRUE(catalog.size() == 3, "wrong number of files");
+  pnet::ASSERT_TRUE(catalog.entry(0).num_records == 1000000 &&
+                    catalog.entry(2).num_records == 200000,
+                    "wrong number of records");
+  pnet::ASSERT_TRUE(catalog.entry(0).lag == 1990, "wrong lag");
+  pnet::ASSERT_TRUE(catalog.entry(0).num_marks == 9, "wrong marks");
+
+  checkRange(packets, t_start + 1234567, t_start + 1345678);
+  checkRange(packets, t_start + 9900000, t_start + 10100000);  // two files
+  checkRange(packets, t_start + 21000000, t_start + 30000000); // last file
+  checkRange(packets, 0, t_start + 5);
+  checkRange(packets, t_start + 50000000, t_start + 60000000);
+}
+
+void test_catalog_packets(){
+  std::cout << "test_catalog_packets...\n";
+  checkPackets(pnet::PacketRecorder::PKT);
+  checkPackets(pnet::PacketRecorder::PKT_GZ);
+  checkPackets(pnet::PacketRecorder::PKA);
+  std::cout << "OK.\n";
+}
+
+// Flows are written when they expire, which is not in the order of their
+// last packets.
+void test_catalog_flows(){
+  std::cout << "test_catalog_flows...\n";
+  resetDirectory();
+  std::vector<uint64_t> t_last;
+  for(pnet::FlowRecorder::Format format : {pnet::FlowRecorder::FLR,
+                                           pnet::FlowRecorder::FLR_GZ,
+                                           pnet::FlowRecorder::TEXT,
+                                           pnet::FlowRecorder::TEXT_GZ}){
+    pnet::FlowRecorder recorder(output_dir, format);
+    for(uint64_t i = 0; i < 100000; ++i){
+      pnet::Packet packet;
+      packet.ip_src.s_addr = i;
+      packet.ip_dst.s_addr = 0x01020304;
+      packet.port_src = 1234;
+      packet.port_dst = 53;
+      packet.protocol = IPPROTO_UDP;
+      packet.flags = 0;
+      packet.size = 100;
+      uint64_t t = t_start + t_last.size() * 100 - (i % 10 == 0 ? 50000 : 0);
+      packet.t_arrival = pnet::Time(t);
+      pnet::Flow flow(packet);
+      recorder.write(flow);
+      t_last.push_back(t);
+    }
+  }
+  pnet::Catalog catalog(output_dir, "flows");
+  pnet::ASSERT_TRUE(catalog.size() == 4, "wrong number of files");
+  pnet::ASSERT_TRUE(catalog.entry(0).lag == 49900, "wrong lag");
+
+  uint64_t ranges[][2] = {{2000000, 2500000}, {9990000, 10010000},
+                          {15000000, 15000100}, {19990000, 30000000},
+                          {29000000, 35000000}};
+  for(auto &range : ranges){
+    pnet::Time t_begin(t_start + range[0]), t_end(t_start + range[1]);
+    std::vector<pnet::FlowRecord> flows;
+    uint64_t n = pnet::readFlowRange(output_dir, t_begin, t_end, flows);
+    uint64_t expected = 0;
+    for(uint64_t t : t_last){
+      expected += t >= t_begin.microseconds() && t < t_end.microseconds();
+    }
+    pnet::ASSERT_TRUE(n == flows.size() && n == expected,
+                      "wrong number of flows in range");
+    for(const pnet::FlowRecord &flow : flows){
+      pnet::ASSERT_TRUE(flow.t_last >= t_begin.microseconds() &&
+                        flow.t_last < t_end.microseconds() &&
+                        flow.packets == 1 && flow.bytes == 100,
+                        "wrong flow in range");
+    }
+  }
+  std::cout << "OK.\n";
+}
+
+// A month of 10 second files with no data behind them.
+void test_catalog_lookup(){
+  std::cout << "test_catalog_lookup...\n";
+  resetDirectory();
+  const uint64_t num_files = 30 * 24 * 360;
+  {
+    pnet::CatalogWriter writer(output_dir, "packets");
+    for(uint64_t i = 0; i < num_files; ++i){
+      writer.open("file" + std::to_string(i) + ".pkt");
+      for(uint64_t j = 0; j < 10; ++j){
+        writer.add(pnet::Time(t_start + i * 10000000 + j * 1000000), 28);
+      }
+    }
+  }
+  pnet::Catalog catalog(output_dir, "packets");
+  pnet::ASSERT_TRUE(catalog.size() == num_files, "wrong catalog size");
+  pnet::Time t_begin(t_start + 123456 * 1000000ull + 500000);
+  pnet::Time t_end = t_begin + pnet::Time(25, 0);
+  std::vector<uint64_t> files = catalog.find(t_begin, t_end);
+  pnet::ASSERT_TRUE(files.size() == 4 && files[0] == 12345,
+                    "wrong files found");
+  pnet::ASSERT_TRUE(catalog.seek(files[0], t_begin).record == 6,
+                    "wrong start");
+  pnet::ASSERT_TRUE(catalog.seekEnd(files[3], t_end).record == 2,
+                    "wrong end");
+  pnet::ASSERT_TRUE(std::string(catalog.entry(files[1]).name) ==
+                    "file12346.pkt", "wrong name");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_catalog_packets();
+  test_catalog_flows();
+  test_catalog_lookup();
+  pnet::utils::rm("-rf " + output_dir);
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include <pnet.hpp>
+
+const std::string gz_file = "/tmp/pnet_test_compress.gz";
+const std::string output_dir = "/tmp/pnet_test_compress";
+
+std::string readFile(const std::string &filename){
+  std::ifstream in(filename, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+pnet::Packet zeroPacket(){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = packet.ip_dst.s_addr = 0;
+  packet.port_src = packet.port_dst = 0;
+  packet.protocol = 0;
+  packet.flags = packet.size = 0;
+  packet.t_arrival = 0;
+  return packet;
+}
+
+// Packet records: compressible, but not trivially.
+std::string makeData(uint64_t num_packets){
+  std::string data;
+  pnet::Packet packet = zeroPacket();
+  for(uint64_t i = 0; i < num_packets; ++i){
+    packet.ip_src.s_addr = i % 1000;
+    packet.size = (i * 7919) % 1500;
+    packet.t_arrival = i * 1000;
+    data.append(reinterpret_cast<const char*>(&packet), sizeof(packet));
+  }
+  return data;
+}
+
+void writeGzip(const std::string &data, uint32_t num_threads){
+  pnet::GzipWriter writer(gz_file, num_threads);
+  // Uneven writes across block boundaries.
+  for(uint64_t i = 0; i < data.size(); i += 100003){
+    writer.write(data.data() + i, std::min<uint64_t>(100003, data.size() - i));
+  }
+  writer.close();
+  pnet::ASSERT_TRUE(writer.bytesIn() == data.size(), "wrong input size");
+}
+
+std::string readStream(pnet::GzipReader &reader, uint64_t chunk){
+  std::string result, buffer(chunk, 0);
+  uint64_t n;
+  while((n = reader.read(&buffer[0], chunk)) > 0){
+    result.append(buffer.data(), n);
+  }
+  return result;
+}
+
+void test_gzip_roundtrip(){
+  std::cout << "test_gzip_roundtrip...\n";
+  std::string data = makeData(150000);   // 4 blocks
+  writeGzip(data, 0);
+  std::string serial = readFile(gz_file);
+  writeGzip(data, 3);
+  pnet::ASSERT_TRUE(readFile(gz_file) == serial,
+                    "output depends on the number of threads");
+
+  pnet::GzipReader reader(gz_file);
+  pnet::ASSERT_TRUE(reader.indexed(), "file not indexed");
+  pnet::ASSERT_TRUE(reader.uncompressedSize() == data.size(), "wrong size");
+  std::string all(data.size(), 0);
+  reader.readAll(&all[0], 3);
+  pnet::ASSERT_TRUE(all == data, "readAll failed");
+  pnet::ASSERT_TRUE(readStream(reader, 12345) == data, "read failed");
+
+  // gunzip reads the members as one stream.
+  pnet::ASSERT_TRUE(pnet::utils::unzip(gz_file, gz_file + ".out"),
+                    "gunzip failed");
+  pnet::ASSERT_TRUE(readFile(gz_file + ".out") == data, "gunzip mismatch");
+  pnet::utils::rm(gz_file + ".out");
+  std::cout << "OK.\n";
+}
+
+// Files from gzip, and concatenated ones, are read as a stream.
+void test_gzip_foreign(){
+  std::cout << "test_gzip_foreign...\n";
+  std::string data = makeData(50000);
+  const std::string plain = "/tmp/pnet_test_compress.raw";
+  {
+    std::ofstream out(plain, std::ios::binary);
+    out << data;
+  }
+  pnet::utils::zip(plain, gz_file);
+  std::string cmd = "gzip -c " + plain + " >> " + gz_file;
+  pnet::ASSERT_TRUE(system(cmd.c_str()) == 0, "gzip failed");
+  pnet::GzipReader reader(gz_file);
+  pnet::ASSERT_TRUE(!reader.indexed(), "foreign file indexed");
+  pnet::ASSERT_TRUE(readStream(reader, 1 << 16) == data + data,
+                    "wrong multi-member stream");
+  pnet::utils::rm(plain);
+  std::cout << "OK.\n";
+}
+
+void test_gzip_empty(){
+  std::cout << "test_gzip_empty...\n";
+  writeGzip("", 2);
+  pnet::ASSERT_TRUE(pnet::utils::unzip(gz_file, gz_file + ".out"),
+                    "gunzip failed");
+  pnet::ASSERT_TRUE(readFile(gz_file + ".out").empty(), "not empty");
+  pnet::GzipReader reader(gz_file);
+  char buffer[16];
+  pnet::ASSERT_TRUE(reader.read(buffer, 16) == 0, "read from empty file");
+  pnet::utils::rm(gz_file + ".out");
+  std::cout << "OK.\n";
+}
+
+// Compressed .pkt files are written and read without temporary files,
+// two readers can share a file.
+void test_compressed_packets(){
+  std::cout << "test_compressed_packets...\n";
+  pnet::utils::findOrCreate(output_dir);
+  pnet::Packet packet = zeroPacket();
+  packet.t_arrival = pnet::Time(1500000000, 0);
+  const uint64_t num_packets = 100000;
+  {
+    pnet::PacketRecorder recorder(output_dir, true);
+    for(uint64_t i = 0; i < num_packets; ++i){
+      packet.size = i % 1500;
+      recorder.write(packet);
+    }
+  }
+  std::vector<std::string> files = pnet::utils::ls(output_dir, true,
+                                                   {".pkt.gz"});
+  pnet::ASSERT_TRUE(files.size() == 1, "wrong number of files");
+  pnet::PacketReader reader1(files[0]);
+  pnet::PacketReader reader2(files[0], 10);
+  pnet::ASSERT_TRUE(reader1.is_compressed, "not compressed");
+  pnet::ASSERT_TRUE(reader1.size() == num_packets, "wrong number of packets");
+  pnet::ASSERT_TRUE(reader2.size() == 10 && reader2.packets[9].size == 9,
+                    "max_packets ignored");
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::ASSERT_TRUE(reader1.packets[i].size == i % 1500, "wrong packet");
+  }
+
+  // The same file from gzip, read as a stream.
+  std::string plain = output_dir + "/plain.pkt";
+  pnet::utils::unzip(files[0], plain);
+  pnet::utils::rm(files[0]);
+  pnet::utils::zip(plain, plain + ".gz");
+  pnet::PacketReader reader3(plain + ".gz");
+  pnet::ASSERT_TRUE(reader3.size() == num_packets &&
+                    reader3.packets[num_packets - 1].size ==
+                    (num_packets - 1) % 1500, "wrong gzip stream");
+  pnet::PacketReader reader4(plain + ".gz", 70000);
+  pnet::ASSERT_TRUE(reader4.size() == 70000 &&
+                    reader4.packets[69999].size == 69999 % 1500,
+                    "wrong gzip stream prefix");
+  pnet::utils::rm(plain);
+  pnet::utils::rm(plain + ".gz");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_gzip_roundtrip();
+  test_gzip_foreign();
+  test_gzip_empty();
+  test_compressed_packets();
+  pnet::utils::rm(gz_file);
+  return 0;
+}
@@ -0,0 +1,391 @@
+#include <pnet_decoder.hpp>
+
+#include <random>
+
+typedef std::vector<uint8_t> Bytes;
+
+// Frame builder: each function appends one header.
+
+void put16(Bytes &b, uint16_t x){
+  b.push_back(x >> 8);
+  b.push_back(x & 0xff);
+}
+
+void put32(Bytes &b, uint32_t x){
+  put16(b, x >> 16);
+  put16(b, x & 0xffff);
+}
+
+void ethernet(Bytes &b, uint16_t ethertype){
+  b.insert(b.end(), 12, 0xee);
+  put16(b, ethertype);
+}
+
+void vlan(Bytes &b, uint16_t ethertype){
+  put16(b, 100);
+  put16(b, ethertype);
+}
+
+void mpls(Bytes &b, uint32_t label, bool bottom){
+  put32(b, (label << 12) | (bottom << 8) | 64);
+}
+
+void ipv4(Bytes &b, uint8_t protocol, uint16_t payload_len,
+          uint32_t src = 0x0a000001, uint32_t dst = 0x0a000002){
+  b.push_back(0x45);
+  b.push_back(0);
+  put16(b, 20 + payload_len);
+  put32(b, 0);
+  b.push_back(64);
+  b.push_back(protocol);
+  put16(b, 0);
+  put32(b, src);
+  put32(b, dst);
+}
+
+void ipv6(Bytes &b, uint8_t next, uint16_t payload_len, uint8_t src = 1,
+          uint8_t dst = 2){
+  put32(b, 0x60000000);
+  put16(b, payload_len);
+  b.push_back(next);
+  b.push_back(64);
+  b.insert(b.end(), 15, 0x20);
+  b.push_back(src);
+  b.insert(b.end(), 15, 0x20);
+  b.push_back(dst);
+}
+
+void ipv6Extension(Bytes &b, uint8_t next){
+  b.push_back(next);
+  b.push_back(0);
+  b.insert(b.end(), 6, 0);
+}
+
+void ipv6Fragment(Bytes &b, uint8_t next, uint16_t offset){
+  b.push_back(next);
+  b.push_back(0);
+  put16(b, offset << 3);
+  put32(b, 1234);
+}
+
+void tcp(Bytes &b, uint16_t port_src, uint16_t port_dst, uint8_t flags){
+  put16(b, port_src);
+  put16(b, port_dst);
+  put32(b, 0);
+  put32(b, 0);
+  b.push_back(0x50);
+  b.push_back(flags);
+  put16(b, 0);
+  put32(b, 0);
+}
+
+void udp(Bytes &b, uint16_t port_src, uint16_t port_dst){
+  put16(b, port_src);
+  put16(b, port_dst);
+  put32(b, 0);
+}
+
+void gre(Bytes &b, uint16_t flags, uint16_t type){
+  put16(b, flags);
+  put16(b, type);
+  if(flags & 0x2000){
+    put32(b, 42);
+  }
+}
+
+void vxlan(Bytes &b){
+  put32(b, 0x08000000);
+  put32(b, 100 << 8);
+}
+
+pnet::Frame toFrame(const Bytes &b,
+                    uint32_t linktype = pnet::LINKTYPE_ETHERNET){
+  pnet::Frame frame = {b.data(), (uint32_t) b.size(), (uint32_t) b.size(),
+                       linktype, pnet::Time(1, 2)};
+  return frame;
+}
+
+bool decode(pnet::FrameDecoder &decoder, const Bytes &b, pnet::Packet &pkt){
+  return decoder.decode(toFrame(b), pkt);
+}
+
+void checkTCP(const pnet::Packet &pkt, uint16_t size){
+  pnet::ASSERT_TRUE(pkt.protocol == IPPROTO_TCP, "wrong protocol");
+  pnet::ASSERT_TRUE(ntohs(pkt.port_src) == 1234, "wrong source port");
+  pnet::ASSERT_TRUE(ntohs(pkt.port_dst) == 80, "wrong destination port");
+  pnet::ASSERT_TRUE(pkt.flags == pnet::Packet::TCP_SYN, "wrong flags");
+  pnet::ASSERT_TRUE(pkt.size == size, "wrong size");
+}
+
+// Ethernet, QinQ and MPLS headers in front of IPv4.
+void test_decoder_l2(){
+  std::cout << "test_decoder_l2...\n";
+  pnet::FrameDecoder decoder;
+  pnet::Packet pkt;
+  Bytes b;
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "plain frame");
+  checkTCP(pkt, 40);
+  pnet::ASSERT_TRUE(pkt.ip_src.s_addr == htonl(0x0a000001), "wrong source");
+  pnet::ASSERT_TRUE(pkt.t_arrival.microseconds() == 1000002, "wrong time");
+
+  b.clear();
+  ethernet(b, 0x88a8);
+  vlan(b, 0x8100);
+  vlan(b, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "QinQ frame");
+  checkTCP(pkt, 40);
+
+  b.clear();
+  ethernet(b, 0x8847);
+  mpls(b, 16, false);
+  mpls(b, 17, true);
+  ipv4(b, IPPROTO_UDP, 8);
+  udp(b, 53, 5353);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "MPLS frame");
+  pnet::ASSERT_TRUE(pkt.protocol == IPPROTO_UDP, "wrong protocol");
+  pnet::ASSERT_TRUE(ntohs(pkt.port_dst) == 5353, "wrong destination port");
+  pnet::ASSERT_TRUE(pkt.size == 28, "wrong size");
+
+  // Raw IPv6, no link-layer header.
+  b.clear();
+  ipv6(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decoder.decode(toFrame(b, pnet::LINKTYPE_RAW), pkt),
+                    "raw frame");
+  checkTCP(pkt, 60);
+  pnet::ASSERT_TRUE(decoder.num_decoded == 4, "wrong decoded count");
+  std::cout << "OK.\n";
+}
+
+void test_decoder_ipv6(){
+  std::cout << "test_decoder_ipv6...\n";
+  pnet::FrameDecoder decoder;
+  pnet::Packet pkt, reply;
+  Bytes b;
+  ethernet(b, 0x86dd);
+  ipv6(b, 0, 44);
+  ipv6Extension(b, 60);
+  ipv6Extension(b, 44);
+  ipv6Fragment(b, IPPROTO_TCP, 0);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "extension headers");
+  checkTCP(pkt, 84);
+
+  // The reply has the same key, another host does not.
+  b.clear();
+  ethernet(b, 0x86dd);
+  ipv6(b, IPPROTO_TCP, 20, 2, 1);
+  tcp(b, 80, 1234, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, reply), "reply");
+  pnet::ASSERT_TRUE(pkt == reply, "reply has another key");
+  pnet::ASSERT_TRUE(pkt.hash(7) == reply.hash(7), "reply has another hash");
+  b.clear();
+  ethernet(b, 0x86dd);
+  ipv6(b, IPPROTO_TCP, 20, 3, 1);
+  tcp(b, 80, 1234, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, reply), "other host");
+  pnet::ASSERT_TRUE(!(pkt == reply), "addresses collide");
+
+  // Later fragments carry no ports.
+  b.clear();
+  ethernet(b, 0x86dd);
+  ipv6(b, 44, 28);
+  ipv6Fragment(b, IPPROTO_UDP, 100);
+  udp(b, 1, 2);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "fragment");
+  pnet::ASSERT_TRUE(pkt.protocol == IPPROTO_UDP && pkt.port_src == 0,
+                    "fragment has ports");
+  std::cout << "OK.\n";
+}
+
+void test_decoder_tunnels(){
+  std::cout << "test_decoder_tunnels...\n";
+  pnet::FrameDecoder decoder;
+  pnet::Packet pkt;
+  // GRE with key, IPv4 in IPv4.
+  Bytes b;
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_GRE, 8 + 40, 0xc0a80001, 0xc0a80002);
+  gre(b, 0x2000, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "GRE");
+  checkTCP(pkt, 40);
+  pnet::ASSERT_TRUE(pkt.ip_src.s_addr == htonl(0x0a000001),
+                    "outer address");
+
+  // Outer header only if decapsulation is off.
+  decoder.decap_tunnels = false;
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "GRE outer");
+  pnet::ASSERT_TRUE(pkt.protocol == IPPROTO_GRE, "wrong protocol");
+  pnet::ASSERT_TRUE(pkt.ip_src.s_addr == htonl(0xc0a80001),
+                    "inner address");
+  decoder.decap_tunnels = true;
+
+  // VXLAN over IPv6 with an Ethernet/IPv4 payload.
+  b.clear();
+  ethernet(b, 0x86dd);
+  ipv6(b, IPPROTO_UDP, 8 + 8 + 14 + 40);
+  udp(b, 50000, 4789);
+  vxlan(b);
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "VXLAN");
+  checkTCP(pkt, 40);
+
+  // Ethernet over GRE over MPLS.
+  b.clear();
+  ethernet(b, 0x8847);
+  mpls(b, 16, true);
+  ipv4(b, IPPROTO_GRE, 4 + 14 + 40);
+  gre(b, 0, 0x6558);
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(decode(decoder, b, pkt), "Ethernet over GRE");
+  checkTCP(pkt, 40);
+
+  // Tunnels nested too deep.
+  b.clear();
+  ethernet(b, 0x0800);
+  for(uint32_t i = 0; i <= pnet::FrameDecoder::MAX_ENCAPSULATIONS; ++i){
+    ipv4(b, IPPROTO_GRE, 0);
+    gre(b, 0, 0x0800);
+  }
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, pnet::Packet::TCP_SYN);
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "nested tunnels");
+  pnet::ASSERT_TRUE(decoder.num_errors[pnet::DECODE_TOO_DEEP] == 1,
+                    "wrong error");
+  std::cout << "OK.\n";
+}
+
+void test_decoder_errors(){
+  std::cout << "test_decoder_errors...\n";
+  pnet::FrameDecoder decoder;
+  pnet::Packet pkt;
+  Bytes b;
+  ethernet(b, 0x0806);    // ARP
+  b.insert(b.end(), 28, 0);
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "ARP");
+  pnet::ASSERT_TRUE(!decoder.decode(toFrame(b, 999), pkt), "link type");
+
+  b.clear();
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_TCP, 20);
+  tcp(b, 1234, 80, 0);
+  b[14] = 0x44;           // header length 16
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "bad header length");
+  b[14] = 0x45;
+  b.resize(14 + 20 + 2);
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "truncated TCP");
+
+  b.clear();
+  ethernet(b, 0x0800);
+  ipv4(b, IPPROTO_GRE, 4);
+  gre(b, 0x0001, 0x880b); // PPTP
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "GRE version 1");
+
+  b.clear();
+  ethernet(b, 0x86dd);
+  ipv6(b, 60, 80);
+  for(uint32_t i = 0; i < 10; ++i){
+    ipv6Extension(b, 60);
+  }
+  pnet::ASSERT_TRUE(!decode(decoder, b, pkt), "extension chain");
+
+  pnet::ASSERT_TRUE(decoder.num_failed == 6, "wrong failed count");
+  pnet::ASSERT_TRUE(decoder.num_errors[pnet::DECODE_BAD_ETHERTYPE] == 1 &&
+                    decoder.num_errors[pnet::DECODE_BAD_LINKTYPE] == 1 &&
+                    decoder.num_errors[pnet::DECODE_BAD_IP_HEADER] == 1 &&
+                    decoder.num_errors[pnet::DECODE_TRUNCATED] == 1 &&
+                    decoder.num_errors[pnet::DECODE_BAD_TUNNEL] == 1 &&
+                    decoder.num_errors[pnet::DECODE_BAD_IPV6_EXTENSION] == 1,
+                    "wrong error counts");
+  pnet::ASSERT_TRUE(decoder.errorsToString().find("truncated=1") !=
+                    std::string::npos, "wrong error string");
+  std::cout << "OK.\n";
+}
+
+// Truncated and randomly corrupted frames. Every frame lives in a buffer of
+// exactly caplen bytes, so reads past the end show up under a sanitizer.
+void test_decoder_fuzz(){
+  std::cout << "test_decoder_fuzz...\n";
+  std::vector<Bytes> corpus(5);
+  ethernet(corpus[0], 0x8100);
+  vlan(corpus[0], 0x0800);
+  ipv4(corpus[0], IPPROTO_TCP, 20);
+  tcp(corpus[0], 1234, 80, pnet::Packet::TCP_SYN);
+  ethernet(corpus[1], 0x86dd);
+  ipv6(corpus[1], 0, 8 + 8 + 8 + 8 + 14 + 28);
+  ipv6Extension(corpus[1], 44);
+  ipv6Fragment(corpus[1], IPPROTO_UDP, 0);
+  udp(corpus[1], 1, 4789);
+  vxlan(corpus[1]);
+  ethernet(corpus[1], 0x0800);
+  ipv4(corpus[1], IPPROTO_UDP, 8);
+  udp(corpus[1], 1, 2);
+  ethernet(corpus[2], 0x8847);
+  mpls(corpus[2], 1, true);
+  ipv4(corpus[2], IPPROTO_GRE, 8 + 20);
+  gre(corpus[2], 0x2000, 0x0800);
+  ipv4(corpus[2], IPPROTO_UDP, 8);
+  udp(corpus[2], 53, 53);
+  ethernet(corpus[3], 0x0800);
+  ipv4(corpus[3], IPPROTO_GRE, 4 + 8 + 14 + 20);
+  gre(corpus[3], 0, 0x88be);
+  put32(corpus[3], 0);
+  put32(corpus[3], 0);
+  ethernet(corpus[3], 0x0800);
+  ipv4(corpus[3], IPPROTO_ICMP, 0);
+  ethernet(corpus[4], 0x0800);
+  ipv4(corpus[4], IPPROTO_UDP, 8);
+  udp(corpus[4], 1, 2);
+
+  pnet::FrameDecoder decoder;
+  pnet::Packet pkt;
+  uint64_t num_frames = 0;
+  for(const Bytes &frame : corpus){
+    pnet::ASSERT_TRUE(decode(decoder, frame, pkt), "corpus frame");
+    ++num_frames;
+    for(uint64_t length = 0; length < frame.size(); ++length){
+      Bytes prefix(frame.begin(), frame.begin() + length);
+      decode(decoder, prefix, pkt);
+      ++num_frames;
+    }
+  }
+  std::mt19937_64 rng(1234);
+  for(uint64_t i = 0; i < 200000; ++i){
+    Bytes frame = corpus[rng() % corpus.size()];
+    uint64_t num_flips = 1 + rng() % 4;
+    for(uint64_t j = 0; j < num_flips; ++j){
+      frame[rng() % frame.size()] = (uint8_t) rng();
+    }
+    frame.resize(rng() % (frame.size() + 1));
+    decode(decoder, frame, pkt);
+    ++num_frames;
+  }
+  uint64_t num_errors = 0;
+  for(int i = 0; i < pnet::NUM_DECODE_ERRORS; ++i){
+    num_errors += decoder.num_errors[i];
+  }
+  pnet::ASSERT_TRUE(decoder.num_decoded + decoder.num_failed == num_frames,
+                    "frames not accounted for");
+  pnet::ASSERT_TRUE(num_errors == decoder.num_failed, "wrong error counts");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_decoder_l2();
+  test_decoder_ipv6();
+  test_decoder_tunnels();
+  test_decoder_errors();
+  test_decoder_fuzz();
+  return 0;
+}
@@ -0,0 +1,802 @@
+#include <pnet.hpp>
+#include <pnet_admission.hpp>
+#include <pnet_flow_shards.hpp>
+
+pnet::Packet makePacket(const char *src, uint16_t sport,
+                        const char *dst, uint16_t dport,
+                        uint32_t proto, uint64_t t_us){
+  pnet::Packet packet;
+  inet_pton(AF_INET, src, &packet.ip_src);
+  inet_pton(AF_INET, dst, &packet.ip_dst);
+  packet.port_src = htons(sport);
+  packet.port_dst = htons(dport);
+  packet.protocol = proto;
+  packet.flags = 0;
+  packet.size = 100;
+  packet.t_arrival = t_us;
+  return packet;
+}
+
+pnet::Packet reversed(const pnet::Packet &packet){
+  pnet::Packet result(packet);
+  std::swap(result.ip_src, result.ip_dst);
+  std::swap(result.port_src, result.port_dst);
+  return result;
+}
+
+void test_key_hash(){
+  std::cout << "test_key_hash...\n";
+  pnet::Packet p = makePacket("10.0.0.1", 1234, "10.0.0.2", 80, 6, 0);
+  pnet::Packet q = makePacket("10.0.0.1", 80, "10.0.0.2", 1234, 6, 0);
+  pnet::ASSERT_TRUE(p.hash() == reversed(p).hash(),
+                    "hash is not direction-symmetric");
+  pnet::ASSERT_TRUE(p.hash(7) == reversed(p).hash(7),
+                    "keyed hash is not direction-symmetric");
+  pnet::ASSERT_TRUE(p.hash() != q.hash(), "port swap collides");
+  pnet::ASSERT_TRUE(p.hash() != p.hash(7), "seed has no effect");
+  std::cout << "OK.\n";
+}
+
+void test_flow_index(){
+  std::cout << "test_flow_index...\n";
+  const uint64_t num_keys = 10000;
+  std::vector<pnet::Key> keys;
+  for(uint64_t i = 0; i < num_keys; ++i){
+    pnet::Key key;
+    key.ip_src.s_addr = (uint32_t) i;
+    key.ip_dst.s_addr = (uint32_t) (i * 7919);
+    key.port_src = (uint16_t) i;
+    key.port_dst = 80;
+    key.protocol = 6;
+    keys.push_back(key);
+  }
+  // Starts small and grows several times.
+  pnet::FlowIndex<pnet::Key, pnet::Key> index;
+  for(auto &key : keys){
+    index.insert(key.hash(), &key);
+  }
+  pnet::ASSERT_TRUE(index.size() == num_keys, "wrong index size");
+  for(auto &key : keys){
+    pnet::ASSERT_TRUE(index.find(key, key.hash()) == &key, "key not found");
+  }
+  // Erase every other key, the rest must remain reachable.
+  for(uint64_t i = 0; i < num_keys; i += 2){
+    pnet::ASSERT_TRUE(index.erase(&keys[i], keys[i].hash()), "erase failed");
+  }
+  for(uint64_t i = 0; i < num_keys; ++i){
+    pnet::Key *found = index.find(keys[i], keys[i].hash());
+    pnet::ASSERT_TRUE(found == (i % 2 ? &keys[i] : nullptr),
+                      "wrong lookup after erase");
+  }
+  pnet::ASSERT_TRUE(index.size() == num_keys / 2, "wrong size after erase");
+
+  // Hashes equal in their low bits share a probe run, across growth.
+  pnet::FlowIndex<pnet::Key, pnet::Key> run;
+  for(uint64_t i = 0; i < 100; ++i){
+    run.insert((i << 32) | 7, &keys[i]);
+  }
+  for(uint64_t i = 0; i < 100; ++i){
+    pnet::ASSERT_TRUE(run.find(keys[i], (i << 32) | 7) == &keys[i],
+                      "key not found in probe run");
+  }
+  pnet::ASSERT_TRUE(run.erase(&keys[0], 7), "erase failed");
+  pnet::ASSERT_TRUE(run.find(keys[99], (99ULL << 32) | 7) == &keys[99],
+                    "key lost after erase");
+  std::cout << "OK.\n";
+}
+
+void test_flow_table(){
+  std::cout << "test_flow_table...\n";
+  pnet::FlowTable table;
+  pnet::Packet p = makePacket("10.0.0.1", 1234, "10.0.0.2", 80, 6, 0);
+  pnet::ASSERT_TRUE(table.insert(p), "first packet must create a flow");
+  pnet::ASSERT_TRUE(!table.insert(reversed(p)),
+                    "reverse packet must join the flow");
+  pnet::Flow *flow = table.find(reversed(p));
+  pnet::ASSERT_TRUE(flow && flow->size() == 2, "flow not found");
+  pnet::ASSERT_TRUE(flow->packets.back().updown == -1, "wrong direction");
+
+  // The flow times out 60 seconds after its last packet.
+  pnet::Packet q = makePacket("10.0.0.3", 53, "10.0.0.4", 53, 17, 61000000);
+  table.insert(q);
+  pnet::ASSERT_TRUE(table.find(p) == nullptr, "flow did not expire");
+  pnet::ASSERT_TRUE(table.find(q) != nullptr, "new flow not found");
+  pnet::ASSERT_TRUE(table.flow_hash.size() == 1, "wrong number of flows");
+  std::cout << "OK.\n";
+}
+
+void test_flow_allocator(){
+  std::cout << "test_flow_allocator...\n";
+  pnet::FlowQueue queue;
+  pnet::Packet p = makePacket("10.0.0.1", 1234, "10.0.0.2", 80, 6, 0);
+  for(int round = 0; round < 3; ++round){
+    for(int i = 0; i < 10000; ++i){
+      p.port_src = htons(i);
+      pnet::Flow *flow = queue.emplace_back(p);
+      for(int j = 0; j < i % 20; ++j){
+        flow->insert(p);
+      }
+    }
+    uint64_t num_packets = 0;
+    for(pnet::Flow *flow = queue.head; flow; flow = flow->next){
+      for(auto &info : flow->packets){
+        pnet::ASSERT_TRUE(info.size == p.size, "corrupted packet history");
+        ++num_packets;
+      }
+    }
+    pnet::ASSERT_TRUE(num_packets == 10000 + 95000, "wrong number of packets");
+    while(!queue.empty()){
+      queue.del(queue.head);
+    }
+  }
+  // Memory of expired flows must be reused by the next rounds.
+  pnet::ASSERT_TRUE(queue.flowStats().live_blocks == 0, "flows leaked");
+  pnet::ASSERT_TRUE(queue.packetStats().live_blocks == 0, "chunks leaked");
+  pnet::ASSERT_TRUE(queue.flowStats().high_water_mark == 10000,
+                    "wrong flow high water mark");
+  pnet::ASSERT_TRUE(queue.flowStats().total_allocations == 30000,
+                    "wrong number of allocations");
+  pnet::ASSERT_TRUE(queue.flowStats().num_slabs == 3, "slabs not reused");
+  std::cout << "OK.\n";
+}
+
+struct Timer {
+  Timer(): timer_prev(nullptr), timer_next(nullptr),
+           timer_slot(pnet::TimerWheel<Timer>::NOT_SCHEDULED),
+           timer_deadline(0), fired_at(0) {}
+  Timer *timer_prev;
+  Timer *timer_next;
+  uint32_t timer_slot;
+  uint64_t timer_deadline;
+  uint64_t fired_at;
+};
+
+void test_timer_wheel(){
+  std::cout << "test_timer_wheel...\n";
+  const uint64_t t_start = 1500000000ULL * 1000000;
+  const uint64_t tick = 1 << pnet::TimerWheel<Timer>::TICK_BITS;
+  pnet::TimerWheel<Timer> wheel(t_start);
+  std::vector<Timer> timers(20000);
+  srand(1);
+  for(auto &timer : timers){
+    // Deadlines from milliseconds up to a few days.
+    uint64_t scale = 1ULL << (rand() % 38);
+    wheel.schedule(&timer, t_start + (rand() % scale));
+  }
+  // Cancel every tenth timer.
+  for(uint64_t i = 0; i < timers.size(); i += 10){
+    wheel.cancel(&timers[i]);
+  }
+  uint64_t now = t_start;
+  uint64_t fired = 0;
+  while(wheel.size() > 0){
+    now += rand() % 3000000;
+    wheel.advance(now, [&](Timer *timer){
+      timer->fired_at = now;
+      ++fired;
+    });
+  }
+  pnet::ASSERT_TRUE(fired == timers.size() - timers.size() / 10,
+                    "wrong number of timers fired");
+  for(uint64_t i = 0; i < timers.size(); ++i){
+    Timer &timer = timers[i];
+    if(i % 10 == 0){
+      pnet::ASSERT_TRUE(timer.fired_at == 0, "cancelled timer fired");
+      continue;
+    }
+    pnet::ASSERT_TRUE(timer.fired_at >= timer.timer_deadline,
+                      "timer fired early");
+    // Fired within one tick by the first advance past its deadline.
+    pnet::ASSERT_TRUE(timer.fired_at < timer.timer_deadline + tick + 3000000,
+                      "timer fired late");
+  }
+  std::cout << "OK.\n";
+}
+
+void test_flow_expiry(){
+  std::cout << "test_flow_expiry...\n";
+  const uint64_t sec = 1000000;
+  pnet::FlowTable table;
+  pnet::Packet tcp = makePacket("10.0.0.1", 1234, "10.0.0.2", 80, 6, 0);
+  pnet::Packet rst = reversed(tcp);
+  rst.flags = pnet::Packet::TCP_RST;
+  pnet::Packet dns = makePacket("10.0.0.1", 5353, "10.0.0.3", 53, 17, 0);
+  pnet::Packet udp = makePacket("10.0.0.1", 5000, "10.0.0.4", 5001, 17, 0);
+  table.insert(tcp);
+  table.insert(dns);
+  table.insert(udp);
+  table.insert(rst);
+  table.expireFlows(pnet::Time(2 * sec));
+  pnet::ASSERT_TRUE(table.find(tcp) == nullptr, "reset flow did not expire");
+  pnet::ASSERT_TRUE(table.find(dns) != nullptr, "DNS flow expired early");
+  table.expireFlows(pnet::Time(11 * sec));
+  pnet::ASSERT_TRUE(table.find(dns) == nullptr, "DNS flow did not expire");
+  pnet::ASSERT_TRUE(table.find(udp) != nullptr, "UDP flow expired early");
+  table.expireFlows(pnet::Time(61 * sec));
+  pnet::ASSERT_TRUE(table.find(udp) == nullptr, "UDP flow did not expire");
+
+  // Active flows are cut after the active timeout.
+  pnet::ExpiryPolicy policy;
+  policy.active_timeout = 5 * sec;
+  table.setExpiryPolicy(policy);
+  uint64_t num_new_flows = 0;
+  for(uint64_t t = 100; t <= 111; ++t){
+    udp.t_arrival = t * sec;
+    num_new_flows += table.insert(udp);
+  }
+  pnet::ASSERT_TRUE(num_new_flows == 3, "active timeout is not applied");
+  pnet::ASSERT_TRUE(table.num_expired_flows == 5, "wrong expiry count");
+  std::cout << "OK.\n";
+}
+
+void test_sharded_flow_table(){
+  std::cout << "test_sharded_flow_table...\n";
+  pnet::FlowTable table;
+  pnet::ShardedFlowTable sharded(4);
+  srand(2);
+  uint64_t t = 0;
+  for(int i = 0; i < 200000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, t);
+    p.ip_src.s_addr = rand() % 100;
+    p.port_src = rand() % 50;
+    p.protocol = (rand() % 2) ? 6 : 17;
+    if(rand() % 2){
+      p = reversed(p);
+    }
+    t += rand() % 1000;
+    p.t_arrival = t;
+    table.insert(p);
+    sharded.insert(p);
+  }
+  table.expireFlows(pnet::Time(t));
+  pnet::ASSERT_TRUE(sharded.getCurrentFSD() == table.getCurrentFSD(),
+                    "sharded FSD differs");
+  pnet::ASSERT_TRUE(sharded.getCurrentFSD(17) == table.getCurrentFSD(17),
+                    "sharded UDP FSD differs");
+  pnet::ASSERT_TRUE(sharded.numFlows() == table.flows.num_elements,
+                    "sharded flow count differs");
+  pnet::ASSERT_TRUE(sharded.numExpiredFlows() == table.num_expired_flows,
+                    "sharded expired flow count differs");
+  pnet::ASSERT_TRUE(sharded.upTime().microseconds()
+                    == table.upTime().microseconds(),
+                    "sharded up time differs");
+  std::cout << "OK.\n";
+}
+
+// Idle workers sleep instead of spinning.
+void test_sharded_flow_table_idle(){
+  std::cout << "test_sharded_flow_table_idle...\n";
+  pnet::ShardedFlowTable sharded(4);
+  for(int i = 0; i < 1000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000 + i, "10.0.0.2", 80, 6, i);
+    sharded.insert(p);
+  }
+  pnet::ASSERT_TRUE(sharded.numFlows() == 1000, "wrong number of flows");
+  usleep(100000);
+  struct timespec cpu_start, cpu_end;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+  usleep(300000);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  double cpu = (cpu_end.tv_sec - cpu_start.tv_sec)
+               + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+  pnet::ASSERT_TRUE(cpu < 0.05, "idle workers busy");
+  std::cout << "OK.\n";
+}
+
+// Distributions of the flows of a table, computed by walking the flows.
+pnet::FlowDistributionSnapshot walkFlows(const pnet::FlowTable &table,
+                                         const pnet::FlowBinning &binning,
+                                         uint16_t proto){
+  pnet::FlowDistributionSnapshot result;
+  result.packets.assign(binning.packets.num_bins, 0);
+  result.bytes.assign(binning.bytes.num_bins, 0);
+  result.duration.assign(binning.duration.num_bins, 0);
+  for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+    if(proto != 0 && flow->protocol != proto){
+      continue;
+    }
+    ++result.num_flows;
+    ++result.packets[binning.packets.bin(flow->size())];
+    ++result.bytes[binning.bytes.bin(flow->bytes())];
+    ++result.duration[binning.duration.bin(
+        flow->t_lastPacket().microseconds()
+        - flow->t_firstPacket().microseconds())];
+  }
+  return result;
+}
+
+bool sameDistributions(const pnet::FlowDistributionSnapshot &a,
+                       const pnet::FlowDistributionSnapshot &b){
+  return a.num_flows == b.num_flows && a.packets == b.packets
+         && a.bytes == b.bytes && a.duration == b.duration;
+}
+
+void test_flow_distributions(){
+  std::cout << "test_flow_distributions...\n";
+  pnet::Binning log_bins(8, pnet::Binning::LOG2, 4);
+  pnet::ASSERT_TRUE(log_bins.bin(1) == 0u && log_bins.bin(4) == 0u
+                    && log_bins.bin(8) == 1u && log_bins.bin(1023) == 7u,
+                    "wrong log2 bins");
+  pnet::Binning linear_bins(10, pnet::Binning::LINEAR, 0, 100);
+  pnet::ASSERT_TRUE(linear_bins.bin(99) == 0u && linear_bins.bin(100) == 1u
+                    && linear_bins.bin(5000) == 9u, "wrong linear bins");
+
+  pnet::FlowTable table;
+  pnet::FlowBinning binning;
+  pnet::ASSERT_TRUE(table.getCurrentFSD().size()
+                    == pnet::FlowTable::NUM_FSD_BINS,
+                    "wrong number of FSD bins");
+  srand(3);
+  uint64_t t = 0;
+  for(int round = 0; round < 2; ++round){
+    for(int i = 0; i < 100000; ++i){
+      pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, t);
+      p.ip_src.s_addr = rand() % 300;
+      p.port_src = rand() % 20;
+      p.protocol = (rand() % 3) ? 6 : 17;
+      p.size = rand() % 1500;
+      t += rand() % 5000;
+      p.t_arrival = t;
+      table.insert(p);
+    }
+    // Flows expired while packets arrived, and flows were created and
+    // grew: the kept up-to-date distributions match a walk over the flows.
+    pnet::ASSERT_TRUE(table.num_expired_flows > 0, "no flow expired");
+    for(uint16_t proto : {0, 6, 17, 1}){
+      pnet::ASSERT_TRUE(sameDistributions(table.getDistributions(proto),
+                                          walkFlows(table, binning, proto)),
+                        "distributions differ from the flows");
+    }
+    pnet::ASSERT_TRUE(table.getCurrentFSD(17)
+                      == walkFlows(table, binning, 17).packets,
+                      "FSD differs from the flows");
+    // Other bins, rebuilt from the current flows.
+    binning.packets = pnet::Binning(16, pnet::Binning::LOG2);
+    binning.bytes = pnet::Binning(30, pnet::Binning::LINEAR, 0, 1000);
+    binning.duration = pnet::Binning(12, pnet::Binning::LOG2, 1000);
+    table.setFlowBinning(binning);
+    pnet::ASSERT_TRUE(sameDistributions(table.getDistributions(),
+                                        walkFlows(table, binning, 0)),
+                      "rebuilt distributions differ from the flows");
+  }
+  table.Flush();
+  pnet::ASSERT_TRUE(table.getDistributions().num_flows == 0,
+                    "flushed flows are counted");
+  std::cout << "OK.\n";
+}
+
+// A reader thread takes snapshots while packets are inserted: each one
+// counts every flow exactly once in each distribution.
+void test_distribution_snapshots(){
+  std::cout << "test_distribution_snapshots...\n";
+  pnet::FlowTable table;
+  std::atomic<bool> done(false);
+  uint64_t num_snapshots = 0;
+  std::thread reader([&](){
+    while(!done.load()){
+      pnet::FlowDistributionSnapshot s = table.getDistributions(6);
+      uint64_t packets = 0, bytes = 0, duration = 0;
+      for(uint64_t i = 0; i < s.packets.size(); ++i) packets += s.packets[i];
+      for(uint64_t i = 0; i < s.bytes.size(); ++i) bytes += s.bytes[i];
+      for(uint64_t i = 0; i < s.duration.size(); ++i) duration += s.duration[i];
+      pnet::ASSERT_TRUE(packets == s.num_flows && bytes == s.num_flows
+                        && duration == s.num_flows,
+                        "inconsistent snapshot");
+      ++num_snapshots;
+    }
+  });
+  srand(4);
+  uint64_t t = 0;
+  for(int i = 0; i < 1000000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, t);
+    p.ip_src.s_addr = rand() % 1000;
+    p.port_src = rand() % 10;
+    t += rand() % 2000;
+    p.t_arrival = t;
+    table.insert(p);
+  }
+  done.store(true);
+  reader.join();
+  pnet::ASSERT_TRUE(num_snapshots > 0, "no snapshot taken");
+  std::cout << "OK.\n";
+}
+
+bool closeTo(double x, double y){
+  return std::fabs(x - y) <= 1e-4 * std::max(1.0, std::fabs(y));
+}
+
+// Streaming features match those computed from the packet history, and
+// those of the batch path over the same packets.
+void test_flow_features(){
+  std::cout << "test_flow_features...\n";
+  typedef pnet::FlowFeatures F;
+  pnet::FlowTable table;
+  table.setFeatureExtraction(true);
+  std::vector<pnet::Packet> packets;
+  srand(5);
+  uint64_t t = 1500000000000000ULL;
+  for(int i = 0; i < 50000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, t);
+    p.ip_src.s_addr = rand() % 200;
+    p.size = rand() % 3 ? 40 + rand() % 100 : 1500;
+    if(rand() % 3 == 0){
+      p = reversed(p);
+    }
+    t += rand() % 4 ? rand() % 500 : 2000;
+    p.t_arrival = t;
+    table.insert(p);
+    packets.push_back(p);
+  }
+  pnet::ASSERT_TRUE(table.num_expired_flows == 0, "flows expired");
+
+  for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+    F f = flow->getFeatures();
+    double iat_sum = 0, size_sum[2] = {0, 0};
+    uint64_t n[2] = {0, 0}, bursts = 1;
+    pnet::Time previous = flow->packets.front().t_arrival;
+    for(const pnet::PacketInfo &info : flow->packets){
+      int64_t gap = (info.t_arrival - previous).microseconds();
+      iat_sum += gap;
+      bursts += gap > pnet::FlowFeatureExtractor::BURST_GAP;
+      previous = info.t_arrival;
+      size_sum[info.updown == -1] += info.size;
+      ++n[info.updown == -1];
+    }
+    double iat_mean = flow->size() > 1 ? iat_sum / (flow->size() - 1) : 0;
+    double iat_m2 = 0;
+    previous = flow->packets.front().t_arrival;
+    bool first = true;
+    for(const pnet::PacketInfo &info : flow->packets){
+      if(!first){
+        double d = (info.t_arrival - previous).microseconds() - iat_mean;
+        iat_m2 += d * d;
+      }
+      first = false;
+      previous = info.t_arrival;
+    }
+    double iat_std = flow->size() > 2 ? std::sqrt(iat_m2 / (flow->size() - 1))
+                                      : 0;
+    pnet::ASSERT_TRUE(f[F::PACKETS_UP] == n[0] && f[F::PACKETS_DOWN] == n[1]
+                      && f[F::BYTES_UP] == flow->bytes_up
+                      && f[F::BYTES_UP] + f[F::BYTES_DOWN] == flow->bytes(),
+                      "wrong direction counters");
+    pnet::ASSERT_TRUE(f[F::DURATION] == (flow->t_lastPacket()
+                      - flow->t_firstPacket()).microseconds(),
+                      "wrong duration");
+    pnet::ASSERT_TRUE(closeTo(f[F::IAT_MEAN], iat_mean)
+                      && closeTo(f[F::IAT_STD], iat_std), "wrong IAT");
+    pnet::ASSERT_TRUE(n[0] == 0 || closeTo(f[F::SIZE_UP_MEAN],
+                                           size_sum[0] / n[0]),
+                      "wrong size mean");
+    pnet::ASSERT_TRUE(closeTo(f[F::SIZE_MEAN],
+                              (double) flow->bytes() / flow->size()),
+                      "wrong size mean");
+    pnet::ASSERT_TRUE(f[F::NUM_BURSTS] == bursts, "wrong burst count");
+    pnet::ASSERT_TRUE(f[F::SIZE_MINIMUM] <= f[F::SIZE_P25]
+                      && f[F::SIZE_P25] <= f[F::SIZE_P50]
+                      && f[F::SIZE_P50] <= f[F::SIZE_P90]
+                      && f[F::SIZE_P90] <= f[F::SIZE_MAXIMUM],
+                      "wrong size percentiles");
+  }
+
+  std::vector<pnet::Key> keys;
+  std::vector<F> batch;
+  pnet::extractFlowFeatures(packets.data(), packets.size(), keys, batch);
+  pnet::ASSERT_TRUE(keys.size() == table.flows.num_elements,
+                    "wrong number of batch flows");
+  for(uint64_t i = 0; i < keys.size(); ++i){
+    pnet::Flow *flow = table.find(keys[i]);
+    pnet::ASSERT_TRUE(flow && flow->ip_src.s_addr == keys[i].ip_src.s_addr,
+                      "batch flow not found");
+    F f = flow->getFeatures();
+    for(uint32_t j = 0; j < F::NUM_FEATURES; ++j){
+      pnet::ASSERT_TRUE(closeTo(batch[i][j], f[j]),
+                        std::string("batch differs: ") + F::name(j));
+    }
+  }
+  std::cout << "OK.\n";
+}
+
+// Packets of num_flows flows of 1 to 20 packets, both directions,
+// interleaved.
+std::vector<pnet::Packet> sampledTraffic(uint64_t num_flows,
+                                         std::vector<uint64_t> &sizes){
+  std::vector<pnet::Packet> packets;
+  sizes.assign(num_flows, 0);
+  for(uint64_t i = 0; i < num_flows; ++i){
+    sizes[i] = 1 + rand() % 20;
+    for(uint64_t j = 0; j < sizes[i]; ++j){
+      pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, 0);
+      p.ip_src.s_addr = i;
+      packets.push_back(j % 2 ? reversed(p) : p);
+    }
+  }
+  std::random_shuffle(packets.begin(), packets.end());
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    packets[i].t_arrival = i;
+  }
+  return packets;
+}
+
+void test_flow_sampling(){
+  std::cout << "test_flow_sampling...\n";
+  srand(8);
+  std::vector<uint64_t> sizes;
+  std::vector<pnet::Packet> packets = sampledTraffic(40000, sizes);
+  pnet::FlowTable table;
+  pnet::AdmissionControl admission(table, pnet::AdmissionPolicy(
+      pnet::AdmissionPolicy::FLOW_SAMPLING, 8));
+  for(const pnet::Packet &p : packets){
+    admission.insert(p);
+  }
+  // Flows are kept whole, 1 in 8.
+  uint64_t num_flows = table.flows.num_elements;
+  pnet::ASSERT_TRUE(num_flows > 4500 && num_flows < 5500,
+                    "wrong number of sampled flows");
+  std::vector<uint64_t> exact(pnet::FlowTable::NUM_FSD_BINS, 0);
+  for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+    uint64_t i = std::min(flow->ip_src.s_addr, flow->ip_dst.s_addr);
+    pnet::ASSERT_TRUE(flow->size() == sizes[i], "sampled flow is not whole");
+    pnet::ASSERT_TRUE(flow->toRecord().weight() == 8,
+                      "sampling rate is not recorded");
+  }
+  for(uint64_t size : sizes){
+    ++exact[size - 1];
+  }
+  std::vector<double> estimated = pnet::estimatedFSD(table);
+  double total = 0;
+  for(uint64_t i = 0; i < 20; ++i){
+    total += estimated[i];
+    pnet::ASSERT_TRUE(std::fabs(estimated[i] - exact[i]) < 0.25 * exact[i],
+                      "biased FSD estimate");
+  }
+  pnet::ASSERT_TRUE(std::fabs(total - 40000) < 2000, "biased flow count");
+  pnet::ASSERT_TRUE(admission.numAdmitted() + admission.numShed()
+                    == packets.size(), "packets lost");
+  std::cout << "OK.\n";
+}
+
+// Elephants are held with nearly all their packets, mice are shed.
+void test_sample_and_hold(){
+  std::cout << "test_sample_and_hold...\n";
+  srand(9);
+  pnet::FlowTable table;
+  pnet::AdmissionControl admission(table, pnet::AdmissionPolicy(
+      pnet::AdmissionPolicy::SAMPLE_AND_HOLD, 20));
+  uint64_t t = 0;
+  for(uint64_t i = 0; i < 200000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, ++t);
+    bool elephant = i % 4 == 0;
+    p.ip_src.s_addr = elephant ? rand() % 10 : 1000 + i;
+    admission.insert(p);
+  }
+  uint64_t num_elephants = 0;
+  for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+    if(flow->ip_src.s_addr < 10){
+      ++num_elephants;
+      pnet::FlowRecord record = flow->toRecord();
+      pnet::ASSERT_TRUE(std::fabs(record.estimatedPackets() - 5000) < 200
+                        && std::fabs(record.weight() - 1) < 1e-6,
+                        "wrong elephant estimate");
+    }
+  }
+  pnet::ASSERT_TRUE(num_elephants == 10u, "elephant not held");
+  pnet::ASSERT_TRUE(table.flows.num_elements < 10000,
+                    "too many mice admitted");
+  std::cout << "OK.\n";
+}
+
+// The rate rises while the table is too large and goes back down.
+void test_adaptive_sampling(){
+  std::cout << "test_adaptive_sampling...\n";
+  pnet::FlowTable table;
+  pnet::AdmissionPolicy policy(pnet::AdmissionPolicy::ADAPTIVE);
+  policy.max_flows = 5000;
+  policy.check_interval = 1000;
+  pnet::AdmissionControl admission(table, policy);
+  uint64_t t = 0;
+  for(uint64_t i = 0; i < 500000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, ++t);
+    p.ip_src.s_addr = i;
+    admission.insert(p);
+  }
+  pnet::ASSERT_TRUE(admission.getRate() > 1, "rate did not rise");
+  pnet::ASSERT_TRUE(table.flows.num_elements < 3 * policy.max_flows,
+                    "table is not bounded");
+  double total = 0;
+  for(double count : pnet::estimatedFSD(table)){
+    total += count;
+  }
+  pnet::ASSERT_TRUE(std::fabs(total - 500000) < 0.1 * 500000,
+                    "biased flow count");
+  // Flows expire and the rate goes back down.
+  t += 120000000;
+  for(uint64_t i = 0; i < 100000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, ++t);
+    p.ip_src.s_addr = i % 10;
+    admission.insert(p);
+  }
+  pnet::ASSERT_TRUE(admission.getRate() == 1, "rate did not go down");
+
+  // Only ADAPTIVE uses the check interval.
+  pnet::FlowTable fixed_table;
+  pnet::AdmissionPolicy fixed(pnet::AdmissionPolicy::FLOW_SAMPLING, 4);
+  fixed.check_interval = 0;
+  pnet::AdmissionControl fixed_admission(fixed_table, fixed);
+  for(uint64_t i = 0; i < 1000; ++i){
+    pnet::Packet p = makePacket("10.0.0.1", 1000, "10.0.0.2", 80, 6, ++t);
+    p.ip_src.s_addr = i;
+    fixed_admission.insert(p);
+  }
+  pnet::ASSERT_TRUE(fixed_admission.numSeen() == 1000, "wrong packet count");
+  std::cout << "OK.\n";
+}
+
+// Packets of an elephant flow: both directions, some out of order, a few
+// long gaps.
+std::vector<pnet::Packet> flowPackets(uint64_t n){
+  std::vector<pnet::Packet> packets;
+  pnet::Packet p = makePacket("10.0.0.1", 1234, "10.0.0.2", 80, 6, 1000);
+  uint64_t t = 1500000000000000ULL;
+  for(uint64_t i = 0; i < n; ++i){
+    pnet::Packet q = i % 3 == 1 ? reversed(p) : p;
+    t += i % 1000 == 999 ? 5000000000ULL : rand() % 200;
+    q.t_arrival = pnet::Time(t - (i % 17 == 5 ? 150 : 0));
+    q.size = 40 + rand() % 1460;
+    packets.push_back(q);
+  }
+  return packets;
+}
+
+void checkCounters(const pnet::Flow &flow,
+                   const std::vector<pnet::Packet> &packets){
+  uint64_t bytes = 0;
+  for(const pnet::Packet &p : packets){
+    bytes += p.size;
+  }
+  pnet::ASSERT_TRUE(flow.size() == packets.size() && flow.bytes() == bytes,
+                    "wrong flow counters");
+  pnet::ASSERT_TRUE(!(flow.t_firstPacket() < packets.front().t_arrival) &&
+                    !(packets.front().t_arrival < flow.t_firstPacket()) &&
+                    !(flow.t_lastPacket() < packets.back().t_arrival) &&
+                    !(packets.back().t_arrival < flow.t_lastPacket()),
+                    "wrong flow times");
+}
+
+bool samePacket(const pnet::Flow::PacketInfo &info, const pnet::Packet &p){
+  return info.size == p.size &&
+         info.t_arrival.microseconds() == p.t_arrival.microseconds() &&
+         info.updown == (p.ip_src.s_addr == inet_addr("10.0.0.1") ? 1 : -1);
+}
+
+void test_flow_history(){
+  std::cout << "test_flow_history...\n";
+  srand(3);
+  const uint64_t n = 100000;
+  std::vector<pnet::Packet> packets = flowPackets(n);
+  pnet::Flow::PacketArena arena;
+
+  // Full history, encoded in a few bytes per packet.
+  {
+    pnet::Flow flow(packets[0], &arena);
+    for(uint64_t i = 1; i < n; ++i){
+      flow.insert(packets[i]);
+    }
+    checkCounters(flow, packets);
+    pnet::ASSERT_TRUE(flow.packets.size() == n, "wrong history size");
+    uint64_t i = 0;
+    for(const pnet::Flow::PacketInfo &info : flow.packets){
+      pnet::ASSERT_TRUE(samePacket(info, packets[i++]), "wrong history");
+    }
+    pnet::ASSERT_TRUE(samePacket(flow.packets.front(), packets[0]) &&
+                      samePacket(flow.packets.back(), packets[n - 1]),
+                      "wrong front or back");
+    pnet::ASSERT_TRUE(flow.packets.encodedBytes() < 5 * n,
+                      "history is not compact");
+    pnet::ASSERT_TRUE(flow.packets.numBlocks()
+                      == n / pnet::PacketHistory::BLOCK_PACKETS,
+                      "history not sealed into blocks");
+  }
+
+  // A block with an hour-long gap keeps the varint stream.
+  {
+    pnet::PacketHistory history(&arena);
+    std::vector<pnet::PacketInfo> infos;
+    uint64_t t = 1500000000000000ull;
+    for(uint64_t i = 0; i < 10000; ++i){
+      t += i == 5000 ? 3600000000ull : rand() % 100;
+      infos.push_back(pnet::PacketInfo(i % 3 ? 1 : -1, rand() % 1500,
+                                       pnet::Time(t)));
+      history.add(infos.back());
+    }
+    pnet::ASSERT_TRUE(history.numBlocks() == 2, "wrong number of blocks");
+    uint64_t i = 0;
+    for(const pnet::PacketInfo &info : history){
+      pnet::ASSERT_TRUE(info.size == infos[i].size
+                        && info.updown == infos[i].updown
+                        && info.t_arrival.microseconds()
+                           == infos[i].t_arrival.microseconds(),
+                        "wrong history across blocks");
+      ++i;
+    }
+    pnet::ASSERT_TRUE(i == infos.size(), "wrong history size");
+  }
+  pnet::ASSERT_TRUE(arena.getStats().live_blocks == 0, "chunks leaked");
+
+  // First N.
+  {
+    pnet::Flow flow(packets[0], &arena,
+                    pnet::HistoryPolicy(pnet::HistoryPolicy::FIRST_N, 1000));
+    for(uint64_t i = 1; i < n; ++i){
+      flow.insert(packets[i]);
+    }
+    checkCounters(flow, packets);
+    pnet::ASSERT_TRUE(flow.packets.size() == 1000, "wrong history size");
+    uint64_t i = 0;
+    for(const pnet::Flow::PacketInfo &info : flow.packets){
+      pnet::ASSERT_TRUE(samePacket(info, packets[i++]), "wrong first packets");
+    }
+  }
+
+  // Reservoir: a uniform sample, in arrival order.
+  {
+    pnet::Flow flow(packets[0], &arena,
+                    pnet::HistoryPolicy(pnet::HistoryPolicy::RESERVOIR, 1000));
+    for(uint64_t i = 1; i < n; ++i){
+      flow.insert(packets[i]);
+    }
+    checkCounters(flow, packets);
+    pnet::ASSERT_TRUE(flow.packets.size() == 1000, "wrong sample size");
+    uint64_t j = 0, sum = 0;
+    for(const pnet::Flow::PacketInfo &info : flow.packets){
+      while(j < n && !samePacket(info, packets[j])){
+        ++j;
+      }
+      pnet::ASSERT_TRUE(j < n, "sample not in order");
+      sum += j++;
+    }
+    double mean = (double) sum / flow.packets.size();
+    pnet::ASSERT_TRUE(mean > 0.45 * n && mean < 0.55 * n, "biased sample");
+  }
+
+  // Summary only.
+  {
+    pnet::Flow flow(packets[0], &arena,
+                    pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+    for(uint64_t i = 1; i < n; ++i){
+      flow.insert(packets[i]);
+    }
+    checkCounters(flow, packets);
+    pnet::ASSERT_TRUE(flow.packets.empty(), "summary keeps packets");
+  }
+  pnet::ASSERT_TRUE(arena.getStats().live_blocks == 0, "chunks leaked");
+
+  // Per table.
+  pnet::FlowTable table;
+  table.setHistoryPolicy(pnet::HistoryPolicy(pnet::HistoryPolicy::SUMMARY));
+  for(const pnet::Packet &p : packets){
+    table.insert(p);
+  }
+  pnet::ASSERT_TRUE(table.flows.packetStats().live_blocks == 0,
+                    "summary table keeps packets");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_key_hash();
+  test_flow_index();
+  test_flow_table();
+  test_flow_allocator();
+  test_timer_wheel();
+  test_flow_expiry();
+  test_sharded_flow_table();
+  test_sharded_flow_table_idle();
+  test_flow_distributions();
+  test_distribution_snapshots();
+  test_flow_history();
+  test_flow_features();
+  test_flow_sampling();
+  test_sample_and_hold();
+  test_adaptive_sampling();
+  return 0;
+}
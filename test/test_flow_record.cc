@@ -0,0 +1,193 @@
+#include <pnet.hpp>
+
+const std::string output_dir = "/tmp/pnet_test_flow_record";
+
+void resetDirectory(){
+  pnet::utils::rm("-rf " + output_dir);
+  pnet::utils::findOrCreate(output_dir);
+}
+
+// Flow i has i % 5 + 1 packets, every other one in the reverse direction.
+std::vector<pnet::Flow*> makeFlows(uint64_t num_flows){
+  std::vector<pnet::Flow*> flows;
+  for(uint64_t i = 0; i < num_flows; ++i){
+    pnet::Packet packet;
+    packet.ip_src.s_addr = htonl(0x0a000000 + i);
+    packet.ip_dst.s_addr = htonl(0xc0a80101);
+    packet.port_src = htons(1024 + i % 60000);
+    packet.port_dst = htons(443);
+    packet.protocol = IPPROTO_TCP;
+    packet.flags = pnet::Packet::TCP_SYN;
+    packet.size = 60;
+    packet.t_arrival = pnet::Time(1500000000000000ull + 100 * i);
+    pnet::Flow *flow = new pnet::Flow(packet);
+    for(uint64_t j = 1; j <= i % 5; ++j){
+      pnet::Packet next(packet);
+      if(j % 2){
+        std::swap(next.ip_src, next.ip_dst);
+        std::swap(next.port_src, next.port_dst);
+      }
+      next.flags = pnet::Packet::TCP_ACK;
+      next.size = 1000 + j;
+      next.t_arrival = packet.t_arrival + pnet::Time(0, 10 * j);
+      flow->insert(next);
+    }
+    flows.push_back(flow);
+  }
+  return flows;
+}
+
+std::string recordedFile(const std::string &extension){
+  std::vector<std::string> files = pnet::utils::ls(output_dir, true,
+                                                   {extension});
+  pnet::ASSERT_TRUE(files.size() == 1, "expected a single file");
+  return files[0];
+}
+
+void test_flow_record_text(){
+  std::cout << "test_flow_record_text...\n";
+  std::vector<pnet::Flow*> flows = makeFlows(10);
+  for(pnet::Flow *flow : flows){
+    pnet::FlowRecord record = flow->toRecord();
+    pnet::FlowRecord parsed;
+    pnet::ASSERT_TRUE(parsed.fromString(flow->toString()), "parse failed");
+    pnet::ASSERT_TRUE(parsed.key.ip_src.s_addr == record.key.ip_src.s_addr &&
+                      parsed.key.port_dst == record.key.port_dst &&
+                      parsed.packets == record.packets &&
+                      parsed.bytes == record.bytes &&
+                      parsed.t_first == record.t_first &&
+                      parsed.t_last == record.t_last, "wrong parsed record");
+    delete flow;
+  }
+  pnet::FlowRecord record;
+  pnet::ASSERT_TRUE(!record.fromString("10.0.0.1\t80"), "parsed garbage");
+  std::cout << "OK.\n";
+}
+
+void checkRecorded(pnet::FlowRecorder::Format format, bool extra){
+  resetDirectory();
+  std::vector<pnet::Flow*> flows = makeFlows(1000);
+  {
+    pnet::FlowRecorder recorder(output_dir, format);
+    recorder.setExtraCounters(extra);
+    for(pnet::Flow *flow : flows){
+      recorder.write(*flow);
+    }
+  }
+  std::string extension = format == pnet::FlowRecorder::FLR ? ".flr"
+                                                             : ".flr.gz";
+  pnet::FlowRecordReader reader(recordedFile(extension));
+  pnet::ASSERT_TRUE(reader.size() == flows.size(), "wrong number of flows");
+  pnet::ASSERT_TRUE(reader.hasExtraCounters() == extra, "wrong flags");
+  pnet::ASSERT_TRUE(reader.recordSize() == (extra ? 72 : 56),
+                    "wrong record size");
+  uint64_t i = 0;
+  for(const pnet::FlowRecord &record : reader){
+    const pnet::Flow &flow = *flows[i];
+    pnet::ASSERT_TRUE(record.key == flow &&
+                      record.key.ip_src.s_addr == flow.ip_src.s_addr &&
+                      record.packets == flow.size() &&
+                      record.bytes == flow.bytes() &&
+                      record.t_first == flow.t_firstPacket().microseconds() &&
+                      record.t_last == flow.t_lastPacket().microseconds() &&
+                      record.tcp_flags == flow.tcp_flags, "wrong record");
+    if(extra){
+      // Packets 0, 2, 4 go up.
+      uint64_t up = (flow.size() + 1) / 2;
+      pnet::ASSERT_TRUE(reader.extra(i).packets_up == up &&
+                        reader.extra(i).bytes_up ==
+                        60u + (up > 1 ? 1002u : 0u) + (up > 2 ? 1004u : 0u),
+                        "wrong extra counters");
+    }
+    pnet::ASSERT_TRUE(&reader[i] == &record, "wrong iteration");
+    ++i;
+  }
+  pnet::ASSERT_TRUE(i == flows.size(), "wrong iteration count");
+
+  // Compressed files are inflated only up to max_records.
+  pnet::FlowRecordReader first(recordedFile(extension), 10);
+  pnet::ASSERT_TRUE(first.size() == 10, "max_records ignored");
+  pnet::ASSERT_TRUE(first[9].t_last == reader[9].t_last
+                    && first[9].packets == reader[9].packets,
+                    "wrong first records");
+
+  // Text export matches the text recorder.
+  std::string exported = output_dir + "/exported.flw";
+  pnet::ASSERT_TRUE(pnet::exportFlowText(recordedFile(extension), exported)
+                    == flows.size(), "wrong export count");
+  std::ifstream in(exported);
+  std::string line;
+  for(pnet::Flow *flow : flows){
+    pnet::ASSERT_TRUE(std::getline(in, line) && line == flow->toString(),
+                      "wrong exported line");
+    delete flow;
+  }
+}
+
+void test_flow_record_files(){
+  std::cout << "test_flow_record_files...\n";
+  checkRecorded(pnet::FlowRecorder::FLR, false);
+  checkRecorded(pnet::FlowRecorder::FLR, true);
+  checkRecorded(pnet::FlowRecorder::FLR_GZ, true);
+  std::cout << "OK.\n";
+}
+
+// Features extracted by a FlowTable are recorded after the counters.
+void test_flow_record_features(){
+  std::cout << "test_flow_record_features...\n";
+  resetDirectory();
+  std::vector<pnet::Packet> packets;
+  for(pnet::Flow *flow : makeFlows(1000)){
+    pnet::Packet packet(*flow);
+    for(const pnet::PacketInfo &info : flow->packets){
+      pnet::Packet p(packet);
+      if(info.updown == -1){
+        std::swap(p.ip_src, p.ip_dst);
+        std::swap(p.port_src, p.port_dst);
+      }
+      p.size = info.size;
+      p.t_arrival = info.t_arrival;
+      packets.push_back(p);
+    }
+    delete flow;
+  }
+  {
+    pnet::FlowRecorder recorder(output_dir, pnet::FlowRecorder::FLR);
+    recorder.setExtraCounters(true);
+    recorder.setFeatures(true);
+    pnet::FlowTable table(&recorder);
+    table.setFeatureExtraction(true);
+    for(const pnet::Packet &p : packets){
+      table.insert(p);
+    }
+  }
+  std::vector<pnet::Key> keys;
+  std::vector<pnet::FlowFeatures> features;
+  pnet::extractFlowFeatures(packets.data(), packets.size(), keys, features);
+  pnet::FlowRecordReader reader(recordedFile(".flr"));
+  pnet::ASSERT_TRUE(reader.hasExtraCounters() && reader.hasFeatures(),
+                    "wrong flags");
+  pnet::ASSERT_TRUE(reader.recordSize() == 72 + sizeof(pnet::FlowFeatures),
+                    "wrong record size");
+  pnet::ASSERT_TRUE(reader.size() == keys.size(), "wrong number of flows");
+  for(uint64_t i = 0; i < reader.size(); ++i){
+    pnet::ASSERT_TRUE(reader[i].key.ip_src.s_addr == keys[i].ip_src.s_addr,
+                      "wrong flow order");
+    pnet::ASSERT_TRUE(reader.extra(i).packets_up
+                      == reader.features(i)[pnet::FlowFeatures::PACKETS_UP],
+                      "wrong extra counters");
+    for(uint32_t j = 0; j < pnet::FlowFeatures::NUM_FEATURES; ++j){
+      pnet::ASSERT_TRUE(std::fabs(reader.features(i)[j] - features[i][j])
+                        <= 1e-3, "wrong recorded features");
+    }
+  }
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_flow_record_text();
+  test_flow_record_files();
+  test_flow_record_features();
+  pnet::utils::rm("-rf " + output_dir);
+  return 0;
+}
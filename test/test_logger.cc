@@ -1,22 +1,178 @@
 #include <pnet_logger.hpp>
 
-void test_logger(){
-  std::cout << "test_logger...\n";
+#include <sys/wait.h>
+
+#include <thread>
+
+const std::string log_name = "/tmp/deneme.log";
 
-  std::string log_name = "/tmp/deneme.log";
+std::vector<std::string> readLines(const std::string &filename){
+  std::ifstream in(filename);
+  std::vector<std::string> lines;
+  std::string line;
+  while(std::getline(in, line)){
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+uint64_t countLines(const std::vector<std::string> &lines,
+                    const std::string &text){
+  uint64_t n = 0;
+  for(const std::string &line : lines){
+    n += line.find(text) != std::string::npos;
+  }
+  return n;
+}
+
+// Messages of concurrent threads all reach the file, each one whole.
+void test_logger_threads(){
+  std::cout << "test_logger_threads...\n";
+  pnet::Logger::INIT(log_name, 1 << 16);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < 4; ++t){
+    threads.push_back(std::thread([t](){
+      for(int i = 0; i < 5000; ++i){
+        pnet::Logger::INFO("thread " + std::to_string(t) + " message "
+                           + std::to_string(i) + " end");
+      }
+    }));
+  }
+  for(std::thread &thread : threads){
+    thread.join();
+  }
+  pnet::Logger::FLUSH();
+  pnet::ASSERT_TRUE(pnet::Logger::numDropped() == 0, "messages dropped");
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(lines.size() == 20000, "wrong number of lines");
+  pnet::ASSERT_TRUE(countLines(lines, " end") == 20000, "torn messages");
+  pnet::ASSERT_TRUE(countLines(lines, "[INFO] thread 3 message 4999 end")
+                    == 1, "message lost");
+  pnet::Logger::CLOSE();
+  std::cout << "OK.\n";
+}
+
+// A full ring drops messages and says so.
+void test_logger_full(){
+  std::cout << "test_logger_full...\n";
+  pnet::Logger::INIT(log_name, 16);
+  pnet::Logger::setRateLimit(0, 0);
+  for(int i = 0; i < 100000; ++i){
+    pnet::Logger::INFO("message " + std::to_string(i));
+  }
+  uint64_t dropped = pnet::Logger::numDropped();
+  pnet::Logger::CLOSE();
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(countLines(lines, "[INFO] message ") + dropped == 100000,
+                    "messages lost");
+  pnet::ASSERT_TRUE(dropped == 0
+                    || countLines(lines, "messages dropped") > 0,
+                    "drops not reported");
+  std::cout << "OK.\n";
+}
 
+// Repeats of a message beyond the limit are counted, not written.
+void test_logger_rate_limit(){
+  std::cout << "test_logger_rate_limit...\n";
   pnet::Logger::INIT(log_name);
-  pnet::Logger::INFO("This is INFO");
-  pnet::Logger::STDOUT("This is STDOUT");
-  pnet::Logger::ERROR("This is ERROR");
-  pnet::Logger::FATAL("This is FATAL");
+  pnet::Logger::setRateLimit(3, 200000);
+  for(int i = 0; i < 10; ++i){
+    pnet::Logger::ERROR("disk full");
+    pnet::Logger::INFO("other " + std::to_string(i));
+  }
+  usleep(250000);
+  pnet::Logger::ERROR("disk full");
+  pnet::ASSERT_TRUE(pnet::Logger::numSuppressed() == 7,
+                    "wrong number of suppressed messages");
+  pnet::Logger::CLOSE();
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(countLines(lines, "<<ERROR>> disk full") == 4,
+                    "rate limit not applied");
+  pnet::ASSERT_TRUE(countLines(lines, "disk full [repeated 7 more times]")
+                    == 1, "repeats not reported");
+  pnet::ASSERT_TRUE(countLines(lines, "[INFO] other ") == 10,
+                    "other messages limited");
+  std::cout << "OK.\n";
+}
+
+// Messages below PNET_LOG_LEVEL are not even built.
+void test_logger_severity(){
+  std::cout << "test_logger_severity...\n";
+  pnet::Logger::INIT(log_name);
+  int built = 0;
+  auto message = [&built](const std::string &text){
+    ++built;
+    return text;
+  };
+  PNET_LOG_DEBUG(message("debug"));
+  PNET_LOG_INFO(message("info"));
+  PNET_LOG_ERROR(message("error"));
+  pnet::Logger::DEBUG("debug");
+  pnet::Logger::CLOSE();
+  pnet::ASSERT_TRUE(built == 2, "filtered message built");
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(lines.size() == 2 && countLines(lines, "DEBUG") == 0,
+                    "message not filtered");
+  std::cout << "OK.\n";
+}
 
+// FATAL writes the messages pending before it.
+void test_logger_fatal_flush(){
+  std::cout << "test_logger_fatal_flush...\n";
+  std::cout.flush();
+  pid_t pid = fork();
+  if(pid == 0){
+    pnet::Logger::INIT(log_name, 1 << 16);
+    for(int i = 0; i < 10000; ++i){
+      pnet::Logger::INFO("pending " + std::to_string(i));
+    }
+    pnet::Logger::FATAL("last words");
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  pnet::ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) != 0,
+                    "FATAL did not fail");
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(lines.size() == 10001, "pending messages lost");
+  pnet::ASSERT_TRUE(lines.back().find("<<---FATAL--->> last words")
+                    != std::string::npos, "FATAL not last");
+  std::cout << "OK.\n";
+}
+
+// FATAL exits with an error, so it runs in a child process.
+void test_logger(){
+  std::cout << "test_logger...\n";
+  std::cout.flush();
+  pid_t pid = fork();
+  if(pid == 0){
+    pnet::Logger::INIT(log_name);
+    pnet::Logger::INFO("This is INFO");
+    pnet::Logger::STDOUT("This is STDOUT");
+    pnet::Logger::ERROR("This is ERROR");
+    pnet::Logger::FATAL("This is FATAL");
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  pnet::ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) != 0,
+                    "FATAL did not fail");
+  std::vector<std::string> lines = readLines(log_name);
+  pnet::ASSERT_TRUE(lines.size() == 4
+                    && countLines(lines, "This is INFO") == 1
+                    && countLines(lines, "This is STDOUT") == 1
+                    && countLines(lines, "This is ERROR") == 1
+                    && countLines(lines, "This is FATAL") == 1,
+                    "wrong log");
   pnet::utils::rm(log_name);
   std::cout << "OK.\n";
 }
 
 
 int main(){
+  test_logger_threads();
+  test_logger_full();
+  test_logger_rate_limit();
+  test_logger_severity();
+  test_logger_fatal_flush();
   test_logger();
   return 0;
-}
\ No newline at end of file
+}
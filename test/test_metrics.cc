@@ -0,0 +1,173 @@
+// Metrics are tested whether or not the build enables them.
+#ifndef PNET_METRICS
+#define PNET_METRICS
+#endif
+
+#include <pnet.hpp>
+#include <pnet_shared_buffer.hpp>
+
+#include <sys/wait.h>
+
+#include <thread>
+
+const std::string metrics_name = "pnet_test_metrics";
+
+// Buckets cover every value with a relative error below 1 / SUB_BUCKETS.
+void test_histogram_buckets(){
+  std::cout << "test_histogram_buckets...\n";
+  const uint64_t n = pnet::MetricsHistogram::NUM_BUCKETS;
+  for(uint64_t i = 1; i < n; ++i){
+    uint64_t lower = pnet::MetricsHistogram::lowerBound(i);
+    pnet::ASSERT_TRUE(lower > pnet::MetricsHistogram::lowerBound(i - 1),
+                      "bounds not increasing");
+    pnet::ASSERT_TRUE(pnet::MetricsHistogram::bucket(lower) == i
+                      && pnet::MetricsHistogram::bucket(lower - 1) == i - 1,
+                      "wrong bucket bounds");
+  }
+  pnet::ASSERT_TRUE(pnet::MetricsHistogram::bucket(UINT64_MAX) == n - 1,
+                    "wrong last bucket");
+  uint64_t values[] = {0, 15, 16, 17, 1000, 123456789, 1ull << 40};
+  for(uint64_t v : values){
+    uint64_t lower = pnet::MetricsHistogram::lowerBound(
+        pnet::MetricsHistogram::bucket(v));
+    pnet::ASSERT_TRUE(lower <= v && v - lower <= v / 16, "wrong bucket");
+  }
+
+  // Percentiles of 1..10000.
+  pnet::MetricsHistogram *h = new pnet::MetricsHistogram();
+  std::memset(static_cast<void*>(h), 0, sizeof(*h));
+  for(uint64_t v = 1; v <= 10000; ++v){
+    h->record(v);
+  }
+  pnet::HistogramSnapshot s;
+  s.add(*h);
+  pnet::ASSERT_TRUE(s.count == 10000 && s.max == 10000
+                    && s.mean() == 5000.5, "wrong count, max or mean");
+  uint64_t p50 = s.percentile(0.5), p99 = s.percentile(0.99);
+  pnet::ASSERT_TRUE(p50 <= 5000 && p50 > 5000 * 15 / 16, "wrong p50");
+  pnet::ASSERT_TRUE(p99 <= 9900 && p99 > 9900 * 15 / 16, "wrong p99");
+  delete h;
+  std::cout << "OK.\n";
+}
+
+// Threads record into slots of their own, the reader sums them.
+void test_metrics_threads(){
+  std::cout << "test_metrics_threads...\n";
+  pnet::MetricsReader reader;
+  pnet::ASSERT_TRUE(reader.open(metrics_name), "cannot open metrics");
+  int64_t before = reader.counter(pnet::metrics::PACKETS_CAPTURED);
+  uint64_t threads_before = reader.numThreads();
+  std::vector<std::thread> threads;
+  for(int t = 0; t < 4; ++t){
+    threads.push_back(std::thread([](){
+      for(int i = 0; i < 1000000; ++i){
+        PNET_METRIC_ADD(PACKETS_CAPTURED, 1);
+      }
+      PNET_METRIC_RECORD(PRODUCE_NS, 100);
+    }));
+  }
+  for(std::thread &thread : threads){
+    thread.join();
+  }
+  pnet::ASSERT_TRUE(reader.counter(pnet::metrics::PACKETS_CAPTURED)
+                    == before + 4000000, "wrong counter");
+  pnet::ASSERT_TRUE(reader.numThreads() == threads_before + 4,
+                    "threads share slots");
+  pnet::ASSERT_TRUE(reader.histogram(pnet::metrics::PRODUCE_NS).count >= 4,
+                    "wrong histogram");
+  std::cout << "OK.\n";
+}
+
+// A forked consumer records through the same page.
+void test_metrics_fork(){
+  std::cout << "test_metrics_fork...\n";
+  pnet::MetricsReader reader;
+  pnet::ASSERT_TRUE(reader.open(metrics_name), "cannot open metrics");
+  pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet(1024);
+  int64_t consumed = reader.counter(pnet::metrics::PACKETS_CONSUMED);
+  uint64_t waits = reader.histogram(pnet::metrics::CONSUME_NS).count;
+  pnet::ASSERT_TRUE(reader.gauge(pnet::metrics::RING_CAPACITY) == 1024,
+                    "wrong ring capacity");
+
+  std::cout.flush();
+  pid_t pid = fork();
+  if(pid == 0){
+    std::vector<pnet::Packet> batch(64);
+    uint64_t n = 0;
+    while(n < 10000){
+      n += buffer->consume(batch.data(), batch.size());
+    }
+    _exit(0);
+  }
+  std::vector<pnet::Packet> batch(100);
+  for(int i = 0; i < 100; ++i){
+    buffer->produce(batch.data(), batch.size());
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  pnet::ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                    "consumer failed");
+  pnet::ASSERT_TRUE(reader.counter(pnet::metrics::PACKETS_CONSUMED)
+                    == consumed + 10000, "consumer not counted");
+  pnet::ASSERT_TRUE(reader.histogram(pnet::metrics::CONSUME_NS).count > waits,
+                    "consume not timed");
+  pnet::ASSERT_TRUE(reader.gauge(pnet::metrics::RING_OCCUPANCY) == 0,
+                    "wrong ring occupancy");
+  pnet::SharedBuffer::destroy();
+  std::cout << "OK.\n";
+}
+
+// Flow table counters follow the table.
+void test_metrics_flow_table(){
+  std::cout << "test_metrics_flow_table...\n";
+  pnet::MetricsReader reader;
+  pnet::ASSERT_TRUE(reader.open(metrics_name), "cannot open metrics");
+  int64_t packets = reader.counter(pnet::metrics::FLOW_PACKETS);
+  int64_t created = reader.counter(pnet::metrics::FLOWS_CREATED);
+  int64_t active = reader.counter(pnet::metrics::FLOWS_ACTIVE);
+  uint64_t lookups = reader.histogram(pnet::metrics::PROBE_LENGTH).count;
+  {
+    pnet::FlowTable table(nullptr, 0, 1000);
+    for(uint32_t i = 0; i < 1000; ++i){
+      pnet::Packet pkt;
+      pkt.ip_src.s_addr = htonl(0x0a000000 + i % 100);
+      pkt.ip_dst.s_addr = htonl(0x01010101);
+      pkt.protocol = IPPROTO_UDP;
+      pkt.t_arrival = pnet::Time(1000000 + i);
+      table.insert(pkt);
+    }
+    pnet::ASSERT_TRUE(reader.counter(pnet::metrics::FLOW_PACKETS)
+                      == packets + 1000, "wrong packets");
+    pnet::ASSERT_TRUE(reader.counter(pnet::metrics::FLOWS_CREATED)
+                      == created + 100, "wrong flows created");
+    pnet::ASSERT_TRUE(reader.counter(pnet::metrics::FLOWS_ACTIVE)
+                      == active + (int64_t) table.flow_hash.size(),
+                      "wrong active flows");
+    pnet::ASSERT_TRUE(reader.histogram(pnet::metrics::PROBE_LENGTH).count
+                      == lookups + 1000, "wrong lookups");
+    pnet::ASSERT_TRUE(reader.histogram(pnet::metrics::FLOW_INSERT_NS).count
+                      >= 1000 / 64, "inserts not timed");
+  }
+  pnet::ASSERT_TRUE(reader.counter(pnet::metrics::FLOWS_ACTIVE) == active,
+                    "flushed flows still active");
+  std::cout << "OK.\n";
+}
+
+int main(){
+  pnet::Logger::INIT("/tmp/pnet_test_metrics.log");
+  test_histogram_buckets();
+  // Recorded before publishing, kept after.
+  PNET_METRIC_ADD(PACKETS_CAPTURED, 5);
+  pnet::ASSERT_TRUE(pnet::Metrics::publish(metrics_name),
+                    "cannot publish metrics");
+  pnet::MetricsReader reader;
+  pnet::ASSERT_TRUE(reader.open(metrics_name)
+                    && reader.counter(pnet::metrics::PACKETS_CAPTURED) == 5,
+                    "metrics lost on publish");
+  test_metrics_threads();
+  test_metrics_fork();
+  test_metrics_flow_table();
+  pnet::Metrics::unpublish();
+  pnet::ASSERT_TRUE(!reader.open(metrics_name), "metrics not unpublished");
+  return 0;
+}
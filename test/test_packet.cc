@@ -1,4 +1,7 @@
 #include <pnet.hpp>
+#include <pnet_traffic.hpp>
+
+#include <random>
 
 void test_read_write(){
 
@@ -27,8 +30,214 @@ void test_read_write(){
   std::cout << "OK.\n" ;
 }
 
+pnet::Packet numberedPacket(uint64_t i){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = i;
+  packet.ip_dst.s_addr = ~i;
+  packet.port_src = i & 0xffff;
+  packet.port_dst = 80;
+  packet.protocol = 6;
+  packet.flags = 0;
+  packet.size = i % 1500;
+  packet.t_arrival = i;
+  return packet;
+}
+
+bool isNumbered(const pnet::Packet &packet, uint64_t i){
+  return packet.ip_src.s_addr == (uint32_t) i &&
+         packet.t_arrival.microseconds() == i;
+}
+
+void test_packet_reader(){
+
+  std::cout << "test_packet_reader...\n";
+
+  const std::string filename = "/tmp/pnet_test_reader.pkt";
+  const uint64_t num_packets = 100000;
+  {
+    std::ofstream out(filename, std::ios::binary);
+    for(uint64_t i = 0; i < num_packets; ++i){
+      out << numberedPacket(i);
+    }
+    out.write("trailing", 8);   // truncated record, ignored
+  }
+
+  pnet::PacketReader reader(filename);
+  pnet::ASSERT_TRUE(reader.size() == num_packets, "wrong number of packets");
+  uint64_t i = 0;
+  for(const pnet::Packet &packet : reader.packets){
+    pnet::ASSERT_TRUE(isNumbered(packet, i++), "wrong packet");
+  }
+
+  // Four workers splitting the file.
+  uint64_t part = (num_packets + 3) / 4, total = 0;
+  for(uint64_t w = 0; w < 4; ++w){
+    pnet::PacketSpan span = reader.range(w * part, part);
+    for(uint64_t j = 0; j < span.size(); ++j){
+      pnet::ASSERT_TRUE(isNumbered(span[j], w * part + j), "wrong range");
+    }
+    total += span.size();
+  }
+  pnet::ASSERT_TRUE(total == num_packets, "ranges do not cover the file");
+  pnet::ASSERT_TRUE(reader.range(num_packets + 5, 10).empty(),
+                    "range past the end");
+
+  // Streaming, with released pages behind the cursor.
+  i = 0;
+  pnet::PacketSpan span;
+  while(!(span = reader.next(999)).empty()){
+    for(const pnet::Packet &packet : span){
+      pnet::ASSERT_TRUE(isNumbered(packet, i++), "wrong streamed packet");
+    }
+  }
+  pnet::ASSERT_TRUE(i == num_packets, "wrong number of streamed packets");
+
+  pnet::PacketReader first(filename, 10);
+  pnet::ASSERT_TRUE(first.size() == 10, "max_packets ignored");
+
+  pnet::utils::zip(filename, filename + ".gz");
+  pnet::PacketReader compressed(filename + ".gz");
+  pnet::ASSERT_TRUE(compressed.is_compressed, "not compressed");
+  pnet::ASSERT_TRUE(compressed.size() == num_packets &&
+                    isNumbered(compressed.packets[num_packets - 1],
+                               num_packets - 1), "wrong compressed file");
+  pnet::utils::rm(filename);
+  pnet::utils::rm(filename + ".gz");
+
+  std::cout << "OK.\n" ;
+}
+
+pnet::Packet randomPacket(std::mt19937_64 &random){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = random();
+  packet.ip_dst.s_addr = random() % 3 ? random() : 0xffffffff;
+  packet.port_src = random();
+  packet.port_dst = random() % 2 ? htons(443) : random();
+  packet.protocol = random() % 4 ? random() % 256 : random();
+  packet.flags = random() % 2 ? random() % 64 : random();
+  packet.size = random();
+  packet.t_arrival = pnet::Time(random() % 2 ? random() % 1000000000 + 1
+                                             : random(),
+                                random() % 1000000);
+  return packet;
+}
+
+void test_text_codec(){
+
+  std::cout << "test_text_codec...\n";
+
+  std::mt19937_64 random(7);
+  std::vector<pnet::Packet> packets;
+  std::string expected;
+  while(expected.size() < 3 * pnet::PacketTextCodec::MIN_PARALLEL_BYTES){
+    packets.push_back(randomPacket(random));
+    expected += packets.back().toString() + "\n";
+  }
+
+  // Same text as toString(), and back, on one and several threads.
+  for(uint32_t num_threads : {1, 4}){
+    pnet::PacketTextCodec codec(num_threads);
+    std::string text;
+    codec.format(packets.data(), packets.size(), text);
+    pnet::ASSERT_TRUE(text == expected, "text differs from toString()");
+    std::vector<pnet::Packet> parsed;
+    pnet::ASSERT_TRUE(codec.parse(text.data(), text.size(), parsed)
+                      == packets.size(), "wrong number of packets");
+    pnet::ASSERT_TRUE(std::memcmp(parsed.data(), packets.data(),
+                                  packets.size() * sizeof(pnet::Packet)) == 0,
+                      "wrong parsed packets");
+    pnet::ASSERT_TRUE(codec.num_failed == 0, "lines failed");
+  }
+
+  // Other spacing, CRLF, empty and malformed lines.
+  std::string text = "1.2.3.4 80 5.6.7.8 443 6 2 60 1500000000.5\r\n"
+                     "\n"
+                     "1.2.3.400\t80\t5.6.7.8\t443\t6\t2\t60\t1.0\n"
+                     "1.2.3.4\t80\t5.6.7.8\t443\t6\t2\t60\n"
+                     "10.0.0.1\t70000\t5.6.7.8\t443\t6\t2\t60\t1.0\n"
+                     "10.0.0.1\t53\t10.0.0.2\t1024\t17\t0\t99\t7.000001";
+  pnet::PacketTextCodec codec(1);
+  std::vector<pnet::Packet> parsed;
+  pnet::ASSERT_TRUE(codec.parse(text.data(), text.size(), parsed) == 2 &&
+                    codec.num_failed == 3, "wrong malformed lines");
+  pnet::ASSERT_TRUE(ntohs(parsed[0].port_dst) == 443 &&
+                    parsed[0].t_arrival.microseconds() == 1500000000500000ull &&
+                    parsed[1].size == 99 && parsed[1].protocol == 17 &&
+                    parsed[1].t_arrival.microseconds() == 7000001,
+                    "wrong parsed fields");
+
+  // Files, plain and gzipped.
+  for(const std::string filename : {"/tmp/pnet_test_text.pkta",
+                                    "/tmp/pnet_test_text.txt.gz"}){
+    pnet::PacketTextCodec file_codec(4);
+    file_codec.writeFile(filename, packets.data(), packets.size());
+    std::vector<pnet::Packet> read;
+    pnet::ASSERT_TRUE(file_codec.readFile(filename, read) == packets.size() &&
+                      std::memcmp(read.data(), packets.data(),
+                                  packets.size() * sizeof(pnet::Packet)) == 0,
+                      "wrong packets from file");
+    pnet::utils::rm(filename);
+  }
+
+  std::cout << "OK.\n" ;
+}
+
+void test_traffic_generator(){
+  std::cout << "test_traffic_generator...\n";
+  pnet::TrafficConfig config;
+  config.concurrent_flows = 1000;
+  config.max_flow_packets = 1000;
+  config.rst_share = 0;
+  pnet::TrafficGenerator generator(config);
+  // Zipf sizes: P(1) = 1 / H(1000, 1.2), about 0.22.
+  uint64_t ones = 0;
+  for(int i = 0; i < 100000; ++i){
+    ones += generator.flowSize() == 1;
+  }
+  pnet::ASSERT_TRUE(ones > 20000 && ones < 24000, "wrong flow sizes");
+
+  std::vector<pnet::Packet> packets;
+  pnet::TrafficGenerator(config).generate(packets, 200000);
+  pnet::FlowTable table;
+  uint64_t num_tcp = 0, num_udp = 0;
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    const pnet::Packet &p = packets[i];
+    pnet::ASSERT_TRUE(i == 0 || packets[i - 1].t_arrival.microseconds()
+                                <= p.t_arrival.microseconds(),
+                      "packets out of order");
+    if(table.insert(p)){
+      num_tcp += p.protocol == IPPROTO_TCP;
+      num_udp += p.protocol == IPPROTO_UDP;
+      pnet::ASSERT_TRUE(p.protocol != IPPROTO_TCP
+                        || p.flags == pnet::Packet::TCP_SYN,
+                        "TCP flow does not start with a SYN");
+    }
+  }
+  uint64_t num_flows = num_tcp + num_udp;
+  pnet::ASSERT_TRUE(num_tcp > 0.75 * num_flows && num_udp > 0.1 * num_flows,
+                    "wrong protocol mix");
+  // Closed TCP flows have seen FIN's in both directions.
+  uint64_t num_closed = 0;
+  for(pnet::Flow *flow = table.flows.head; flow; flow = flow->next){
+    num_closed += flow->closed();
+  }
+  pnet::ASSERT_TRUE(num_closed > 0, "no TCP flow closed");
+
+  const std::string file = "/tmp/pnet_test_traffic.pkt";
+  pnet::TrafficGenerator(config).writeFile(file, 10000);
+  pnet::PacketReader reader(file);
+  pnet::ASSERT_TRUE(reader.size() == 10000u, "wrong number of packets");
+  pnet::ASSERT_TRUE(reader.packets[9999].t_arrival.microseconds()
+                    == packets[9999].t_arrival.microseconds(),
+                    "written traffic differs");
+  pnet::utils::rm(file);
+  std::cout << "OK.\n";
+}
 
 int main(){
   test_read_write();
+  test_packet_reader();
+  test_text_codec();
+  test_traffic_generator();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include <pnet_packet_bus.hpp>
+
+#include <sys/wait.h>
+
+const std::string bus_name = "/pnet_test_bus";
+
+pnet::Packet makePacket(uint32_t src, uint32_t dst, uint64_t t){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = src;
+  packet.ip_dst.s_addr = dst;
+  packet.port_src = htons(1000 + src % 7);
+  packet.port_dst = htons(80);
+  packet.protocol = 6;
+  packet.flags = 0;
+  packet.size = 100;
+  packet.t_arrival = t;
+  return packet;
+}
+
+void test_broadcast(){
+  std::cout << "test_broadcast...\n";
+  pnet::PacketBus *producer = pnet::PacketBus::create(
+      bus_name, 2, pnet::PacketBus::BROADCAST, 1024);
+  pnet::PacketBus *c0 = pnet::PacketBus::attach(bus_name, 0);
+  pnet::PacketBus *c1 = pnet::PacketBus::attach(bus_name, 1);
+  for(uint64_t t = 0; t < 1000; ++t){
+    producer->publish(makePacket(1, 2, t));
+  }
+  producer->flush();
+  pnet::Packet packet;
+  for(uint64_t t = 0; t < 1000; ++t){
+    pnet::ASSERT_TRUE(c0->consume(packet), "consumer 0 failed");
+    pnet::ASSERT_TRUE(packet.t_arrival.microseconds() == t, "wrong packet");
+    pnet::ASSERT_TRUE(c1->consume(packet), "consumer 1 failed");
+    pnet::ASSERT_TRUE(packet.t_arrival.microseconds() == t, "wrong packet");
+  }
+  pnet::ASSERT_TRUE(c0->stats(0).delivered == 1000, "wrong delivered count");
+  pnet::ASSERT_TRUE(c0->stats(1).lag == 0, "wrong lag");
+
+  // Consumer 1 stalls, consumer 0 must still get everything.
+  for(uint64_t t = 0; t < 5000; ++t){
+    producer->publish(makePacket(1, 2, t));
+    if(t % 100 == 99){
+      producer->flush();
+      while(c0->stats(0).lag > 0){
+        c0->consume(packet);
+      }
+    }
+  }
+  pnet::PacketBus::ConsumerStats s0 = producer->stats(0);
+  pnet::PacketBus::ConsumerStats s1 = producer->stats(1);
+  pnet::ASSERT_TRUE(s0.dropped == 0 && s0.delivered == 6000,
+                    "fast consumer lost packets");
+  pnet::ASSERT_TRUE(s1.lag == 1024 && s1.dropped == 5000 - 1024,
+                    "wrong drop count of the slow consumer");
+  pnet::ASSERT_TRUE(s1.published == 6000, "wrong published count");
+  delete c0;
+  delete c1;
+  delete producer;
+  std::cout << "OK.\n";
+}
+
+void test_partitioned(){
+  std::cout << "test_partitioned...\n";
+  const uint32_t num_consumers = 4;
+  pnet::PacketBus *producer = pnet::PacketBus::create(
+      bus_name, num_consumers, pnet::PacketBus::PARTITIONED, 4096);
+  for(uint32_t i = 0; i < 1000; ++i){
+    pnet::Packet packet = makePacket(i, 1000 + i, i);
+    producer->publish(packet);
+    std::swap(packet.ip_src, packet.ip_dst);
+    std::swap(packet.port_src, packet.port_dst);
+    producer->publish(packet);  // reverse direction
+  }
+  producer->shutdown();
+
+  // Consumers run in separate processes and attach by name.
+  std::vector<pid_t> pids;
+  std::cout.flush();
+  for(uint32_t c = 0; c < num_consumers; ++c){
+    pid_t pid = fork();
+    if(pid == 0){
+      pnet::PacketBus *bus = pnet::PacketBus::attach(bus_name, c);
+      std::vector<int> seen(1000, 0);
+      pnet::Packet packet;
+      while(bus->consume(packet)){
+        uint32_t flow = std::min(packet.ip_src.s_addr, packet.ip_dst.s_addr);
+        ++seen[flow];
+      }
+      // Both directions of a flow go to the same consumer.
+      for(int count : seen){
+        if(count != 0 && count != 2){
+          _exit(1);
+        }
+      }
+      delete bus;
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  for(pid_t pid : pids){
+    int status;
+    waitpid(pid, &status, 0);
+    pnet::ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                      "flow split across consumers");
+  }
+  uint64_t total = 0;
+  for(uint32_t c = 0; c < num_consumers; ++c){
+    pnet::PacketBus::ConsumerStats s = producer->stats(c);
+    pnet::ASSERT_TRUE(s.published > 0, "consumer got no packets");
+    pnet::ASSERT_TRUE(s.delivered == s.published, "packets lost");
+    total += s.delivered;
+  }
+  pnet::ASSERT_TRUE(total == 2000, "wrong total number of packets");
+  delete producer;
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_broadcast();
+  test_partitioned();
+  return 0;
+}
@@ -0,0 +1,325 @@
+#include <pnet_interface.hpp>
+
+const std::string pcap_file = "/tmp/pnet_test.pcap";
+const std::string swapped_file = "/tmp/pnet_test_swapped.pcap";
+const std::string pcapng_file = "/tmp/pnet_test.pcapng";
+
+pnet::Packet makePacket(uint32_t src, uint32_t dst, uint16_t port,
+                        uint32_t protocol, uint64_t t){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = htonl(src);
+  packet.ip_dst.s_addr = htonl(dst);
+  packet.port_src = htons(port);
+  packet.port_dst = htons(80);
+  packet.protocol = protocol;
+  packet.flags = protocol == IPPROTO_TCP ? pnet::Packet::TCP_ACK : 0;
+  packet.size = 40 + t % 1000;
+  packet.t_arrival = pnet::Time(t);
+  return packet;
+}
+
+std::vector<pnet::Packet> makePackets(){
+  std::vector<pnet::Packet> packets;
+  for(uint64_t i = 0; i < 1000; ++i){
+    packets.push_back(makePacket(i % 13, 1000 + i % 7, 1024 + i % 5,
+                                 i % 3 ? IPPROTO_TCP : IPPROTO_UDP,
+                                 1000000 * i + i));
+  }
+  return packets;
+}
+
+bool samePacket(const pnet::Packet &p, const pnet::Packet &q){
+  return p == q && p.protocol == q.protocol && p.flags == q.flags &&
+         p.size == q.size &&
+         p.t_arrival.microseconds() == q.t_arrival.microseconds();
+}
+
+// A minimal Ethernet/IPv4/TCP frame, written by hand.
+std::vector<uint8_t> makeFrame(bool vlan){
+  std::vector<uint8_t> frame(12, 0);
+  if(vlan){
+    uint8_t tag[] = {0x81, 0x00, 0x00, 0x0a};
+    frame.insert(frame.end(), tag, tag + 4);
+  }
+  uint8_t ip[] = {0x08, 0x00,
+                  0x45, 0, 0, 40, 0, 0, 0, 0, 64, 6, 0, 0,
+                  10, 0, 0, 1, 10, 0, 0, 2,
+                  0x04, 0xd2, 0x00, 0x50, 0, 0, 0, 0, 0, 0, 0, 0,
+                  0x50, 0x12, 0, 0, 0, 0, 0, 0};
+  frame.insert(frame.end(), ip, ip + sizeof(ip));
+  return frame;
+}
+
+void checkFrame(const pnet::Packet &packet){
+  pnet::ASSERT_TRUE(packet.ip_src.s_addr == htonl(0x0a000001), "wrong source");
+  pnet::ASSERT_TRUE(packet.ip_dst.s_addr == htonl(0x0a000002),
+                    "wrong destination");
+  pnet::ASSERT_TRUE(ntohs(packet.port_src) == 1234, "wrong source port");
+  pnet::ASSERT_TRUE(ntohs(packet.port_dst) == 80, "wrong destination port");
+  pnet::ASSERT_TRUE(packet.protocol == IPPROTO_TCP, "wrong protocol");
+  pnet::ASSERT_TRUE(packet.flags == (pnet::Packet::TCP_SYN |
+                                     pnet::Packet::TCP_ACK), "wrong flags");
+  pnet::ASSERT_TRUE(packet.size == 40, "wrong size");
+}
+
+void put16(std::ofstream &out, uint16_t x, bool swap){
+  if(swap) x = __builtin_bswap16(x);
+  out.write(reinterpret_cast<const char*>(&x), 2);
+}
+
+void put32(std::ofstream &out, uint32_t x, bool swap){
+  if(swap) x = __builtin_bswap32(x);
+  out.write(reinterpret_cast<const char*>(&x), 4);
+}
+
+void putBytes(std::ofstream &out, const std::vector<uint8_t> &bytes){
+  out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  for(uint64_t i = bytes.size(); i % 4 != 0; ++i){
+    out.put(0);
+  }
+}
+
+void test_decoder(){
+  std::cout << "test_decoder...\n";
+  pnet::FrameDecoder decoder;
+  pnet::Packet packet;
+  for(int vlan = 0; vlan < 2; ++vlan){
+    std::vector<uint8_t> bytes = makeFrame(vlan);
+    pnet::Frame frame = {bytes.data(), (uint32_t) bytes.size(),
+                         (uint32_t) bytes.size(), pnet::LINKTYPE_ETHERNET,
+                         pnet::Time(5, 6)};
+    pnet::ASSERT_TRUE(decoder.decode(frame, packet), "decode failed");
+    checkFrame(packet);
+    pnet::ASSERT_TRUE(packet.t_arrival.microseconds() ==
+                      pnet::Time(5, 6).microseconds(), "wrong time");
+    // Truncated frames are rejected.
+    frame.caplen = 20;
+    pnet::ASSERT_TRUE(!decoder.decode(frame, packet), "truncated frame");
+  }
+  pnet::ASSERT_TRUE(decoder.num_decoded == 2, "wrong decoded count");
+  pnet::ASSERT_TRUE(decoder.num_failed == 2, "wrong failed count");
+  std::cout << "OK.\n";
+}
+
+void test_pcap_roundtrip(){
+  std::cout << "test_pcap_roundtrip...\n";
+  std::vector<pnet::Packet> packets = makePackets();
+  {
+    pnet::PcapWriter writer(pcap_file);
+    for(const pnet::Packet &packet : packets){
+      writer.write(packet);
+    }
+  }
+  pnet::PcapFile file(pcap_file);
+  pnet::FrameDecoder decoder;
+  pnet::Frame frames[64];
+  pnet::Packet batch[64];
+  uint64_t i = 0, n;
+  while((n = file.next(frames, 64)) > 0){
+    uint64_t m = decoder.decode(frames, n, batch);
+    pnet::ASSERT_TRUE(m == n, "decode failed");
+    for(uint64_t j = 0; j < m; ++j, ++i){
+      pnet::ASSERT_TRUE(samePacket(batch[j], packets[i]), "wrong packet");
+    }
+  }
+  pnet::ASSERT_TRUE(i == packets.size(), "wrong number of packets");
+  pnet::ASSERT_TRUE(file.position() == file.fileSize(), "file not consumed");
+  std::cout << "OK.\n";
+}
+
+// Big endian file with nanosecond timestamps.
+void test_pcap_swapped(){
+  std::cout << "test_pcap_swapped...\n";
+  std::vector<uint8_t> frame = makeFrame(true);
+  {
+    std::ofstream out(swapped_file, std::ios::binary);
+    bool swap = true;
+    put32(out, 0xa1b23c4d, swap);
+    put16(out, 2, swap);
+    put16(out, 4, swap);
+    put32(out, 0, swap);
+    put32(out, 0, swap);
+    put32(out, 65535, swap);
+    put32(out, pnet::LINKTYPE_ETHERNET, swap);
+    put32(out, 7, swap);
+    put32(out, 123456789, swap);
+    put32(out, frame.size(), swap);
+    put32(out, frame.size(), swap);
+    out.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+  }
+  pnet::PcapFile file(swapped_file);
+  pnet::FrameDecoder decoder;
+  pnet::Frame frames[4];
+  pnet::Packet packet;
+  pnet::ASSERT_TRUE(file.next(frames, 4) == 1, "wrong number of frames");
+  pnet::ASSERT_TRUE(decoder.decode(frames[0], packet), "decode failed");
+  checkFrame(packet);
+  pnet::ASSERT_TRUE(packet.t_arrival.microseconds() ==
+                    pnet::Time(7, 123456).microseconds(), "wrong time");
+  pnet::ASSERT_TRUE(file.next(frames, 4) == 0, "expected end of file");
+  std::cout << "OK.\n";
+}
+
+// One section with an interface at nanosecond resolution, enhanced packet
+// blocks and an unknown block in between.
+void test_pcapng(){
+  std::cout << "test_pcapng...\n";
+  std::vector<uint8_t> frame = makeFrame(false);
+  {
+    std::ofstream out(pcapng_file, std::ios::binary);
+    bool swap = false;
+    // Section header block
+    put32(out, 0x0a0d0d0a, swap);
+    put32(out, 28, swap);
+    put32(out, 0x1a2b3c4d, swap);
+    put16(out, 1, swap);
+    put16(out, 0, swap);
+    put32(out, 0xffffffff, swap);
+    put32(out, 0xffffffff, swap);
+    put32(out, 28, swap);
+    // Interface description block with if_tsresol = 9
+    put32(out, 1, swap);
+    put32(out, 32, swap);
+    put16(out, pnet::LINKTYPE_ETHERNET, swap);
+    put16(out, 0, swap);
+    put32(out, 65535, swap);
+    put16(out, 9, swap);
+    put16(out, 1, swap);
+    putBytes(out, std::vector<uint8_t>(1, 9));
+    put32(out, 0, swap);
+    put32(out, 32, swap);
+    // Unknown block
+    put32(out, 0x0badbeef, swap);
+    put32(out, 16, swap);
+    put32(out, 0, swap);
+    put32(out, 16, swap);
+    for(uint64_t i = 0; i < 3; ++i){
+      // Enhanced packet block
+      uint64_t t = (i + 10) * 1000000000ULL + 5000;
+      uint32_t length = 32 + (frame.size() + 3) / 4 * 4;
+      put32(out, 6, swap);
+      put32(out, length, swap);
+      put32(out, 0, swap);
+      put32(out, t >> 32, swap);
+      put32(out, t & 0xffffffff, swap);
+      put32(out, frame.size(), swap);
+      put32(out, frame.size(), swap);
+      putBytes(out, frame);
+      put32(out, length, swap);
+    }
+  }
+  pnet::PcapFile file(pcapng_file);
+  pnet::FrameDecoder decoder;
+  pnet::Frame frames[8];
+  pnet::Packet packets[8];
+  uint64_t n = file.next(frames, 8);
+  pnet::ASSERT_TRUE(n == 3, "wrong number of frames");
+  pnet::ASSERT_TRUE(decoder.decode(frames, n, packets) == 3, "decode failed");
+  for(uint64_t i = 0; i < 3; ++i){
+    checkFrame(packets[i]);
+    pnet::ASSERT_TRUE(packets[i].t_arrival.microseconds() ==
+                      pnet::Time(i + 10, 5).microseconds(), "wrong time");
+  }
+  std::cout << "OK.\n";
+}
+
+// An interface at a binary resolution (if_tsresol = 0x94, 2^20 ticks per
+// second) must still give microseconds below one second.
+void test_pcapng_binary_resolution(){
+  std::cout << "test_pcapng_binary_resolution...\n";
+  std::vector<uint8_t> frame = makeFrame(false);
+  const uint64_t ticks_per_second = 1ULL << 20;
+  {
+    std::ofstream out(pcapng_file, std::ios::binary);
+    bool swap = false;
+    // Section header block
+    put32(out, 0x0a0d0d0a, swap);
+    put32(out, 28, swap);
+    put32(out, 0x1a2b3c4d, swap);
+    put16(out, 1, swap);
+    put16(out, 0, swap);
+    put32(out, 0xffffffff, swap);
+    put32(out, 0xffffffff, swap);
+    put32(out, 28, swap);
+    // Interface description block with if_tsresol = 0x94
+    put32(out, 1, swap);
+    put32(out, 32, swap);
+    put16(out, pnet::LINKTYPE_ETHERNET, swap);
+    put16(out, 0, swap);
+    put32(out, 65535, swap);
+    put16(out, 9, swap);
+    put16(out, 1, swap);
+    putBytes(out, std::vector<uint8_t>(1, 0x94));
+    put32(out, 0, swap);
+    put32(out, 32, swap);
+    // Half a second, then the last tick of a second.
+    uint64_t ticks[2] = {5 * ticks_per_second + ticks_per_second / 2,
+                         6 * ticks_per_second + ticks_per_second - 1};
+    for(uint64_t i = 0; i < 2; ++i){
+      // Enhanced packet block
+      uint64_t t = ticks[i];
+      uint32_t length = 32 + (frame.size() + 3) / 4 * 4;
+      put32(out, 6, swap);
+      put32(out, length, swap);
+      put32(out, 0, swap);
+      put32(out, t >> 32, swap);
+      put32(out, t & 0xffffffff, swap);
+      put32(out, frame.size(), swap);
+      put32(out, frame.size(), swap);
+      putBytes(out, frame);
+      put32(out, length, swap);
+    }
+  }
+  pnet::PcapFile file(pcapng_file);
+  pnet::FrameDecoder decoder;
+  pnet::Frame frames[8];
+  pnet::Packet packets[8];
+  uint64_t n = file.next(frames, 8);
+  pnet::ASSERT_TRUE(n == 2, "wrong number of frames");
+  pnet::ASSERT_TRUE(decoder.decode(frames, n, packets) == 2, "decode failed");
+  pnet::ASSERT_TRUE(packets[0].t_arrival.microseconds() ==
+                    pnet::Time(5, 500000).microseconds(), "wrong time");
+  pnet::ASSERT_TRUE(packets[1].t_arrival.microseconds() ==
+                    pnet::Time(6, 999999).microseconds(), "wrong time");
+  std::cout << "OK.\n";
+}
+
+// Reading the file through the interface must give the same flows as
+// inserting the packets directly.
+void test_pcap_interface(){
+  std::cout << "test_pcap_interface...\n";
+  pnet::NetworkInterface *iface =
+      pnet::NetworkInterface::createInterface(pcap_file);
+  pnet::FlowTable table;
+  iface->setFlowTable(&table);
+  pnet::ASSERT_TRUE(iface->open(pcap_file), "cannot open file");
+  iface->loop();
+  pnet::ASSERT_TRUE(iface->getNumPacketsProduced() == 1000,
+                    "wrong number of packets");
+  pnet::FlowTable expected;
+  for(const pnet::Packet &packet : makePackets()){
+    expected.insert(packet);
+  }
+  pnet::ASSERT_TRUE(table.flow_hash.size() == expected.flow_hash.size(),
+                    "wrong number of flows");
+  pnet::ASSERT_TRUE(table.num_expired_flows == expected.num_expired_flows,
+                    "wrong number of expired flows");
+  iface->close();
+  delete iface;
+  std::cout << "OK.\n";
+}
+
+int main(){
+  pnet::Logger::INIT("/tmp/pnet_test_pcap.log");
+  test_decoder();
+  test_pcap_roundtrip();
+  test_pcap_swapped();
+  test_pcapng();
+  test_pcapng_binary_resolution();
+  test_pcap_interface();
+  unlink(pcap_file.c_str());
+  unlink(swapped_file.c_str());
+  unlink(pcapng_file.c_str());
+  pnet::Logger::CLOSE();
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <pnet.hpp>
+
+const std::string output_dir = "/tmp/pnet_test_recorder";
+
+void resetDirectory(){
+  pnet::utils::rm("-rf " + output_dir);
+  pnet::utils::findOrCreate(output_dir);
+}
+
+pnet::Packet numberedPacket(uint64_t i){
+  pnet::Packet packet;
+  packet.ip_src.s_addr = i;
+  packet.ip_dst.s_addr = 0x01020304;
+  packet.port_src = i & 0xffff;
+  packet.port_dst = 80;
+  packet.protocol = IPPROTO_TCP;
+  packet.flags = 0;
+  packet.size = i % 1500;
+  packet.t_arrival = pnet::Time(1500000000000000ull + i);
+  return packet;
+}
+
+// Packets of all recorded files, in order.
+std::vector<pnet::Packet> readAll(const std::string &extension){
+  std::vector<pnet::Packet> packets;
+  for(const std::string &file : pnet::utils::ls(output_dir, true,
+                                                {extension})){
+    pnet::PacketReader reader(file);
+    packets.insert(packets.end(), reader.packets.begin(),
+                   reader.packets.end());
+  }
+  return packets;
+}
+
+void test_sequential_file(){
+  std::cout << "test_sequential_file...\n";
+  resetDirectory();
+  const std::string filename = output_dir + "/file.bin";
+  std::string data;
+  for(uint64_t i = 0; data.size() < 3 * pnet::SequentialFile::BUFFER_SIZE;
+      ++i){
+    data += std::to_string(i);
+  }
+  for(bool direct : {false, true}){
+    pnet::SequentialFile file;
+    pnet::ASSERT_TRUE(file.open(filename, direct, 64 << 20), "open failed");
+    for(uint64_t i = 0; i < data.size(); i += 12345){
+      file.write(data.data() + i, std::min<uint64_t>(12345, data.size() - i));
+    }
+    pnet::ASSERT_TRUE(file.bytes() == data.size(), "wrong size");
+    file.close();
+    std::ifstream in(filename, std::ios::binary);
+    std::string result((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+    pnet::ASSERT_TRUE(result == data, "wrong file content");
+  }
+  std::cout << "OK.\n";
+}
+
+void test_async_recorder(){
+  std::cout << "test_async_recorder...\n";
+  resetDirectory();
+  const uint64_t num_packets = 2500000;
+  pnet::AsyncRecorderConfig config;
+  config.buffer_packets = 100000;
+  config.num_buffers = 3;
+  config.direct_io = true;
+  config.preallocate = true;
+  {
+    pnet::AsyncPacketRecorder recorder(output_dir, pnet::PacketRecorder::PKT,
+                                       config);
+    for(uint64_t i = 0; i < num_packets; ++i){
+      recorder.write(numberedPacket(i));
+    }
+    recorder.close();
+    pnet::ASSERT_TRUE(recorder.written() == num_packets, "packets missing");
+    pnet::ASSERT_TRUE(recorder.dropped() == 0, "packets dropped");
+  }
+  std::vector<pnet::Packet> packets = readAll(".pkt");
+  pnet::ASSERT_TRUE(packets.size() == num_packets, "wrong number of packets");
+  for(uint64_t i = 0; i < num_packets; ++i){
+    pnet::ASSERT_TRUE(packets[i].ip_src.s_addr == i, "wrong packet");
+  }
+  pnet::Catalog catalog(output_dir, "packets");
+  pnet::ASSERT_TRUE(catalog.size() == 3, "wrong number of files");
+  std::cout << "OK.\n";
+}
+
+// Compression is much slower than write(): with two small buffers,
+// packets are dropped and counted, the others are recorded in order.
+void test_async_drop(){
+  std::cout << "test_async_drop...\n";
+  resetDirectory();
+  const uint64_t num_packets = 1000000;
+  pnet::AsyncRecorderConfig config;
+  config.buffer_packets = 1000;
+  config.policy = pnet::AsyncRecorderConfig::DROP;
+  uint64_t dropped;
+  {
+    pnet::AsyncPacketRecorder recorder(output_dir,
+                                       pnet::PacketRecorder::PKT_GZ, config);
+    for(uint64_t i = 0; i < num_packets; ++i){
+      recorder.write(numberedPacket(i));
+    }
+    recorder.close();
+    dropped = recorder.dropped();
+    pnet::ASSERT_TRUE(recorder.written() + dropped == num_packets,
+                      "packets lost");
+    pnet::ASSERT_TRUE(recorder.stalls() == 0, "write() waited");
+  }
+  pnet::ASSERT_TRUE(dropped > 0, "nothing dropped");
+  std::vector<pnet::Packet> packets = readAll(".pkt.gz");
+  pnet::ASSERT_TRUE(packets.size() == num_packets - dropped,
+                    "wrong number of packets");
+  for(uint64_t i = 1; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(packets[i - 1].ip_src.s_addr < packets[i].ip_src.s_addr,
+                      "packets out of order");
+  }
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_sequential_file();
+  test_async_recorder();
+  test_async_drop();
+  pnet::utils::rm("-rf " + output_dir);
+  return 0;
+}
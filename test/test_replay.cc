@@ -0,0 +1,172 @@
+#include <pnet_interface.hpp>
+#include <pnet_traffic.hpp>
+
+#include <thread>
+
+const std::string trace_dir = "/tmp/pnet_test_replay";
+
+// Two files of a trace, the second one compressed and later in time.
+std::vector<pnet::Packet> writeTrace(uint64_t n, double mean_gap){
+  pnet::utils::rm("-rf " + trace_dir);
+  pnet::utils::findOrCreate(trace_dir);
+  pnet::TrafficConfig config;
+  config.concurrent_flows = 100;
+  config.arrivals = pnet::TrafficConfig::CONSTANT;
+  config.mean_gap = mean_gap;
+  pnet::TrafficGenerator(config).writeFile(trace_dir + "/0.pkt", n);
+  config.t_start += n * mean_gap;
+  config.seed = 2;
+  pnet::TrafficGenerator(config).writeFile(trace_dir + "/1.pkt.gz", n);
+
+  std::vector<pnet::Packet> packets, more;
+  config.t_start -= n * mean_gap;
+  config.seed = 1;
+  pnet::TrafficGenerator(config).generate(packets, n);
+  config.t_start += n * mean_gap;
+  config.seed = 2;
+  pnet::TrafficGenerator(config).generate(more, n);
+  packets.insert(packets.end(), more.begin(), more.end());
+  return packets;
+}
+
+// Runs the replay into the shared buffer, returns the packets consumed.
+std::vector<pnet::Packet> replay(pnet::NetworkInterface *iface){
+  pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet(4096);
+  iface->setSharedBuffer(buffer);
+  std::thread producer([&](){
+    iface->loop();
+    buffer->close();
+  });
+  std::vector<pnet::Packet> packets, batch(512);
+  uint64_t n;
+  while((n = buffer->consume(batch.data(), batch.size())) > 0){
+    packets.insert(packets.end(), batch.begin(), batch.begin() + n);
+  }
+  producer.join();
+  pnet::SharedBuffer::destroy();
+  return packets;
+}
+
+// Replay as fast as possible through the shared buffer gives back the
+// trace, in order.
+void test_replay_max_speed(){
+  std::cout << "test_replay_max_speed...\n";
+  std::vector<pnet::Packet> expected = writeTrace(50000, 10);
+  pnet::NetworkInterface *iface =
+      pnet::NetworkInterface::createInterface(trace_dir);
+  pnet::PktInterface *pkt_iface = dynamic_cast<pnet::PktInterface*>(iface);
+  pnet::ASSERT_TRUE(pkt_iface != nullptr, "not a replay interface");
+  pkt_iface->setConfig(pnet::ReplayConfig(0));
+  pnet::ASSERT_TRUE(iface->open(trace_dir), "cannot open trace");
+  pnet::ASSERT_TRUE(pkt_iface->files().size() == 2, "wrong number of files");
+
+  std::vector<pnet::Packet> packets = replay(iface);
+  pnet::ASSERT_TRUE(packets.size() == expected.size(),
+                    "wrong number of packets");
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(packets[i].t_arrival.microseconds()
+                      == expected[i].t_arrival.microseconds()
+                      && packets[i].ip_src.s_addr == expected[i].ip_src.s_addr
+                      && packets[i].size == expected[i].size,
+                      "packets out of order");
+  }
+  pnet::ASSERT_TRUE(iface->getNumPacketsProduced() == expected.size(),
+                    "wrong number of packets produced");
+  iface->close();
+  delete iface;
+  std::cout << "OK.\n";
+}
+
+// Text traces (.txt, .pkta.gz) replay like binary ones.
+void test_replay_text(){
+  std::cout << "test_replay_text...\n";
+  std::vector<pnet::Packet> expected = writeTrace(5000, 10);
+  pnet::utils::rm("-rf " + trace_dir);
+  pnet::utils::findOrCreate(trace_dir);
+  pnet::PacketTextCodec codec;
+  codec.writeFile(trace_dir + "/0.txt", expected.data(), 5000);
+  codec.writeFile(trace_dir + "/1.pkta.gz", expected.data() + 5000, 5000);
+
+  for(const char *name : {"/0.txt", "/1.pkta.gz", "/2.pkta"}){
+    pnet::NetworkInterface *iface =
+        pnet::NetworkInterface::createInterface(trace_dir + name);
+    pnet::ASSERT_TRUE(dynamic_cast<pnet::PktInterface*>(iface) != nullptr,
+                      "not a replay interface");
+    delete iface;
+  }
+
+  pnet::PktInterface iface(pnet::ReplayConfig(0));
+  pnet::ASSERT_TRUE(iface.open(trace_dir), "cannot open trace");
+  pnet::ASSERT_TRUE(iface.files().size() == 2, "wrong number of files");
+  std::vector<pnet::Packet> packets = replay(&iface);
+  pnet::ASSERT_TRUE(packets.size() == expected.size(),
+                    "wrong number of packets");
+  for(uint64_t i = 0; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(packets[i].t_arrival.microseconds()
+                      == expected[i].t_arrival.microseconds()
+                      && packets[i].ip_src.s_addr == expected[i].ip_src.s_addr
+                      && packets[i].port_dst == expected[i].port_dst
+                      && packets[i].size == expected[i].size,
+                      "wrong packets");
+  }
+  iface.close();
+
+  pnet::ASSERT_TRUE(iface.open(trace_dir + "/0.txt"), "cannot open file");
+  pnet::ASSERT_TRUE(replay(&iface).size() == 5000, "wrong number of packets");
+  iface.close();
+  std::cout << "OK.\n";
+}
+
+// A 0.2 s trace at twice the speed takes 0.1 s, packets get the time of
+// the replay.
+void test_replay_pacing(pnet::ReplayConfig::Pacing pacing){
+  std::cout << "test_replay_pacing (" << pacing << ")...\n";
+  std::vector<pnet::Packet> expected = writeTrace(1000, 100);
+  pnet::ReplayConfig config(2.0, pacing);
+  config.rewrite_timestamps = true;
+  pnet::PktInterface iface(config);
+  pnet::ASSERT_TRUE(iface.open(trace_dir), "cannot open trace");
+  uint64_t t_start = pnet::Time::now().microseconds();
+  std::vector<pnet::Packet> packets = replay(&iface);
+  uint64_t elapsed = pnet::Time::now().microseconds() - t_start;
+  pnet::ASSERT_TRUE(packets.size() == expected.size(),
+                    "wrong number of packets");
+  pnet::ASSERT_TRUE(elapsed >= 99900 && elapsed < 500000, "wrong pace");
+  pnet::ASSERT_TRUE(iface.targetRate() > 19900 && iface.targetRate() < 20200,
+                    "wrong target rate");
+  pnet::ASSERT_TRUE(iface.achievedRate() > 8000
+                    && iface.achievedRate() < 20200, "wrong achieved rate");
+  pnet::ASSERT_TRUE(iface.jitter(0) <= iface.jitter(0.5)
+                    && iface.jitter(0.5) <= iface.maxJitter(),
+                    "wrong jitter");
+
+  // Rewritten times are the wall clock times of the replay, in order and
+  // as far apart as the deadlines, less the lateness of the first packet.
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t wall = pnet::Time(ts).microseconds();
+  uint64_t t_first = packets.front().t_arrival.microseconds();
+  uint64_t t_last = packets.back().t_arrival.microseconds();
+  pnet::ASSERT_TRUE(t_last <= wall && wall - t_first < 5000000,
+                    "timestamps not rewritten");
+  pnet::ASSERT_TRUE(t_last - t_first + iface.maxJitter() >= 99900
+                    && t_last - t_first <= elapsed,
+                    "wrong rewritten timestamps");
+  for(uint64_t i = 1; i < packets.size(); ++i){
+    pnet::ASSERT_TRUE(!(packets[i].t_arrival < packets[i - 1].t_arrival),
+                      "rewritten timestamps out of order");
+  }
+  iface.close();
+  std::cout << "OK.\n";
+}
+
+int main(){
+  pnet::Logger::INIT("/tmp/pnet_test_replay.log");
+  test_replay_max_speed();
+  test_replay_text();
+  test_replay_pacing(pnet::ReplayConfig::HYBRID);
+  test_replay_pacing(pnet::ReplayConfig::SLEEP);
+  test_replay_pacing(pnet::ReplayConfig::SPIN);
+  pnet::utils::rm("-rf " + trace_dir);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <pnet_shared_buffer.hpp>
+
+#include <sys/wait.h>
+
+// Producer child process sends numbered packets, parent checks the order.
+void test_produce_consume(uint64_t batch_size){
+  std::cout << "test_produce_consume (batch " << batch_size << ")...\n";
+  const uint64_t num_packets = 1000000;
+  pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet(1024);
+
+  std::cout.flush();
+  pid_t pid = fork();
+  if(pid == 0){
+    std::vector<pnet::Packet> batch(batch_size);
+    for(uint64_t i = 0; i < num_packets; i += batch_size){
+      uint64_t n = std::min(batch_size, num_packets - i);
+      for(uint64_t j = 0; j < n; ++j){
+        batch[j].t_arrival = i + j;
+      }
+      if(n == 1){
+        buffer->produce(batch[0]);
+      } else {
+        buffer->produce(batch.data(), n);
+      }
+    }
+    _exit(0);
+  }
+
+  std::vector<pnet::Packet> batch(batch_size);
+  uint64_t expected = 0;
+  while(expected < num_packets){
+    uint64_t n = buffer->consume(batch.data(), batch_size);
+    pnet::ASSERT_TRUE(n > 0, "consume failed");
+    for(uint64_t j = 0; j < n; ++j){
+      pnet::ASSERT_TRUE(batch[j].t_arrival.microseconds() == expected++,
+                        "packets out of order");
+    }
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  pnet::ASSERT_TRUE(buffer->occupancy() == 0, "buffer not drained");
+  pnet::ASSERT_TRUE(buffer->getNumPacketsProcessed() == num_packets,
+                    "wrong number of packets processed");
+  pnet::SharedBuffer::destroy();
+  std::cout << "OK.\n";
+}
+
+void test_close(){
+  std::cout << "test_close...\n";
+  pnet::SharedBuffer *buffer = pnet::SharedBuffer::createOrGet(16);
+  pnet::Packet packet;
+  buffer->produce(packet);
+  buffer->close();
+  pnet::ASSERT_TRUE(!buffer->produce(packet), "produce after close");
+  pnet::ASSERT_TRUE(buffer->consume(packet), "remaining packet lost");
+  pnet::ASSERT_TRUE(!buffer->consume(packet), "consume on closed buffer");
+  pnet::SharedBuffer::destroy();
+  std::cout << "OK.\n";
+}
+
+int main(){
+  test_produce_consume(1);
+  test_produce_consume(64);
+  test_close();
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <pnet_metrics.hpp>
+
+#include <signal.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+// Live view of the metrics a pnet process publishes (Metrics::publish()).
+// Reads the shared memory page without locks, so it can be started and
+// stopped at any time without disturbing the pipeline.
+//
+// Usage: pnet-top [options]
+//   -n name         published page, /dev/shm/<name> (default: pnet_metrics)
+//   -i interval_ms  refresh interval (default: 1000)
+//   -c count        number of refreshes, then exit (default: forever)
+
+using pnet::metrics::Counter;
+using pnet::metrics::Gauge;
+using pnet::metrics::Histogram;
+
+void print(const pnet::MetricsReader &reader,
+           const std::vector<int64_t> &last, double seconds){
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  double uptime = ts.tv_sec + ts.tv_nsec / 1e9 - reader.startTime() / 1e6;
+  bool alive = kill(reader.pid(), 0) == 0;
+  printf("pid %lu (%s)  up %.1f s  threads %lu\n\n", reader.pid(),
+         alive ? "running" : "exited", uptime, reader.numThreads());
+  printf("  %-20s %16s %14s\n", "counter", "total", "per second");
+  for(int c = 0; c < pnet::metrics::NUM_COUNTERS; ++c){
+    int64_t value = reader.counter((Counter) c);
+    double rate = seconds > 0 ? (value - last[c]) / seconds : 0;
+    printf("  %-20s %16ld %14.0f\n", pnet::metrics::name((Counter) c),
+           value, rate);
+  }
+  printf("\n  %-20s %16s\n", "gauge", "value");
+  for(int g = 0; g < pnet::metrics::NUM_GAUGES; ++g){
+    printf("  %-20s %16ld\n", pnet::metrics::name((Gauge) g),
+           reader.gauge((Gauge) g));
+  }
+  printf("\n  %-20s %12s %10s %10s %10s %10s %10s\n", "histogram", "count",
+         "mean", "p50", "p99", "p99.9", "max");
+  for(int h = 0; h < pnet::metrics::NUM_HISTOGRAMS; ++h){
+    pnet::HistogramSnapshot s = reader.histogram((Histogram) h);
+    printf("  %-20s %12lu %10.1f %10lu %10lu %10lu %10lu\n",
+           pnet::metrics::name((Histogram) h), s.count, s.mean(),
+           s.percentile(0.5), s.percentile(0.99), s.percentile(0.999),
+           s.max);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]){
+  std::string name = pnet::Metrics::DEFAULT_NAME;
+  uint64_t interval_ms = 1000;
+  int64_t count = -1;
+  for(int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if(arg == "-n" && i + 1 < argc){
+      name = argv[++i];
+    } else if(arg == "-i" && i + 1 < argc){
+      interval_ms = std::strtoull(argv[++i], nullptr, 10);
+    } else if(arg == "-c" && i + 1 < argc){
+      count = std::strtoll(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-n name] [-i interval_ms] [-c count]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  pnet::MetricsReader reader;
+  if(!reader.open(name)){
+    fprintf(stderr, "pnet-top: no metrics published as /dev/shm/%s\n",
+            name.c_str());
+    return 1;
+  }
+  bool clear = isatty(STDOUT_FILENO);
+  std::vector<int64_t> last(pnet::metrics::NUM_COUNTERS, 0);
+  uint64_t t_last = 0;
+  for(int64_t i = 0; count < 0 || i < count; ++i){
+    if(i > 0){
+      usleep(interval_ms * 1000);
+    }
+    uint64_t now = pnet::metrics::nanoseconds();
+    if(clear){
+      printf("\033[H\033[2J");
+    }
+    print(reader, last, t_last ? (now - t_last) / 1e9 : 0);
+    if(!clear){
+      printf("\n");
+    }
+    for(int c = 0; c < pnet::metrics::NUM_COUNTERS; ++c){
+      last[c] = reader.counter((Counter) c);
+    }
+    t_last = now;
+  }
+  return 0;
+}